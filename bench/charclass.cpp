@@ -0,0 +1,88 @@
+#include "../src/CharClass.hpp"
+#include "../src/Predicate.hpp"
+#include "../src/Slice.hpp"
+#include <chrono>
+#include <iostream>
+
+// Compare the character class parser with the predicate parser (folding
+// strings) and the slice parser (extending a view) on long runs of
+// whitespace, identifier and digit characters. The predicate parser is also
+// applied token by token, which folds the run one character at a time.
+
+using CharPredicate =
+    Parser::PredicateParser<char, std::string, Utils::fromChar, Utils::fold>;
+
+template <typename F>
+static void measure(const std::string &name, const std::string &input,
+                    const int rounds, F &&parse) {
+  auto start = std::chrono::steady_clock::now();
+  std::size_t outputs = 0;
+  for (int i = 0; i < rounds; ++i)
+    outputs += parse(input);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  double bytes = static_cast<double>(input.size()) * rounds;
+  std::cout << "  " << name << ": " << bytes / elapsed.count() / 1e6
+            << " MB/s (" << outputs << " bytes matched)" << std::endl;
+}
+
+static std::size_t feed(Parser::AbstractParser<char, std::string> &parser,
+                        const std::string &input) {
+  auto [consumed, v] = parser.feed(input.data(), input.data() + input.size());
+  if (!v.has_value())
+    v = parser();
+  return Parser::asResult(v)->get().value().size();
+}
+
+static std::size_t
+applyTokens(Parser::AbstractParser<char, std::string> &parser,
+            const std::string &input) {
+  Parser::ParserResult<char, std::string> v;
+  for (char c : input) {
+    if ((v = parser(c)).has_value())
+      break;
+  }
+  return Parser::asResult(v)->get().value().size();
+}
+
+static void run(const std::string &name, const Parser::CharClass &c,
+                const std::string &input, const int rounds) {
+  std::cout << name << ", run " << input.size() - 1 << std::endl;
+  auto predicate = CharPredicate(
+      [c]() { return [c](const char &v) { return c.contains(v); }; },
+      Parser::MORE, name);
+  auto charClass = Parser::CharClassParser(c, Parser::MORE, name);
+  measure("predicate, tokens", input, rounds,
+          [&](const std::string &s) { return applyTokens(predicate, s); });
+  measure("predicate", input, rounds,
+          [&](const std::string &s) { return feed(predicate, s); });
+  measure("char class", input, rounds,
+          [&](const std::string &s) { return feed(charClass, s); });
+  auto slice = Parser::SliceClass(c, Parser::MORE, name);
+  auto shared = std::make_shared<const std::string>(input);
+  Parser::SliceScope scope(shared);
+  measure("slice", input, rounds, [&](const std::string &) {
+    auto [consumed, v] =
+        slice->feed(shared->data(), shared->data() + shared->size());
+    return Parser::asResult(v)->get().value().size();
+  });
+}
+
+int main() {
+  // the predicate folds the run one character at a time when the tokens are
+  // applied one by one, which is quadratic
+  for (int run : {64, 1024, 4096}) {
+    std::string spaces, identifier, digits;
+    for (int i = 0; i < run; ++i) {
+      spaces.push_back(" \t\n"[i % 3]);
+      identifier.push_back("abcXYZ_019"[i % 10]);
+      digits.push_back('0' + i % 10);
+    }
+    int rounds = (1 << 20) / run;
+    ::run("whitespace", Parser::CharClass::whitespace(), spaces + ";", rounds);
+    ::run("identifier", Parser::CharClass::identifier(), identifier + ";",
+          rounds);
+    ::run("digit", Parser::CharClass::digit(), digits + ";", rounds);
+  }
+  return 0;
+}
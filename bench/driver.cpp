@@ -0,0 +1,86 @@
+#include "../src/CharClass.hpp"
+#include "../src/Driver.hpp"
+#include "../src/Sequence.hpp"
+#include <cstdlib>
+#include <iostream>
+#include <unistd.h>
+
+// The throughput of the driver with a parser that does nothing, which is the
+// cost of the I/O layer, and with a statement grammar.
+// Usage: driver.out [megabytes]
+
+// Sums the tokens, and returns at the end of input.
+class Count final : public Parser::AbstractParser<char, std::string> {
+private:
+  std::size_t count = 0;
+  unsigned char sum = 0;
+
+public:
+  void reset() override { count = 0; }
+  Parser::AbstractParserPtr<char, std::string> clone() const override {
+    return std::make_unique<Count>();
+  }
+  Parser::ParserResult<char, std::string> operator()(const char &c) override {
+    ++count;
+    sum += c;
+    return {};
+  }
+  Parser::FeedResult<char, std::string> feed(const char *begin,
+                                             const char *end) override {
+    for (const char *it = begin; it != end; ++it)
+      sum += *it;
+    count += end - begin;
+    return {static_cast<std::size_t>(end - begin), {}};
+  }
+  Parser::ParserResult<char, std::string> operator()() override {
+    return Parser::ParsingError::get<char, std::string>(
+        std::to_string(count) + " tokens, sum " + std::to_string(sum),
+        "count");
+  }
+  const std::string &getName() const override {
+    static std::string name = "count";
+    return name;
+  }
+};
+
+static void report(const std::string &name, const Parser::DriverStats &stats) {
+  std::cout << "  " << name << ": " << stats.throughput() / 1e6 << " MB/s, "
+            << stats.results << " results, peak RSS of the process "
+            << stats.peakRss / (1 << 20) << " MiB"
+            << (stats.error != 0 ? ", failed" : "") << std::endl;
+}
+
+int main(int argc, char **argv) {
+  std::size_t megabytes = argc > 1 ? std::atoi(argv[1]) : 32;
+  char path[] = "/tmp/driverXXXXXX";
+  int fd = mkstemp(path);
+  std::string line;
+  for (int i = 0; i < 1024; ++i)
+    line += std::string(i % 13 + 1, 'a' + i % 26) + ";";
+  for (std::size_t written = 0; written < megabytes << 20;)
+    written += write(fd, line.data(), line.size());
+  close(fd);
+
+  auto onResult = [](Parser::ParserResult<char, std::string> &) {
+    return true;
+  };
+  Parser::DriverOptions read;
+  read.mmap = false;
+
+  Count count;
+  std::cout << "I/O, " << megabytes << " MiB" << std::endl;
+  report("mmap", Parser::parseFile(path, count, onResult));
+  report("read", Parser::parseFile(path, count, onResult, read));
+
+  auto statement = Parser::Sequence<char, std::string>::get(
+      "statement",
+      std::array{Parser::CharClassParser::get(Parser::CharClass::identifier(),
+                                              Parser::MORE, "identifier"),
+                 Parser::CharClassParser::get(Parser::CharClass(";"),
+                                              Parser::ONCE, ";")});
+  std::cout << "statements, " << megabytes << " MiB" << std::endl;
+  report("mmap", Parser::parseFile(path, *statement, onResult));
+  report("read", Parser::parseFile(path, *statement, onResult, read));
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,122 @@
+#include "../src/Alternate.hpp"
+#include "../src/Lazy.hpp"
+#include "../src/Memo.hpp"
+#include "../src/Predicate.hpp"
+#include "../src/Sequence.hpp"
+#include <chrono>
+#include <iostream>
+
+// Memoization on the parenthesised grammar in lazyTest, and on an expression
+// grammar where the alternation derives the same rule three times. The table
+// is cleared before every round, so the hit rate is the one of a single pass
+// over the input.
+
+using CharPredicate =
+    Parser::PredicateParser<char, std::string, Utils::fromChar, Utils::fold>;
+using Ptr = Parser::AbstractParserPtr<char, std::string>;
+using Memo = Parser::MemoTable<char, std::string>;
+
+static Ptr lazy(Parser::AbstractParser<char, std::string> *src, Memo *memo) {
+  return std::make_unique<Parser::LazyParser<char, std::string>>(src, nullptr,
+                                                                 memo);
+}
+
+static Ptr literal(const std::string &s) {
+  return Parser::StringPredicate(s, s);
+}
+
+static std::unique_ptr<Parser::Alternate<char, std::string>> empty(
+    const std::string &name) {
+  return std::make_unique<Parser::Alternate<char, std::string>>(
+      std::make_unique<std::vector<Ptr>>(), name);
+}
+
+// options = '(' options ')' | a+
+static void parenthesised(Parser::Alternate<char, std::string> &options,
+                          Memo *memo) {
+  options.getOptions()->push_back(Parser::Sequence<char, std::string>::get(
+      "SEQ", std::array{literal("("), lazy(&options, memo), literal(")")}));
+  options.getOptions()->push_back(CharPredicate::get('a', Parser::MORE, "a"));
+}
+
+// expr = term '+' expr | term '-' expr | term, term = '(' expr ')' | a+
+static void expression(Parser::Alternate<char, std::string> &expr,
+                       Parser::Alternate<char, std::string> &term,
+                       Memo *memo) {
+  for (auto op : {"+", "-"}) {
+    expr.getOptions()->push_back(Parser::Sequence<char, std::string>::get(
+        "binary",
+        std::array{lazy(&term, memo), literal(op), lazy(&expr, memo)}));
+  }
+  expr.getOptions()->push_back(lazy(&term, memo));
+  term.getOptions()->push_back(Parser::Sequence<char, std::string>::get(
+      "group", std::array{literal("("), lazy(&expr, memo), literal(")")}));
+  term.getOptions()->push_back(CharPredicate::get('a', Parser::MORE, "a"));
+}
+
+static std::size_t run(Parser::AbstractParser<char, std::string> &parser,
+                       const std::string &input) {
+  Parser::ParserResult<char, std::string> v;
+  for (char c : input) {
+    if ((v = parser(c)).has_value())
+      break;
+  }
+  if (!v.has_value())
+    v = parser();
+  std::size_t count = 0;
+  for (auto &result = Parser::asResult(v); result->get().has_value();)
+    ++count;
+  return count;
+}
+
+static void measure(const std::string &name,
+                    Parser::AbstractParser<char, std::string> &parser,
+                    Memo *memo, const std::string &input, const int rounds) {
+  auto start = std::chrono::steady_clock::now();
+  std::size_t outputs = 0;
+  for (int i = 0; i < rounds; ++i) {
+    if (memo != nullptr)
+      memo->clear();
+    outputs += run(parser, input);
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  double tokens = static_cast<double>(input.size()) * rounds;
+  std::cout << "  " << name << ": " << tokens / elapsed.count() / 1e6
+            << " Mtokens/s (" << outputs << " outputs)";
+  if (memo != nullptr) {
+    auto &stats = memo->getStats();
+    std::cout << ", hits " << stats.hits << ", misses " << stats.misses
+              << ", hit rate " << stats.hitRate() << ", " << stats.bytes
+              << " bytes";
+  }
+  std::cout << std::endl;
+}
+
+int main() {
+  const int rounds = 200;
+  {
+    auto input = std::string(32, '(') + "aaaa" + std::string(32, ')');
+    std::cout << "parenthesised, depth 32" << std::endl;
+    Memo memo;
+    auto plain = empty("options"), memoized = empty("options");
+    parenthesised(*plain, nullptr);
+    parenthesised(*memoized, &memo);
+    measure("plain", *plain, nullptr, input, rounds);
+    measure("memo", *memoized, &memo, input, rounds);
+  }
+  {
+    std::string input = "a";
+    for (int i = 0; i < 4; ++i)
+      input = "(" + input + "+a)-(a-" + input + ")";
+    std::cout << "expression, " << input.size() << " tokens" << std::endl;
+    Memo memo;
+    auto plainExpr = empty("expr"), plainTerm = empty("term");
+    auto memoExpr = empty("expr"), memoTerm = empty("term");
+    expression(*plainExpr, *plainTerm, nullptr);
+    expression(*memoExpr, *memoTerm, &memo);
+    measure("plain", *plainExpr, nullptr, input, rounds / 20);
+    measure("memo", *memoExpr, &memo, input, rounds / 20);
+  }
+  return 0;
+}
@@ -0,0 +1,116 @@
+#include "../src/Grammar.hpp"
+#include "../src/Predicate.hpp"
+#include "../src/Regex.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+// Scaling with the number of threads, from 1 up to the number of cores (or
+// the argument), of parseBatch over documents of a recursive grammar and of
+// parseChunked over the same documents as one input. Every line of the output
+// is a JSON object:
+//
+//   {"mode": ..., "threads": ..., "bytes": ..., "seconds": ...,
+//    "tokens_per_sec": ..., "speedup": ..., "errors": ...}
+
+using Ptr = Parser::AbstractParserPtr<char, std::string>;
+using Seq = Parser::Sequence<char, std::string>;
+using Alt = Parser::Alternate<char, std::string>;
+using Lazy = Parser::LazyParser<char, std::string>;
+
+static Ptr literal(const std::string &s) {
+  return Parser::StringPredicate(s, s);
+}
+
+// options = '(' options ')' | token, statement = options ' '
+static std::shared_ptr<const Parser::Grammar<char, std::string>> grammar() {
+  auto options =
+      std::make_unique<Alt>(std::make_unique<std::vector<Ptr>>(), "options");
+  options->getOptions()->push_back(Seq::get(
+      "SEQ", std::array{literal("("),
+                        Ptr(std::make_unique<Lazy>(options.get())),
+                        literal(")")}));
+  options->getOptions()->push_back(
+      Parser::RegexParser::get("[a-z_]\\w*|\\d+(\\.\\d+)?", "token"));
+  auto root = Seq::get(
+      "statement",
+      std::array{Ptr(std::make_unique<Lazy>(options.get())), literal(" ")});
+  std::vector<Ptr> rules;
+  rules.push_back(std::move(options));
+  return Parser::Grammar<char, std::string>::make(std::move(root),
+                                                  std::move(rules));
+}
+
+template <typename F> static double measure(F &&parse) {
+  // once to warm up, then measured
+  parse();
+  auto start = std::chrono::steady_clock::now();
+  parse();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+int main(int argc, char **argv) {
+  auto g = grammar();
+  std::vector<std::string> documents;
+  std::string input;
+  for (int i = 0; i < 64; ++i) {
+    std::string document;
+    while (document.size() < 16 * 1024) {
+      int depth = document.size() % 7;
+      document += std::string(depth, '(') + (i % 2 ? "ident_42" : "3.14159") +
+                  std::string(depth, ')') + " ";
+    }
+    input += document;
+    documents.push_back(std::move(document));
+  }
+  unsigned int cores = argc > 1 ? std::atoi(argv[1])
+                                : std::thread::hardware_concurrency();
+  cores = std::max(1u, cores);
+  Parser::ChunkOptions options;
+  options.chunkSize = 16 * 1024;
+  double base[2] = {0, 0};
+  for (unsigned int threads = 1;; threads *= 2) {
+    threads = std::min(threads, cores);
+    Parser::ThreadPool pool(threads);
+    std::atomic<std::size_t> errors = 0;
+    auto onResult = [&](Parser::ParserResult<char, std::string> &r) {
+      if (Parser::isError(r)) {
+        ++errors;
+        return false;
+      }
+      return true;
+    };
+    double seconds[2] = {
+        measure([&] {
+          Parser::parseBatch(
+              g, documents, pool,
+              [&](std::size_t, Parser::ParserResult<char, std::string> &r) {
+                return onResult(r);
+              });
+        }),
+        // the statements end with a space
+        measure([&] {
+          Parser::parseChunked(
+              g, input.data(), input.data() + input.size(), pool,
+              [](const char *, const char *p) { return p[-1] == ' '; },
+              onResult, options);
+        })};
+    const char *modes[2] = {"batch", "chunked"};
+    for (int m = 0; m < 2; ++m) {
+      if (threads == 1)
+        base[m] = seconds[m];
+      std::cout << "{\"mode\": \"" << modes[m] << "\", \"threads\": " << threads
+                << ", \"bytes\": " << input.size()
+                << ", \"seconds\": " << seconds[m]
+                << ", \"tokens_per_sec\": " << input.size() / seconds[m]
+                << ", \"speedup\": " << base[m] / seconds[m]
+                << ", \"errors\": " << errors << "}" << std::endl;
+    }
+    if (threads == cores)
+      break;
+  }
+  return 0;
+}
@@ -0,0 +1,127 @@
+#include "../src/Alternate.hpp"
+#include "../src/Lazy.hpp"
+#include "../src/Predicate.hpp"
+#include "../src/Sequence.hpp"
+#include "../src/Static.hpp"
+#include "../src/TakeTill.hpp"
+#include <chrono>
+#include <iostream>
+
+// Compare the recursive grammar in lazyTest built with the dynamic combinators
+// and with the static ones, and a take till built with both.
+
+using CharPredicate =
+    Parser::PredicateParser<char, std::string, Utils::fromChar, Utils::fold>;
+
+static std::string makeInput(const int depth, const int run) {
+  return std::string(depth, '(') + std::string(run, 'a') +
+         std::string(depth, ')');
+}
+
+template <typename F>
+static void measure(const std::string &name, const std::string &input,
+                    const int rounds, F &&parse) {
+  auto start = std::chrono::steady_clock::now();
+  std::size_t outputs = 0;
+  for (int i = 0; i < rounds; ++i)
+    outputs += parse(input);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  double tokens = static_cast<double>(input.size()) * rounds;
+  std::cout << name << ": " << tokens / elapsed.count() / 1e6
+            << " Mtokens/s (" << outputs << " outputs)" << std::endl;
+}
+
+// Apply the input token by token, and count the outputs.
+static std::size_t run(Parser::AbstractParser<char, std::string> &parser,
+                       const std::string &input) {
+  for (char c : input) {
+    if (auto v = parser(c); v.has_value()) {
+      auto &result = Parser::asResult(v);
+      std::size_t count = 0;
+      while (result->get().has_value())
+        ++count;
+      return count;
+    }
+  }
+  return 0;
+}
+
+static std::size_t feed(Parser::AbstractParser<char, std::string> &parser,
+                        const std::string &input) {
+  auto [consumed, v] = parser.feed(input.data(), input.data() + input.size());
+  if (!v.has_value())
+    return 0;
+  auto &result = Parser::asResult(v);
+  std::size_t count = 0;
+  while (result->get().has_value())
+    ++count;
+  return count;
+}
+
+int main() {
+  auto alternatives = std::make_unique<
+      std::vector<Parser::AbstractParserPtr<char, std::string>>>();
+  auto options =
+      Parser::Alternate<char, std::string>(std::move(alternatives), "options");
+  Parser::AbstractParserPtr<char, std::string> recursive =
+      std::make_unique<Parser::LazyParser<char, std::string>>(&options);
+  options.getOptions()->push_back(Parser::Sequence<char, std::string>::get(
+      "SEQ", std::array{Parser::AbstractParserPtr<char, std::string>(
+                            Parser::StringPredicate("(", "(")),
+                        std::move(recursive),
+                        Parser::AbstractParserPtr<char, std::string>(
+                            Parser::StringPredicate(")", ")"))}));
+  options.getOptions()->push_back(CharPredicate::get('a', Parser::MORE, "a"));
+  options.reset();
+
+  Parser::Dynamic<char, std::string> staticOptions(nullptr);
+  auto grammar = Parser::alt(
+      "options",
+      Parser::seq("SEQ", *Parser::StringPredicate("(", "("),
+                  Parser::LazyParser<char, std::string>(&staticOptions),
+                  *Parser::StringPredicate(")", ")")),
+      CharPredicate('a', Parser::MORE, "a"));
+  staticOptions.set(grammar.clone());
+
+  for (auto [depth, length, rounds] :
+       {std::tuple{4, 64, 20000}, std::tuple{32, 16, 5000},
+        std::tuple{2, 4096, 500}}) {
+    auto input = makeInput(depth, length);
+    std::cout << "depth " << depth << ", run " << length << std::endl;
+    measure("  dynamic", input, rounds,
+            [&](const std::string &s) { return run(options, s); });
+    measure("  static", input, rounds,
+            [&](const std::string &s) { return run(grammar, s); });
+    measure("  dynamic (feed)", input, rounds,
+            [&](const std::string &s) { return feed(options, s); });
+    measure("  static (feed)", input, rounds,
+            [&](const std::string &s) { return feed(grammar, s); });
+  }
+
+  // A take till with a suffix that is not a literal, so that both run a
+  // suffix state per token.
+  auto any = [] {
+    return CharPredicate([] { return [](const char &c) { return c != '*'; }; },
+                         Parser::ONCE, "any");
+  };
+  auto dynamicTill = Parser::TakeTill<char, std::string, std::string>(
+      std::make_unique<CharPredicate>(any()),
+      Parser::Sequence<char, std::string>::get(
+          "end", std::array{CharPredicate::get('*', Parser::MORE, "*"),
+                            CharPredicate::get('/', Parser::ONCE, "/")}),
+      "comment");
+  auto staticTill = Parser::takeTill(
+      "comment", any(),
+      Parser::seq("end", CharPredicate('*', Parser::MORE, "*"),
+                  CharPredicate('/', Parser::ONCE, "/")));
+  for (auto [length, rounds] : {std::pair{64, 20000}, std::pair{4096, 500}}) {
+    auto input = std::string(length, 'a') + "**/";
+    std::cout << "take till, run " << length << std::endl;
+    measure("  dynamic", input, rounds,
+            [&](const std::string &s) { return run(dynamicTill, s); });
+    measure("  static", input, rounds,
+            [&](const std::string &s) { return run(staticTill, s); });
+  }
+  return 0;
+}
@@ -0,0 +1,318 @@
+#include "../src/Alternate.hpp"
+#include "../src/Dfa.hpp"
+#include "../src/Driver.hpp"
+#include "../src/Lazy.hpp"
+#include "../src/Optimize.hpp"
+#include "../src/Predicate.hpp"
+#include "../src/Regex.hpp"
+#include "../src/Sequence.hpp"
+#include "../src/TakeTill.hpp"
+#include "../src/Vm.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Throughput of every combinator on generated inputs, from 1 KB up to the size
+// given as the argument (1M by default, with a K, M or G suffix). Every line of
+// the output is a JSON object, so the results of two commits can be diffed:
+//
+//   {"case": ..., "bytes": ..., "rounds": ..., "tokens_per_sec": ...,
+//    "allocs_per_token": ..., "peak_rss": ..., "results": ..., "errors": ...}
+//
+// The input of a case is a unit repeated, and the parser is applied to it over
+// and over with parseBuffer. Every case is measured again in validating mode,
+// with "/validate" after its name, in the sink mode, with "/sink", and with a
+// streaming sink taking the runs in pieces of 256 tokens, with "/stream". The
+// allocations are counted by replacing the global operator new. Every case runs
+// in a forked process, so peak_rss is the peak of that case, which includes the
+// few MB that the benchmark uses before it forks.
+
+static std::size_t allocations = 0;
+
+// not inlined, the compilers would see malloc and free paired with new and
+// delete otherwise
+[[gnu::noinline]] void *operator new(std::size_t size) {
+  ++allocations;
+  if (void *p = std::malloc(size == 0 ? 1 : size))
+    return p;
+  throw std::bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void *p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void *p, std::size_t) noexcept {
+  std::free(p);
+}
+
+using CharPredicate =
+    Parser::PredicateParser<char, std::string, Utils::fromChar, Utils::fold>;
+using Ptr = Parser::AbstractParserPtr<char, std::string>;
+
+enum class Mode { Build, Validate, Sink, Stream };
+
+struct Case {
+  std::string name;
+  std::string unit;
+  // the parser of one unit, the alternation is kept for the lazy grammar
+  std::function<Ptr()> make;
+};
+
+static Ptr literal(const std::string &s) {
+  return Parser::StringPredicate(s, s);
+}
+
+template <typename... P> static Ptr seq(const std::string &name, P... ps) {
+  return Parser::Sequence<char, std::string>::get(
+      name, std::array<Ptr, sizeof...(ps)>{Ptr(std::move(ps))...});
+}
+
+template <typename... P> static Ptr alt(const std::string &name, P... ps) {
+  return Parser::Alternate<char, std::string>::get(
+      name, std::array<Ptr, sizeof...(ps)>{Ptr(std::move(ps))...});
+}
+
+static std::string word(const int i) {
+  char buffer[8];
+  std::snprintf(buffer, sizeof(buffer), "w%02d", i);
+  return buffer;
+}
+
+// options = '(' options ')' | a+
+static Parser::Alternate<char, std::string> options(
+    std::make_unique<std::vector<Ptr>>(), "options");
+
+static std::vector<Case> cases() {
+  std::vector<Case> list;
+  list.push_back({"predicate", std::string(64, 'a'), [] {
+                    return CharPredicate::get('a', 64, "a{64}");
+                  }});
+  list.push_back({"string", "keyword", [] { return literal("keyword"); }});
+  // a long token, the value of the run is folded token by token
+  list.push_back({"run", std::string(4096, 'a') + " ", [] {
+                    return seq("run",
+                               CharPredicate::get('a', Parser::MORE, "a"),
+                               literal(" "));
+                  }});
+  {
+    // the options are literals, so they are matched with a LiteralSet
+    std::string unit;
+    for (int i = 0; i < 64; ++i)
+      unit += word(i);
+    list.push_back({"alternate-literals", unit, [] {
+                      auto v = std::make_unique<std::vector<Ptr>>();
+                      for (int i = 0; i < 64; ++i)
+                        v->push_back(literal(word(i)));
+                      return Ptr(std::make_unique<
+                                 Parser::Alternate<char, std::string>>(
+                          std::move(v), "words"));
+                    }});
+  }
+  {
+    // the options all start with 'w', so they run in lockstep
+    std::string unit;
+    for (int i = 0; i < 64; ++i)
+      unit += word(i) + " ";
+    auto wide = [] {
+      auto v = std::make_unique<std::vector<Ptr>>();
+      for (int i = 0; i < 64; ++i) {
+        v->push_back(Parser::Sequence<char, std::string>::get(
+            word(i),
+            std::array{literal(word(i)),
+                       CharPredicate::get(' ', Parser::MORE, "space")}));
+      }
+      return Ptr(std::make_unique<Parser::Alternate<char, std::string>>(
+          std::move(v), "words"));
+    };
+    list.push_back({"alternate-wide", unit, wide});
+    // the same grammar compiled into a DFA
+    list.push_back({"alternate-wide-dfa", unit,
+                    [wide] { return Parser::compileRegular(wide()); }});
+  }
+  {
+    std::string unit;
+    for (int i = 0; i < 64; ++i)
+      unit.push_back('a' + i % 26);
+    list.push_back({"sequence-deep", unit, [unit] {
+                      auto v = std::make_unique<std::vector<Ptr>>();
+                      for (char c : unit)
+                        v->push_back(literal(std::string(1, c)));
+                      return Ptr(std::make_unique<
+                                 Parser::Sequence<char, std::string>>(
+                          std::move(v), "deep"));
+                    }});
+  }
+  list.push_back({"regex", "ident_42 3.14159 x ", [] {
+                    return Ptr(Parser::RegexParser::get(
+                        "([a-z_]\\w*|\\d+(\\.\\d+)?) ", "token"));
+                  }});
+  list.push_back(
+      {"takeTill", "/*" + std::string(4096, 'x') + "*/", [] {
+         auto any = std::make_unique<CharPredicate>(
+             [] { return [](const char &) { return true; }; }, Parser::ONCE,
+             "any");
+         return Parser::Sequence<char, std::string>::get(
+             "comment",
+             std::array{literal("/*"),
+                        Ptr(std::make_unique<
+                            Parser::TakeTill<char, std::string, std::string>>(
+                            std::move(any), literal("*/"), "body"))});
+       }});
+  list.push_back({"lazy",
+                  std::string(32, '(') + "aaaa" + std::string(32, ')') + " ",
+                  [] {
+                    return Parser::Sequence<char, std::string>::get(
+                        "statement",
+                        std::array{Ptr(std::make_unique<
+                                       Parser::LazyParser<char, std::string>>(
+                                       &options)),
+                                   literal(" ")});
+                  }});
+  {
+    // as a grammar assembled by a program: nested combinators, literals
+    // split in parts and options with a common prefix
+    auto statement = [] {
+      auto ab = [] { return alt("ab", literal("a"), literal("b")); };
+      auto branch = [&](const std::string &keyword) {
+        return seq(keyword, literal("if"), literal(" "), ab(),
+                   seq("keyword", literal(" "), literal(keyword), literal(" ")),
+                   ab(), literal(";"));
+      };
+      return alt("statement",
+                 seq("block", seq("begin", literal("begin"), literal(" ")),
+                     ab(), seq("end", literal(" "), literal("end")),
+                     literal(";")),
+                 branch("then"), branch("else"));
+    };
+    list.push_back(
+        {"statements", "begin a end;if a then b;if b else a;", statement});
+  }
+  // the same grammars optimized
+  for (auto name : {"sequence-deep", "statements"}) {
+    for (std::size_t i = 0, n = list.size(); i < n; ++i) {
+      if (list[i].name == name) {
+        list.push_back({list[i].name + "-opt", list[i].unit,
+                        [make = list[i].make] {
+                          return Parser::optimize(make());
+                        }});
+      }
+    }
+  }
+  // the same grammars compiled for the VM
+  for (auto name : {"sequence-deep", "takeTill", "lazy"}) {
+    for (std::size_t i = 0, n = list.size(); i < n; ++i) {
+      if (list[i].name == name) {
+        list.push_back({list[i].name + "-vm", list[i].unit,
+                        [make = list[i].make] {
+                          return Ptr(Parser::VmParser::compile(make()));
+                        }});
+      }
+    }
+  }
+  return list;
+}
+
+static std::size_t parseSize(const char *s) {
+  char *end;
+  double v = std::strtod(s, &end);
+  switch (*end) {
+  case 'G':
+    v *= 1024;
+    [[fallthrough]];
+  case 'M':
+    v *= 1024;
+    [[fallthrough]];
+  case 'K':
+    v *= 1024;
+  }
+  return static_cast<std::size_t>(v);
+}
+
+static void measure(const Case &c, const std::size_t size, const Mode mode) {
+  std::string input;
+  input.reserve(size + c.unit.size());
+  while (input.size() < size)
+    input += c.unit;
+  auto parser = c.make();
+  Parser::OutputSink<std::string> sink;
+  Parser::OutputSink<std::string> stream([](std::string) {}, 256);
+  parser->setValidating(mode == Mode::Validate);
+  if (mode == Mode::Sink)
+    parser->setSink(&sink);
+  if (mode == Mode::Stream)
+    parser->setSink(&stream);
+  std::size_t results = 0, errors = 0, tokens = 0;
+  auto onResult = [&](Parser::ParserResult<char, std::string> &r) {
+    if (Parser::isError(r)) {
+      ++errors;
+      return false;
+    }
+    auto &result = Parser::asResult(r);
+    while (result->get().has_value())
+      ;
+    sink.flush([](std::string) {});
+    ++results;
+    return true;
+  };
+  // repeat the small inputs, so that the time is not only noise
+  double seconds = 0;
+  int rounds = 0;
+  auto before = allocations;
+  while (seconds < 0.2 && errors == 0) {
+    auto stats = Parser::parseBuffer(input.data(), input.data() + input.size(),
+                                     *parser, onResult);
+    seconds += stats.seconds;
+    tokens += input.size();
+    ++rounds;
+  }
+  auto allocated = allocations - before;
+  const char *suffix = mode == Mode::Validate ? "/validate"
+                       : mode == Mode::Sink   ? "/sink"
+                       : mode == Mode::Stream ? "/stream"
+                                              : "";
+  std::cout << "{\"case\": \"" << c.name << suffix
+            << "\", \"bytes\": " << input.size()
+            << ", \"rounds\": " << rounds
+            << ", \"tokens_per_sec\": " << tokens / seconds
+            << ", \"allocs_per_token\": "
+            << static_cast<double>(allocated) / tokens
+            << ", \"peak_rss\": " << Parser::peakRss()
+            << ", \"results\": " << results / rounds
+            << ", \"errors\": " << errors << "}" << std::endl;
+}
+
+// Measure the case in a child process, so that its peak RSS is its own.
+static void run(const Case &c, const std::size_t size, const Mode mode) {
+  std::cout.flush();
+  pid_t pid = ::fork();
+  if (pid < 0) {
+    measure(c, size, mode);
+    return;
+  }
+  if (pid == 0) {
+    measure(c, size, mode);
+    std::cout.flush();
+    std::_Exit(0);
+  }
+  ::waitpid(pid, nullptr, 0);
+}
+
+int main(int argc, char **argv) {
+  std::size_t max = argc > 1 ? parseSize(argv[1]) : 1 << 20;
+  options.getOptions()->push_back(Parser::Sequence<char, std::string>::get(
+      "SEQ",
+      std::array{literal("("),
+                 Ptr(std::make_unique<Parser::LazyParser<char, std::string>>(
+                     &options)),
+                 literal(")")}));
+  options.getOptions()->push_back(CharPredicate::get('a', Parser::MORE, "a"));
+  options.reset();
+  for (auto &c : cases()) {
+    for (auto mode : {Mode::Build, Mode::Validate, Mode::Sink, Mode::Stream}) {
+      for (std::size_t size = 1024; size <= max; size *= 32)
+        run(c, size, mode);
+    }
+  }
+  return 0;
+}
@@ -1,76 +1,249 @@
 #pragma once
+#include "HelperResults.hpp"
+#include "LiteralSet.hpp"
 #include "Parser.hpp"
-#include <queue>
-#include <stack>
 
 namespace Parser {
 
 /**
  * This is a combinator that represents the union of parsers.
+ * The FIRST sets of the options are used to dispatch the first token: options
+ * that cannot start with it would fail on it anyway, so they are not applied at
+ * all. If every option is a literal (such as a StringPredicate), the options
+ * are matched with a LiteralSet instead. The results and errors are the same
+ * as applying every option.
  */
 template <typename S, typename T>
 class Alternate : public AbstractParser<S, T> {
 private:
-  /**
-   * This class is to store the parser result of a single parser.
-   * As the parsing of other parsers may continue after one success (their
-   * length may be different), we have to store the additional tokens in
-   * a queue in this object.
-   */
-  class StateResult : public AbstractParserResult<S, T> {
-  private:
-    std::queue<S> waitlist;
-    AbstractParserResultPtr<S, T> result;
+  std::unique_ptr<std::vector<AbstractParserPtr<S, T>>> options;
+  // computed on demand and shared with the clones
+  std::shared_ptr<const std::vector<FirstSet<S>>> firsts;
+  // the grammar version that they were computed at
+  std::uint64_t version = 0;
+  // replaces the options if they are all literals
+  AbstractParserPtr<S, T> literals;
+  // the options that accepted the first token
+  std::vector<unsigned int> active;
+  std::vector<bool> completed;
+  std::unique_ptr<StateResult<S, T>> result;
+  // the option of the result
+  unsigned int resultIndex = 0;
+  std::optional<ParsingError> error;
+  Name name;
+  // the sink mode: the options run at the same time, so they put their
+  // outputs in a sink each, and the one of the result goes to the sink
+  OutputSink<T> *sink = nullptr;
+  std::vector<OutputSink<T>> sinks;
+  // the sink of the only option left is forwarded to the sink, which had mark
+  // outputs then
+  std::size_t mark = 0;
+  bool committed = false;
+  // the tokens applied, and the ones applied when the error was made
+  std::size_t tokens = 0;
+  std::size_t errorAt = 0;
+  unsigned int errorIndex = 0;
+  // the last option that was skipped, and the token that it was skipped for
+  int skipped = -1;
+  S head;
+  bool validating = false;
 
-  public:
-    StateResult(decltype(result) result) : result(std::move(result)) {}
+  void start(const S &value) {
+    prepare();
+    head = value;
+    for (unsigned int i = 0; i < options->size(); ++i) {
+      if ((*firsts)[i].mayStart(value))
+        active.push_back(i);
+      else
+        skipped = i;
+    }
+  }
 
-    StateResult(const StateResult &) = delete;
+  void fail(ParsingError e, const unsigned int i) {
+    error = std::optional(std::move(e));
+    errorAt = tokens;
+    errorIndex = i;
+  }
 
-    void push(const S &value) { waitlist.push(value); }
+  void succeed(AbstractParserResultPtr<S, T> &r, const unsigned int i) {
+    result = std::make_unique<StateResult<S, T>>(std::move(r));
+    resultIndex = i;
+  }
 
-    std::optional<S> getRemaining() override {
-      if (auto s = result->getRemaining(); s.has_value())
-        return s;
-      if (!waitlist.empty()) {
-        S s = waitlist.front();
-        waitlist.pop();
-        return s;
+  /**
+   * Once a single option may complete and none did, its outcome is the one of
+   * the alternation: if the sink streams, its outputs are passed to the sink
+   * as they come, and taken back if it fails. A buffered sink gets them when
+   * the alternation completes.
+   */
+  void commit() {
+    if (sink == nullptr || committed || result != nullptr ||
+        !sink->streaming())
+      return;
+    int last = -1;
+    for (auto i : active) {
+      if (completed[i])
+        continue;
+      if (last >= 0)
+        return;
+      last = i;
+    }
+    if (last < 0)
+      return;
+    mark = sink->size();
+    sinks[last].forward(sink);
+    committed = true;
+  }
+
+  // Only the active options have seen any token.
+  void clear() {
+    for (auto i : active) {
+      (*options)[i]->reset();
+      completed[i] = false;
+      if (sink != nullptr)
+        sinks[i].clear();
+    }
+    active.clear();
+    result = std::unique_ptr<StateResult<S, T>>(nullptr);
+    error.reset();
+    tokens = 0;
+    skipped = -1;
+    committed = false;
+  }
+
+  ParserResult<S, T> finish() {
+    if (result != nullptr) {
+      if (sink != nullptr)
+        sink->append(sinks[resultIndex]);
+      AbstractParserResultPtr<S, T> p = std::move(result);
+      auto parsed = std::make_optional(
+          std::variant<ParsingError, decltype(p)>(std::move(p)));
+      clear();
+      return parsed;
+    }
+    // The skipped options failed on the first token. If one of them would be
+    // the last one failing, apply the token to get its error.
+    if (skipped >= 0 && (!error.has_value() ||
+                         (errorAt == 1 && errorIndex < (unsigned)skipped))) {
+      auto &p = (*options)[skipped];
+      auto r = (*p)(head);
+      p->reset();
+      if (sink != nullptr)
+        sinks[skipped].clear();
+      if (r.has_value() && isError(r)) {
+        error = std::optional(asError(r));
+        errorAt = 1;
       }
-      return {};
     }
+    if (!error.has_value()) {
+      // this should not happen as the parsers should return something when
+      // they encounter operator()() which indicates the end of input.
+      clear();
+      return ParsingError::get<S, T>(ErrorCode::Incomplete, name);
+    }
+    auto v = error.value();
+    v.recordAlternate(name);
+    // the other options went on after it failed
+    v.delay(tokens - errorAt);
+    if (committed)
+      sink->truncate(mark);
+    clear();
+    return ParsingError::get<S, T>(v);
+  }
 
-    std::optional<T> get() override { return result->get(); }
-  };
-  std::unique_ptr<std::vector<AbstractParserPtr<S, T>>> options;
-  std::vector<bool> completed;
-  std::unique_ptr<StateResult> result;
-  std::optional<ParsingError> error;
-  std::string name;
+  // The options are cloned, or instantiated for an instance. The FIRST sets
+  // and the literal set are shared.
+  AbstractParserPtr<S, T> copy(const bool instance) const {
+    auto v = std::make_unique<std::vector<AbstractParserPtr<S, T>>>();
+    v->reserve(options->size());
+    for (auto &parser : *options)
+      v->push_back(instance ? parser->instantiate() : parser->clone());
+    auto p = std::make_unique<Alternate<S, T>>(std::move(v), name);
+    p->firsts = firsts;
+    p->version = version;
+    if (literals != nullptr)
+      p->literals = instance ? literals->instantiate() : literals->clone();
+    p->validating = validating;
+    return p;
+  }
 
 public:
-  Alternate(decltype(options) options, const std::string &name)
+  Alternate(decltype(options) options, Name name)
       : options(std::move(options)), name(name) {
     reset();
   }
 
   void reset() override {
-    result = std::unique_ptr<StateResult>(nullptr);
-    completed.clear();
-    for (auto &p : *options) {
+    // the outputs passed on by the committed option are taken back
+    if (committed)
+      sink->truncate(mark);
+    completed.assign(options->size(), false);
+    for (auto &p : *options)
       p->reset();
-      completed.push_back(false);
-    }
+    if (literals != nullptr)
+      literals->reset();
+    for (auto &outputs : sinks)
+      outputs.clear();
+    active.clear();
+    result = std::unique_ptr<StateResult<S, T>>(nullptr);
+    error.reset();
+    tokens = 0;
+    skipped = -1;
+    committed = false;
   }
 
-  AbstractParserPtr<S, T> clone() override {
-    auto v = std::make_unique<std::vector<AbstractParserPtr<S, T>>>();
-    for (auto &parser : *options)
-      v->push_back(std::move(parser->clone()));
-    return std::make_unique<Alternate<S, T>>(std::move(v), name);
+  AbstractParserPtr<S, T> clone() const override { return copy(false); }
+
+  AbstractParserPtr<S, T> instantiate() const override { return copy(true); }
+
+  bool restore(AbstractParser<S, T> &other) override {
+    auto p = dynamic_cast<Alternate<S, T> *>(&other);
+    if (p == nullptr || p->options->size() != options->size() ||
+        sink != nullptr || p->sink != nullptr)
+      return false;
+    reset();
+    if (p->literals != nullptr) {
+      if (literals == nullptr)
+        literals = p->literals->clone();
+      if (!literals->restore(*p->literals))
+        return false;
+    }
+    for (unsigned int i = 0; i < options->size(); ++i) {
+      if (!(*options)[i]->restore(*(*p->options)[i]))
+        return false;
+    }
+    firsts = p->firsts;
+    version = p->version;
+    active = p->active;
+    completed = p->completed;
+    if (p->result != nullptr) {
+      // the pending result is shared instead of being copied, but its outputs
+      // are copied for both
+      if constexpr (std::is_copy_constructible_v<T>) {
+        AbstractParserResultPtr<S, T> pending = std::move(p->result);
+        auto copy = share(pending);
+        p->result = std::make_unique<StateResult<S, T>>(std::move(pending));
+        result = std::make_unique<StateResult<S, T>>(std::move(copy));
+      } else {
+        return false;
+      }
+    }
+    error = p->error;
+    tokens = p->tokens;
+    errorAt = p->errorAt;
+    errorIndex = p->errorIndex;
+    skipped = p->skipped;
+    head = p->head;
+    return true;
   }
 
   ParserResult<S, T> operator()(const S &value) override {
+    if (tokens == 0)
+      prepare();
+    if (literals != nullptr)
+      return (*literals)(value);
+    if (tokens++ == 0)
+      start(value);
     bool allCompleted = true;
     // as we continue the parsing, we have to store the token in the previous
     // result or they will be lost those undetermined parsers failed.
@@ -79,16 +252,15 @@ public:
     // Iterate through the undetermined parsers and apply the token.
     // If they success, make them our current result. We only keep the latest
     // result as that matches the most tokens. (be greedy)
-    for (unsigned int i = 0; i < completed.size(); ++i) {
+    for (auto i : active) {
       if (!completed[i]) {
-        auto r = (*options->at(i))(value);
+        auto r = (*(*options)[i])(value);
         if (r.has_value()) {
           completed[i] = true;
           if (isError(r)) {
-            error = std::optional(asError(r));
+            fail(asError(r), i);
           } else {
-            auto &v = asResult(r);
-            result = std::make_unique<StateResult>(std::move(v));
+            succeed(asResult(r), i);
           }
         } else {
           allCompleted = false;
@@ -98,65 +270,182 @@ public:
     // If all parsers are determined, we return a result if we have one,
     // or an error if none of the parsers matches the input.
     // Otherwise, indicate that we are not completed yet.
-    if (allCompleted) {
-      if (result != nullptr) {
-        AbstractParserResultPtr<S, T> p = std::move(result);
-        auto parsed = std::make_optional(
-            std::variant<ParsingError, decltype(p)>(std::move(p)));
-        reset();
-        return parsed;
+    if (allCompleted)
+      return finish();
+    commit();
+    return {};
+  }
+
+  FeedResult<S, T> feed(const S *begin, const S *end) override {
+    if (begin == end)
+      return {0, {}};
+    if (tokens == 0)
+      prepare();
+    if (literals != nullptr)
+      return literals->feed(begin, end);
+    if (tokens == 0)
+      start(*begin);
+    commit();
+    // The branches are independent, so instead of applying the tokens in
+    // lockstep we run each undetermined branch over the span on its own, and
+    // reconstruct what the lockstep loop would have done: the branch that
+    // finished on the latest token wins (the last one if they finished on the
+    // same token), and the tokens after it go to its waitlist.
+    std::size_t consumed = 0;
+    std::size_t resultAt = 0;
+    std::size_t localErrorAt = 0;
+    bool allCompleted = true;
+    for (auto i : active) {
+      if (completed[i])
+        continue;
+      auto [n, r] = (*options)[i]->feed(begin, end);
+      if (!r.has_value()) {
+        allCompleted = false;
+        continue;
+      }
+      completed[i] = true;
+      if (n > consumed)
+        consumed = n;
+      if (isError(r)) {
+        if (n >= localErrorAt) {
+          error = std::optional(asError(r));
+          errorAt = tokens + n;
+          errorIndex = i;
+          localErrorAt = n;
+        }
+      } else if (n >= resultAt) {
+        succeed(asResult(r), i);
+        resultAt = n;
       }
-      auto v = error.value();
-      v.record(name + " (alt)");
-      reset();
-      return ParsingError::get<S, T>(v);
     }
-    return {};
+    if (!allCompleted)
+      consumed = end - begin;
+    else if (consumed == 0)
+      consumed = 1;
+    tokens += consumed;
+    if (result != nullptr) {
+      for (const S *it = begin + resultAt; it != begin + consumed; ++it)
+        result->push(*it);
+    }
+    if (allCompleted)
+      return {consumed, finish()};
+    commit();
+    return {consumed, {}};
   }
 
   ParserResult<S, T> operator()() override {
     // This function is similar to the previous one, the only different
     // is we don't have an input. Return if we have any result, and fail if no
     // result.
-    bool allCompleted = true;
-    for (unsigned int i = 0; i < completed.size(); ++i) {
+    if (tokens == 0)
+      prepare();
+    if (literals != nullptr)
+      return (*literals)();
+    if (tokens++ == 0) {
+      for (unsigned int i = 0; i < options->size(); ++i)
+        active.push_back(i);
+    }
+    for (auto i : active) {
       if (!completed[i]) {
-        auto r = (*options->at(i))();
+        auto r = (*(*options)[i])();
         if (r.has_value()) {
           completed[i] = true;
           if (isError(r)) {
-            error = std::optional(asError(r));
+            fail(asError(r), i);
           } else {
-            auto &v = asResult(r);
-            result = std::make_unique<StateResult>(std::move(v));
+            succeed(asResult(r), i);
           }
-        } else {
-          allCompleted = false;
         }
       }
     }
-    if (result != nullptr) {
-      AbstractParserResultPtr<S, T> p = std::move(result);
-      auto parsed = std::make_optional(
-          std::variant<ParsingError, decltype(p)>(std::move(p)));
-      reset();
-      return parsed;
+    return finish();
+  }
+
+  void setValidating(const bool validating) override {
+    this->validating = validating;
+    for (auto &p : *options)
+      p->setValidating(validating);
+    if (literals != nullptr)
+      literals->setValidating(validating);
+  }
+
+  /**
+   * The literal set is not in the sink mode, its results have the outputs.
+   * The sinks of the options take the pieces of the sink.
+   */
+  void setSink(OutputSink<T> *sink) override {
+    this->sink = sink;
+    sinks = std::vector<OutputSink<T>>(sink == nullptr ? 0 : options->size());
+    for (unsigned int i = 0; i < options->size(); ++i) {
+      if (sink != nullptr)
+        sinks[i].setPieces(sink->getPieces());
+      (*options)[i]->setSink(sink == nullptr ? nullptr : &sinks[i]);
     }
-    reset();
-    if (error.has_value()) {
-      auto v = error.value();
-      v.record(name + " (alt)");
-      return ParsingError::get<S, T>(v);
+    committed = false;
+  }
+
+  const std::string &getName() const override { return name.str(); }
+
+  /**
+   * Compute the FIRST sets of the options, and the literal set that replaces
+   * them, if they are not computed yet. The alternation does it when it is
+   * first applied, and its clones and instances share them, so a parser that
+   * is only instantiated (see Grammar) is prepared when it is made. They are
+   * computed again after a parser was modified (see grammarVersion).
+   */
+  void prepare() {
+    completed.resize(options->size(), false);
+    if (prepared())
+      return;
+    version = grammarVersion.load(std::memory_order_relaxed);
+    auto sets = std::make_shared<std::vector<FirstSet<S>>>();
+    for (auto &p : *options)
+      sets->push_back(p->first());
+    firsts = std::move(sets);
+    if constexpr (std::is_same_v<S, char> && std::is_same_v<T, std::string>)
+      literals = LiteralSet::fromOptions(*options, name);
+    if (literals != nullptr)
+      literals->setValidating(validating);
+  }
+
+  bool prepared() const {
+    return firsts != nullptr && firsts->size() == options->size() &&
+           version == grammarVersion.load(std::memory_order_relaxed);
+  }
+
+  FirstSet<S> first() const override {
+    FirstSet<S> set;
+    // computed from the options if the alternation is not prepared
+    if (prepared()) {
+      for (auto &f : *firsts)
+        set.merge(f);
+    } else {
+      for (auto &p : *options)
+        set.merge(p->first());
     }
-    // we have nothing matched nor any error. Actually this should not happen
-    // as the parsers should return something when they encounter operator()()
-    // which indicates the end of input.
-    return ParsingError::get<S, T>("Insufficient Tokens", name);
+    return set;
+  }
+
+  /**
+   * Drop the FIRST sets and the literal set, so that they are computed again
+   * from the options.
+   */
+  void invalidate() {
+    firsts = nullptr;
+    literals = nullptr;
   }
 
-  const std::string &getName() override { return name; }
+  /**
+   * The options may be modified, so the FIRST sets are computed again, here
+   * and in the alternations above. The sink, if any, has to be set again.
+   */
+  auto &getOptions() {
+    invalidate();
+    grammarChanged();
+    return options;
+  }
 
-  auto &getOptions() { return options; }
+  const auto &getOptions() const { return options; }
 
   template <typename array>
   static auto get(const std::string &name, array &&args) {
@@ -0,0 +1,98 @@
+#include "Arena.hpp"
+#include <new>
+
+namespace Parser {
+
+namespace {
+thread_local Arena *current = nullptr;
+thread_local AllocationStats stats;
+#ifdef PARSER_PROFILE
+thread_local std::size_t count = 0;
+#endif
+
+// Every allocation is prefixed with the arena it comes from (null for the
+// global allocator). This keeps the user data 16 bytes aligned.
+constexpr std::size_t headerSize = 16;
+} // namespace
+
+Arena::~Arena() {
+  for (auto *b : blocks)
+    ::operator delete(b);
+}
+
+void *Arena::allocate(std::size_t size) {
+  ++stats.allocations;
+  ++live;
+  size = (size + granularity - 1) / granularity * granularity;
+  if (size > maxSmall) {
+    ++stats.heapAllocations;
+    return ::operator new(size);
+  }
+  auto &list = freeLists[size / granularity - 1];
+  if (list != nullptr) {
+    void *p = list;
+    list = *static_cast<void **>(p);
+    return p;
+  }
+  if (static_cast<std::size_t>(limit - cursor) < size) {
+    ++stats.heapAllocations;
+    blocks.push_back(static_cast<char *>(::operator new(blockSize)));
+    cursor = blocks.back();
+    limit = cursor + blockSize;
+  }
+  void *p = cursor;
+  cursor += size;
+  return p;
+}
+
+void Arena::deallocate(void *p, std::size_t size) {
+  ++stats.deallocations;
+  --live;
+  size = (size + granularity - 1) / granularity * granularity;
+  if (size > maxSmall) {
+    ::operator delete(p);
+    return;
+  }
+  auto &list = freeLists[size / granularity - 1];
+  *static_cast<void **>(p) = list;
+  list = p;
+}
+
+ArenaScope::ArenaScope(Arena *arena) : previous(current) { current = arena; }
+
+ArenaScope::~ArenaScope() { current = previous; }
+
+void *allocate(std::size_t size) {
+#ifdef PARSER_PROFILE
+  ++count;
+#endif
+  char *p;
+  if (current != nullptr) {
+    p = static_cast<char *>(current->allocate(size + headerSize));
+  } else {
+    ++stats.allocations;
+    ++stats.heapAllocations;
+    p = static_cast<char *>(::operator new(size + headerSize));
+  }
+  *reinterpret_cast<Arena **>(p) = current;
+  return p + headerSize;
+}
+
+void deallocate(void *p, std::size_t size) {
+  char *raw = static_cast<char *>(p) - headerSize;
+  Arena *arena = *reinterpret_cast<Arena **>(raw);
+  if (arena != nullptr) {
+    arena->deallocate(raw, size + headerSize);
+  } else {
+    ++stats.deallocations;
+    ::operator delete(raw);
+  }
+}
+
+AllocationStats &heapStats() { return stats; }
+
+#ifdef PARSER_PROFILE
+std::size_t allocationCount() { return count; }
+#endif
+
+} // namespace Parser
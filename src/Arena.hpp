@@ -0,0 +1,135 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <deque>
+#include <queue>
+#include <stack>
+#include <vector>
+
+namespace Parser {
+
+/**
+ * Allocation counters. `heapAllocations` counts the calls into the global
+ * allocator, the others count the requests served.
+ */
+struct AllocationStats {
+  std::size_t allocations = 0;
+  std::size_t deallocations = 0;
+  std::size_t heapAllocations = 0;
+};
+
+/**
+ * A simple arena for the short-lived objects of a parse session (parser
+ * results, error stacks and the storage of the queues and stacks in the
+ * combinators).
+ * Memory is bump allocated from large blocks, and freed memory is kept in
+ * per-size free lists, so in the steady state nothing goes to the global
+ * allocator. The blocks are freed all at once when the arena is destroyed.
+ *
+ * An arena must only be used by one thread, and it must outlive every object
+ * allocated from it.
+ */
+class Arena {
+private:
+  static constexpr std::size_t granularity = 16;
+  static constexpr std::size_t maxSmall = 1024;
+  static constexpr std::size_t blockSize = 64 * 1024;
+
+  std::vector<char *> blocks;
+  char *cursor = nullptr;
+  char *limit = nullptr;
+  std::array<void *, maxSmall / granularity> freeLists{};
+  AllocationStats stats;
+  std::size_t live = 0;
+
+public:
+  Arena() = default;
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  ~Arena();
+
+  void *allocate(std::size_t size);
+  void deallocate(void *p, std::size_t size);
+
+  const AllocationStats &getStats() const { return stats; }
+  std::size_t getLive() const { return live; }
+};
+
+/**
+ * Make the allocations of the current thread go to the arena, until the scope
+ * ends.
+ */
+class ArenaScope {
+private:
+  Arena *previous;
+
+public:
+  ArenaScope(Arena *arena);
+  ArenaScope(const ArenaScope &) = delete;
+  ~ArenaScope();
+};
+
+/**
+ * Allocate from the arena of the current scope, or from the global allocator
+ * if there is none. The memory can be freed with deallocate anywhere, as it
+ * remembers where it comes from.
+ */
+void *allocate(std::size_t size);
+void deallocate(void *p, std::size_t size);
+
+/**
+ * Counters of the allocations done outside of any arena in this thread.
+ */
+AllocationStats &heapStats();
+
+#ifdef PARSER_PROFILE
+/**
+ * The number of calls to allocate in this thread, from any arena or not. It is
+ * only counted for the profiler, so that allocate costs nothing more without
+ * it.
+ */
+std::size_t allocationCount();
+#endif
+
+/**
+ * Base class for objects that should be allocated with allocate.
+ */
+struct ArenaAllocated {
+  static void *operator new(std::size_t size) { return allocate(size); }
+  static void operator delete(void *p, std::size_t size) {
+    deallocate(p, size);
+  }
+};
+
+/**
+ * Allocator for the standard containers, using allocate.
+ */
+template <typename U> class ArenaAllocator {
+public:
+  using value_type = U;
+  static_assert(alignof(U) <= 16, "over-aligned types are not supported");
+
+  ArenaAllocator() = default;
+  template <typename V> ArenaAllocator(const ArenaAllocator<V> &) {}
+
+  U *allocate(std::size_t n) {
+    return static_cast<U *>(Parser::allocate(n * sizeof(U)));
+  }
+  void deallocate(U *p, std::size_t n) {
+    Parser::deallocate(p, n * sizeof(U));
+  }
+
+  template <typename V> bool operator==(const ArenaAllocator<V> &) const {
+    return true;
+  }
+  template <typename V> bool operator!=(const ArenaAllocator<V> &) const {
+    return false;
+  }
+};
+
+template <typename U> using Vector = std::vector<U, ArenaAllocator<U>>;
+template <typename U> using Deque = std::deque<U, ArenaAllocator<U>>;
+template <typename U> using Queue = std::queue<U, Deque<U>>;
+template <typename U> using Stack = std::stack<U, Deque<U>>;
+
+} // namespace Parser
@@ -0,0 +1,75 @@
+#pragma once
+#include "Arena.hpp"
+#include "Parser.hpp"
+
+namespace Parser {
+
+/**
+ * Wrapper of a top-level parser that makes everything allocated during the
+ * parsing (results, queues and stacks) come from its own arena. The
+ * combinators keep the storage of their queues and stacks when they are
+ * reset, so the arena is not freed on reset: the memory of the results is
+ * reused through the free lists of the arena, and the blocks are only freed
+ * all at once when the wrapper is destroyed.
+ * The results and the errors must not outlive the wrapper.
+ */
+template <typename S, typename T>
+class ArenaParser final : public AbstractParser<S, T> {
+private:
+  // declared first so it is destroyed after the parser
+  std::unique_ptr<Arena> arena;
+  AbstractParserPtr<S, T> parser;
+
+public:
+  ArenaParser(decltype(parser) parser)
+      : arena(std::make_unique<Arena>()), parser(std::move(parser)) {}
+
+  void reset() override {
+    // resetting does not allocate, the storage of the parser is kept
+    parser->reset();
+  }
+
+  AbstractParserPtr<S, T> clone() const override {
+    return std::make_unique<ArenaParser>(parser->clone());
+  }
+
+  AbstractParserPtr<S, T> instantiate() const override {
+    return std::make_unique<ArenaParser>(parser->instantiate());
+  }
+
+  bool restore(AbstractParser<S, T> &other) override {
+    auto p = dynamic_cast<ArenaParser *>(&other);
+    if (p == nullptr)
+      return false;
+    ArenaScope scope(arena.get());
+    return parser->restore(*p->parser);
+  }
+
+  ParserResult<S, T> operator()(const S &value) override {
+    ArenaScope scope(arena.get());
+    return (*parser)(value);
+  }
+
+  ParserResult<S, T> operator()() override {
+    ArenaScope scope(arena.get());
+    return (*parser)();
+  }
+
+  FeedResult<S, T> feed(const S *begin, const S *end) override {
+    ArenaScope scope(arena.get());
+    return parser->feed(begin, end);
+  }
+
+  void setValidating(const bool validating) override {
+    parser->setValidating(validating);
+  }
+
+  void setSink(OutputSink<T> *sink) override { parser->setSink(sink); }
+
+  const std::string &getName() const override { return parser->getName(); }
+  FirstSet<S> first() const override { return parser->first(); }
+
+  const Arena &getArena() const { return *arena; }
+};
+
+} // namespace Parser
@@ -0,0 +1,241 @@
+#include "CharClass.hpp"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Parser {
+
+CharClass::CharClass(const std::string &chars) {
+  for (char c : chars) {
+    auto v = static_cast<unsigned char>(c);
+    bits[v >> 6] |= std::uint64_t(1) << (v & 63);
+  }
+  update();
+}
+
+void CharClass::update() {
+  rangeCount = 0;
+  vectorized = true;
+  for (unsigned int i = 0; i < 256;) {
+    if (!contains(static_cast<char>(i))) {
+      ++i;
+      continue;
+    }
+    unsigned int j = i;
+    while (j + 1 < 256 && contains(static_cast<char>(j + 1)))
+      ++j;
+    if (rangeCount == maxRanges) {
+      // too many ranges, use the table
+      vectorized = false;
+      return;
+    }
+    ranges[rangeCount++] = {static_cast<unsigned char>(i),
+                            static_cast<unsigned char>(j)};
+    i = j + 1;
+  }
+  vectorized = rangeCount > 0;
+}
+
+CharClass CharClass::range(char lo, char hi) {
+  CharClass c;
+  for (unsigned int v = static_cast<unsigned char>(lo);
+       v <= static_cast<unsigned char>(hi); ++v)
+    c.bits[v >> 6] |= std::uint64_t(1) << (v & 63);
+  c.update();
+  return c;
+}
+
+CharClass CharClass::whitespace() { return CharClass(" \t\n\v\f\r"); }
+
+CharClass CharClass::digit() { return range('0', '9'); }
+
+CharClass CharClass::identifier() {
+  return range('a', 'z') | range('A', 'Z') | digit() | CharClass("_");
+}
+
+CharClass CharClass::operator|(const CharClass &other) const {
+  CharClass c;
+  for (int i = 0; i < 4; ++i)
+    c.bits[i] = bits[i] | other.bits[i];
+  c.update();
+  return c;
+}
+
+CharClass CharClass::operator~() const {
+  CharClass c;
+  for (int i = 0; i < 4; ++i)
+    c.bits[i] = ~bits[i];
+  c.update();
+  return c;
+}
+
+const char *CharClass::scanScalar(const char *begin, const char *end) const {
+  while (begin != end && contains(*begin))
+    ++begin;
+  return begin;
+}
+
+// A character c is in [lo, hi] iff c - lo is at most hi - lo as an unsigned
+// byte. SSE2 and AVX2 only have signed comparison, so we shift the values by
+// 0x80 first. The lanes that are outside every range are the end of the run.
+const char *CharClass::scan(const char *begin, const char *end) const {
+  if (!vectorized)
+    return scanScalar(begin, end);
+  const char *it = begin;
+#if defined(__AVX2__)
+  __m256i shift256[maxRanges], bound256[maxRanges];
+  for (unsigned int i = 0; i < rangeCount; ++i) {
+    shift256[i] = _mm256_set1_epi8(static_cast<char>(0x80 - ranges[i].first));
+    bound256[i] = _mm256_set1_epi8(
+        static_cast<char>(-128 + (ranges[i].second - ranges[i].first)));
+  }
+  for (; end - it >= 32; it += 32) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(it));
+    auto out = _mm256_set1_epi8(-1);
+    for (unsigned int i = 0; i < rangeCount; ++i) {
+      auto t = _mm256_add_epi8(v, shift256[i]);
+      out = _mm256_and_si256(out, _mm256_cmpgt_epi8(t, bound256[i]));
+    }
+    if (auto mask = static_cast<unsigned int>(_mm256_movemask_epi8(out)))
+      return it + __builtin_ctz(mask);
+  }
+#endif
+#if defined(__SSE2__)
+  __m128i shift[maxRanges], bound[maxRanges];
+  for (unsigned int i = 0; i < rangeCount; ++i) {
+    shift[i] = _mm_set1_epi8(static_cast<char>(0x80 - ranges[i].first));
+    bound[i] = _mm_set1_epi8(
+        static_cast<char>(-128 + (ranges[i].second - ranges[i].first)));
+  }
+  for (; end - it >= 16; it += 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+    auto out = _mm_set1_epi8(-1);
+    for (unsigned int i = 0; i < rangeCount; ++i) {
+      auto t = _mm_add_epi8(v, shift[i]);
+      out = _mm_and_si128(out, _mm_cmpgt_epi8(t, bound[i]));
+    }
+    if (auto mask = static_cast<unsigned int>(_mm_movemask_epi8(out)))
+      return it + __builtin_ctz(mask);
+  }
+#endif
+  return scanScalar(it, end);
+}
+
+FirstSet<char> CharClass::first() const {
+  FirstSet<char> set;
+  for (unsigned int i = 0; i < 256; ++i) {
+    if (contains(static_cast<char>(i)))
+      set.insert(static_cast<char>(i));
+  }
+  return set;
+}
+
+namespace {
+std::string describe(std::uint64_t payload) {
+  return std::string(1, static_cast<char>(payload));
+}
+} // namespace
+
+ParserResult<char, std::string> CharClassParser::accepted(const char last) {
+  if (quantifier == NONE) {
+    auto error = ParsingError::unexpected(last, describe, name);
+    reset();
+    return ParsingError::get<char, std::string>(error);
+  }
+  if (full()) {
+    auto parsed = output();
+    reset();
+    return parsed;
+  }
+  return {};
+}
+
+ParserResult<char, std::string> CharClassParser::output() {
+  if (count == 0 || validating)
+    return castResult<CharClassParserResult, char, std::string>();
+  return castResult<CharClassParserResult, char, std::string>(
+      std::move(aggregated));
+}
+
+ParserResult<char, std::string>
+CharClassParser::rejected(const char value) {
+  if (insufficient()) {
+    auto error = ParsingError(ErrorCode::InsufficientTokens, name, 1);
+    reset();
+    return ParsingError::get<char, std::string>(error);
+  }
+  auto result =
+      count == 0 || validating
+          ? castResult<CharClassParserResult, char, std::string>(value)
+          : castResult<CharClassParserResult, char, std::string>(
+                value, std::move(aggregated));
+  reset();
+  return result;
+}
+
+bool CharClassParser::restore(AbstractParser<char, std::string> &other) {
+  auto p = dynamic_cast<CharClassParser *>(&other);
+  if (p == nullptr)
+    return false;
+  count = p->count;
+  aggregated = p->aggregated;
+  return true;
+}
+
+FirstSet<char> CharClassParser::first() const {
+  auto set = charClass.first();
+  set.setNullable(quantifier == NONE || quantifier == OPTIONAL ||
+                  quantifier == ANY || quantifier == 0);
+  return set;
+}
+
+ParserResult<char, std::string> CharClassParser::
+operator()(const char &value) {
+  if (!charClass.contains(value))
+    return rejected(value);
+  if (!validating)
+    aggregated.push_back(value);
+  ++count;
+  return accepted(value);
+}
+
+FeedResult<char, std::string> CharClassParser::feed(const char *begin,
+                                                    const char *end) {
+  if (quantifier == NONE)
+    return AbstractParser::feed(begin, end);
+  // the number of characters that we may still accept
+  const char *limit = end;
+  if (quantifier == ONCE || quantifier == OPTIONAL) {
+    if (end - begin > 1)
+      limit = begin + 1;
+  } else if (quantifier > 0 && end - begin > quantifier - count) {
+    limit = begin + (quantifier - count);
+  }
+  const char *it = charClass.scan(begin, limit);
+  auto n = static_cast<std::size_t>(it - begin);
+  if (n > 0) {
+    if (!validating)
+      aggregated.append(begin, n);
+    count += n;
+    if (auto result = accepted(it[-1]); result.has_value())
+      return {n, std::move(result)};
+  }
+  if (it == end)
+    return {n, {}};
+  return {n + 1, rejected(*it)};
+}
+
+ParserResult<char, std::string> CharClassParser::operator()() {
+  if (insufficient()) {
+    auto error = ParsingError(ErrorCode::InsufficientTokens, name);
+    reset();
+    return ParsingError::get<char, std::string>(error);
+  }
+  auto result = output();
+  reset();
+  return result;
+}
+
+} // namespace Parser
@@ -0,0 +1,163 @@
+#pragma once
+#include "Parser.hpp"
+#include "Predicate.hpp"
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace Parser {
+
+/**
+ * A set of characters as a 256-bit table. Besides testing single characters,
+ * it can find the end of a run of characters in the class with SIMD (SSE2, or
+ * AVX2 if it is enabled when compiling), if the class is made of a few ranges
+ * like whitespace, digits or identifier characters. Otherwise it falls back to
+ * the table lookup.
+ */
+class CharClass {
+private:
+  static constexpr std::size_t maxRanges = 8;
+
+  std::array<std::uint64_t, 4> bits{};
+  // the class as ranges of characters, for the SIMD scanning
+  std::array<std::pair<unsigned char, unsigned char>, maxRanges> ranges{};
+  unsigned int rangeCount = 0;
+  bool vectorized = false;
+
+  void update();
+
+public:
+  CharClass() = default;
+  CharClass(const std::string &chars);
+
+  static CharClass range(char lo, char hi);
+  static CharClass whitespace();
+  static CharClass digit();
+  static CharClass identifier();
+
+  CharClass operator|(const CharClass &other) const;
+  CharClass operator~() const;
+
+  bool contains(const char c) const {
+    auto v = static_cast<unsigned char>(c);
+    return (bits[v >> 6] >> (v & 63)) & 1;
+  }
+
+  /**
+   * Returns the first position in [begin, end) that is not in the class, or
+   * end if every character is in it.
+   */
+  const char *scan(const char *begin, const char *end) const;
+
+  /**
+   * Same as scan but without SIMD, for testing and comparison.
+   */
+  const char *scanScalar(const char *begin, const char *end) const;
+
+  FirstSet<char> first() const;
+};
+
+/**
+ * A predicate over a character class. The quantifiers have the same meaning as
+ * the ones of PredicateParser, but with feed the run of characters in the
+ * class is found with CharClass::scan and appended to the result at once,
+ * instead of testing and folding the characters one by one.
+ */
+class CharClassParser final : public AbstractParser<char, std::string> {
+private:
+  CharClass charClass;
+  int quantifier;
+  int count = 0;
+  std::string aggregated;
+  Name name;
+  // the characters are not appended, the results have no value
+  bool validating = false;
+
+  class CharClassParserResult final
+      : public AbstractParserResult<char, std::string> {
+  private:
+    char token;
+    std::string value;
+    bool tokenLeft;
+    bool valueLeft;
+
+  public:
+    CharClassParserResult() : tokenLeft(false), valueLeft(false) {}
+    CharClassParserResult(char token)
+        : token(token), tokenLeft(true), valueLeft(false) {}
+    CharClassParserResult(std::string value)
+        : value(std::move(value)), tokenLeft(false), valueLeft(true) {}
+    CharClassParserResult(char token, std::string value)
+        : token(token), value(std::move(value)), tokenLeft(true),
+          valueLeft(true) {}
+
+    std::optional<char> getRemaining() override {
+      if (tokenLeft) {
+        tokenLeft = false;
+        return std::make_optional(token);
+      }
+      return {};
+    }
+
+    std::optional<std::string> get() override {
+      if (valueLeft) {
+        valueLeft = false;
+        return std::make_optional(std::move(value));
+      }
+      return {};
+    }
+  };
+
+  bool insufficient() const {
+    return count < quantifier ||
+           (count == 0 && (quantifier == ONCE || quantifier == MORE));
+  }
+  bool full() const {
+    return quantifier == ONCE || quantifier == OPTIONAL || quantifier == count;
+  }
+  ParserResult<char, std::string> accepted(const char last);
+  ParserResult<char, std::string> output();
+  ParserResult<char, std::string> rejected(const char value);
+
+public:
+  CharClassParser(CharClass charClass, const int quantifier, Name name)
+      : charClass(charClass), quantifier(quantifier), name(name) {}
+
+  void reset() override {
+    count = 0;
+    aggregated.clear();
+  }
+
+  AbstractParserPtr<char, std::string> clone() const override {
+    auto p = std::make_unique<CharClassParser>(charClass, quantifier, name);
+    p->validating = validating;
+    return p;
+  }
+
+  bool restore(AbstractParser<char, std::string> &other) override;
+
+  const CharClass &getCharClass() const { return charClass; }
+  int getQuantifier() const { return quantifier; }
+
+  FirstSet<char> first() const override;
+
+  void setValidating(const bool validating) override {
+    this->validating = validating;
+  }
+
+  ParserResult<char, std::string> operator()(const char &value) override;
+
+  FeedResult<char, std::string> feed(const char *begin,
+                                     const char *end) override;
+
+  ParserResult<char, std::string> operator()() override;
+
+  const std::string &getName() const override { return name.str(); }
+
+  static AbstractParserPtr<char, std::string>
+  get(CharClass charClass, const int quantifier, const std::string &name) {
+    return std::make_unique<CharClassParser>(charClass, quantifier, name);
+  }
+};
+
+} // namespace Parser
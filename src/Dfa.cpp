@@ -0,0 +1,486 @@
+#include "Dfa.hpp"
+#include "Alternate.hpp"
+#include "CharClass.hpp"
+#include "Predicate.hpp"
+#include "Sequence.hpp"
+#include <map>
+#include <utility>
+
+namespace Parser {
+
+namespace {
+using CharPredicate =
+    PredicateParser<char, std::string, Utils::fromChar, Utils::fold>;
+using State = std::vector<std::int16_t>;
+
+constexpr std::size_t maxStates = 1 << 12;
+constexpr int maxFixed = 64;
+constexpr int eof = -1;
+
+enum Kind { Leaf, Seq, Alt };
+enum Status { Running, Done, Failed };
+enum Outcome { Continue, Complete, Fail, Abort };
+
+struct Node {
+  Kind kind;
+  // leaves with a fixed quantifier have a class per position
+  std::vector<CharClass> classes;
+  int quantifier = ONCE;
+  std::vector<int> children;
+  // leaves: status, count, output; sequences: status, index; alternations:
+  // status, winner, lag
+  int slot = 0;
+  // leaves: the start register, the end register is the next one
+  int reg = 0;
+};
+
+struct Step {
+  Outcome outcome;
+  // the number of remaining tokens, up to 2
+  int lag = 0;
+};
+
+/**
+ * Runs the combinators on abstract states, see DfaParser.
+ */
+class Compiler {
+private:
+  std::vector<Node> nodes;
+  int slots = 0;
+  int registers = 0;
+  std::vector<DfaParser::Write> writes;
+
+  int add(Node node, const int size) {
+    node.slot = slots;
+    slots += size;
+    if (node.kind == Leaf) {
+      node.reg = registers;
+      registers += 2;
+    }
+    nodes.push_back(std::move(node));
+    return nodes.size() - 1;
+  }
+
+  void write(const int reg, const int offset) {
+    writes.push_back({static_cast<std::uint16_t>(reg),
+                      static_cast<std::uint16_t>(offset)});
+  }
+
+  Step leaf(State &s, const Node &n, const int c) {
+    auto &status = s[n.slot];
+    auto &count = s[n.slot + 1];
+    auto &output = s[n.slot + 2];
+    bool fixed = n.quantifier > 0;
+    bool insufficient =
+        fixed ? count < n.quantifier : count == 0 && n.quantifier == MORE;
+    if (c == eof || !n.classes[fixed ? count : 0].contains(c)) {
+      if (insufficient) {
+        status = Failed;
+        return {Fail};
+      }
+      // the token remains
+      status = Done;
+      output = count > 0;
+      write(n.reg + 1, 0);
+      return {Complete, c == eof ? 0 : 1};
+    }
+    if (count == 0)
+      write(n.reg, 0);
+    count = fixed ? count + 1 : 1;
+    if (n.quantifier == NONE) {
+      status = Failed;
+      return {Fail};
+    }
+    if (n.quantifier == OPTIONAL || (fixed && count == n.quantifier)) {
+      status = Done;
+      output = 1;
+      write(n.reg + 1, 1);
+      return {Complete, 0};
+    }
+    return {Continue};
+  }
+
+  Step sequence(State &s, const Node &n, const int c) {
+    auto &index = s[n.slot + 1];
+    auto r = step(s, n.children[index], c);
+    while (true) {
+      if (r.outcome == Fail)
+        s[n.slot] = Failed;
+      if (r.outcome != Complete)
+        return r;
+      if (index + 1 == static_cast<int>(n.children.size())) {
+        s[n.slot] = Done;
+        return r;
+      }
+      ++index;
+      // the remaining tokens are applied to the next parser
+      if (r.lag == 0 && c != eof)
+        return {Continue};
+      if ((r.lag > 0 && c == eof) || r.lag > 1)
+        return {Abort};
+      r = step(s, n.children[index], c);
+    }
+  }
+
+  Step alternate(State &s, const Node &n, const int c) {
+    auto &winner = s[n.slot + 1];
+    auto &lag = s[n.slot + 2];
+    // the token goes to the waitlist of the result
+    if (winner >= 0 && c != eof && lag < 2)
+      ++lag;
+    bool completed = true;
+    for (unsigned int i = 0; i < n.children.size(); ++i) {
+      if (s[nodes[n.children[i]].slot] != Running)
+        continue;
+      auto r = step(s, n.children[i], c);
+      if (r.outcome == Abort)
+        return r;
+      if (r.outcome == Continue) {
+        completed = false;
+      } else if (r.outcome == Complete) {
+        winner = i;
+        lag = r.lag;
+      }
+    }
+    if (!completed && c != eof)
+      return {Continue};
+    s[n.slot] = winner >= 0 ? Done : Failed;
+    if (winner >= 0)
+      return {Complete, lag};
+    return {Fail};
+  }
+
+  void plan(const State &s, const int i, DfaParser::Accept &accept) {
+    auto &n = nodes[i];
+    if (n.kind == Leaf) {
+      if (s[n.slot + 2])
+        accept.outputs.emplace_back(n.reg, n.reg + 1);
+      accept.end = n.reg + 1;
+    } else if (n.kind == Seq) {
+      for (int child : n.children)
+        plan(s, child, accept);
+    } else {
+      plan(s, n.children[s[n.slot + 1]], accept);
+    }
+  }
+
+public:
+  /**
+   * Returns the node of the parser, or -1 if it is not regular.
+   */
+  int build(AbstractParser<char, std::string> &parser) {
+    Node node;
+    node.kind = Leaf;
+    if (auto p = dynamic_cast<CharPredicate *>(&parser)) {
+      auto l = p->literal();
+      if (l.has_value() && !l->empty() &&
+          static_cast<int>(l->size()) <= maxFixed) {
+        for (char c : *l)
+          node.classes.push_back(CharClass(std::string(1, c)));
+        node.quantifier = l->size();
+        return add(std::move(node), 3);
+      }
+      if (!p->getToken().has_value() || p->getQuantifier() >= 0)
+        return -1;
+      node.classes.push_back(CharClass(std::string(1, *p->getToken())));
+      node.quantifier = p->getQuantifier();
+      return add(std::move(node), 3);
+    }
+    if (auto p = dynamic_cast<CharClassParser *>(&parser)) {
+      int q = p->getQuantifier();
+      if (q == 0 || q > maxFixed)
+        return -1;
+      node.classes.assign(q > 0 ? q : 1, p->getCharClass());
+      node.quantifier = q;
+      return add(std::move(node), 3);
+    }
+    // read only, so the FIRST sets of the alternations stay valid
+    const std::vector<AbstractParserPtr<char, std::string>> *children =
+        nullptr;
+    if (auto p = dynamic_cast<Sequence<char, std::string> *>(&parser)) {
+      node.kind = Seq;
+      children = std::as_const(*p).getSequence().get();
+    } else if (auto p = dynamic_cast<Alternate<char, std::string> *>(&parser)) {
+      node.kind = Alt;
+      children = std::as_const(*p).getOptions().get();
+    }
+    if (children == nullptr || children->empty())
+      return -1;
+    for (auto &child : *children) {
+      int i = build(*child);
+      if (i < 0)
+        return -1;
+      node.children.push_back(i);
+    }
+    return add(std::move(node), node.kind == Seq ? 2 : 3);
+  }
+
+  Step step(State &s, const int i, const int c) {
+    auto &n = nodes[i];
+    if (n.kind == Leaf)
+      return leaf(s, n, c);
+    if (n.kind == Seq)
+      return sequence(s, n, c);
+    return alternate(s, n, c);
+  }
+
+  std::shared_ptr<DfaParser::Table> explore(const int root);
+};
+
+// Interns the values into a vector, and returns their indices.
+template <typename K> struct Interned {
+  std::map<K, int> ids;
+  std::vector<K> values;
+
+  int get(const K &k) {
+    auto [it, inserted] = ids.emplace(k, values.size());
+    if (inserted)
+      values.push_back(k);
+    return it->second;
+  }
+};
+
+using Writes = std::vector<std::pair<int, int>>;
+using Plan = std::pair<int, std::vector<std::pair<int, int>>>;
+
+std::shared_ptr<DfaParser::Table> Compiler::explore(const int root) {
+  // the characters that no predicate distinguishes are in the same class
+  std::array<std::vector<bool>, 256> signatures;
+  for (auto &n : nodes) {
+    for (auto &cls : n.classes) {
+      for (int c = 0; c < 256; ++c)
+        signatures[c].push_back(cls.contains(c));
+    }
+  }
+  auto table = std::make_shared<DfaParser::Table>();
+  std::vector<int> representatives;
+  Interned<std::vector<bool>> classes;
+  for (int c = 0; c < 256; ++c) {
+    table->classes[c] = classes.get(signatures[c]);
+    if (table->classes[c] == static_cast<int>(representatives.size()))
+      representatives.push_back(c);
+  }
+  const int width = representatives.size();
+  table->classCount = width;
+
+  // Explore the states reachable from the initial state. The targets are
+  // states, error, or error - 1 - the index of the plan.
+  Interned<State> states;
+  Interned<Writes> actions;
+  Interned<Plan> plans;
+  actions.get({});
+  State initial(slots, 0);
+  for (auto &n : nodes) {
+    if (n.kind == Alt)
+      initial[n.slot + 1] = -1;
+  }
+  states.get(initial);
+  std::vector<std::pair<int, int>> transitions, ends;
+  bool aborted = false;
+  auto transition = [&](const int from, const int c) {
+    State s = states.values[from];
+    writes.clear();
+    auto r = step(s, root, c);
+    Writes w;
+    for (auto &write : writes)
+      w.emplace_back(write.reg, write.offset);
+    int action = actions.get(w);
+    int target = DfaParser::error;
+    if (r.outcome == Abort || (r.outcome == Continue && c == eof)) {
+      aborted = true;
+    } else if (r.outcome == Continue) {
+      target = states.get(s);
+    } else if (r.outcome == Complete) {
+      DfaParser::Accept accept;
+      plan(s, root, accept);
+      target = DfaParser::error - 1 - plans.get({accept.end, accept.outputs});
+    }
+    return std::make_pair(target, action);
+  };
+  for (std::size_t i = 0; i < states.values.size(); ++i) {
+    for (int c : representatives)
+      transitions.push_back(transition(i, c));
+    ends.push_back(transition(i, eof));
+    if (aborted || states.values.size() > maxStates)
+      return nullptr;
+  }
+
+  // Merge the equivalent states (Moore's algorithm): split the blocks by the
+  // targets and actions of the transitions until nothing changes.
+  const std::size_t n = states.values.size();
+  std::vector<int> block(n, 0);
+  std::size_t blocks = 1;
+  while (true) {
+    Interned<std::vector<int>> keys;
+    std::vector<int> next(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      std::vector<int> key{block[i], ends[i].first, ends[i].second};
+      for (int k = 0; k < width; ++k) {
+        auto [target, action] = transitions[i * width + k];
+        key.push_back(target >= 0 ? block[target] : target);
+        key.push_back(action);
+      }
+      next[i] = keys.get(key);
+    }
+    block = std::move(next);
+    if (keys.values.size() == blocks)
+      break;
+    blocks = keys.values.size();
+  }
+  if (blocks > static_cast<std::size_t>(INT16_MAX) ||
+      plans.values.size() > static_cast<std::size_t>(INT16_MAX - 1) ||
+      actions.values.size() > UINT16_MAX)
+    return nullptr;
+
+  // the initial state is in the first block
+  table->transitions.resize(blocks * width);
+  table->eof.resize(blocks);
+  std::vector<bool> filled(blocks, false);
+  auto convert = [&](std::pair<int, int> t) {
+    return DfaParser::Transition{
+        static_cast<std::int16_t>(t.first >= 0 ? block[t.first] : t.first),
+        static_cast<std::uint16_t>(t.second)};
+  };
+  for (std::size_t i = 0; i < n; ++i) {
+    if (filled[block[i]])
+      continue;
+    filled[block[i]] = true;
+    for (int k = 0; k < width; ++k)
+      table->transitions[block[i] * width + k] =
+          convert(transitions[i * width + k]);
+    table->eof[block[i]] = convert(ends[i]);
+  }
+  for (auto &w : actions.values) {
+    std::vector<DfaParser::Write> converted;
+    for (auto [reg, offset] : w)
+      converted.push_back({static_cast<std::uint16_t>(reg),
+                           static_cast<std::uint16_t>(offset)});
+    table->actions.push_back(std::move(converted));
+  }
+  for (auto &[end, outputs] : plans.values)
+    table->accepts.push_back({end, outputs});
+  table->registers = registers;
+  return table;
+}
+
+} // namespace
+
+ParserResult<char, std::string> DfaParser::finish(const std::int16_t target,
+                                                  const bool end) {
+  if (target == error) {
+    if (replay == nullptr)
+      replay = source->instantiate();
+    ParserResult<char, std::string> r;
+    std::size_t replayed = 0;
+    while (replayed < tokens.size() && !r.has_value())
+      r = (*replay)(tokens[replayed++]);
+    if (!r.has_value() && end)
+      r = (*replay)();
+    replay->reset();
+    // the tokens after the one the replay failed on
+    auto after = tokens.size() - replayed;
+    reset();
+    if (!r.has_value())
+      return ParsingError::get<char, std::string>(ErrorCode::Incomplete,
+                                                  source->getName());
+    if (isError(r))
+      asError(r).delay(after);
+    return r;
+  }
+  auto &accept = table->accepts[error - 1 - target];
+  std::vector<std::string> outputs;
+  if (!validating) {
+    for (auto [start, stop] : accept.outputs)
+      outputs.push_back(
+          tokens.substr(registers[start], registers[stop] - registers[start]));
+  }
+  auto remaining = tokens.substr(registers[accept.end]);
+  reset();
+  return castResult<DfaResult, char, std::string>(std::move(outputs),
+                                                   std::move(remaining));
+}
+
+bool DfaParser::restore(AbstractParser<char, std::string> &other) {
+  auto p = dynamic_cast<DfaParser *>(&other);
+  if (p == nullptr || p->table != table)
+    return false;
+  tokens = p->tokens;
+  registers = p->registers;
+  state = p->state;
+  return true;
+}
+
+ParserResult<char, std::string> DfaParser::operator()(const char &value) {
+  tokens.push_back(value);
+  auto &t = table->transitions[state * table->classCount +
+                               table->classes[static_cast<unsigned char>(
+                                   value)]];
+  if (t.action != 0)
+    apply(t.action, tokens.size() - 1);
+  if (t.target >= 0) {
+    state = t.target;
+    return {};
+  }
+  return finish(t.target, false);
+}
+
+FeedResult<char, std::string> DfaParser::feed(const char *begin,
+                                              const char *end) {
+  auto &t = *table;
+  for (const char *it = begin; it != end; ++it) {
+    tokens.push_back(*it);
+    auto &next = t.transitions[state * t.classCount +
+                               t.classes[static_cast<unsigned char>(*it)]];
+    if (next.action != 0)
+      apply(next.action, tokens.size() - 1);
+    if (next.target < 0)
+      return {static_cast<std::size_t>(it - begin + 1),
+              finish(next.target, false)};
+    state = next.target;
+  }
+  return {static_cast<std::size_t>(end - begin), {}};
+}
+
+ParserResult<char, std::string> DfaParser::operator()() {
+  auto &t = table->eof[state];
+  if (t.action != 0)
+    apply(t.action, tokens.size());
+  return finish(t.target, true);
+}
+
+std::unique_ptr<DfaParser>
+DfaParser::compile(AbstractParserPtr<char, std::string> &parser) {
+  if (dynamic_cast<Sequence<char, std::string> *>(parser.get()) == nullptr &&
+      dynamic_cast<Alternate<char, std::string> *>(parser.get()) == nullptr)
+    return nullptr;
+  Compiler compiler;
+  int root = compiler.build(*parser);
+  if (root < 0)
+    return nullptr;
+  auto table = compiler.explore(root);
+  if (table == nullptr)
+    return nullptr;
+  return std::make_unique<DfaParser>(
+      std::move(table),
+      std::shared_ptr<AbstractParser<char, std::string>>(std::move(parser)));
+}
+
+AbstractParserPtr<char, std::string>
+compileRegular(AbstractParserPtr<char, std::string> parser) {
+  if (auto dfa = DfaParser::compile(parser))
+    return dfa;
+  compileRegularChildren(*parser);
+  return parser;
+}
+
+void compileRegularChildren(AbstractParser<char, std::string> &parser) {
+  if (auto p = dynamic_cast<Sequence<char, std::string> *>(&parser)) {
+    for (auto &child : *p->getSequence())
+      child = compileRegular(std::move(child));
+  } else if (auto p = dynamic_cast<Alternate<char, std::string> *>(&parser)) {
+    for (auto &child : *p->getOptions())
+      child = compileRegular(std::move(child));
+  }
+}
+
+} // namespace Parser
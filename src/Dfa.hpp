@@ -0,0 +1,172 @@
+#pragma once
+#include "Parser.hpp"
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Parser {
+
+/**
+ * A regular sub-grammar compiled into a DFA: sequences and alternations,
+ * nested in any way, over literal predicates (such as StringPredicate), single
+ * character predicates and CharClassParsers with any quantifier.
+ *
+ * The combinators are deterministic, so the DFA states are the states of the
+ * whole sub-grammar (the position in the sequences, the counters of the
+ * predicates and the pending results of the alternations), with the
+ * characters grouped into classes that no predicate distinguishes, and the
+ * equivalent states merged. The transitions record the positions where the
+ * predicates start and stop matching in registers, and the outputs and the
+ * remaining tokens are cut from the tokens of the current match with them, so
+ * they are the same as the ones of the sub-grammar. Errors are rare and
+ * carry the names of the parsers, so the tokens are applied to the original
+ * sub-grammar to get the same error.
+ *
+ * A sub-grammar is not regular if a sequence would apply more than one
+ * remaining token of an alternation to the next parser, as these tokens are
+ * not part of the state.
+ */
+class DfaParser final : public AbstractParser<char, std::string> {
+public:
+  struct Transition {
+    // a state, error, or an accept (error - 1 - the index of the accept)
+    std::int16_t target;
+    // the index of the register writes, 0 for none
+    std::uint16_t action;
+  };
+
+  // the register is set to the position of the token plus the offset
+  struct Write {
+    std::uint16_t reg;
+    std::uint16_t offset;
+  };
+
+  struct Accept {
+    // the register of the end of the match, the tokens after it remain
+    int end;
+    // the start and end registers of the outputs
+    std::vector<std::pair<int, int>> outputs;
+  };
+
+  struct Table {
+    std::array<std::uint8_t, 256> classes{};
+    unsigned int classCount = 0;
+    // indexed by state * classCount + class
+    std::vector<Transition> transitions;
+    // the end of input for each state, which is never a state
+    std::vector<Transition> eof;
+    std::vector<std::vector<Write>> actions;
+    std::vector<Accept> accepts;
+    unsigned int registers = 0;
+
+    std::size_t states() const { return eof.size(); }
+  };
+
+  static constexpr std::int16_t error = -1;
+
+private:
+  std::shared_ptr<const Table> table;
+  // the sub-grammar, shared with the clones
+  std::shared_ptr<const AbstractParser<char, std::string>> source;
+  // an instance of the sub-grammar, to get the errors
+  AbstractParserPtr<char, std::string> replay;
+  std::string tokens;
+  std::vector<std::size_t> registers;
+  int state = 0;
+  bool validating = false;
+
+  class DfaResult final : public AbstractParserResult<char, std::string> {
+  private:
+    std::vector<std::string> outputs;
+    std::string remaining;
+    std::size_t output = 0;
+    std::size_t next = 0;
+
+  public:
+    DfaResult(std::vector<std::string> outputs, std::string remaining)
+        : outputs(std::move(outputs)), remaining(std::move(remaining)) {}
+
+    std::optional<char> getRemaining() override {
+      if (next < remaining.size())
+        return remaining[next++];
+      return {};
+    }
+
+    std::optional<std::string> get() override {
+      if (output < outputs.size())
+        return std::move(outputs[output++]);
+      return {};
+    }
+  };
+
+  void apply(const unsigned int action, const std::size_t position) {
+    for (auto &w : table->actions[action])
+      registers[w.reg] = position + w.offset;
+  }
+
+  ParserResult<char, std::string> finish(const std::int16_t target,
+                                         const bool end);
+
+public:
+  DfaParser(std::shared_ptr<const Table> table,
+            std::shared_ptr<const AbstractParser<char, std::string>> source)
+      : table(std::move(table)), source(std::move(source)),
+        registers(this->table->registers) {}
+
+  void reset() override {
+    tokens.clear();
+    state = 0;
+  }
+
+  AbstractParserPtr<char, std::string> clone() const override {
+    auto p = std::make_unique<DfaParser>(table, source);
+    p->validating = validating;
+    return p;
+  }
+
+  bool restore(AbstractParser<char, std::string> &other) override;
+
+  ParserResult<char, std::string> operator()(const char &value) override;
+
+  FeedResult<char, std::string> feed(const char *begin,
+                                     const char *end) override;
+
+  ParserResult<char, std::string> operator()() override;
+
+  const std::string &getName() const override { return source->getName(); }
+  FirstSet<char> first() const override { return source->first(); }
+  void setValidating(const bool validating) override {
+    this->validating = validating;
+  }
+  std::optional<std::vector<char>> literal() const override {
+    return source->literal();
+  }
+
+  const Table &getTable() const { return *table; }
+
+  /**
+   * Compile the parser if it is a regular sequence or alternation, otherwise
+   * returns nullptr and the parser is left as is. The parser is moved into
+   * the DfaParser on success.
+   */
+  static std::unique_ptr<DfaParser>
+  compile(AbstractParserPtr<char, std::string> &parser);
+};
+
+/**
+ * Replace the largest regular sub-grammars of the parser (through sequences
+ * and alternations) with DfaParsers. The sources of lazy parsers are not
+ * owned by them, they can be compiled with compileRegularChildren.
+ */
+AbstractParserPtr<char, std::string>
+compileRegular(AbstractParserPtr<char, std::string> parser);
+
+/**
+ * Same as compileRegular, for the sub-parsers of a sequence or alternation
+ * that is not owned by a pointer.
+ */
+void compileRegularChildren(AbstractParser<char, std::string> &parser);
+
+} // namespace Parser
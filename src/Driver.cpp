@@ -0,0 +1,133 @@
+#include "Driver.hpp"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Parser {
+
+namespace {
+// Returns whether the file is done (mapped or failed), otherwise it should be
+// read instead.
+bool readMapped(int fd, std::size_t size, const DriverOptions &options,
+                const std::function<bool(const char *, const char *)> &consume,
+                DriverStats &stats) {
+  void *p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED)
+    return false;
+  stats.mapped = true;
+  ::madvise(p, size, MADV_SEQUENTIAL);
+  // the slices of the input share the mapping, it is unmapped with the last
+  // of them
+  std::shared_ptr<const void> mapping(
+      p, [size](const void *p) { ::munmap(const_cast<void *>(p), size); });
+  auto base = static_cast<const char *>(p);
+  SliceScope scope(mapping, base, base + size);
+  // the windows are dropped with madvise, which takes whole pages
+  std::size_t page = ::sysconf(_SC_PAGESIZE);
+  std::size_t window = std::max(options.window, page) / page * page;
+  for (std::size_t offset = 0; offset < size; offset += window) {
+    std::size_t length = std::min(window, size - offset);
+    stats.bytes += length;
+    bool more = consume(base + offset, base + offset + length);
+    // the pages are read from the file again if a slice views them
+    ::madvise(const_cast<char *>(base) + offset, length, MADV_DONTNEED);
+    if (!more)
+      break;
+  }
+  return true;
+}
+} // namespace
+
+void readInput(int fd, const DriverOptions &options,
+               const std::function<bool(const char *, const char *)> &consume,
+               DriverStats &stats) {
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    stats.error = errno;
+    return;
+  }
+  if (options.mmap && S_ISREG(st.st_mode) && st.st_size > 0 &&
+      readMapped(fd, st.st_size, options, consume, stats))
+    return;
+  std::size_t size = std::max<std::size_t>(options.chunkSize, 1);
+  std::shared_ptr<char[]> buffer;
+  while (true) {
+    // the slices of a chunk share its buffer, which is only reused if none
+    // of them is left
+    if (buffer == nullptr || buffer.use_count() > 1)
+      buffer = std::shared_ptr<char[]>(new char[size]);
+    auto n = ::read(fd, buffer.get(), size);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      stats.error = errno;
+      return;
+    }
+    if (n == 0)
+      return;
+    stats.bytes += n;
+    SliceScope scope(buffer, buffer.get(), buffer.get() + n);
+    if (!consume(buffer.get(), buffer.get() + n))
+      return;
+  }
+}
+
+std::size_t peakRss() {
+  struct rusage usage;
+  if (::getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  // in kilobytes on Linux
+  return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+}
+
+int openInput(const std::string &path) {
+  if (path == "-")
+    return STDIN_FILENO;
+  return ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+void closeInput(int fd) {
+  if (fd != STDIN_FILENO)
+    ::close(fd);
+}
+
+MappedFile::MappedFile(int fd) {
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    return;
+  void *p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED)
+    return;
+  ::madvise(p, st.st_size, MADV_SEQUENTIAL);
+  data = static_cast<const char *>(p);
+  size = st.st_size;
+}
+
+MappedFile::~MappedFile() {
+  if (data != nullptr)
+    ::munmap(const_cast<char *>(data), size);
+}
+
+void MappedFile::release(const char *begin, const char *end) {
+  std::size_t page = ::sysconf(_SC_PAGESIZE);
+  std::size_t from = (begin - data + page - 1) / page * page;
+  std::size_t to = (end - data) / page * page;
+  if (from < to)
+    ::madvise(const_cast<char *>(data) + from, to - from, MADV_DONTNEED);
+}
+
+bool lineStart(const char *begin, const char *p) {
+  if (p == begin)
+    return true;
+  if (p[-1] != '\n')
+    return false;
+  const char *q = p - 1;
+  if (q != begin && q[-1] == '\r')
+    --q;
+  return q == begin || q[-1] != '\\';
+}
+
+} // namespace Parser
@@ -0,0 +1,266 @@
+#pragma once
+#include "Parser.hpp"
+#include "Slice.hpp"
+#include <cerrno>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace Parser {
+
+struct DriverOptions {
+  // map regular files instead of reading them
+  bool mmap = true;
+  // the size of the reads, for pipes and stdin
+  std::size_t chunkSize = 1 << 20;
+  // the mapped file is fed in windows of this size, the pages of the windows
+  // that are done are dropped so that the RSS does not grow with the file
+  std::size_t window = 16 << 20;
+};
+
+struct DriverStats {
+  std::size_t bytes = 0;
+  std::size_t results = 0;
+  double seconds = 0;
+  // of the process, in bytes
+  std::size_t peakRss = 0;
+  bool mapped = false;
+  // errno of the failed system call, or 0
+  int error = 0;
+
+  // bytes per second
+  double throughput() const { return seconds > 0 ? bytes / seconds : 0; }
+};
+
+/**
+ * Read the file and call consume with spans of it, until it returns false.
+ * Regular files are mapped, other files are read in chunks. The spans are
+ * consumed in a SliceScope, so the slices of the input keep the mapping or the
+ * chunk alive.
+ */
+void readInput(int fd, const DriverOptions &options,
+               const std::function<bool(const char *, const char *)> &consume,
+               DriverStats &stats);
+
+std::size_t peakRss();
+
+/**
+ * Open the file for reading, or returns stdin if the path is "-". Returns -1
+ * on failure.
+ */
+int openInput(const std::string &path);
+void closeInput(int fd);
+
+/**
+ * A regular file mapped as a whole, for the drivers that need the input at
+ * once. The pages that are done can be dropped with release, so that the RSS
+ * does not grow with the file. It is empty if the file cannot be mapped.
+ */
+class MappedFile {
+private:
+  const char *data = nullptr;
+  std::size_t size = 0;
+
+public:
+  MappedFile(int fd);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool isMapped() const { return data != nullptr; }
+  const char *begin() const { return data; }
+  const char *end() const { return data + size; }
+
+  /**
+   * Drop the whole pages of [begin, end), they are read from the file again
+   * if they are used.
+   */
+  void release(const char *begin, const char *end);
+};
+
+/**
+ * Whether p starts a line: it follows a newline that is not escaped with a
+ * backslash, as in the C preprocessor. A sync point for parseChunked.
+ */
+bool lineStart(const char *begin, const char *p);
+
+/**
+ * Applies the parser to the input over and over, see parseFd.
+ */
+template <typename T, typename F> class FeedLoop {
+private:
+  AbstractParser<char, T> &parser;
+  F &onResult;
+  DriverStats &stats;
+  // the remaining tokens of the last result
+  std::vector<char> pending;
+  // the tokens applied since the last result
+  std::size_t applied = 0;
+  // the offset of the end of the input given to consume
+  std::uint64_t offset;
+  bool stopped = false;
+
+  // Returns whether we should continue.
+  bool handle(ParserResult<char, T> &r) {
+    ++stats.results;
+    // the pending tokens are the ones before the end of the input that were
+    // not applied
+    if (isError(r))
+      asError(r).locate(offset - pending.size());
+    std::vector<char> remaining;
+    if (!isError(r)) {
+      auto &result = asResult(r);
+      for (auto t = result->getRemaining(); t.has_value();
+           t = result->getRemaining())
+        remaining.push_back(t.value());
+    }
+    bool progress = remaining.size() < applied;
+    // the remaining tokens go before the pending ones
+    remaining.insert(remaining.end(), pending.begin(), pending.end());
+    pending = std::move(remaining);
+    applied = 0;
+    stopped = !onResult(r) || !progress;
+    return !stopped;
+  }
+
+public:
+  /**
+   * The offset is the one of the first token of the input, which the errors
+   * are located from.
+   */
+  FeedLoop(AbstractParser<char, T> &parser, F &onResult, DriverStats &stats,
+           const std::uint64_t offset = 0)
+      : parser(parser), onResult(onResult), stats(stats), offset(offset) {}
+
+  /**
+   * Whether the parser is between two results, with no tokens pending: the
+   * next tokens start a new result.
+   */
+  bool idle() const { return applied == 0 && pending.empty(); }
+
+  bool isStopped() const { return stopped; }
+
+  /**
+   * Apply a span of the input. Returns false if the parsing is stopped.
+   */
+  bool consume(const char *begin, const char *end) {
+    while (begin != end || !pending.empty()) {
+      if (!pending.empty()) {
+        auto tokens = std::move(pending);
+        pending.clear();
+        auto [n, r] = parser.feed(tokens.data(), tokens.data() + tokens.size());
+        applied += n;
+        // keep the tokens that were not applied
+        pending.assign(tokens.begin() + n, tokens.end());
+        if (r.has_value() && !handle(r))
+          return false;
+        continue;
+      }
+      auto [n, r] = parser.feed(begin, end);
+      begin += n;
+      applied += n;
+      offset += n;
+      if (r.has_value() && !handle(r))
+        return false;
+    }
+    return true;
+  }
+
+  /**
+   * The end of input: apply the remaining tokens of the last result, and
+   * terminate the parser. A parser that returns nothing at the end of input
+   * is reported as incomplete.
+   */
+  void finish() {
+    while (!stopped && stats.error == 0 && consume(nullptr, nullptr) &&
+           applied > 0) {
+      auto r = parser();
+      if (!r.has_value()) {
+        parser.reset();
+        r = ParsingError::get<char, T>(ErrorCode::Incomplete,
+                                       parser.getName());
+      }
+      handle(r);
+    }
+  }
+};
+
+/**
+ * Apply the parser to the whole input, over and over: every time the parser
+ * returns (a result or an error), onResult is called with it (as a
+ * ParserResult<char, T> &, the remaining tokens are already taken, and the
+ * errors are located in the input, see ParsingError::getPosition), and the
+ * parser continues with the remaining tokens of the result and the rest of the
+ * input. The parsing stops when onResult returns false, or when the parser
+ * returns a result without consuming anything (which would never end). At the
+ * end of input, the parser is terminated if it has been applied to anything
+ * since the last result.
+ *
+ * The input is applied with feed, so the parsers go through the bulk path.
+ */
+template <typename T, typename F>
+DriverStats parseFd(int fd, AbstractParser<char, T> &parser, F &&onResult,
+                    const DriverOptions &options = DriverOptions()) {
+  DriverStats stats;
+  auto start = std::chrono::steady_clock::now();
+  FeedLoop<T, F> loop(parser, onResult, stats);
+  readInput(
+      fd, options,
+      [&](const char *begin, const char *end) {
+        return loop.consume(begin, end);
+      },
+      stats);
+  loop.finish();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  stats.seconds = elapsed.count();
+  stats.peakRss = peakRss();
+  return stats;
+}
+
+/**
+ * Same as parseFd, for an input in memory. If the owner of the input is
+ * given, it is fed in a SliceScope, so that the slices of the input are views
+ * that keep it alive. Otherwise they are copies.
+ */
+template <typename T, typename F>
+DriverStats parseBuffer(const char *begin, const char *end,
+                        AbstractParser<char, T> &parser, F &&onResult,
+                        std::shared_ptr<const void> owner = nullptr) {
+  DriverStats stats;
+  auto start = std::chrono::steady_clock::now();
+  std::optional<SliceScope> scope;
+  if (owner != nullptr)
+    scope.emplace(std::move(owner), begin, end);
+  FeedLoop<T, F> loop(parser, onResult, stats);
+  stats.bytes = end - begin;
+  loop.consume(begin, end);
+  loop.finish();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  stats.seconds = elapsed.count();
+  stats.peakRss = peakRss();
+  return stats;
+}
+
+/**
+ * Same as parseFd, for the file at the path, or stdin if the path is "-".
+ */
+template <typename T, typename F>
+DriverStats parseFile(const std::string &path, AbstractParser<char, T> &parser,
+                      F &&onResult,
+                      const DriverOptions &options = DriverOptions()) {
+  int fd = openInput(path);
+  if (fd < 0) {
+    DriverStats stats;
+    stats.error = errno;
+    return stats;
+  }
+  auto stats = parseFd(fd, parser, onResult, options);
+  closeInput(fd);
+  return stats;
+}
+
+} // namespace Parser
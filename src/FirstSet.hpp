@@ -0,0 +1,150 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cstdint>
+#include <vector>
+
+namespace Parser {
+
+/**
+ * The version of the grammars, increased when a combinator gives out its
+ * sub-parsers for modification (such as Sequence::getSequence). The FIRST sets
+ * cached by the alternations may depend on any parser below them, through
+ * lazy parsers as well, so they are computed again when it changed.
+ */
+inline std::atomic<std::uint64_t> grammarVersion{0};
+
+inline void grammarChanged() {
+  grammarVersion.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * A set of tokens. This is a bitset for characters and a list otherwise, as we
+ * only require the tokens to be comparable for equality.
+ */
+template <typename S> class TokenSet {
+private:
+  std::vector<S> tokens;
+
+public:
+  void insert(const S &value) {
+    if (!contains(value))
+      tokens.push_back(value);
+  }
+  bool contains(const S &value) const {
+    return std::find(tokens.begin(), tokens.end(), value) != tokens.end();
+  }
+  void merge(const TokenSet &other) {
+    for (const auto &t : other.tokens)
+      insert(t);
+  }
+  bool intersects(const TokenSet &other) const {
+    for (const auto &t : other.tokens) {
+      if (contains(t))
+        return true;
+    }
+    return false;
+  }
+};
+
+template <> class TokenSet<char> {
+private:
+  std::bitset<256> bits;
+
+public:
+  void insert(const char &value) {
+    bits.set(static_cast<unsigned char>(value));
+  }
+  bool contains(const char &value) const {
+    return bits.test(static_cast<unsigned char>(value));
+  }
+  void merge(const TokenSet &other) { bits |= other.bits; }
+  bool intersects(const TokenSet &other) const {
+    return (bits & other.bits).any();
+  }
+  const std::bitset<256> &getBits() const { return bits; }
+};
+
+/**
+ * The tokens that a parser may accept as its first token (the FIRST set in
+ * parsing theory). It is used to skip the parsers that would fail immediately.
+ * The set is conservative: it is unknown if the parser cannot tell (for
+ * example, with a custom predicate), and it is nullable if the parser may
+ * succeed without consuming the first token. Any token may be accepted by an
+ * unknown or nullable set.
+ */
+template <typename S> class FirstSet {
+private:
+  TokenSet<S> tokens;
+  bool unknown = false;
+  bool nullable = false;
+
+public:
+  static FirstSet any() {
+    FirstSet set;
+    set.unknown = true;
+    return set;
+  }
+
+  static FirstSet of(const S &value, const bool nullable = false) {
+    FirstSet set;
+    set.tokens.insert(value);
+    set.nullable = nullable;
+    return set;
+  }
+
+  bool isUnknown() const { return unknown; }
+  bool isNullable() const { return nullable; }
+  const TokenSet<S> &getTokens() const { return tokens; }
+
+  bool mayStart(const S &value) const {
+    return unknown || nullable || tokens.contains(value);
+  }
+
+  void insert(const S &value) { tokens.insert(value); }
+  void setNullable(const bool value) { nullable = value; }
+
+  /**
+   * Union, for alternations.
+   */
+  void merge(const FirstSet &other) {
+    tokens.merge(other.tokens);
+    unknown = unknown || other.unknown;
+    nullable = nullable || other.nullable;
+  }
+
+  /**
+   * Whether no token may be accepted as the first token by both parsers, which
+   * is only known if the sets are known and not nullable.
+   */
+  bool disjoint(const FirstSet &other) const {
+    return !unknown && !other.unknown && !nullable && !other.nullable &&
+           !tokens.intersects(other.tokens);
+  }
+
+  /**
+   * Append the FIRST set of the next parser in a concatenation, starting from
+   * epsilon(). Returns whether the parsers after it may still see the first
+   * token, i.e. whether we should continue.
+   */
+  bool append(const FirstSet &next) {
+    if (unknown || !nullable)
+      return false;
+    tokens.merge(next.tokens);
+    unknown = next.unknown;
+    nullable = next.nullable;
+    return nullable && !unknown;
+  }
+
+  /**
+   * The set of the empty concatenation, which accepts nothing but is nullable.
+   */
+  static FirstSet epsilon() {
+    FirstSet set;
+    set.nullable = true;
+    return set;
+  }
+};
+
+} // namespace Parser
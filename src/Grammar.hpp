@@ -0,0 +1,316 @@
+#pragma once
+#include "Alternate.hpp"
+#include "Driver.hpp"
+#include "Lazy.hpp"
+#include "Parser.hpp"
+#include "Pool.hpp"
+#include "Sequence.hpp"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace Parser {
+
+/**
+ * A grammar that is shared by parse sessions, possibly in several threads.
+ * The parsers of the grammar are the configuration: they are const once the
+ * grammar is made, and are never applied. The sessions use instances of them
+ * (see AbstractParser::instantiate), which borrow their sub-parsers,
+ * predicates and tables, so a session only allocates the state of the
+ * parsing.
+ *
+ * The rules are the sources of the lazy parsers, which are owned by the
+ * grammar so that they live as long as it. The FIRST sets of the alternations
+ * (and the literal sets that replace them) are computed when the grammar is
+ * made, so that the instances share them instead of computing their own.
+ *
+ * The parsers with state that is shared by their clones must not be in a
+ * grammar used by several threads: lazy parsers with a memo table and
+ * parsers instrumented with a Profiler. RegexParsers use a cache per thread.
+ */
+template <typename S, typename T> class Grammar {
+private:
+  std::unique_ptr<const AbstractParser<S, T>> root;
+  std::vector<std::unique_ptr<const AbstractParser<S, T>>> rules;
+
+  // Prepare the alternations, after their options. The options are read
+  // through the const accessors, which leave the prepared FIRST sets valid.
+  static void prepare(AbstractParser<S, T> &parser,
+                      std::unordered_set<const void *> &visited) {
+    if (auto p = dynamic_cast<Sequence<S, T> *>(&parser)) {
+      for (auto &child : *std::as_const(*p).getSequence())
+        prepare(*child, visited);
+    } else if (auto p = dynamic_cast<Alternate<S, T> *>(&parser)) {
+      for (auto &child : *std::as_const(*p).getOptions())
+        prepare(*child, visited);
+      p->prepare();
+    } else if (auto p = dynamic_cast<LazyParser<S, T> *>(&parser)) {
+      if (visited.insert(p->getSource()).second)
+        prepare(*p->getSource(), visited);
+    }
+  }
+
+public:
+  Grammar(AbstractParserPtr<S, T> root,
+          std::vector<AbstractParserPtr<S, T>> rules = {}) {
+    std::unordered_set<const void *> visited;
+    for (auto &rule : rules) {
+      if (visited.insert(rule.get()).second)
+        prepare(*rule, visited);
+    }
+    prepare(*root, visited);
+    this->root = std::move(root);
+    for (auto &rule : rules)
+      this->rules.push_back(std::move(rule));
+  }
+
+  Grammar(const Grammar &) = delete;
+  Grammar &operator=(const Grammar &) = delete;
+
+  /**
+   * A new instance of the root parser, from any thread. It must not outlive
+   * the grammar.
+   */
+  AbstractParserPtr<S, T> instantiate() const { return root->instantiate(); }
+
+  const std::string &getName() const { return root->getName(); }
+
+  static std::shared_ptr<const Grammar>
+  make(AbstractParserPtr<S, T> root,
+       std::vector<AbstractParserPtr<S, T>> rules = {}) {
+    return std::make_shared<const Grammar>(std::move(root), std::move(rules));
+  }
+};
+
+/**
+ * The mutable state of the parsing of a grammar: an instance of its root
+ * parser, which is reset and reused for every document. A session must only
+ * be used by one thread at a time, and should be made by that thread (see
+ * RegexParser). A validating session only recognizes the documents, its
+ * results have no outputs (see AbstractParser::setValidating).
+ */
+template <typename S, typename T> class ParseSession {
+private:
+  std::shared_ptr<const Grammar<S, T>> grammar;
+  AbstractParserPtr<S, T> parser;
+
+public:
+  ParseSession(std::shared_ptr<const Grammar<S, T>> grammar,
+               const bool validating = false)
+      : grammar(std::move(grammar)), parser(this->grammar->instantiate()) {
+    parser->setValidating(validating);
+  }
+
+  AbstractParser<S, T> &getParser() { return *parser; }
+  const Grammar<S, T> &getGrammar() const { return *grammar; }
+
+  void reset() { parser->reset(); }
+};
+
+/**
+ * Parse every document with parseBuffer, in the threads of the pool with a
+ * session per thread. onResult is called with the index of the document and
+ * the result (see parseBuffer), from all the threads at the same time.
+ * Returns the stats of every document.
+ */
+template <typename T, typename F>
+std::vector<DriverStats>
+parseBatch(const std::shared_ptr<const Grammar<char, T>> &grammar,
+           const std::vector<std::string> &documents, ThreadPool &pool,
+           F &&onResult) {
+  std::vector<std::optional<ParseSession<char, T>>> sessions(pool.size());
+  std::vector<DriverStats> stats(documents.size());
+  pool.run(documents.size(), [&](std::size_t i, unsigned int worker) {
+    auto &session = sessions[worker];
+    // made by the worker, so its caches are the ones of the thread
+    if (!session.has_value())
+      session.emplace(grammar);
+    session->reset();
+    auto &document = documents[i];
+    stats[i] = parseBuffer(
+        document.data(), document.data() + document.size(),
+        session->getParser(),
+        [&](ParserResult<char, T> &r) { return onResult(i, r); });
+  });
+  return stats;
+}
+
+struct ChunkOptions {
+  // the chunks are about this size, they end at the next sync point
+  std::size_t chunkSize = 4 << 20;
+  // the number of chunks of a round per thread, their results are kept until
+  // the round is done
+  unsigned int chunksPerThread = 4;
+};
+
+struct ChunkedStats : DriverStats {
+  std::size_t chunks = 0;
+  // the chunks parsed again, as the parsing did not stop at their start
+  std::size_t fallbacks = 0;
+};
+
+/**
+ * Parse a large input in parallel: the input is split into chunks that start
+ * at sync points, where resync(begin, p) is true (lineStart for example), and
+ * the chunks are parsed in the threads of the pool with a session per thread.
+ * onResult is called by the calling thread, with the results in the order of
+ * the input, as parseBuffer would.
+ *
+ * The results of a chunk are only used if the parsing of the chunk before it
+ * stopped between two results at its end, otherwise the sync point was not the
+ * start of a result, and the chunk is parsed again after the previous one
+ * until the parsing stops at the end of a chunk. So the results are the same
+ * as the ones of parseBuffer, whatever the sync points are.
+ *
+ * The chunks are parsed in rounds, and released is called with the part of
+ * the input that is done after every round. If the owner of the input is
+ * given, the slices of the input are views that keep it alive, as in
+ * parseBuffer.
+ */
+template <typename T, typename R, typename F>
+ChunkedStats parseChunked(
+    const std::shared_ptr<const Grammar<char, T>> &grammar, const char *begin,
+    const char *end, ThreadPool &pool, R &&resync, F &&onResult,
+    const ChunkOptions &options = ChunkOptions(),
+    const std::function<void(const char *, const char *)> &released = {},
+    const std::shared_ptr<const void> &owner = nullptr) {
+  using Result = ParserResult<char, T>;
+  struct Chunk {
+    std::vector<Result> results;
+    DriverStats stats;
+    bool idle = false;
+    bool stopped = false;
+  };
+  ChunkedStats stats;
+  auto start = std::chrono::steady_clock::now();
+  std::vector<const char *> bounds = {begin};
+  for (const char *p = begin; p != end;) {
+    p = end - p > static_cast<std::ptrdiff_t>(options.chunkSize)
+            ? p + std::max<std::size_t>(options.chunkSize, 1)
+            : end;
+    while (p != end && !resync(begin, p))
+      ++p;
+    bounds.push_back(p);
+  }
+  std::size_t count = bounds.size() - 1;
+  stats.chunks = count;
+  std::vector<std::optional<ParseSession<char, T>>> sessions(pool.size());
+  std::size_t round = std::max<std::size_t>(
+      pool.size() * std::max(options.chunksPerThread, 1u), 1);
+  std::vector<Chunk> chunks(round);
+  bool stopped = false;
+  for (std::size_t first = 0; first < count && !stopped;) {
+    std::size_t n = std::min(round, count - first);
+    pool.run(n, [&](std::size_t i, unsigned int worker) {
+      // the scopes are per thread
+      std::optional<SliceScope> scope;
+      if (owner != nullptr)
+        scope.emplace(owner, begin, end);
+      auto &session = sessions[worker];
+      if (!session.has_value())
+        session.emplace(grammar);
+      session->reset();
+      auto &chunk = chunks[i];
+      chunk = Chunk();
+      auto collect = [&](Result &r) {
+        chunk.results.push_back(std::move(r));
+        return true;
+      };
+      FeedLoop<T, decltype(collect)> loop(session->getParser(), collect,
+                                          chunk.stats,
+                                          bounds[first + i] - begin);
+      loop.consume(bounds[first + i], bounds[first + i + 1]);
+      if (first + i + 1 == count)
+        loop.finish();
+      chunk.idle = loop.idle();
+      chunk.stopped = loop.isStopped();
+    });
+    // the worker 0 is the calling thread, its session parses the fallbacks
+    if (!sessions[0].has_value())
+      sessions[0].emplace(grammar);
+    std::size_t next = first;
+    for (std::size_t i = first; i < first + n && !stopped; ++i) {
+      if (i < next)
+        continue;
+      auto &chunk = chunks[i - first];
+      if (chunk.idle || i + 1 == count) {
+        for (auto &r : chunk.results) {
+          ++stats.results;
+          if (!onResult(r)) {
+            stopped = true;
+            break;
+          }
+        }
+        stopped |= chunk.stopped;
+        next = i + 1;
+        continue;
+      }
+      // the parsing of the chunk does not stop at its end, parse the chunks
+      // after it together until it does
+      ++stats.fallbacks;
+      std::optional<SliceScope> scope;
+      if (owner != nullptr)
+        scope.emplace(owner, begin, end);
+      auto &parser = sessions[0]->getParser();
+      parser.reset();
+      FeedLoop<T, F> loop(parser, onResult, stats, bounds[i] - begin);
+      next = i;
+      do {
+        loop.consume(bounds[next], bounds[next + 1]);
+        ++next;
+      } while (!loop.isStopped() && !loop.idle() && next < count);
+      if (next == count)
+        loop.finish();
+      stopped = loop.isStopped();
+    }
+    first = next;
+    if (released)
+      released(begin, bounds[first]);
+  }
+  stats.bytes = end - begin;
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  stats.seconds = elapsed.count();
+  stats.peakRss = peakRss();
+  return stats;
+}
+
+/**
+ * Same as parseChunked for a file, which is mapped. The pages of the file are
+ * dropped after every round, and the mapping is kept by the slices of the
+ * input. Other files (pipes and stdin) are parsed sequentially with parseFd.
+ */
+template <typename T, typename R, typename F>
+ChunkedStats
+parseFileChunked(const std::string &path,
+                 const std::shared_ptr<const Grammar<char, T>> &grammar,
+                 ThreadPool &pool, R &&resync, F &&onResult,
+                 const ChunkOptions &options = ChunkOptions()) {
+  ChunkedStats stats;
+  int fd = openInput(path);
+  if (fd < 0) {
+    stats.error = errno;
+    return stats;
+  }
+  auto file = std::make_shared<MappedFile>(fd);
+  if (file->isMapped()) {
+    stats = parseChunked(
+        grammar, file->begin(), file->end(), pool, resync, onResult, options,
+        [&](const char *b, const char *e) { file->release(b, e); }, file);
+    stats.mapped = true;
+  } else {
+    ParseSession<char, T> session(grammar);
+    static_cast<DriverStats &>(stats) =
+        parseFd(fd, session.getParser(), onResult);
+  }
+  closeInput(fd);
+  return stats;
+}
+
+} // namespace Parser
@@ -1,7 +1,6 @@
 #pragma once
+#include "Arena.hpp"
 #include "Parser.hpp"
-#include <queue>
-#include <stack>
 
 namespace Parser {
 /**
@@ -10,49 +9,107 @@ namespace Parser {
  * * Each parser may expand its input (or for lookahead). (`getRemaining`)
  *   Consider a sequence of parsers P1 P2 and P3 applied sequentially,
  *   part of the tokens not consumed from P1 may match P2 and P2 may further
- *   expand the tokens. So we need a stack for holding the tokens.
+ *   expand the tokens. So we need a stack for holding the tokens (see
+ *   PendingTokens).
  * * The result of each parser is finite. (`get`)
  *   We simplify the situation by consuming all tokens from the previous
- *   results. Actually this should be a queue.
- * Actually this class can be modified so that we don't have to have
- * the second assumption, by storing the shared_ptr of the results. However I
- * have no time to implement that.
+ *   results.
+ * The tokens left by the previous results are taken when the last parser
+ * completes, so that the combinator keeps its storage for the next input.
  */
 template <typename S, typename T>
 class AggregatedParserResult final : public AbstractParserResult<S, T> {
 private:
-  std::unique_ptr<std::stack<AbstractParserResultPtr<S, T>>> prevResults;
+  Vector<T> prev;
   AbstractParserResultPtr<S, T> result;
-  std::queue<T> prev;
+  // the tokens after the remaining tokens of result
+  Vector<S> remaining;
+  std::size_t output = 0;
+  std::size_t next = 0;
 
 public:
-  AggregatedParserResult(decltype(prevResults) prevResults,
-                         decltype(result) result, decltype(prev) prev)
-      : prevResults(std::move(prevResults)), result(std::move(result)),
-        prev(prev) {}
+  AggregatedParserResult(decltype(prev) prev, decltype(result) result,
+                         decltype(remaining) remaining = {})
+      : prev(std::move(prev)), result(std::move(result)),
+        remaining(std::move(remaining)) {}
   AggregatedParserResult(const AggregatedParserResult &) = delete;
 
   std::optional<S> getRemaining() override {
     if (auto v = result->getRemaining(); v.has_value())
       return v;
-    while (!prevResults->empty()) {
-      if (auto v = prevResults->top()->getRemaining(); v.has_value())
-        return v;
-      prevResults->pop();
-    }
+    if (next < remaining.size())
+      return std::move(remaining[next++]);
     return {};
   }
 
   std::optional<T> get() override {
-    if (!prev.empty()) {
-      T top = prev.front();
-      prev.pop();
-      return std::make_optional(top);
-    }
+    if (output < prev.size())
+      return std::move(prev[output++]);
     return result->get();
   }
 };
 
+/**
+ * The tokens to apply to the current parser of a combinator: the remaining
+ * tokens of the results of the previous parsers, the last one first, and the
+ * input tokens after them. clear keeps the storage, so that resetting the
+ * combinator does not allocate.
+ */
+template <typename S, typename T> class PendingTokens {
+private:
+  Stack<AbstractParserResultPtr<S, T>> results;
+  Queue<S> input;
+
+public:
+  void push(S value) { input.push(std::move(value)); }
+  void push(AbstractParserResultPtr<S, T> result) {
+    results.push(std::move(result));
+  }
+
+  std::optional<S> next() {
+    while (!results.empty()) {
+      if (auto t = results.top()->getRemaining(); t.has_value())
+        return t;
+      results.pop();
+    }
+    if (input.empty())
+      return {};
+    S value = std::move(input.front());
+    input.pop();
+    return value;
+  }
+
+  /**
+   * Take all the tokens left, for the result of the combinator.
+   */
+  Vector<S> take() {
+    Vector<S> tokens;
+    for (auto t = next(); t.has_value(); t = next())
+      tokens.push_back(std::move(t.value()));
+    return tokens;
+  }
+
+  /**
+   * Drop the tokens left, and return their number: the tokens after the one
+   * the current parser failed on, for the lag of its error.
+   */
+  std::size_t skip() {
+    std::size_t count = 0;
+    while (next().has_value())
+      ++count;
+    return count;
+  }
+
+  void clear() {
+    // std::stack and std::queue have no clear, and assigning empty ones would
+    // allocate new storage
+    while (!results.empty())
+      results.pop();
+    while (!input.empty())
+      input.pop();
+  }
+};
+
 /**
  * This class is a dummy result for storing the input. The input may not be
  * consumed if there are other remaining tokens in the stack of parser results.
@@ -60,13 +117,13 @@ public:
 template <typename S, typename T>
 class QueueParserResult final : public AbstractParserResult<S, T> {
 private:
-  std::queue<S> inputs;
+  Queue<S> inputs;
 
 public:
-  void push(const S &value) { inputs.push(value); }
+  void push(S value) { inputs.push(std::move(value)); }
   std::optional<S> getRemaining() override {
     if (!inputs.empty()) {
-      S value = inputs.front();
+      S value = std::move(inputs.front());
       inputs.pop();
       return std::make_optional(value);
     }
@@ -75,4 +132,91 @@ public:
   std::optional<T> get() override { return {}; }
 };
 
+/**
+ * This class is to store the parser result of a single parser in an
+ * alternation. As the parsing of other parsers may continue after one success
+ * (their length may be different), we have to store the additional tokens in
+ * a queue in this object.
+ */
+template <typename S, typename T>
+class StateResult final : public AbstractParserResult<S, T> {
+private:
+  Queue<S> waitlist;
+  AbstractParserResultPtr<S, T> result;
+
+public:
+  StateResult(decltype(result) result) : result(std::move(result)) {}
+
+  StateResult(const StateResult &) = delete;
+
+  void push(S value) { waitlist.push(std::move(value)); }
+
+  std::optional<S> getRemaining() override {
+    if (auto s = result->getRemaining(); s.has_value())
+      return s;
+    if (!waitlist.empty()) {
+      S s = std::move(waitlist.front());
+      waitlist.pop();
+      return s;
+    }
+    return {};
+  }
+
+  std::optional<T> get() override { return result->get(); }
+};
+
+/**
+ * The outputs and the remaining tokens of a result, recorded so that the
+ * result can be replayed many times. The outputs are copied for every replay,
+ * so T must be copyable.
+ */
+template <typename S, typename T> struct Recording {
+  std::vector<T> outputs;
+  std::vector<S> remaining;
+
+  void record(AbstractParserResult<S, T> &result) {
+    for (auto t = result.get(); t.has_value(); t = result.get())
+      outputs.push_back(std::move(t.value()));
+    for (auto t = result.getRemaining(); t.has_value();
+         t = result.getRemaining())
+      remaining.push_back(std::move(t.value()));
+  }
+};
+
+template <typename S, typename T>
+class ReplayedResult final : public AbstractParserResult<S, T> {
+private:
+  std::shared_ptr<const Recording<S, T>> recording;
+  std::size_t output = 0;
+  std::size_t remaining = 0;
+
+public:
+  ReplayedResult(decltype(recording) recording)
+      : recording(std::move(recording)) {}
+
+  std::optional<S> getRemaining() override {
+    if (remaining < recording->remaining.size())
+      return recording->remaining[remaining++];
+    return {};
+  }
+
+  std::optional<T> get() override {
+    if (output < recording->outputs.size())
+      return recording->outputs[output++];
+    return {};
+  }
+};
+
+/**
+ * Replace the result with a replay of it, and return another replay, so that
+ * a pending result can be shared by a parser and its snapshot.
+ */
+template <typename S, typename T>
+AbstractParserResultPtr<S, T> share(AbstractParserResultPtr<S, T> &result) {
+  auto recording = std::make_shared<Recording<S, T>>();
+  recording->record(*result);
+  result = std::make_unique<ReplayedResult<S, T>>(recording);
+  return std::make_unique<ReplayedResult<S, T>>(std::move(recording));
+}
+
 } // namespace Parser
\ No newline at end of file
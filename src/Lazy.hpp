@@ -1,46 +1,278 @@
 #pragma once
+#include "Memo.hpp"
 #include "Parser.hpp"
 #include <functional>
+#include <unordered_set>
 
 namespace Parser {
 
 /**
  * Just a simple wrapper class to handle recursive parser using lazy
  * instantiation of sub-parsers. It also provides a mapping function
- * to alter the parser result conveniently.
- * The sub-parser is only instantiated when the parser is applied.
+ * to alter the parser result conveniently. The mapping function is not
+ * applied in the validating mode, as the results have no outputs then.
+ * The sub-parser is only instantiated when the parser is applied, and the
+ * instance is kept when the parser is reset, so that it is reused for the
+ * next input instead of instantiating the sub-tree again, until a parser is
+ * modified (see grammarVersion). The instance is
+ * an instance of the source (see AbstractParser::instantiate), which is
+ * only used as a const parser, so a source can be shared by the parsers of
+ * several threads.
+ *
+ * With a memo table, the outcomes of the sub-parser are memoized (see
+ * MemoTable). The tokens are matched against the table first, and the
+ * sub-parser is only instantiated when the tokens have not been seen before.
+ * The outcomes depend on the validating mode, so a memo table must not be
+ * shared by parsers in different modes. The outputs are copied when they are
+ * replayed, so a memo table cannot be given if T cannot be copied.
  */
 template <typename S, typename T>
 class LazyParser : public AbstractParser<S, T> {
 private:
-  AbstractParser<S, T> *src;
+  using Mapping = std::function<ParserResult<S, T>(ParserResult<S, T>)>;
+
+  const AbstractParser<S, T> *src;
+  // the source, for the passes that rewrite it in place before it is used,
+  // the instances only have the const one
+  AbstractParser<S, T> *rule;
   std::unique_ptr<AbstractParser<S, T>> instance;
-  std::function<ParserResult<S, T>(ParserResult<S, T>)> mapping;
+  // the grammar version that the instance was made at
+  std::uint64_t version = 0;
+  // shared by the copies
+  std::shared_ptr<const Mapping> mapping;
+  MemoTable<S, T> *memo;
+  // the key of the source in the memo table
+  std::shared_ptr<typename MemoTable<S, T>::Key> key;
+  std::shared_ptr<typename MemoTable<S, T>::Trie> trie;
+  unsigned int node = 0;
+  // the tokens matched against the table, while replaying
+  std::vector<S> pending;
+  bool replaying = false;
+  // whether the instance has a state, it resets itself when it completes so
+  // resetting the parser is cheap for the instances of a recursion
+  bool dirty = false;
+  bool validating = false;
+  OutputSink<T> *sink = nullptr;
+
+  // the outcomes in the table are replayed by copying their outputs
+  static constexpr bool memoizable = std::is_copy_constructible_v<T>;
+
+  static std::shared_ptr<const Mapping> share(Mapping mapping) {
+    if (mapping == nullptr)
+      return nullptr;
+    return std::make_shared<const Mapping>(std::move(mapping));
+  }
+
+  bool useMemo() const { return memo != nullptr; }
+
+  bool useMapping() const { return mapping != nullptr && !validating; }
+
+  // The mapping function and the memo table work on the outputs of the
+  // results, so the instance is only in the sink mode without them.
+  OutputSink<T> *instanceSink() const {
+    return !useMapping() && !useMemo() ? sink : nullptr;
+  }
+
+  void load() {
+    // the source may have been modified since, the instance is only replaced
+    // between inputs
+    auto current = grammarVersion.load(std::memory_order_relaxed);
+    if (instance != nullptr && !dirty && version != current)
+      instance = nullptr;
+    if (instance == nullptr) {
+      version = current;
+      instance = src->instantiate();
+      instance->setValidating(validating);
+      instance->setSink(instanceSink());
+    }
+  }
+
+  ParserResult<S, T> track(ParserResult<S, T> result) {
+    dirty = !result.has_value() || isError(result);
+    return result;
+  }
+
+  void lookup() {
+    if (trie != nullptr)
+      return;
+    trie = memo->get(key->getId());
+    node = 0;
+    replaying = true;
+  }
+
+  // The tokens were not seen before, apply them to the sub-parser.
+  void diverge() {
+    memo->miss();
+    replaying = false;
+    load();
+    for (auto &t : pending)
+      (*instance)(t);
+    dirty = true;
+    pending.clear();
+  }
+
+  ParserResult<S, T> done(ParserResult<S, T> result) {
+    trie = nullptr;
+    pending.clear();
+    return result;
+  }
+
+  ParserResult<S, T> memoized(const S &value) {
+    lookup();
+    if (replaying) {
+      if (int child = trie->find(node, value); child >= 0) {
+        node = child;
+        pending.push_back(value);
+        if (auto &outcome = trie->nodes[node].outcome; outcome != nullptr) {
+          memo->hit();
+          return done(MemoTable<S, T>::replay(outcome));
+        }
+        return {};
+      }
+      diverge();
+    }
+    auto result = track((*instance)(value));
+    node = memo->extend(*trie, node, value);
+    if (result.has_value())
+      return done(memo->record(*trie, node, std::move(result), false));
+    return result;
+  }
+
+  ParserResult<S, T> memoized() {
+    lookup();
+    if (replaying) {
+      if (auto &outcome = trie->nodes[node].end; outcome != nullptr) {
+        memo->hit();
+        return done(MemoTable<S, T>::replay(outcome));
+      }
+      diverge();
+    }
+    auto result = track((*instance)());
+    if (!result.has_value())
+      return done(std::move(result));
+    return done(memo->record(*trie, node, std::move(result), true));
+  }
 
 public:
-  LazyParser(decltype(src) src, decltype(mapping) mapping = nullptr)
-      : src(src), mapping(mapping) {
+  LazyParser(AbstractParser<S, T> *src, Mapping mapping = nullptr)
+      : src(src), rule(src), mapping(share(std::move(mapping))),
+        memo(nullptr) {
+    reset();
+  }
+  LazyParser(AbstractParser<S, T> *src, Mapping mapping,
+             MemoTable<S, T> *memo)
+      : src(src), rule(src), mapping(share(std::move(mapping))), memo(memo),
+        key(memo != nullptr ? memo->key(src) : nullptr) {
+    static_assert(memoizable,
+                  "the outputs are copied from the memo table, so T must be "
+                  "copyable");
     reset();
   }
-  void reset() override { instance = nullptr; }
-  AbstractParserPtr<S, T> clone() override {
-    return std::make_unique<LazyParser>(src);
+  // Copying a lazy parser does not copy the instance, same as clone.
+  LazyParser(const LazyParser &other)
+      : src(other.src), rule(other.rule), mapping(other.mapping),
+        memo(other.memo), key(other.key), validating(other.validating) {}
+  LazyParser(LazyParser &&) = default;
+  void reset() override {
+    if (dirty)
+      instance->reset();
+    dirty = false;
+    trie = nullptr;
+    pending.clear();
+  }
+  AbstractParserPtr<S, T> clone() const override {
+    return std::make_unique<LazyParser>(*this);
+  }
+  AbstractParserPtr<S, T> instantiate() const override {
+    auto p = std::make_unique<LazyParser>(*this);
+    p->rule = nullptr;
+    return p;
+  }
+  bool restore(AbstractParser<S, T> &other) override {
+    auto p = dynamic_cast<LazyParser *>(&other);
+    if (p == nullptr || p->src != src || sink != nullptr || p->sink != nullptr)
+      return false;
+    reset();
+    if (p->instance != nullptr) {
+      instance = p->instance->snapshot();
+      if (instance == nullptr)
+        return false;
+      dirty = true;
+    }
+    trie = p->trie;
+    node = p->node;
+    pending = p->pending;
+    replaying = p->replaying;
+    return true;
+  }
+  void setValidating(const bool validating) override {
+    this->validating = validating;
+    if (instance != nullptr) {
+      instance->setValidating(validating);
+      instance->setSink(instanceSink());
+    }
+  }
+  void setSink(OutputSink<T> *sink) override {
+    this->sink = sink;
+    if (instance != nullptr)
+      instance->setSink(instanceSink());
+  }
+  const std::string &getName() const override { return src->getName(); }
+  /**
+   * The source, to be rewritten in place before the parser is used (see
+   * optimize), or nullptr for an instance.
+   */
+  AbstractParser<S, T> *getSource() { return rule; }
+  /**
+   * Whether the results are the ones of the source, without a mapping
+   * function or a memo table.
+   */
+  bool isTransparent() const { return mapping == nullptr && memo == nullptr; }
+  FirstSet<S> first() const override {
+    // Guards against recursion, per thread as the sources may be shared by
+    // the sessions of a grammar.
+    static thread_local std::unordered_set<const LazyParser *> visiting;
+    // left recursion, we cannot tell
+    if (!visiting.insert(this).second)
+      return FirstSet<S>::any();
+    auto set = src->first();
+    visiting.erase(this);
+    return set;
   }
-  const std::string &getName() override { return src->getName(); }
   ParserResult<S, T> operator()(const S &value) override {
-    if (instance == nullptr)
-      instance = std::move(src->clone());
-    auto result = (*instance)(value);
-    if (mapping != nullptr)
-      result = mapping(std::move(result));
+    ParserResult<S, T> result;
+    if (useMemo()) {
+      if constexpr (memoizable)
+        result = memoized(value);
+    } else {
+      load();
+      result = track((*instance)(value));
+    }
+    if (useMapping())
+      result = (*mapping)(std::move(result));
     return result;
   }
+  FeedResult<S, T> feed(const S *begin, const S *end) override {
+    // The mapping function is applied on every return value (including the
+    // empty ones), so we can only pass the span through without it.
+    if (useMapping() || useMemo())
+      return AbstractParser<S, T>::feed(begin, end);
+    load();
+    auto fed = instance->feed(begin, end);
+    dirty = !fed.result.has_value() || isError(fed.result);
+    return fed;
+  }
   ParserResult<S, T> operator()() override {
-    if (instance == nullptr)
-      instance = std::move(src->clone());
-    auto result = (*instance)();
-    if (mapping != nullptr)
-      result = mapping(std::move(result));
+    ParserResult<S, T> result;
+    if (useMemo()) {
+      if constexpr (memoizable)
+        result = memoized();
+    } else {
+      load();
+      result = track((*instance)());
+    }
+    if (useMapping())
+      result = (*mapping)(std::move(result));
     return result;
   }
 };
@@ -0,0 +1,177 @@
+#include "LiteralSet.hpp"
+#include "Predicate.hpp"
+#include <algorithm>
+
+namespace Parser {
+
+int LiteralSet::Trie::find(const int node, const char c) const {
+  auto &next = nodes[node].next;
+  auto it = std::lower_bound(
+      next.begin(), next.end(), c,
+      [](const std::pair<char, int> &a, const char b) { return a.first < b; });
+  if (it == next.end() || it->first != c)
+    return -1;
+  return it->second;
+}
+
+// Returns the last literal in the subtree.
+int LiteralSet::Trie::build(const int node) {
+  int best = -1;
+  for (std::size_t i = 0; i < nodes[node].next.size(); ++i) {
+    auto [c, child] = nodes[node].next[i];
+    int last = build(child);
+    auto &n = nodes[node];
+    if (last > best) {
+      n.second = best;
+      n.bestChar = c;
+      best = last;
+    } else if (last > n.second) {
+      n.second = last;
+    }
+  }
+  nodes[node].alive = best;
+  return std::max(best, nodes[node].terminal);
+}
+
+LiteralSet::LiteralSet(
+    const std::vector<std::pair<std::string, Name>> &literals, Name name)
+    : name(name) {
+  auto t = std::make_shared<Trie>();
+  t->nodes.emplace_back();
+  for (auto &[literal, n] : literals) {
+    int node = 0;
+    for (char c : literal) {
+      int child = t->find(node, c);
+      if (child < 0) {
+        child = t->nodes.size();
+        t->nodes.emplace_back();
+        auto &next = t->nodes[node].next;
+        next.insert(std::upper_bound(next.begin(), next.end(),
+                                     std::make_pair(c, child)),
+                    std::make_pair(c, child));
+      }
+      node = child;
+    }
+    t->nodes[node].terminal = t->literals.size();
+    t->literals.push_back(literal);
+    t->names.push_back(n);
+  }
+  t->build(0);
+  trie = std::move(t);
+}
+
+ParserResult<char, std::string>
+LiteralSet::finish(const unsigned int applied) {
+  if (matched >= 0) {
+    auto parsed = castResult<LiteralResult, char, std::string>(
+        validating ? std::string() : trie->literals[matched], pending);
+    reset();
+    return parsed;
+  }
+  ParsingError error;
+  if (errorIndex >= 0) {
+    error = ParsingError(ErrorCode::InsufficientTokens,
+                         trie->names[errorIndex], applied - errorPosition);
+    error.recordAlternate(name);
+  } else {
+    // no literals at all
+    error = ParsingError(ErrorCode::Incomplete, name);
+  }
+  reset();
+  return ParsingError::get<char, std::string>(error);
+}
+
+bool LiteralSet::restore(AbstractParser<char, std::string> &other) {
+  auto p = dynamic_cast<LiteralSet *>(&other);
+  if (p == nullptr)
+    return false;
+  // The alternations of the same grammar that were prepared apart have tries
+  // of their own, which are the same as they are built from the same
+  // literals. The trie of the other one is taken over.
+  if (p->trie != trie) {
+    if (p->trie->literals != trie->literals)
+      return false;
+    trie = p->trie;
+  }
+  node = p->node;
+  depth = p->depth;
+  matched = p->matched;
+  pending = p->pending;
+  errorIndex = p->errorIndex;
+  errorPosition = p->errorPosition;
+  return true;
+}
+
+FirstSet<char> LiteralSet::first() const {
+  FirstSet<char> set;
+  for (auto &[c, child] : trie->nodes[0].next)
+    set.insert(c);
+  return set;
+}
+
+ParserResult<char, std::string> LiteralSet::operator()(const char &value) {
+  // The literals in the subtree of the current node are still alive, except
+  // the one that ends here. Those that do not continue with this token fail
+  // now, as the predicates would fail on it.
+  auto &n = trie->nodes[node];
+  int child = trie->find(node, value);
+  int failing = (child >= 0 && value == n.bestChar) ? n.second : n.alive;
+  if (failing >= 0) {
+    errorIndex = failing;
+    errorPosition = depth;
+  }
+  if (matched >= 0)
+    pending.push_back(value);
+  if (child < 0)
+    return finish(depth + 1);
+  node = child;
+  ++depth;
+  auto &next = trie->nodes[child];
+  if (next.terminal >= 0) {
+    matched = next.terminal;
+    pending.clear();
+  }
+  if (next.alive < 0)
+    return finish(depth);
+  return {};
+}
+
+FeedResult<char, std::string> LiteralSet::feed(const char *begin,
+                                               const char *end) {
+  for (const char *it = begin; it != end; ++it) {
+    if (auto result = LiteralSet::operator()(*it); result.has_value())
+      return {static_cast<std::size_t>(it - begin + 1), std::move(result)};
+  }
+  return {static_cast<std::size_t>(end - begin), {}};
+}
+
+ParserResult<char, std::string> LiteralSet::operator()() {
+  // the literals that are still alive fail at the end of input
+  if (int failing = trie->nodes[node].alive; failing >= 0) {
+    errorIndex = failing;
+    errorPosition = depth;
+  }
+  return finish(depth);
+}
+
+std::unique_ptr<LiteralSet> LiteralSet::fromOptions(
+    std::vector<AbstractParserPtr<char, std::string>> &options, Name name) {
+  using CharPredicate =
+      PredicateParser<char, std::string, Utils::fromChar, Utils::fold>;
+  std::vector<std::pair<std::string, Name>> literals;
+  for (auto &option : options) {
+    // the output of a literal char predicate is the literal itself
+    if (dynamic_cast<CharPredicate *>(option.get()) == nullptr)
+      return nullptr;
+    auto l = option->literal();
+    if (!l.has_value() || l->empty())
+      return nullptr;
+    literals.emplace_back(std::string(l->begin(), l->end()),
+                          option->getName());
+  }
+  if (literals.empty())
+    return nullptr;
+  return std::make_unique<LiteralSet>(literals, name);
+}
+
+} // namespace Parser
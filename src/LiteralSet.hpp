@@ -0,0 +1,136 @@
+#pragma once
+#include "Parser.hpp"
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Parser {
+
+/**
+ * The alternation of a set of literals, matched with a trie instead of running
+ * one parser per literal in lockstep. The results and errors are the same as
+ * Alternate over the StringPredicates of the literals: the longest literal
+ * matched wins (the last one if the same literal appears twice), the tokens
+ * after it are returned by getRemaining, and if nothing matches the error is
+ * from the last literal that fails on the last token.
+ *
+ * The trie is built once and shared with the clones.
+ */
+class LiteralSet final : public AbstractParser<char, std::string> {
+private:
+  struct Node {
+    // sorted by the character
+    std::vector<std::pair<char, int>> next;
+    // the literal that ends at this node, or -1
+    int terminal = -1;
+    // the last literal that continues after this node, or -1
+    int alive = -1;
+    // the child with the last literal in its subtree, and the last literal
+    // in the subtrees of the other children
+    char bestChar = 0;
+    int second = -1;
+  };
+
+  struct Trie {
+    std::vector<Node> nodes;
+    std::vector<std::string> literals;
+    std::vector<Name> names;
+
+    int find(const int node, const char c) const;
+    int build(const int node);
+  };
+
+  std::shared_ptr<const Trie> trie;
+  Name name;
+  int node = 0;
+  unsigned int depth = 0;
+  int matched = -1;
+  // the tokens after the matched literal
+  std::string pending;
+  int errorIndex = -1;
+  // the number of tokens before the one the error is at
+  unsigned int errorPosition = 0;
+  bool validating = false;
+
+  class LiteralResult final : public AbstractParserResult<char, std::string> {
+  private:
+    std::string value;
+    std::string remaining;
+    std::size_t next = 0;
+    bool valueLeft;
+
+  public:
+    // the literals are not empty, an empty value is no value
+    LiteralResult(std::string value, std::string remaining)
+        : value(std::move(value)), remaining(std::move(remaining)),
+          valueLeft(!this->value.empty()) {}
+
+    std::optional<char> getRemaining() override {
+      if (next < remaining.size())
+        return remaining[next++];
+      return {};
+    }
+
+    std::optional<std::string> get() override {
+      if (valueLeft) {
+        valueLeft = false;
+        return std::make_optional(std::move(value));
+      }
+      return {};
+    }
+  };
+
+  // applied is the number of tokens applied, for the lag of the error
+  ParserResult<char, std::string> finish(const unsigned int applied);
+
+public:
+  /**
+   * The literals are pairs of the literal and the name used in the errors,
+   * and must not be empty.
+   */
+  LiteralSet(const std::vector<std::pair<std::string, Name>> &literals,
+             Name name);
+  LiteralSet(std::shared_ptr<const Trie> trie, Name name)
+      : trie(std::move(trie)), name(name) {}
+
+  void reset() override {
+    node = 0;
+    depth = 0;
+    matched = -1;
+    pending.clear();
+    errorIndex = -1;
+  }
+
+  AbstractParserPtr<char, std::string> clone() const override {
+    auto p = std::make_unique<LiteralSet>(trie, name);
+    p->validating = validating;
+    return p;
+  }
+
+  bool restore(AbstractParser<char, std::string> &other) override;
+
+  FirstSet<char> first() const override;
+
+  void setValidating(const bool validating) override {
+    this->validating = validating;
+  }
+
+  ParserResult<char, std::string> operator()(const char &value) override;
+
+  FeedResult<char, std::string> feed(const char *begin,
+                                     const char *end) override;
+
+  ParserResult<char, std::string> operator()() override;
+
+  const std::string &getName() const override { return name.str(); }
+
+  /**
+   * Build a LiteralSet for an alternation if every option is a literal
+   * predicate (such as a StringPredicate), otherwise returns nullptr.
+   */
+  static std::unique_ptr<LiteralSet>
+  fromOptions(std::vector<AbstractParserPtr<char, std::string>> &options,
+              Name name);
+};
+
+} // namespace Parser
@@ -0,0 +1,216 @@
+#pragma once
+#include "HelperResults.hpp"
+#include "Parser.hpp"
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Parser {
+
+/**
+ * Memoization of the parsers instantiated by LazyParser, for recursive
+ * grammars where the same rule is derived many times on the same input.
+ *
+ * The parsers do not know their offsets in the input (tokens may be applied
+ * again as lookahead), so the entries are keyed by the parser and the tokens
+ * it has been applied to instead: the outcomes of each parser are stored in a
+ * trie of the token sequences. As the parsers are deterministic, the outcome
+ * after the same sequence of tokens is always the same, which also covers the
+ * same rule being applied at the same offset.
+ *
+ * The parsers are identified by a Key, with an id that is never reused. The
+ * lazy parsers of the same source share its key, and the trie of the key is
+ * dropped when the last of them is destroyed, so a parser that is made later
+ * at the same address does not see the outcomes of the previous one.
+ *
+ * The table has a capacity in (estimated) bytes. When it is full, the tries
+ * of the parsers that have not been used for the longest time are dropped.
+ * The table must only be used by one thread.
+ */
+template <typename S, typename T> class MemoTable {
+public:
+  struct Outcome : Recording<S, T> {
+    std::optional<ParsingError> error;
+  };
+
+  struct Node {
+    std::vector<std::pair<S, unsigned int>> next;
+    // the outcome after the tokens of this node, and the outcome if the input
+    // ends here
+    std::shared_ptr<const Outcome> outcome;
+    std::shared_ptr<const Outcome> end;
+  };
+
+  struct Trie {
+    std::vector<Node> nodes = std::vector<Node>(1);
+    std::size_t bytes = 0;
+    std::size_t lastUse = 0;
+    bool cached = true;
+
+    int find(const unsigned int node, const S &value) const {
+      for (auto &[t, child] : nodes[node].next) {
+        if (t == value)
+          return child;
+      }
+      return -1;
+    }
+  };
+
+  struct Stats {
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    std::size_t evictions = 0;
+    std::size_t bytes = 0;
+
+    double hitRate() const {
+      auto total = hits + misses;
+      return total == 0 ? 0 : static_cast<double>(hits) / total;
+    }
+  };
+
+  class Key {
+  private:
+    MemoTable *table;
+    const void *source;
+    std::size_t id;
+
+  public:
+    Key(MemoTable *table, const void *source, const std::size_t id)
+        : table(table), source(source), id(id) {}
+    Key(const Key &) = delete;
+    ~Key() { table->drop(source, id); }
+
+    std::size_t getId() const { return id; }
+  };
+
+private:
+  std::unordered_map<std::size_t, std::shared_ptr<Trie>> tries;
+  // the keys of the sources that have lazy parsers
+  std::unordered_map<const void *, std::weak_ptr<Key>> keys;
+  std::size_t ids = 0;
+  std::size_t capacity;
+  std::size_t tick = 0;
+  Stats stats;
+
+  void evict(std::shared_ptr<Trie> &trie) {
+    // the parsers using the trie keep it alive until they are done
+    trie->cached = false;
+    stats.bytes -= trie->bytes;
+  }
+
+  void drop(const void *source, const std::size_t id) {
+    if (auto it = tries.find(id); it != tries.end()) {
+      evict(it->second);
+      tries.erase(it);
+    }
+    if (auto it = keys.find(source);
+        it != keys.end() && it->second.expired())
+      keys.erase(it);
+  }
+
+  void charge(Trie &trie, const std::size_t bytes) {
+    trie.bytes += bytes;
+    if (!trie.cached)
+      return;
+    stats.bytes += bytes;
+    while (stats.bytes > capacity && !tries.empty()) {
+      auto lru = tries.begin();
+      for (auto it = tries.begin(); it != tries.end(); ++it) {
+        if (it->second->lastUse < lru->second->lastUse)
+          lru = it;
+      }
+      evict(lru->second);
+      ++stats.evictions;
+      tries.erase(lru);
+    }
+  }
+
+public:
+  MemoTable(const std::size_t capacity = 64 << 20) : capacity(capacity) {}
+  MemoTable(const MemoTable &) = delete;
+  MemoTable &operator=(const MemoTable &) = delete;
+
+  /**
+   * The key of the source, shared by its lazy parsers. The table must outlive
+   * the keys.
+   */
+  std::shared_ptr<Key> key(const void *source) {
+    auto &entry = keys[source];
+    if (auto k = entry.lock())
+      return k;
+    auto k = std::make_shared<Key>(this, source, ++ids);
+    entry = k;
+    return k;
+  }
+
+  /**
+   * The trie of the key, which is created if it does not exist.
+   */
+  std::shared_ptr<Trie> get(const std::size_t id) {
+    if (auto it = tries.find(id); it != tries.end()) {
+      it->second->lastUse = ++tick;
+      return it->second;
+    }
+    auto trie = std::make_shared<Trie>();
+    trie->lastUse = ++tick;
+    tries.emplace(id, trie);
+    charge(*trie, sizeof(Node));
+    return trie;
+  }
+
+  /**
+   * The child of the node for the token, which is created if it does not
+   * exist.
+   */
+  unsigned int extend(Trie &trie, const unsigned int node, const S &value) {
+    if (int child = trie.find(node, value); child >= 0)
+      return child;
+    unsigned int child = trie.nodes.size();
+    trie.nodes.emplace_back();
+    trie.nodes[node].next.emplace_back(value, child);
+    charge(trie, sizeof(Node) + sizeof(std::pair<S, unsigned int>));
+    return child;
+  }
+
+  /**
+   * Store the outcome of a parser. The result is consumed, and a result that
+   * replays it is returned instead.
+   */
+  ParserResult<S, T> record(Trie &trie, const unsigned int node,
+                            ParserResult<S, T> r, const bool end) {
+    auto outcome = std::make_shared<Outcome>();
+    if (isError(r)) {
+      outcome->error = asError(r);
+    } else {
+      outcome->record(*asResult(r));
+    }
+    (end ? trie.nodes[node].end : trie.nodes[node].outcome) = outcome;
+    charge(trie, sizeof(Outcome) + outcome->outputs.size() * sizeof(T) +
+                     outcome->remaining.size() * sizeof(S));
+    return replay(std::move(outcome));
+  }
+
+  static ParserResult<S, T> replay(std::shared_ptr<const Outcome> outcome);
+
+  void hit() { ++stats.hits; }
+  void miss() { ++stats.misses; }
+
+  const Stats &getStats() const { return stats; }
+
+  void clear() {
+    for (auto &[id, trie] : tries)
+      trie->cached = false;
+    tries.clear();
+    stats.bytes = 0;
+  }
+};
+
+template <typename S, typename T>
+ParserResult<S, T>
+MemoTable<S, T>::replay(std::shared_ptr<const Outcome> outcome) {
+  if (outcome->error.has_value())
+    return ParsingError::get<S, T>(outcome->error.value());
+  return castResult<ReplayedResult<S, T>, S, T>(std::move(outcome));
+}
+
+} // namespace Parser
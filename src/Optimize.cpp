@@ -0,0 +1,416 @@
+#include "Optimize.hpp"
+#include "Alternate.hpp"
+#include "Lazy.hpp"
+#include "Predicate.hpp"
+#include "Sequence.hpp"
+#include "TakeTill.hpp"
+#include <algorithm>
+#include <unordered_set>
+
+namespace Parser {
+
+std::optional<std::string> LiteralRun::RunResult::get() {
+  if (literals == nullptr || next == literals->ends.size())
+    return {};
+  std::size_t begin = next == 0 ? 0 : literals->ends[next - 1].first;
+  return literals->text.substr(begin, literals->ends[next++].first - begin);
+}
+
+ParserResult<char, std::string> LiteralRun::fail(const std::uint64_t lag) {
+  // the literal that did not get all its tokens
+  auto &ends = literals->ends;
+  auto it = std::upper_bound(
+      ends.begin(), ends.end(), matched,
+      [](const std::size_t m, const std::pair<std::size_t, Name> &e) {
+        return m < e.first;
+      });
+  auto error = ParsingError(ErrorCode::InsufficientTokens, it->second, lag);
+  reset();
+  return ParsingError::get<char, std::string>(error);
+}
+
+ParserResult<char, std::string> LiteralRun::complete() {
+  reset();
+  return castResult<RunResult, char, std::string>(
+      validating ? std::shared_ptr<const Literals>() : literals);
+}
+
+bool LiteralRun::restore(AbstractParser<char, std::string> &other) {
+  auto p = dynamic_cast<LiteralRun *>(&other);
+  if (p == nullptr || p->literals != literals)
+    return false;
+  matched = p->matched;
+  return true;
+}
+
+ParserResult<char, std::string> LiteralRun::operator()(const char &value) {
+  if (value != literals->text[matched])
+    return fail(1);
+  if (++matched == literals->text.size())
+    return complete();
+  return {};
+}
+
+FeedResult<char, std::string> LiteralRun::feed(const char *begin,
+                                               const char *end) {
+  auto &text = literals->text;
+  auto n = std::min<std::size_t>(end - begin, text.size() - matched);
+  auto it = std::mismatch(begin, begin + n, text.begin() + matched).first;
+  matched += it - begin;
+  if (it != begin + n)
+    return {static_cast<std::size_t>(it - begin + 1), fail(1)};
+  if (matched == text.size())
+    return {n, complete()};
+  return {n, {}};
+}
+
+namespace {
+using Ptr = AbstractParserPtr<char, std::string>;
+using CharPredicate =
+    PredicateParser<char, std::string, Utils::fromChar, Utils::fold>;
+using Seq = Sequence<char, std::string>;
+using Alt = Alternate<char, std::string>;
+using Lazy = LazyParser<char, std::string>;
+using Till = TakeTill<char, std::string, std::string>;
+
+// The literal of a predicate whose output is the literal itself.
+std::optional<std::string> literalOf(AbstractParser<char, std::string> &p) {
+  auto c = dynamic_cast<CharPredicate *>(&p);
+  if (c == nullptr)
+    return {};
+  auto l = c->literal();
+  if (!l.has_value() || l->empty() ||
+      c->getQuantifier() != static_cast<int>(l->size()))
+    return {};
+  return std::string(l->begin(), l->end());
+}
+
+class Optimizer {
+private:
+  // the sources of the lazy parsers, which are optimized in place
+  std::unordered_set<AbstractParser<char, std::string> *> pinned;
+  std::unordered_set<AbstractParser<char, std::string> *> simplified;
+  std::unordered_set<AbstractParser<char, std::string> *> fused;
+  // the pinned parsers being rewritten, whose FIRST sets are not queried
+  std::unordered_set<AbstractParser<char, std::string> *> rewriting;
+
+  // Whether the parser may reach a parser being rewritten.
+  bool reaches(AbstractParser<char, std::string> &p,
+               std::unordered_set<AbstractParser<char, std::string> *> &seen) {
+    if (rewriting.count(&p))
+      return true;
+    if (auto s = dynamic_cast<Seq *>(&p)) {
+      auto &v = *s->getSequence();
+      return std::any_of(v.begin(), v.end(),
+                         [&](Ptr &c) { return reaches(*c, seen); });
+    }
+    if (auto a = dynamic_cast<Alt *>(&p)) {
+      auto &v = *a->getOptions();
+      return std::any_of(v.begin(), v.end(),
+                         [&](Ptr &o) { return reaches(*o, seen); });
+    }
+    if (auto t = dynamic_cast<Till *>(&p))
+      return reaches(*t->getParser(), seen) || reaches(*t->getSuffix(), seen);
+    if (auto l = dynamic_cast<Lazy *>(&p)) {
+      return seen.insert(l->getSource()).second &&
+             reaches(*l->getSource(), seen);
+    }
+    return false;
+  }
+
+  // The FIRST set of the parser, unknown if it may reach a parser being
+  // rewritten, as its options may be moved out.
+  FirstSet<char> firstOf(AbstractParser<char, std::string> &p) {
+    std::unordered_set<AbstractParser<char, std::string> *> seen;
+    return reaches(p, seen) ? FirstSet<char>::any() : p.first();
+  }
+
+  // Whether the parser fails on its first token, whatever it is.
+  bool dead(AbstractParser<char, std::string> &p) {
+    if (auto s = dynamic_cast<Seq *>(&p)) {
+      auto &v = *s->getSequence();
+      if (v.empty())
+        return false;
+      if (dead(*v[0]))
+        return true;
+      // The predicate fails on its token and gives the other ones to the next
+      // parser, which cannot start with them.
+      auto c = dynamic_cast<CharPredicate *>(v[0].get());
+      if (v.size() < 2 || c == nullptr || c->getQuantifier() != NONE ||
+          !c->getToken().has_value())
+        return false;
+      auto next = firstOf(*v[1]);
+      if (next.isUnknown() || next.isNullable())
+        return false;
+      auto bits = next.getTokens().getBits();
+      bits.reset(static_cast<unsigned char>(*c->getToken()));
+      return bits.none();
+    }
+    if (auto a = dynamic_cast<Alt *>(&p)) {
+      auto &v = *a->getOptions();
+      return !v.empty() &&
+             std::all_of(v.begin(), v.end(), [&](Ptr &o) { return dead(*o); });
+    }
+    return false;
+  }
+
+  // the literal that starts an option, if it can be factored
+  std::optional<std::string> prefix(Ptr &option) {
+    auto s = dynamic_cast<Seq *>(option.get());
+    if (s == nullptr || pinned.count(s) || s->getSequence()->size() < 2)
+      return {};
+    return literalOf(*s->getSequence()->front());
+  }
+
+  // Replace the combinators of a single parser by it.
+  void collapse(Ptr &p) {
+    if (pinned.count(p.get()))
+      return;
+    if (auto s = dynamic_cast<Seq *>(p.get());
+        s != nullptr && s->getSequence()->size() == 1) {
+      Ptr child = std::move(s->getSequence()->front());
+      p = std::move(child);
+    } else if (auto a = dynamic_cast<Alt *>(p.get());
+               a != nullptr && a->getOptions()->size() == 1) {
+      Ptr child = std::move(a->getOptions()->front());
+      p = std::move(child);
+    }
+  }
+
+  void visit(Ptr &p) {
+    if (auto l = dynamic_cast<Lazy *>(p.get())) {
+      if (simplified.insert(l->getSource()).second)
+        simplify(*l->getSource());
+      return;
+    }
+    if (pinned.count(p.get())) {
+      if (simplified.insert(p.get()).second)
+        simplify(*p);
+      return;
+    }
+    simplify(*p);
+    collapse(p);
+  }
+
+  void simplify(AbstractParser<char, std::string> &p) {
+    bool pin = pinned.count(&p) > 0;
+    if (pin)
+      rewriting.insert(&p);
+    if (auto s = dynamic_cast<Seq *>(&p)) {
+      sequence(*s);
+    } else if (auto a = dynamic_cast<Alt *>(&p)) {
+      alternate(*a);
+    } else if (auto t = dynamic_cast<Till *>(&p)) {
+      visit(t->getParser());
+      visit(t->getSuffix());
+    }
+    if (pin)
+      rewriting.erase(&p);
+  }
+
+  void sequence(Seq &s) {
+    auto &v = *s.getSequence();
+    for (auto &child : v)
+      visit(child);
+    std::vector<Ptr> flat;
+    for (auto &child : v) {
+      auto inner = dynamic_cast<Seq *>(child.get());
+      if (inner == nullptr || pinned.count(inner) ||
+          inner->getSequence()->empty()) {
+        flat.push_back(std::move(child));
+        continue;
+      }
+      for (auto &c : *inner->getSequence())
+        flat.push_back(std::move(c));
+    }
+    v = std::move(flat);
+  }
+
+  void alternate(Alt &a) {
+    auto &v = *a.getOptions();
+    for (auto &option : v)
+      visit(option);
+    // the options that fail on the first token fail before the others
+    // complete, they only change the error
+    auto n =
+        std::count_if(v.begin(), v.end(), [&](Ptr &o) { return dead(*o); });
+    if (n > 0 && n < static_cast<std::ptrdiff_t>(v.size())) {
+      v.erase(std::remove_if(v.begin(), v.end(),
+                             [&](Ptr &o) { return dead(*o); }),
+              v.end());
+    }
+    // An alternation only runs in lockstep with the other options when they
+    // may start with the same token, otherwise the other options are skipped
+    // and the options of the alternation can be options of the parent.
+    auto firsts = [&] {
+      std::vector<FirstSet<char>> sets;
+      for (auto &option : v)
+        sets.push_back(firstOf(*option));
+      return sets;
+    };
+    auto separate = [&](const std::vector<FirstSet<char>> &sets,
+                        const std::size_t begin, const std::size_t end) {
+      for (std::size_t k = 0; k < sets.size(); ++k) {
+        for (std::size_t i = begin; i < end && (k < begin || k >= end); ++i) {
+          if (!sets[i].disjoint(sets[k]))
+            return false;
+        }
+      }
+      return true;
+    };
+    auto sets = firsts();
+    std::vector<Ptr> flat;
+    for (std::size_t i = 0; i < v.size(); ++i) {
+      auto inner = dynamic_cast<Alt *>(v[i].get());
+      if (inner == nullptr || pinned.count(inner) ||
+          inner->getOptions()->empty() || !separate(sets, i, i + 1)) {
+        flat.push_back(std::move(v[i]));
+        continue;
+      }
+      for (auto &o : *inner->getOptions())
+        flat.push_back(std::move(o));
+    }
+    v = std::move(flat);
+    // The options that start with the same literal are factored. The literal
+    // of the last option is kept, as the error of the last option is the one
+    // returned when they all fail on it.
+    sets = firsts();
+    std::vector<Ptr> factored;
+    // the factored options are visited once they are back in the alternation
+    std::vector<std::size_t> visits;
+    for (std::size_t i = 0; i < v.size();) {
+      auto literal = prefix(v[i]);
+      std::size_t j = i + 1;
+      while (literal.has_value() && j < v.size() && prefix(v[j]) == literal)
+        ++j;
+      if (j - i < 2 || !separate(sets, i, j)) {
+        factored.push_back(std::move(v[i]));
+        ++i;
+        continue;
+      }
+      auto options = std::make_unique<std::vector<Ptr>>();
+      Ptr head;
+      std::string name;
+      for (; i < j; ++i) {
+        auto &s = *static_cast<Seq *>(v[i].get());
+        auto &children = *s.getSequence();
+        head = std::move(children.front());
+        children.erase(children.begin());
+        name = s.getName();
+        options->push_back(std::move(v[i]));
+      }
+      auto children = std::make_unique<std::vector<Ptr>>();
+      children->push_back(std::move(head));
+      children->push_back(
+          std::make_unique<Alt>(std::move(options), a.getName()));
+      visits.push_back(factored.size());
+      factored.push_back(std::make_unique<Seq>(std::move(children), name));
+    }
+    v = std::move(factored);
+    for (auto k : visits)
+      visit(v[k]);
+    // the FIRST sets may have been computed while the options changed
+    a.invalidate();
+  }
+
+  void fuse(Ptr &p) {
+    if (auto l = dynamic_cast<Lazy *>(p.get())) {
+      if (fused.insert(l->getSource()).second)
+        fuseChildren(*l->getSource());
+      return;
+    }
+    if (pinned.count(p.get())) {
+      if (fused.insert(p.get()).second)
+        fuseChildren(*p);
+      return;
+    }
+    fuseChildren(*p);
+    collapse(p);
+  }
+
+  void fuseChildren(AbstractParser<char, std::string> &p) {
+    if (auto a = dynamic_cast<Alt *>(&p)) {
+      for (auto &option : *a->getOptions())
+        fuse(option);
+      return;
+    }
+    if (auto t = dynamic_cast<Till *>(&p)) {
+      fuse(t->getParser());
+      fuse(t->getSuffix());
+      return;
+    }
+    auto s = dynamic_cast<Seq *>(&p);
+    if (s == nullptr)
+      return;
+    auto &v = *s->getSequence();
+    for (auto &child : v)
+      fuse(child);
+    // the literals of the predicates and of the runs fused before
+    auto append = [](LiteralRun::Literals &l, Ptr &child) {
+      if (auto run = dynamic_cast<LiteralRun *>(child.get())) {
+        auto &other = run->getLiterals();
+        for (auto &[end, name] : other.ends)
+          l.ends.emplace_back(l.text.size() + end, name);
+        l.text += other.text;
+        return true;
+      }
+      auto literal = literalOf(*child);
+      if (!literal.has_value())
+        return false;
+      l.text += *literal;
+      l.ends.emplace_back(l.text.size(), child->getName());
+      return true;
+    };
+    std::vector<Ptr> runs;
+    for (std::size_t i = 0; i < v.size();) {
+      auto literals = std::make_shared<LiteralRun::Literals>();
+      std::size_t j = i;
+      while (j < v.size() && append(*literals, v[j]))
+        ++j;
+      if (j - i < 2) {
+        runs.push_back(std::move(v[i]));
+        i = std::max(i + 1, j);
+        continue;
+      }
+      runs.push_back(std::make_unique<LiteralRun>(std::move(literals),
+                                                  s->getName()));
+      i = j;
+    }
+    v = std::move(runs);
+  }
+
+public:
+  void collect(AbstractParser<char, std::string> &p) {
+    if (auto s = dynamic_cast<Seq *>(&p)) {
+      for (auto &child : *s->getSequence())
+        collect(*child);
+    } else if (auto a = dynamic_cast<Alt *>(&p)) {
+      for (auto &option : *a->getOptions())
+        collect(*option);
+    } else if (auto t = dynamic_cast<Till *>(&p)) {
+      collect(*t->getParser());
+      collect(*t->getSuffix());
+    } else if (auto l = dynamic_cast<Lazy *>(&p)) {
+      if (pinned.insert(l->getSource()).second)
+        collect(*l->getSource());
+    }
+  }
+
+  Ptr run(Ptr parser) {
+    collect(*parser);
+    visit(parser);
+    fuse(parser);
+    parser->reset();
+    for (auto p : pinned)
+      p->reset();
+    return parser;
+  }
+};
+} // namespace
+
+AbstractParserPtr<char, std::string>
+optimize(AbstractParserPtr<char, std::string> parser) {
+  return Optimizer().run(std::move(parser));
+}
+
+} // namespace Parser
@@ -0,0 +1,119 @@
+#pragma once
+#include "Parser.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Parser {
+
+/**
+ * The concatenation of literals, matched as a single literal instead of one
+ * predicate per literal. The outputs are the literals, one output per literal
+ * as their StringPredicates would return them in a sequence, and the error is
+ * the one of the predicate of the literal that fails.
+ *
+ * The literals are shared with the clones.
+ */
+class LiteralRun final : public AbstractParser<char, std::string> {
+public:
+  struct Literals {
+    std::string text;
+    // the end of every literal in the text, and its name for the errors
+    std::vector<std::pair<std::size_t, Name>> ends;
+  };
+
+private:
+  std::shared_ptr<const Literals> literals;
+  Name name;
+  std::size_t matched = 0;
+  bool validating = false;
+
+  class RunResult final : public AbstractParserResult<char, std::string> {
+  private:
+    std::shared_ptr<const Literals> literals;
+    std::size_t next = 0;
+
+  public:
+    // without literals for the validating mode
+    RunResult(std::shared_ptr<const Literals> literals)
+        : literals(std::move(literals)) {}
+
+    std::optional<char> getRemaining() override { return {}; }
+
+    std::optional<std::string> get() override;
+  };
+
+  // lag is the one of the error, see ParsingError::getLag
+  ParserResult<char, std::string> fail(const std::uint64_t lag);
+  ParserResult<char, std::string> complete();
+
+public:
+  LiteralRun(std::shared_ptr<const Literals> literals, Name name)
+      : literals(std::move(literals)), name(name) {}
+
+  void reset() override { matched = 0; }
+
+  AbstractParserPtr<char, std::string> clone() const override {
+    auto p = std::make_unique<LiteralRun>(literals, name);
+    p->validating = validating;
+    return p;
+  }
+
+  bool restore(AbstractParser<char, std::string> &other) override;
+
+  ParserResult<char, std::string> operator()(const char &value) override;
+
+  FeedResult<char, std::string> feed(const char *begin,
+                                     const char *end) override;
+
+  ParserResult<char, std::string> operator()() override { return fail(0); }
+
+  const std::string &getName() const override { return name.str(); }
+
+  FirstSet<char> first() const override {
+    return FirstSet<char>::of(literals->text.front());
+  }
+
+  std::optional<std::vector<char>> literal() const override {
+    return std::vector<char>(literals->text.begin(), literals->text.end());
+  }
+
+  void setValidating(const bool validating) override {
+    this->validating = validating;
+  }
+
+  const Literals &getLiterals() const { return *literals; }
+};
+
+/**
+ * Rewrite a grammar into an equivalent one that is cheaper to run:
+ *
+ * - the sequences in sequences and the alternations in alternations are
+ *   flattened, and the sequences and alternations of a single parser are
+ *   replaced by it,
+ * - the literals that follow each other in a sequence are fused into a
+ *   LiteralRun,
+ * - the options of an alternation that start with the same literal are
+ *   factored: (P X | P Y) is P (X | Y),
+ * - the options that always fail on their first token are removed: the
+ *   sequences where a predicate with a NONE quantifier fails on the only token
+ *   that the parser after it may start with.
+ *
+ * The options of an alternation run in lockstep and the one that completes on
+ * the latest token wins, so the alternations are only flattened and factored
+ * when the FIRST sets of the options involved are disjoint from the ones of
+ * the other options. The results, their outputs and their remaining tokens
+ * are the same as the ones of the parser. The inputs that fail still fail on
+ * the same token, but the error may be from another option, and the names of
+ * the combinators that were removed are not in its stack.
+ *
+ * The sources of the lazy parsers are optimized in place, as the lazy parsers
+ * point to them, and they are never replaced or flattened into another parser.
+ * The parsers that are not combinators (including the static ones) are kept
+ * as they are. A grammar is optimized before it is used, and before it is
+ * switched to validating mode; the parser is returned reset.
+ */
+AbstractParserPtr<char, std::string>
+optimize(AbstractParserPtr<char, std::string> parser);
+
+} // namespace Parser
@@ -0,0 +1,68 @@
+#include "Parser.hpp"
+
+namespace Parser {
+
+const std::string &Name::str() const {
+  static const std::string empty;
+  return value != nullptr ? *value : empty;
+}
+
+ParsingError::ParsingError(const std::string &description,
+                           const std::string &name)
+    : ParsingError(ErrorCode::Custom, name) {
+  details().text = description;
+}
+
+ErrorDetails &ParsingError::details() {
+  if (!detailed) {
+    auto name = Name();
+    name.value = std::static_pointer_cast<const std::string>(std::move(data));
+    data = std::allocate_shared<ErrorDetails>(
+        ArenaAllocator<ErrorDetails>(), ErrorDetails{std::move(name), {}, {}});
+    detailed = true;
+  } else if (data.use_count() > 1) {
+    // shared with a copy of the error
+    data = std::allocate_shared<ErrorDetails>(ArenaAllocator<ErrorDetails>(),
+                                              *getDetails());
+  }
+  // the details are only shared as const
+  return *const_cast<ErrorDetails *>(getDetails());
+}
+
+std::string ParsingError::toString() const {
+  auto details = getDetails();
+  std::string result;
+  switch (code) {
+  case ErrorCode::Custom:
+    if (details != nullptr)
+      result = details->text;
+    break;
+  case ErrorCode::Unexpected:
+    result = "Unexpected " +
+             (describe != nullptr ? describe(payload) : details->text);
+    break;
+  case ErrorCode::InsufficientTokens:
+    result = "Insufficient tokens";
+    break;
+  case ErrorCode::Incomplete:
+    result = "Insufficient Tokens";
+    break;
+  case ErrorCode::NotTerminated:
+    result = "Insufficient Tokens: Not Terminated";
+    break;
+  }
+  if (details == nullptr) {
+    Name name;
+    name.value = std::static_pointer_cast<const std::string>(data);
+    return result + "\n  at " + name.str();
+  }
+  result += "\n  at " + details->name.str();
+  for (auto &frame : details->stack) {
+    result += "\n  at " + frame.name.str();
+    if (frame.alternate)
+      result += " (alt)";
+  }
+  return result;
+}
+
+} // namespace Parser
@@ -1,7 +1,14 @@
 #pragma once
+#include "Arena.hpp"
+#include "FirstSet.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <string>
+#include <type_traits>
 #include <variant>
 #include <vector>
 
@@ -13,13 +20,116 @@ public:
   virtual std::optional<S> get() = 0;
 };
 
+/**
+ * Parser results are short-lived and created for almost every token, so they
+ * are allocated from the arena of the current scope if there is one.
+ */
 template <typename S, typename T>
-class AbstractParserResult : public AbstractStream<T> {
+class AbstractParserResult : public AbstractStream<T>, public ArenaAllocated {
 public:
   virtual ~AbstractParserResult() = default;
   virtual std::optional<S> getRemaining() = 0;
 };
 
+/**
+ * The outputs of the parsers in the sink mode (see AbstractParser::setSink),
+ * in order. A parser that fails removes the outputs it put in the sink, so the
+ * outputs are committed when the root parser returns a result, and the
+ * consumer takes them with flush then.
+ *
+ * A streaming sink passes the outputs to its callback as they come instead,
+ * and the alternations forward the sink of an option to theirs as soon as no
+ * other option can win (see forward), so the outputs reach the callback once
+ * no alternative can take them back, before the constructs they are in are
+ * done. A failure cannot take them back then: the outputs of the input that
+ * fails come before the error. With pieces, the predicates that aggregate a
+ * run of tokens (with a MORE or ANY quantifier) push their value every pieces
+ * tokens instead of once at the end, the fold of the pieces being the value.
+ */
+template <typename T> class OutputSink {
+private:
+  Vector<T> outputs;
+  std::function<void(T)> stream;
+  // the sink the outputs are passed to, see forward
+  OutputSink *target = nullptr;
+  std::size_t pieces = 0;
+
+public:
+  OutputSink() = default;
+  OutputSink(std::function<void(T)> stream, const std::size_t pieces = 0)
+      : stream(std::move(stream)), pieces(pieces) {}
+
+  void push(T value) {
+    if (target != nullptr)
+      target->push(std::move(value));
+    else if (stream)
+      stream(std::move(value));
+    else
+      outputs.push_back(std::move(value));
+  }
+
+  /**
+   * Move the outputs left in the result to the sink.
+   */
+  void drain(AbstractStream<T> &result) {
+    for (auto t = result.get(); t.has_value(); t = result.get())
+      push(std::move(t.value()));
+  }
+
+  /**
+   * Move the outputs of the other sink to the end of this one.
+   */
+  void append(OutputSink &other) {
+    for (auto &t : other.outputs)
+      push(std::move(t));
+    other.outputs.clear();
+  }
+
+  /**
+   * Move the outputs to the target, and pass the next ones to it as they
+   * come, until the sink is cleared. The outputs passed on are the target's:
+   * size and truncate only see the ones kept in this sink.
+   */
+  void forward(OutputSink *target) {
+    target->append(*this);
+    this->target = target;
+  }
+
+  std::size_t size() const { return outputs.size(); }
+
+  /**
+   * Whether the outputs pushed leave the sink as they come, to the callback.
+   */
+  bool streaming() const {
+    return target != nullptr ? target->streaming() : (bool)stream;
+  }
+
+  void truncate(const std::size_t size) {
+    while (outputs.size() > size)
+      outputs.pop_back();
+  }
+
+  /**
+   * Drop the outputs, and stop forwarding.
+   */
+  void clear() {
+    outputs.clear();
+    target = nullptr;
+  }
+
+  /**
+   * Call f with every output, moved, and clear the sink.
+   */
+  template <typename F> void flush(F &&f) {
+    for (auto &t : outputs)
+      f(std::move(t));
+    outputs.clear();
+  }
+
+  std::size_t getPieces() const { return pieces; }
+  void setPieces(const std::size_t pieces) { this->pieces = pieces; }
+};
+
 class ParsingError;
 template <typename S, typename T> class AbstractParser;
 
@@ -33,29 +143,181 @@ template <typename S, typename T>
 using ParserResult = std::optional<
     std::variant<ParsingError, std::unique_ptr<AbstractParserResult<S, T>>>>;
 
+/**
+ * The name of a parser. The string is shared by the copies of the name, so the
+ * errors keep the names of their stacks alive without copying them, and they
+ * are freed with the last parser or error that refers to them.
+ */
+class Name {
+private:
+  std::shared_ptr<const std::string> value;
+
+public:
+  Name() = default;
+  Name(const std::string &str)
+      : value(std::make_shared<const std::string>(str)) {}
+  Name(const char *str) : Name(std::string(str)) {}
+
+  const std::string &str() const;
+
+  friend class ParsingError;
+};
+
+enum class ErrorCode : std::uint8_t {
+  Custom,             // the description is provided by the user
+  Unexpected,         // "Unexpected <token>"
+  InsufficientTokens, // "Insufficient tokens", from the predicate parsers
+  Incomplete,         // "Insufficient Tokens", from the combinators
+  NotTerminated,      // "Insufficient Tokens: Not Terminated"
+};
+
+/**
+ * A frame of the error stack: a combinator the error went through.
+ */
+struct ErrorFrame {
+  Name name;
+  bool alternate;
+};
+
+/**
+ * What an error keeps besides its code and token, once it has a text or a
+ * stack. The details are shared by the copies of the error, and copied when
+ * one of them records a frame. They are allocated from the arena of the
+ * current scope if there is one, as the results are.
+ */
+struct ErrorDetails {
+  Name name;
+  // the description for ErrorCode::Custom, or the formatted token for
+  // ErrorCode::Unexpected if there is no describe function
+  std::string text;
+  // the combinators, from the innermost one
+  Vector<ErrorFrame> stack;
+};
+
+/**
+ * Errors are normal on the hot path (for example in the branches of an
+ * alternation), so they are kept cheap to make, to copy and to carry in a
+ * result: an error code, the token that caused it and a single pointer. The
+ * pointer is the name of the parser that failed while there is nothing else
+ * to keep, so that making an error does not allocate, and the ErrorDetails
+ * once there is a text or a stack. The message is only built when toString
+ * is called.
+ *
+ * The position of the error is tracked as a lag: the number of tokens applied
+ * to the parser from the one the error is at, 1 for an error on the token
+ * just applied and 0 for an error at the end of input. The combinators that
+ * hold tokens add the ones applied after the error with delay, and the
+ * drivers turn the lag into the offset of the token in the input with
+ * locate.
+ */
 class ParsingError {
 private:
-  std::string description;
-  std::vector<std::string> stack;
+  // the name, a std::string, or the ErrorDetails if detailed
+  std::shared_ptr<const void> data;
+  // Format the token stored in the payload, for ErrorCode::Unexpected.
+  std::string (*describe)(std::uint64_t) = nullptr;
+  // The token, for ErrorCode::Unexpected.
+  std::uint64_t payload = 0;
+  std::uint64_t position = 0;
+  // the tokens held by the combinators, which is far below the input size
+  std::uint32_t lag = 0;
+  ErrorCode code = ErrorCode::Custom;
+  bool detailed = false;
+
+  const ErrorDetails *getDetails() const {
+    return detailed ? static_cast<const ErrorDetails *>(data.get()) : nullptr;
+  }
+
+  // The details, made or copied if they are shared, to be modified.
+  ErrorDetails &details();
+
+  void push(Name name, const bool alternate) {
+    details().stack.push_back(ErrorFrame{std::move(name), alternate});
+  }
 
 public:
-  ParsingError() : description("") {}
+  ParsingError() = default;
+
+  ParsingError(const std::string &description, const std::string &name);
+
+  /**
+   * Lag is the number of tokens applied to the parser from the one the error
+   * is at, see getLag.
+   */
+  ParsingError(ErrorCode code, Name name, std::uint64_t lag = 0)
+      : data(std::move(name.value)), lag(static_cast<std::uint32_t>(lag)),
+        code(code) {}
 
-  ParsingError(const std::string &description, const std::string &name)
-      : description(description) {
-    stack.push_back(name);
+  /**
+   * Error for an unexpected token, the last one applied. The token is stored
+   * as is and formatted by the describe function when needed, so it must be
+   * trivially copyable and fit in 8 bytes.
+   */
+  template <typename U>
+  static ParsingError unexpected(const U &token,
+                                 std::string (*describe)(std::uint64_t),
+                                 Name name) {
+    static_assert(std::is_trivially_copyable_v<U> &&
+                  sizeof(U) <= sizeof(std::uint64_t));
+    ParsingError e(ErrorCode::Unexpected, std::move(name), 1);
+    std::memcpy(&e.payload, &token, sizeof(U));
+    e.describe = describe;
+    return e;
   }
 
-  void record(const std::string &name) { stack.push_back(name); }
+  /**
+   * Error for an unexpected token, the last one applied, that cannot be
+   * stored as is, formatted when the error is made.
+   */
+  static ParsingError unexpected(std::string token, Name name) {
+    ParsingError e(ErrorCode::Unexpected, std::move(name), 1);
+    e.details().text = std::move(token);
+    return e;
+  }
 
-  std::string toString() const {
-    std::string result = description;
-    for (const auto &msg : stack) {
-      result += "\n  at " + msg;
-    }
-    return result;
+  void record(Name name) { push(std::move(name), false); }
+
+  // Record an alternation, which is shown as "name (alt)".
+  void recordAlternate(Name name) { push(std::move(name), true); }
+
+  ErrorCode getCode() const { return code; }
+
+  /**
+   * The number of tokens applied to the parser from the one the error is at:
+   * 1 if it failed on the last token, 0 if it failed at the end of input.
+   */
+  std::uint64_t getLag() const { return lag; }
+
+  /**
+   * Count tokens that were applied to the parser after the ones its
+   * sub-parser saw when it failed.
+   */
+  void delay(std::uint64_t tokens) {
+    lag += static_cast<std::uint32_t>(tokens);
+  }
+
+  // For the parsers that track where their errors are themselves.
+  void setLag(std::uint64_t lag) {
+    this->lag = static_cast<std::uint32_t>(lag);
+  }
+
+  /**
+   * Set the position from the number of tokens applied to the parser in the
+   * input, up to the one it returned the error on.
+   */
+  void locate(std::uint64_t applied) {
+    position = applied > lag ? applied - lag : 0;
   }
 
+  /**
+   * The offset of the token the error is at in the input, or of the end of
+   * input, once the error is located (see locate). The drivers locate the
+   * errors they return.
+   */
+  std::uint64_t getPosition() const { return position; }
+
+  std::string toString() const;
+
   template <typename S, typename T>
   static ParserResult<S, T> get(const std::string &desc,
                                 const std::string &name) {
@@ -65,10 +327,18 @@ public:
   }
 
   template <typename S, typename T>
-  static ParserResult<S, T> get(ParsingError &e) {
+  static ParserResult<S, T> get(ErrorCode code, Name name,
+                                std::uint64_t lag = 0) {
+    return std::make_optional(
+        std::variant<ParsingError, std::unique_ptr<AbstractParserResult<S, T>>>(
+            ParsingError(code, std::move(name), lag)));
+  }
+
+  template <typename S, typename T>
+  static ParserResult<S, T> get(const ParsingError &e) {
     return std::make_optional(
         std::variant<ParsingError, std::unique_ptr<AbstractParserResult<S, T>>>(
-            ParsingError(e)));
+            e));
   }
 };
 
@@ -87,6 +357,20 @@ ParsingError &asError(ParserResult<S, T> &result) {
   return std::get<ParsingError>(result.value());
 }
 
+// an error is in every result that is not an output, so it is kept small
+static_assert(sizeof(ParsingError) <= 48);
+static_assert(sizeof(ParserResult<char, std::string>) <= 64);
+
+/**
+ * Result of applying a span of tokens to a parser. `consumed` is the number of
+ * tokens taken from the span, the last one being the token that made the
+ * parser return `result`. If `result` is empty, the whole span is consumed.
+ */
+template <typename S, typename T> struct FeedResult {
+  std::size_t consumed;
+  ParserResult<S, T> result;
+};
+
 template <typename S, typename T> class AbstractParser {
 public:
   virtual ~AbstractParser() = default;
@@ -97,11 +381,141 @@ public:
 
   virtual ParserResult<S, T> operator()() = 0;
 
-  virtual const std::string &getName() = 0;
+  /**
+   * Bulk version of operator()(const S &): apply the tokens in [begin, end)
+   * until the parser returns something. This is the same as applying the
+   * tokens one by one, which is what the default implementation does, but the
+   * combinators can override it to avoid the virtual call and the result check
+   * per token.
+   */
+  virtual FeedResult<S, T> feed(const S *begin, const S *end) {
+    for (const S *it = begin; it != end; ++it) {
+      if (auto result = (*this)(*it); result.has_value())
+        return {static_cast<std::size_t>(it - begin + 1), std::move(result)};
+    }
+    return {static_cast<std::size_t>(end - begin), {}};
+  }
+
+  virtual const std::string &getName() const = 0;
+
+  virtual AbstractParserPtr<S, T> clone() const = 0;
+
+  /**
+   * A parser of the same grammar in its initial state, which borrows the
+   * configuration of this one (the sub-parsers it is made from, the
+   * predicates, the tables) instead of copying it, so only the state is
+   * allocated. This parser must outlive the instance, and must not change
+   * while it is used. The instances of a parser can be made and used by
+   * several threads (see Grammar). The default is clone.
+   */
+  virtual AbstractParserPtr<S, T> instantiate() const { return clone(); }
+
+  /**
+   * The tokens that this parser may accept as the first token. Parsers that
+   * cannot tell should return FirstSet<S>::any(), which is the default.
+   */
+  virtual FirstSet<S> first() const { return FirstSet<S>::any(); }
+
+  /**
+   * The tokens if the parser accepts exactly this sequence of tokens without
+   * lookahead, so that combinators can match literals specially. This only
+   * describes the input, not the output.
+   */
+  virtual std::optional<std::vector<S>> literal() const { return {}; }
 
-  virtual AbstractParserPtr<S, T> clone() = 0;
+  /**
+   * Copy the state of another parser into this one. The other parser must be
+   * of the same grammar, i.e. this parser or a clone of it. Returns false if
+   * the parser does not support it (the default), in which case the state of
+   * this parser is unspecified and it should be reset.
+   *
+   * The other parser may be modified, but its state is the same afterwards.
+   */
+  virtual bool restore(AbstractParser<S, T> &) { return false; }
+
+  /**
+   * In the validating mode, the parser only recognizes the input: the results
+   * have the same remaining tokens, but the parsers skip building their
+   * outputs, so the outputs of the results are unspecified (usually there are
+   * none). The combinators pass the mode to their sub-parsers, including the
+   * ones instantiated later, and the clones keep it. The parsers that do not
+   * support it (the default) still build their outputs, and the combinators
+   * drop them.
+   */
+  virtual void setValidating(const bool) {}
+
+  /**
+   * In the sink mode, the parser puts its outputs in the sink as soon as they
+   * are its own, instead of passing them up in its results: the outputs of a
+   * result are the ones the parser put in the sink since it started, followed
+   * by the ones left in the result. The parsers that do not support the mode
+   * (the default) leave all of them in the result. A parser that fails removes
+   * what it put in the sink.
+   *
+   * The combinators give the sink to their sub-parsers, and a sink of their
+   * own to the ones that run at the same time (the options of an alternation),
+   * so the outputs skip the queues of the combinators and the get calls through
+   * every level of results. The clones are not in the mode, and the parsers in
+   * the mode cannot be restored. nullptr leaves the mode.
+   */
+  virtual void setSink(OutputSink<T> *) {}
+
+  /**
+   * A clone of the parser in its current state, which can be applied later
+   * with restore to roll back to this point. This is O(state), unlike
+   * replaying the tokens since the checkpoint. Returns nullptr if the parser
+   * does not support restore.
+   */
+  AbstractParserPtr<S, T> snapshot() {
+    auto p = clone();
+    if (!p->restore(*this))
+      return nullptr;
+    return p;
+  }
+};
+
+/**
+ * The outcome of validate.
+ */
+struct Validation {
+  bool matched = false;
+  // the number of tokens of the match
+  std::size_t length = 0;
+  // the error if it did not match, located in the span
+  std::optional<ParsingError> error;
 };
 
+/**
+ * Match the parser against a prefix of [begin, end) (the end of the span is
+ * the end of input), and return whether it matched and the length of the
+ * match: the tokens applied less the remaining tokens of the result. The
+ * parser should be in the validating mode (see setValidating), otherwise its
+ * outputs are built and dropped.
+ */
+template <typename S, typename T>
+Validation validate(AbstractParser<S, T> &parser, const S *begin,
+                    const S *end) {
+  Validation validation;
+  auto [consumed, r] = parser.feed(begin, end);
+  if (!r.has_value())
+    r = parser();
+  if (!r.has_value())
+    r = ParsingError::get<S, T>(ErrorCode::Incomplete, parser.getName());
+  if (isError(r)) {
+    validation.error = std::move(asError(r));
+    validation.error->locate(consumed);
+    return validation;
+  }
+  std::size_t remaining = 0;
+  auto &result = asResult(r);
+  while (result->getRemaining().has_value())
+    ++remaining;
+  validation.matched = true;
+  // the parsers that expand the input may return more tokens than applied
+  validation.length = consumed > remaining ? consumed - remaining : 0;
+  return validation;
+}
+
 template <typename R, typename S, typename T, typename... _Args>
 inline ParserResult<S, T> castResult(_Args &&... args) {
   AbstractParserResultPtr<S, T> p =
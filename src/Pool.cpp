@@ -0,0 +1,106 @@
+#include "Pool.hpp"
+
+namespace Parser {
+
+ThreadPool::ThreadPool(unsigned int threads) {
+  if (threads == 0)
+    threads = 1;
+  for (unsigned int i = 0; i < threads; ++i)
+    ranges.push_back(std::make_unique<Range>());
+  for (unsigned int i = 1; i < threads; ++i)
+    this->threads.emplace_back([this, i] { wait(i); });
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &t : threads)
+    t.join();
+}
+
+bool ThreadPool::next(const unsigned int worker, std::size_t &index) {
+  auto &own = *ranges[worker];
+  {
+    std::lock_guard<std::mutex> guard(own.lock);
+    if (own.begin < own.end) {
+      index = own.begin++;
+      return true;
+    }
+  }
+  while (true) {
+    // the largest range, it is only a hint as the owner keeps taking from it
+    Range *victim = nullptr;
+    std::size_t largest = 0;
+    for (auto &r : ranges) {
+      std::lock_guard<std::mutex> guard(r->lock);
+      if (r->end - r->begin > largest) {
+        largest = r->end - r->begin;
+        victim = r.get();
+      }
+    }
+    if (victim == nullptr)
+      return false;
+    std::size_t begin, end;
+    {
+      std::lock_guard<std::mutex> guard(victim->lock);
+      if (victim->begin == victim->end)
+        continue;
+      begin = victim->begin + (victim->end - victim->begin) / 2;
+      end = victim->end;
+      victim->end = begin;
+    }
+    std::lock_guard<std::mutex> guard(own.lock);
+    index = begin;
+    own.begin = begin + 1;
+    own.end = end;
+    return true;
+  }
+}
+
+void ThreadPool::work(const unsigned int worker) {
+  std::size_t index;
+  while (next(worker, index))
+    (*task)(index, worker);
+}
+
+void ThreadPool::wait(const unsigned int worker) {
+  std::size_t seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      wake.wait(guard, [&] { return stopping || loop != seen; });
+      if (stopping)
+        return;
+      seen = loop;
+    }
+    work(worker);
+    std::lock_guard<std::mutex> guard(lock);
+    if (--running == 0)
+      done.notify_one();
+  }
+}
+
+void ThreadPool::run(const std::size_t n, const Task &task) {
+  std::size_t count = ranges.size();
+  for (std::size_t i = 0; i < count; ++i) {
+    std::lock_guard<std::mutex> guard(ranges[i]->lock);
+    ranges[i]->begin = n * i / count;
+    ranges[i]->end = n * (i + 1) / count;
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    this->task = &task;
+    running = threads.size();
+    ++loop;
+  }
+  wake.notify_all();
+  work(0);
+  std::unique_lock<std::mutex> guard(lock);
+  done.wait(guard, [&] { return running == 0; });
+  this->task = nullptr;
+}
+
+} // namespace Parser
@@ -0,0 +1,64 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Parser {
+
+/**
+ * A fixed set of threads that run the iterations of a loop. The indices are
+ * split in one range per thread, and a thread that is done with its range
+ * steals the upper half of the largest range left, so the threads stay busy
+ * when the iterations take different times.
+ *
+ * The calling thread of run is the worker 0, and the other workers are
+ * threads that wait for the next loop.
+ */
+class ThreadPool {
+public:
+  using Task = std::function<void(std::size_t index, unsigned int worker)>;
+
+private:
+  struct Range {
+    std::mutex lock;
+    std::size_t begin = 0;
+    std::size_t end = 0;
+  };
+
+  std::vector<std::unique_ptr<Range>> ranges;
+  std::vector<std::thread> threads;
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const Task *task = nullptr;
+  // incremented for every loop, so that the workers run it once
+  std::size_t loop = 0;
+  unsigned int running = 0;
+  bool stopping = false;
+
+  bool next(const unsigned int worker, std::size_t &index);
+  void work(const unsigned int worker);
+  void wait(const unsigned int worker);
+
+public:
+  ThreadPool(unsigned int threads = std::thread::hardware_concurrency());
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  unsigned int size() const { return ranges.size(); }
+
+  /**
+   * Call the task for every index in [0, n), from all the workers, and
+   * returns when they are all done. It must not be called from a task or
+   * from two threads at the same time.
+   */
+  void run(const std::size_t n, const Task &task);
+};
+
+} // namespace Parser
@@ -1,18 +1,19 @@
 #include "Predicate.hpp"
 namespace Parser {
-// Actually this is a specific case of constant string matching using stateful
-// predicate.
+// Actually this is a specific case of constant string matching using the
+// index of the token.
 std::unique_ptr<
     PredicateParser<char, std::string, Utils::fromChar, Utils::fold>>
 StringPredicate(const std::string &str, const std::string &name) {
-  auto fn = [str]() {
-    unsigned int i = 0;
-    return [str, i](const char &c) mutable {
-      return i == str.length() || str[i++] == c;
-    };
+  auto fn = [str](const char &c, int i) {
+    return static_cast<std::size_t>(i) == str.length() || str[i] == c;
   };
   return std::make_unique<
       PredicateParser<char, std::string, Utils::fromChar, Utils::fold>>(
-      fn, str.length(), name);
+      fn, str.length(), name,
+      str.empty() ? FirstSet<char>::any() : FirstSet<char>::of(str[0]),
+      str.empty()
+          ? std::nullopt
+          : std::make_optional(std::vector<char>(str.begin(), str.end())));
 };
 } // namespace Parser
\ No newline at end of file
@@ -18,18 +18,52 @@ template <typename T> T identity(const T &v) { return v; }
  * of type S and convert it to output type T. The fold function (actually foldl)
  * aggregate the input (T->T->T), and the toStr function give us a
  * human-readable error message (though I found that I did not use it much).
+ *
+ * The predicate is either given with the index of the token in the match
+ * (the number of tokens accepted before it), so that it needs no state to
+ * match a sequence, or made by a generator. A generated predicate may be
+ * stateful, so it is generated again when the parser is reset, which may
+ * allocate. The functions, the FIRST set and the literal are shared by the
+ * clones, only the generated predicate is copied.
  */
 template <typename S, typename T, T convert(const S &),
           T fold(const T &, const T &),
           std::string toStr(const T &) = identity<T>>
 class PredicateParser final : public AbstractParser<S, T> {
 private:
-  std::function<std::function<bool(const S &)>()> predicateGen;
+  using Generator = std::function<std::function<bool(const S &)>()>;
+  using Indexed = std::function<bool(const S &, int)>;
+
+  struct Config {
+    Generator predicateGen;
+    Indexed indexed;
+    FirstSet<S> firstSet;
+    std::optional<std::vector<S>> literalTokens;
+  };
+
+  std::shared_ptr<const Config> config;
   std::function<bool(const S &)> predicate;
   int quantifier;
+  // the token, for the predicates matching a single token
+  std::optional<S> token;
   int count = 0;
+  // the count when the aggregated value started, after the pieces pushed to
+  // the sink
+  int piece = 0;
   T aggregated;
-  std::string name;
+  Name name;
+  OutputSink<T> *sink = nullptr;
+  // skip convert and fold, the results have no value
+  bool validating = false;
+
+  template <auto f, auto g>
+  static constexpr bool same =
+      std::is_same_v<std::integral_constant<decltype(f), f>,
+                     std::integral_constant<decltype(g), g>>;
+  // the value is the concatenation of the characters, so a run of them is
+  // appended at once
+  static constexpr bool concatenates =
+      same<convert, Utils::fromChar> && same<fold, Utils::fold>;
 
   class PredicateParserResult final : public AbstractParserResult<S, T> {
   private:
@@ -45,10 +79,11 @@ private:
         : token(token), tokenLeft(true), valueLeft(false) {}
 
     PredicateParserResult(T value)
-        : value(value), tokenLeft(false), valueLeft(true) {}
+        : value(std::move(value)), tokenLeft(false), valueLeft(true) {}
 
     PredicateParserResult(S token, T value)
-        : token(token), value(value), tokenLeft(true), valueLeft(true) {}
+        : token(token), value(std::move(value)), tokenLeft(true),
+          valueLeft(true) {}
 
     std::optional<S> getRemaining() override {
       if (tokenLeft) {
@@ -61,76 +96,271 @@ private:
     std::optional<T> get() override {
       if (valueLeft) {
         valueLeft = false;
-        return std::make_optional(value);
+        return std::make_optional(std::move(value));
       }
       return {};
     }
   };
 
-public:
-  PredicateParser(decltype(predicateGen) predicateGen, const int quantifier,
-                  const std::string &name)
-      : predicateGen(predicateGen), predicate(predicateGen()),
-        quantifier(quantifier), name(name) {}
+  static std::string describe(std::uint64_t payload) {
+    S s;
+    std::memcpy(&s, &payload, sizeof(S));
+    return toStr(convert(s));
+  }
 
-  PredicateParser(const S s, const int quantifier, const std::string &name)
-      : predicateGen([s]() { return [s](const S &v) { return v == s; }; }),
-        predicate(predicateGen()), quantifier(quantifier), name(name) {}
+  ParsingError unexpected(const S &value) {
+    // Tokens are formatted lazily if we can store them in the error. Pointers
+    // may not be valid by then.
+    if constexpr (std::is_trivially_copyable_v<S> && !std::is_pointer_v<S> &&
+                  sizeof(S) <= sizeof(std::uint64_t))
+      return ParsingError::unexpected(value, describe, name);
+    else
+      return ParsingError::unexpected(toStr(convert(value)), name);
+  }
 
-  void reset() override {
-    count = 0;
-    // The predicate function is stateful. We need to generate a new one when we
-    // reset the parser.
-    predicate = predicateGen();
+  // Whether the aggregated value goes in the result. In the sink mode it is
+  // put in the sink instead.
+  bool keep() {
+    if (validating)
+      return false;
+    if (sink != nullptr) {
+      sink->push(std::move(aggregated));
+      return false;
+    }
+    return true;
   }
 
-  AbstractParserPtr<S, T> clone() override {
-    return std::make_unique<PredicateParser>(predicateGen, quantifier, name);
+  bool test(const S &value) {
+    return config->indexed ? config->indexed(value, count) : predicate(value);
   }
 
-  ParserResult<S, T> operator()(const S &value) override {
-    // Simple logic: Handle the special quantifiers specifically in each case.
-    if (predicate(value)) {
+  // Simple logic: Handle the special quantifiers specifically in each case.
+  ParserResult<S, T> accept(const S &value) {
+    if (!validating) {
       T v = convert(value);
-      if (count++ == 0)
-        aggregated = v;
+      if (count == piece)
+        aggregated = std::move(v);
       else
         aggregated = fold(aggregated, v);
-      if (quantifier == NONE)
-        return ParsingError::get<S, T>("Unexpected " + toStr(v), name);
-      if (quantifier == ONCE || quantifier == OPTIONAL || quantifier == count) {
-        auto parsed = castResult<PredicateParserResult, S, T>(aggregated);
-        reset();
-        return parsed;
+    }
+    ++count;
+    if (quantifier == NONE) {
+      auto error = unexpected(value);
+      reset();
+      return ParsingError::get<S, T>(error);
+    }
+    if (quantifier == ONCE || quantifier == OPTIONAL || quantifier == count) {
+      auto parsed = keep() ? castResult<PredicateParserResult, S, T>(
+                                 std::move(aggregated))
+                           : castResult<PredicateParserResult, S, T>();
+      reset();
+      return parsed;
+    }
+    // the value of a long run is pushed in pieces, see OutputSink
+    if (sink != nullptr && !validating && sink->getPieces() > 0 &&
+        (quantifier == MORE || quantifier == ANY) &&
+        static_cast<std::size_t>(count - piece) == sink->getPieces()) {
+      sink->push(std::move(aggregated));
+      piece = count;
+    }
+    return {};
+  }
+
+  // Whether accepting the next token only counts it: the parser does not
+  // fail, complete or push a piece of the value to the sink on it.
+  bool counts() const {
+    if (quantifier == NONE || quantifier == ONCE || quantifier == OPTIONAL ||
+        quantifier == count + 1)
+      return false;
+    return sink == nullptr || validating || sink->getPieces() == 0 ||
+           (quantifier != MORE && quantifier != ANY) ||
+           static_cast<std::size_t>(count + 1 - piece) != sink->getPieces();
+  }
+
+  // Aggregate the tokens that were counted without it, the last ones.
+  void aggregate(const S *begin, const S *end) {
+    if (validating || begin == end)
+      return;
+    int start = count - static_cast<int>(end - begin);
+    if constexpr (concatenates) {
+      if (start == piece)
+        aggregated.assign(begin, end);
+      else
+        aggregated.append(begin, end);
+    } else {
+      for (const S *it = begin; it != end; ++it, ++start) {
+        if (start == piece)
+          aggregated = convert(*it);
+        else
+          aggregated = fold(aggregated, convert(*it));
       }
-      return {};
     }
+  }
+
+  ParserResult<S, T> reject(const S &value) {
     if (count < quantifier ||
         (count == 0 && (quantifier == ONCE || quantifier == MORE))) {
+      auto error = ParsingError(ErrorCode::InsufficientTokens, name, 1);
       reset();
-      return ParsingError::get<S, T>("Insufficient tokens", name);
+      return ParsingError::get<S, T>(error);
     }
     auto result =
-        count == 0 ? castResult<PredicateParserResult, S, T>(value)
-                   : castResult<PredicateParserResult, S, T>(value, aggregated);
+        count == piece || !keep()
+            ? castResult<PredicateParserResult, S, T>(value)
+            : castResult<PredicateParserResult, S, T>(value,
+                                                      std::move(aggregated));
     reset();
     return result;
   }
 
+  static bool isNullable(const int quantifier) {
+    return quantifier == NONE || quantifier == OPTIONAL || quantifier == ANY ||
+           quantifier == 0;
+  }
+
+  static std::shared_ptr<const Config>
+  configure(Generator predicateGen, Indexed indexed, FirstSet<S> first,
+            std::optional<std::vector<S>> literal, const int quantifier) {
+    first.setNullable(first.isNullable() || isNullable(quantifier));
+    return std::make_shared<const Config>(Config{
+        std::move(predicateGen), std::move(indexed), std::move(first),
+        std::move(literal)});
+  }
+
+  PredicateParser(std::shared_ptr<const Config> config, const int quantifier,
+                  std::optional<S> token, Name name)
+      : config(std::move(config)), quantifier(quantifier), token(token),
+        name(name) {
+    reset();
+  }
+
+public:
+  /**
+   * The FIRST set can be provided if it is known which tokens the predicate
+   * may accept as the first token, and the literal if the predicate only
+   * accepts a fixed sequence of tokens.
+   */
+  PredicateParser(Generator predicateGen, const int quantifier, Name name,
+                  FirstSet<S> first = FirstSet<S>::any(),
+                  std::optional<std::vector<S>> literal = {})
+      : PredicateParser(configure(std::move(predicateGen), nullptr,
+                                  std::move(first), std::move(literal),
+                                  quantifier),
+                        quantifier, {}, name) {}
+
+  PredicateParser(Indexed indexed, const int quantifier, Name name,
+                  FirstSet<S> first = FirstSet<S>::any(),
+                  std::optional<std::vector<S>> literal = {})
+      : PredicateParser(configure(nullptr, std::move(indexed),
+                                  std::move(first), std::move(literal),
+                                  quantifier),
+                        quantifier, {}, name) {}
+
+  PredicateParser(const S s, const int quantifier, Name name)
+      : PredicateParser(
+            configure(nullptr, [s](const S &v, int) { return v == s; },
+                      FirstSet<S>::of(s),
+                      quantifier > 0 ? std::make_optional(
+                                           std::vector<S>(quantifier, s))
+                                     : std::nullopt,
+                      quantifier),
+            quantifier, s, name) {}
+
+  void reset() override {
+    count = 0;
+    piece = 0;
+    // The generated predicate may be stateful. We need to generate a new one
+    // when we reset the parser.
+    if (config->predicateGen)
+      predicate = config->predicateGen();
+  }
+
+  AbstractParserPtr<S, T> clone() const override {
+    auto p = std::unique_ptr<PredicateParser>(
+        new PredicateParser(config, quantifier, token, name));
+    p->validating = validating;
+    return p;
+  }
+
+  const std::optional<S> &getToken() const { return token; }
+  int getQuantifier() const { return quantifier; }
+
+  /**
+   * The predicate function is copied with the state, so stateful predicates
+   * must capture their state by value. The value aggregated so far is copied
+   * as well, so it cannot be restored if T cannot be copied.
+   */
+  bool restore(AbstractParser<S, T> &other) override {
+    auto p = dynamic_cast<PredicateParser *>(&other);
+    if (p == nullptr)
+      return false;
+    if constexpr (std::is_copy_assignable_v<T>) {
+      aggregated = p->aggregated;
+    } else if (p->count > 0 && !validating) {
+      return false;
+    }
+    predicate = p->predicate;
+    count = p->count;
+    piece = p->piece;
+    return true;
+  }
+
+  void setValidating(const bool validating) override {
+    this->validating = validating;
+  }
+
+  void setSink(OutputSink<T> *sink) override { this->sink = sink; }
+
+  FirstSet<S> first() const override { return config->firstSet; }
+
+  std::optional<std::vector<S>> literal() const override {
+    return config->literalTokens;
+  }
+
+  ParserResult<S, T> operator()(const S &value) override {
+    return test(value) ? accept(value) : reject(value);
+  }
+
+  /**
+   * Same as applying the tokens one by one, but the tokens of a run that only
+   * count are aggregated together when the run ends: a string of characters
+   * is appended at once instead of being folded for each character.
+   */
+  FeedResult<S, T> feed(const S *begin, const S *end) override {
+    // the tokens counted but not aggregated yet
+    const S *run = begin;
+    for (const S *it = begin; it != end; ++it) {
+      bool matches = test(*it);
+      if (matches && counts()) {
+        ++count;
+        continue;
+      }
+      aggregate(run, it);
+      run = it + 1;
+      auto result = matches ? accept(*it) : reject(*it);
+      if (result.has_value())
+        return {static_cast<std::size_t>(it - begin + 1), std::move(result)};
+    }
+    aggregate(run, end);
+    return {static_cast<std::size_t>(end - begin), {}};
+  }
+
   ParserResult<S, T> operator()() override {
     if (count < quantifier ||
         (count == 0 && (quantifier == ONCE || quantifier == MORE))) {
+      auto error = ParsingError(ErrorCode::InsufficientTokens, name);
       reset();
-      return ParsingError::get<S, T>("Insufficient tokens", name);
+      return ParsingError::get<S, T>(error);
     }
-    auto result = count == 0
+    auto result = count == piece || !keep()
                       ? castResult<PredicateParserResult, S, T>()
-                      : castResult<PredicateParserResult, S, T>(aggregated);
+                      : castResult<PredicateParserResult, S, T>(
+                            std::move(aggregated));
     reset();
     return result;
   }
 
-  const std::string &getName() override { return name; }
+  const std::string &getName() const override { return name.str(); }
 
   static AbstractParserPtr<S, T> get(const S &s, const int quantifier,
                                      const std::string &name) {
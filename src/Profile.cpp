@@ -0,0 +1,72 @@
+#include "Profile.hpp"
+#include <iomanip>
+
+namespace Parser {
+
+namespace {
+double milliseconds(Profiler::Clock::duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+double microseconds(Profiler::Clock::duration d) {
+  return std::chrono::duration<double, std::micro>(d).count();
+}
+
+void escape(std::ostream &out, const std::string &s) {
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      out << '\\' << c;
+    else if (static_cast<unsigned char>(c) < 0x20)
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+          << static_cast<int>(c) << std::dec << std::setfill(' ');
+    else
+      out << c;
+  }
+}
+} // namespace
+
+Profiler::Profiler(const std::size_t maxEvents) : maxEvents(maxEvents) {
+  nodes.push_back(Node{"root", -1, {}});
+}
+
+int Profiler::child(const int parent, const std::string &name) {
+  for (int c : nodes[parent].children) {
+    if (nodes[c].name == name)
+      return c;
+  }
+  int c = nodes.size();
+  nodes.push_back(Node{name, parent, {}});
+  nodes[parent].children.push_back(c);
+  return c;
+}
+
+void Profiler::print(std::ostream &out, const int node, const int depth) const {
+  auto &n = nodes[node];
+  out << std::string(depth * 2, ' ') << n.name << ": tokens " << n.tokens
+      << ", results " << n.results << ", errors " << n.errors << ", clones "
+      << n.clones << ", resets " << n.resets << ", allocations "
+      << n.allocations << ", inclusive " << milliseconds(n.inclusive)
+      << " ms, exclusive " << milliseconds(n.exclusive) << " ms" << std::endl;
+  for (int c : n.children)
+    print(out, c, depth + 1);
+}
+
+void Profiler::report(std::ostream &out) const {
+  for (int c : nodes[root].children)
+    print(out, c, 0);
+}
+
+void Profiler::writeTrace(std::ostream &out) const {
+  out << "{\"traceEvents\": [";
+  for (std::size_t i = 0; i < events.size(); ++i) {
+    auto &e = events[i];
+    out << (i == 0 ? "\n" : ",\n") << "{\"name\": \"";
+    escape(out, nodes[e.node].name);
+    out << "\", \"ph\": \"X\", \"ts\": " << microseconds(e.start)
+        << ", \"dur\": " << microseconds(e.duration)
+        << ", \"pid\": 1, \"tid\": 1}";
+  }
+  out << "\n]}" << std::endl;
+}
+
+} // namespace Parser
@@ -0,0 +1,266 @@
+#pragma once
+#include "Alternate.hpp"
+#include "Arena.hpp"
+#include "Lazy.hpp"
+#include "Parser.hpp"
+#include "Sequence.hpp"
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace Parser {
+
+/**
+ * The counters of the parsers instrumented with instrument(), as a tree of
+ * the names of the parsers. The exclusive time and allocations of a node do
+ * not include the ones of its children, and the inclusive time does not count
+ * the recursive calls twice.
+ *
+ * The calls are also recorded as Chrome trace events (chrome://tracing or
+ * Perfetto), up to a maximum number of events.
+ *
+ * A profiler must only be used by one thread.
+ */
+class Profiler {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Node {
+    std::string name;
+    int parent;
+    std::vector<int> children;
+    std::size_t tokens = 0;
+    std::size_t results = 0;
+    std::size_t errors = 0;
+    std::size_t clones = 0;
+    std::size_t resets = 0;
+    std::size_t allocations = 0;
+    Clock::duration inclusive{};
+    Clock::duration exclusive{};
+    // the number of calls in progress, for the recursive calls
+    unsigned int active = 0;
+  };
+
+  static constexpr int root = 0;
+
+private:
+  struct Frame {
+    int node;
+    Clock::time_point start;
+    Clock::duration children;
+    std::size_t allocations;
+    std::size_t childAllocations;
+  };
+
+  struct Event {
+    int node;
+    Clock::duration start;
+    Clock::duration duration;
+  };
+
+  std::vector<Node> nodes;
+  std::vector<Frame> stack;
+  std::vector<Event> events;
+  std::size_t maxEvents;
+  Clock::time_point origin = Clock::now();
+
+  void print(std::ostream &out, const int node, const int depth) const;
+
+  // the allocations are only counted with PARSER_PROFILE
+  static std::size_t allocations() {
+#ifdef PARSER_PROFILE
+    return allocationCount();
+#else
+    return 0;
+#endif
+  }
+
+public:
+  Profiler(const std::size_t maxEvents = 1 << 20);
+
+  /**
+   * The child of the node with the name, which is created if it does not
+   * exist.
+   */
+  int child(const int parent, const std::string &name);
+
+  Node &get(const int node) { return nodes[node]; }
+  const std::vector<Node> &getNodes() const { return nodes; }
+
+  void enter(const int node) {
+    ++nodes[node].active;
+    stack.push_back({node, Clock::now(), {}, allocations(), 0});
+  }
+
+  void leave() {
+    auto frame = stack.back();
+    stack.pop_back();
+    auto duration = Clock::now() - frame.start;
+    auto allocated = allocations() - frame.allocations;
+    auto &node = nodes[frame.node];
+    node.exclusive += duration - frame.children;
+    node.allocations += allocated - frame.childAllocations;
+    if (--node.active == 0)
+      node.inclusive += duration;
+    if (!stack.empty()) {
+      stack.back().children += duration;
+      stack.back().childAllocations += allocated;
+    }
+    if (events.size() < maxEvents)
+      events.push_back({frame.node, frame.start - origin, duration});
+  }
+
+  /**
+   * Print the tree, one line per node with its counters and times in
+   * milliseconds.
+   */
+  void report(std::ostream &out) const;
+
+  /**
+   * Write the calls in the Chrome trace event format.
+   */
+  void writeTrace(std::ostream &out) const;
+};
+
+#ifdef PARSER_PROFILE
+
+/**
+ * Decorator that counts the calls of a parser in a profiler node. The clones
+ * share the node, so the instances of lazy parsers are counted together.
+ */
+template <typename S, typename T>
+class ProfiledParser final : public AbstractParser<S, T> {
+private:
+  AbstractParserPtr<S, T> parser;
+  Profiler *profiler;
+  int node;
+
+  struct Scope {
+    Profiler &profiler;
+    Scope(Profiler &profiler, const int node) : profiler(profiler) {
+      profiler.enter(node);
+    }
+    ~Scope() { profiler.leave(); }
+  };
+
+  ParserResult<S, T> count(ParserResult<S, T> result) {
+    if (result.has_value())
+      ++(isError(result) ? profiler->get(node).errors
+                         : profiler->get(node).results);
+    return result;
+  }
+
+public:
+  ProfiledParser(decltype(parser) parser, Profiler *profiler, const int node)
+      : parser(std::move(parser)), profiler(profiler), node(node) {}
+
+  void reset() override {
+    ++profiler->get(node).resets;
+    parser->reset();
+  }
+
+  AbstractParserPtr<S, T> clone() const override {
+    ++profiler->get(node).clones;
+    return std::make_unique<ProfiledParser>(parser->clone(), profiler, node);
+  }
+
+  AbstractParserPtr<S, T> instantiate() const override {
+    ++profiler->get(node).clones;
+    return std::make_unique<ProfiledParser>(parser->instantiate(), profiler,
+                                            node);
+  }
+
+  ParserResult<S, T> operator()(const S &value) override {
+    Scope scope(*profiler, node);
+    ++profiler->get(node).tokens;
+    return count((*parser)(value));
+  }
+
+  FeedResult<S, T> feed(const S *begin, const S *end) override {
+    Scope scope(*profiler, node);
+    auto [consumed, result] = parser->feed(begin, end);
+    profiler->get(node).tokens += consumed;
+    return {consumed, count(std::move(result))};
+  }
+
+  ParserResult<S, T> operator()() override {
+    Scope scope(*profiler, node);
+    return count((*parser)());
+  }
+
+  bool restore(AbstractParser<S, T> &other) override {
+    auto p = dynamic_cast<ProfiledParser *>(&other);
+    return p != nullptr && parser->restore(*p->parser);
+  }
+
+  void setValidating(const bool validating) override {
+    parser->setValidating(validating);
+  }
+
+  void setSink(OutputSink<T> *sink) override { parser->setSink(sink); }
+
+  const std::string &getName() const override { return parser->getName(); }
+  FirstSet<S> first() const override { return parser->first(); }
+  std::optional<std::vector<S>> literal() const override {
+    return parser->literal();
+  }
+};
+
+template <typename S, typename T>
+AbstractParserPtr<S, T>
+instrument(AbstractParserPtr<S, T> parser, Profiler &profiler,
+           const int parent, std::unordered_set<const void *> &visited);
+
+/**
+ * Instrument the sub-parsers of a parser in place: the children of sequences
+ * and alternations, and the sources of lazy parsers (once per source, as they
+ * may be recursive).
+ */
+template <typename S, typename T>
+void instrumentChildren(AbstractParser<S, T> &parser, Profiler &profiler,
+                        const int node,
+                        std::unordered_set<const void *> &visited) {
+  if (auto p = dynamic_cast<Sequence<S, T> *>(&parser)) {
+    for (auto &child : *p->getSequence())
+      child = instrument(std::move(child), profiler, node, visited);
+  } else if (auto p = dynamic_cast<Alternate<S, T> *>(&parser)) {
+    for (auto &child : *p->getOptions())
+      child = instrument(std::move(child), profiler, node, visited);
+  } else if (auto p = dynamic_cast<LazyParser<S, T> *>(&parser)) {
+    if (visited.insert(p->getSource()).second)
+      instrumentChildren(*p->getSource(), profiler, node, visited);
+  }
+}
+
+template <typename S, typename T>
+AbstractParserPtr<S, T>
+instrument(AbstractParserPtr<S, T> parser, Profiler &profiler,
+           const int parent, std::unordered_set<const void *> &visited) {
+  int node = profiler.child(parent, parser->getName());
+  instrumentChildren(*parser, profiler, node, visited);
+  return std::make_unique<ProfiledParser<S, T>>(std::move(parser), &profiler,
+                                                node);
+}
+
+#endif
+
+/**
+ * Wrap the parser and its sub-parsers in ProfiledParser, if PARSER_PROFILE is
+ * defined. Otherwise the parser is returned as is, so the instrumentation
+ * costs nothing.
+ */
+template <typename S, typename T>
+AbstractParserPtr<S, T> instrument(AbstractParserPtr<S, T> parser,
+                                   Profiler &profiler) {
+#ifdef PARSER_PROFILE
+  std::unordered_set<const void *> visited;
+  return instrument(std::move(parser), profiler, Profiler::root, visited);
+#else
+  (void)profiler;
+  return parser;
+#endif
+}
+
+} // namespace Parser
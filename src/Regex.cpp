@@ -0,0 +1,663 @@
+#include "Regex.hpp"
+#include "CharClass.hpp"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace Parser {
+
+struct RegexParser::Program {
+  enum Kind { Char, Split, Match };
+
+  struct NfaState {
+    Kind kind;
+    // the class of a Char state
+    int cls;
+    // the next states, -1 for none
+    int out;
+    int out1;
+  };
+
+  std::vector<NfaState> nfa;
+  std::vector<CharClass> classes;
+  int start = 0;
+  // the characters that no class distinguishes have the same byte class
+  std::array<std::uint8_t, 256> byteClasses{};
+  unsigned int byteClassCount = 0;
+  FirstSet<char> firstSet;
+  std::size_t limit = 0;
+};
+
+struct RegexParser::Cache {
+  struct DfaState {
+    // the Char and Match states, sorted
+    std::vector<int> set;
+    bool match;
+    // no Char state, so the match cannot be extended
+    bool final;
+  };
+
+  static constexpr int unknown = -1;
+  static constexpr int dead = -2;
+
+  std::shared_ptr<const Program> program;
+  const std::thread::id owner = std::this_thread::get_id();
+  std::vector<DfaState> states;
+  // indexed by state * byteClassCount + byte class
+  std::vector<int> transitions;
+  std::map<std::vector<int>, int> ids;
+  unsigned int generation = 0;
+  std::size_t flushes = 0;
+
+  // the marks of the NFA states for the closures
+  std::vector<unsigned int> marks;
+  unsigned int mark = 0;
+  std::vector<int> stack;
+
+  Cache(std::shared_ptr<const Program> program)
+      : program(std::move(program)), marks(this->program->nfa.size(), 0) {
+    initial();
+  }
+
+  void closure(const int from, std::vector<int> &set) {
+    stack.push_back(from);
+    while (!stack.empty()) {
+      int s = stack.back();
+      stack.pop_back();
+      if (s < 0 || marks[s] == mark)
+        continue;
+      marks[s] = mark;
+      auto &n = program->nfa[s];
+      if (n.kind == Program::Split) {
+        stack.push_back(n.out1);
+        stack.push_back(n.out);
+      } else {
+        set.push_back(s);
+      }
+    }
+  }
+
+  int intern(std::vector<int> set) {
+    auto [it, inserted] = ids.emplace(set, states.size());
+    if (!inserted)
+      return it->second;
+    bool match = false, final = true;
+    for (int s : set) {
+      match |= program->nfa[s].kind == Program::Match;
+      final &= program->nfa[s].kind == Program::Match;
+    }
+    states.push_back({std::move(set), match, final});
+    transitions.resize(transitions.size() + program->byteClassCount, unknown);
+    return it->second;
+  }
+
+  // Clear the cache, the initial state is always 0.
+  void flush() {
+    states.clear();
+    transitions.clear();
+    ids.clear();
+    ++generation;
+    ++flushes;
+    initial();
+  }
+
+  void initial() {
+    std::vector<int> set;
+    ++mark;
+    closure(program->start, set);
+    std::sort(set.begin(), set.end());
+    intern(std::move(set));
+  }
+
+  int compute(const int from, const char c) {
+    auto &p = *program;
+    std::vector<int> set;
+    ++mark;
+    for (int s : states[from].set) {
+      auto &n = p.nfa[s];
+      if (n.kind == Program::Char && p.classes[n.cls].contains(c))
+        closure(n.out, set);
+    }
+    auto index = from * p.byteClassCount +
+                 p.byteClasses[static_cast<unsigned char>(c)];
+    if (set.empty())
+      return transitions[index] = dead;
+    std::sort(set.begin(), set.end());
+    auto it = ids.find(set);
+    if (it != ids.end())
+      return transitions[index] = it->second;
+    if (states.size() >= p.limit) {
+      // the transition is not recorded, the state from is gone
+      flush();
+      return intern(std::move(set));
+    }
+    int target = intern(std::move(set));
+    return transitions[index] = target;
+  }
+
+  int next(const int from, const char c) {
+    int t = transitions[from * program->byteClassCount +
+                        program->byteClasses[static_cast<unsigned char>(c)]];
+    return t != unknown ? t : compute(from, c);
+  }
+
+  // The cache of the program for the calling thread: this one if the thread
+  // owns it, otherwise the last one that the thread created for the program.
+  static std::shared_ptr<Cache> of(const std::shared_ptr<Cache> &cache) {
+    if (cache->owner == std::this_thread::get_id())
+      return cache;
+    // a cache keeps its program alive, so a live cache is never for another
+    // program at the same address
+    static thread_local std::map<const Program *, std::weak_ptr<Cache>> caches;
+    auto &entry = caches[cache->program.get()];
+    if (auto c = entry.lock())
+      return c;
+    for (auto it = caches.begin(); it != caches.end();) {
+      if (it->second.expired() && &it->second != &entry)
+        it = caches.erase(it);
+      else
+        ++it;
+    }
+    auto c = std::make_shared<Cache>(cache->program);
+    entry = c;
+    return c;
+  }
+};
+
+namespace {
+
+using Program = RegexParser::Program;
+using Cache = RegexParser::Cache;
+
+constexpr int infinite = -1;
+// the bound of the counted repetitions, and the number of NFA states
+constexpr int maxRepeat = 1000;
+constexpr std::size_t maxNfa = 1 << 16;
+
+struct Node {
+  enum Kind { Atom, Concat, Alt, Repeat } kind;
+  CharClass cls;
+  std::vector<Node> children;
+  int min = 0;
+  int max = 0;
+
+  Node(Kind kind, CharClass cls = {}) : kind(kind), cls(cls) {}
+};
+
+// Recursive descent over the pattern, valid is false on a syntax error.
+class Syntax {
+private:
+  const std::string &pattern;
+  std::size_t i = 0;
+
+  bool more() const { return i < pattern.size(); }
+  char peek() const { return pattern[i]; }
+
+  Node fail() {
+    valid = false;
+    i = pattern.size();
+    return {Node::Atom};
+  }
+
+  bool number(int &value) {
+    if (!more() || !std::isdigit(static_cast<unsigned char>(peek())))
+      return false;
+    value = 0;
+    while (more() && std::isdigit(static_cast<unsigned char>(peek()))) {
+      value = value * 10 + (pattern[i++] - '0');
+      if (value > maxRepeat)
+        return false;
+    }
+    return true;
+  }
+
+  // an escape after the backslash, in a class or not, single is set if it is
+  // one character
+  bool escape(CharClass &cls, std::optional<char> &single) {
+    if (!more())
+      return false;
+    char c = pattern[i++];
+    switch (c) {
+    case 'd':
+      cls = CharClass::digit();
+      return true;
+    case 'D':
+      cls = ~CharClass::digit();
+      return true;
+    case 'w':
+      cls = CharClass::identifier();
+      return true;
+    case 'W':
+      cls = ~CharClass::identifier();
+      return true;
+    case 's':
+      cls = CharClass::whitespace();
+      return true;
+    case 'S':
+      cls = ~CharClass::whitespace();
+      return true;
+    case 'n':
+      c = '\n';
+      break;
+    case 'r':
+      c = '\r';
+      break;
+    case 't':
+      c = '\t';
+      break;
+    case 'f':
+      c = '\f';
+      break;
+    case 'v':
+      c = '\v';
+      break;
+    default:
+      if (std::isalnum(static_cast<unsigned char>(c)))
+        return false;
+    }
+    cls = CharClass(std::string(1, c));
+    single = c;
+    return true;
+  }
+
+  // a member of a bracket class, single is set if it may start a range
+  bool member(CharClass &cls, std::optional<char> &single) {
+    char c = pattern[i++];
+    if (c == '\\')
+      return escape(cls, single);
+    cls = CharClass(std::string(1, c));
+    single = c;
+    return true;
+  }
+
+  Node bracket() {
+    bool negated = more() && peek() == '^';
+    if (negated)
+      ++i;
+    CharClass cls;
+    bool first = true;
+    while (more() && (peek() != ']' || first)) {
+      first = false;
+      CharClass item;
+      std::optional<char> lo;
+      if (!member(item, lo))
+        return fail();
+      if (lo.has_value() && i + 1 < pattern.size() && peek() == '-' &&
+          pattern[i + 1] != ']') {
+        ++i;
+        std::optional<char> hi;
+        if (!member(item, hi) || !hi.has_value() ||
+            static_cast<unsigned char>(*hi) < static_cast<unsigned char>(*lo))
+          return fail();
+        item = CharClass::range(*lo, *hi);
+      }
+      cls = cls | item;
+    }
+    if (!more())
+      return fail();
+    ++i;
+    return {Node::Atom, negated ? ~cls : cls};
+  }
+
+  Node atom() {
+    char c = pattern[i++];
+    switch (c) {
+    case '(': {
+      if (pattern.compare(i, 2, "?:") == 0)
+        i += 2;
+      Node node = alternation();
+      if (!more() || peek() != ')')
+        return fail();
+      ++i;
+      return node;
+    }
+    case '[':
+      return bracket();
+    case '.':
+      return {Node::Atom, ~CharClass("\n")};
+    case '\\': {
+      Node node{Node::Atom};
+      std::optional<char> single;
+      if (!escape(node.cls, single))
+        return fail();
+      return node;
+    }
+    case ')':
+    case '|':
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+      return fail();
+    default:
+      return {Node::Atom, CharClass(std::string(1, c))};
+    }
+  }
+
+  Node repetition() {
+    Node node = atom();
+    while (valid && more()) {
+      int min, max;
+      char c = peek();
+      if (c == '*') {
+        min = 0, max = infinite;
+      } else if (c == '+') {
+        min = 1, max = infinite;
+      } else if (c == '?') {
+        min = 0, max = 1;
+      } else if (c == '{') {
+        ++i;
+        if (!number(min))
+          return fail();
+        max = min;
+        if (more() && peek() == ',') {
+          ++i;
+          max = infinite;
+          if (more() && peek() != '}' && (!number(max) || max < min))
+            return fail();
+        }
+        if (!more() || peek() != '}')
+          return fail();
+      } else {
+        break;
+      }
+      ++i;
+      Node repeat{Node::Repeat};
+      repeat.children.push_back(std::move(node));
+      repeat.min = min;
+      repeat.max = max;
+      node = std::move(repeat);
+    }
+    return node;
+  }
+
+  Node concatenation() {
+    Node node{Node::Concat};
+    while (valid && more() && peek() != '|' && peek() != ')')
+      node.children.push_back(repetition());
+    return node;
+  }
+
+public:
+  bool valid = true;
+
+  Syntax(const std::string &pattern) : pattern(pattern) {}
+
+  Node alternation() {
+    Node node{Node::Alt};
+    node.children.push_back(concatenation());
+    while (valid && more() && peek() == '|') {
+      ++i;
+      node.children.push_back(concatenation());
+    }
+    return node;
+  }
+
+  Node parse() {
+    Node node = alternation();
+    if (more())
+      return fail();
+    return node;
+  }
+};
+
+// Thompson's construction, the fragments have dangling outputs that are
+// patched to the next fragment.
+class Builder {
+private:
+  Program &program;
+
+  struct Fragment {
+    int start;
+    // the states and which of their outputs are dangling
+    std::vector<std::pair<int, bool>> outs;
+  };
+
+  int add(Program::Kind kind, const int cls = -1) {
+    program.nfa.push_back({kind, cls, -1, -1});
+    return program.nfa.size() - 1;
+  }
+
+  void patch(const Fragment &f, const int target) {
+    for (auto [s, second] : f.outs)
+      (second ? program.nfa[s].out1 : program.nfa[s].out) = target;
+  }
+
+  Fragment epsilon() {
+    int s = add(Program::Split);
+    return {s, {{s, false}}};
+  }
+
+  void append(std::optional<Fragment> &a, Fragment b) {
+    if (a.has_value()) {
+      patch(*a, b.start);
+      a->outs = std::move(b.outs);
+    } else {
+      a = std::move(b);
+    }
+  }
+
+  // the fragment repeated any number of times
+  Fragment loop(Fragment f) {
+    int s = add(Program::Split);
+    program.nfa[s].out = f.start;
+    patch(f, s);
+    return {s, {{s, true}}};
+  }
+
+  Fragment repeat(const Node &node) {
+    auto &child = node.children[0];
+    std::optional<Fragment> f;
+    for (int i = 0; i < node.min; ++i) {
+      if (i + 1 == node.min && node.max == infinite) {
+        // x+ is x followed by the loop back to x
+        Fragment last = build(child);
+        int start = last.start;
+        Fragment plus = loop(std::move(last));
+        append(f, {start, std::move(plus.outs)});
+      } else {
+        append(f, build(child));
+      }
+    }
+    if (node.max == infinite && node.min == 0)
+      append(f, loop(build(child)));
+    for (int i = node.min; node.max != infinite && i < node.max; ++i) {
+      Fragment optional = build(child);
+      int s = add(Program::Split);
+      program.nfa[s].out = optional.start;
+      optional.outs.emplace_back(s, true);
+      append(f, {s, std::move(optional.outs)});
+    }
+    return f.has_value() ? *f : epsilon();
+  }
+
+public:
+  bool overflow = false;
+
+  Builder(Program &program) : program(program) {}
+
+  Fragment build(const Node &node) {
+    if (program.nfa.size() > maxNfa) {
+      overflow = true;
+      return epsilon();
+    }
+    switch (node.kind) {
+    case Node::Atom: {
+      program.classes.push_back(node.cls);
+      int s = add(Program::Char, program.classes.size() - 1);
+      return {s, {{s, false}}};
+    }
+    case Node::Concat: {
+      std::optional<Fragment> f;
+      for (auto &child : node.children)
+        append(f, build(child));
+      return f.has_value() ? *f : epsilon();
+    }
+    case Node::Alt: {
+      Fragment f = build(node.children.back());
+      for (std::size_t i = node.children.size() - 1; i-- > 0;) {
+        Fragment option = build(node.children[i]);
+        int s = add(Program::Split);
+        program.nfa[s].out = option.start;
+        program.nfa[s].out1 = f.start;
+        option.outs.insert(option.outs.end(), f.outs.begin(), f.outs.end());
+        f = {s, std::move(option.outs)};
+      }
+      return f;
+    }
+    case Node::Repeat:
+      return repeat(node);
+    }
+    return epsilon();
+  }
+};
+
+
+} // namespace
+
+RegexParser::RegexParser(std::shared_ptr<Cache> cache, Name name)
+    : cache(std::move(cache)), name(name) {
+  reset();
+}
+
+void RegexParser::reset() {
+  tokens.clear();
+  state = 0;
+  generation = cache->generation;
+  matched = cache->states[0].match ? 0 : std::string::npos;
+}
+
+AbstractParserPtr<char, std::string> RegexParser::clone() const {
+  auto p = std::make_unique<RegexParser>(Cache::of(cache), name);
+  p->validating = validating;
+  return p;
+}
+
+void RegexParser::resync() {
+  state = 0;
+  for (char c : tokens)
+    state = cache->next(state, c);
+  generation = cache->generation;
+}
+
+bool RegexParser::restore(AbstractParser<char, std::string> &other) {
+  auto p = dynamic_cast<RegexParser *>(&other);
+  if (p == nullptr || p->cache->program != cache->program)
+    return false;
+  tokens = p->tokens;
+  matched = p->matched;
+  if (p->cache == cache) {
+    state = p->state;
+    generation = p->generation;
+  } else {
+    // the states of another cache
+    resync();
+  }
+  return true;
+}
+
+ParserResult<char, std::string> RegexParser::finish(const bool end) {
+  if (matched == std::string::npos) {
+    // the last token is the one that failed, unless at the end of input
+    auto error = ParsingError(ErrorCode::InsufficientTokens, name, end ? 0 : 1);
+    reset();
+    return ParsingError::get<char, std::string>(error);
+  }
+  auto result = castResult<RegexResult, char, std::string>(
+      validating ? std::string() : tokens.substr(0, matched),
+      tokens.substr(matched));
+  reset();
+  return result;
+}
+
+inline ParserResult<char, std::string> RegexParser::step(const char value) {
+  auto &c = *cache;
+  // the cache was cleared, compute the state again
+  if (generation != c.generation)
+    resync();
+  tokens.push_back(value);
+  int next = c.next(state, value);
+  generation = c.generation;
+  if (next == Cache::dead)
+    return finish(false);
+  state = next;
+  auto &s = c.states[next];
+  if (s.match)
+    matched = tokens.size();
+  if (s.final)
+    return finish(true);
+  return {};
+}
+
+ParserResult<char, std::string> RegexParser::operator()(const char &value) {
+  return step(value);
+}
+
+FeedResult<char, std::string> RegexParser::feed(const char *begin,
+                                                const char *end) {
+  for (const char *it = begin; it != end; ++it) {
+    if (auto r = step(*it); r.has_value())
+      return {static_cast<std::size_t>(it - begin + 1), std::move(r)};
+  }
+  return {static_cast<std::size_t>(end - begin), {}};
+}
+
+ParserResult<char, std::string> RegexParser::operator()() {
+  return finish(true);
+}
+
+FirstSet<char> RegexParser::first() const {
+  return cache->program->firstSet;
+}
+
+std::size_t RegexParser::getCachedStates() const {
+  return cache->states.size();
+}
+
+std::size_t RegexParser::getFlushes() const { return cache->flushes; }
+
+std::unique_ptr<RegexParser> RegexParser::get(const std::string &pattern,
+                                              const std::string &name,
+                                              const std::size_t cacheStates) {
+  Syntax syntax(pattern);
+  Node root = syntax.parse();
+  if (!syntax.valid)
+    return nullptr;
+  auto program = std::make_shared<Program>();
+  Builder builder(*program);
+  auto f = builder.build(root);
+  if (builder.overflow)
+    return nullptr;
+  program->start = f.start;
+  int match = program->nfa.size();
+  program->nfa.push_back({Program::Match, -1, -1, -1});
+  for (auto [s, second] : f.outs)
+    (second ? program->nfa[s].out1 : program->nfa[s].out) = match;
+
+  std::map<std::vector<bool>, int> signatures;
+  for (int c = 0; c < 256; ++c) {
+    std::vector<bool> signature;
+    for (auto &cls : program->classes)
+      signature.push_back(cls.contains(static_cast<char>(c)));
+    auto it = signatures.emplace(signature, signatures.size()).first;
+    program->byteClasses[c] = it->second;
+  }
+  program->byteClassCount = signatures.size();
+  // at least the initial state and one more
+  program->limit = std::max<std::size_t>(cacheStates, 2);
+  // the FIRST set is computed once, so that first() does not touch the cache
+  auto cache = std::make_shared<Cache>(program);
+  for (int c = 0; c < 256; ++c) {
+    if (cache->next(0, static_cast<char>(c)) != Cache::dead)
+      program->firstSet.insert(static_cast<char>(c));
+  }
+  program->firstSet.setNullable(cache->states[0].match);
+  return std::make_unique<RegexParser>(std::move(cache), name);
+}
+
+} // namespace Parser
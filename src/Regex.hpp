@@ -0,0 +1,120 @@
+#pragma once
+#include "Parser.hpp"
+#include <memory>
+#include <string>
+
+namespace Parser {
+
+/**
+ * A regular expression, anchored at the first token and matched with greedy
+ * longest-match semantics. The pattern is compiled into a Thompson NFA, and
+ * the DFA states (the sets of NFA states) are built lazily, when the input
+ * reaches them, in a cache shared by the clones. The cache has a maximum
+ * number of states and is cleared when it is full, so the memory is bounded
+ * even if the DFA is exponential. A parser whose state was cleared computes it
+ * again from the tokens of its match.
+ *
+ * The syntax is: characters, `.` (any character but a newline), classes like
+ * `[a-z_]` and `[^...]`, the escapes `\d \w \s \D \W \S \n \r \t \f \v` and
+ * the escaped metacharacters, groups `(...)` and `(?:...)`, `|`, and the
+ * quantifiers `* + ? {n} {n,} {n,m}`.
+ *
+ * The output is the longest match, or nothing if it is empty, and the tokens
+ * after it remain. The parser returns as soon as the match cannot be
+ * extended, and an input without any match is an InsufficientTokens error, as
+ * for the predicates.
+ *
+ * The clones made by the thread that owns the cache share it, and a clone
+ * made by another thread uses a cache of that thread, so the clones of a
+ * parser shared by several threads (see Grammar) do not race on it. A parser
+ * must only be used by one thread at a time.
+ */
+class RegexParser final : public AbstractParser<char, std::string> {
+public:
+  struct Program;
+  struct Cache;
+
+private:
+  std::shared_ptr<Cache> cache;
+  Name name;
+  // the tokens of the current match
+  std::string tokens;
+  int state = 0;
+  // the generation of the cache that state belongs to
+  unsigned int generation = 0;
+  // the length of the longest match so far, or npos
+  std::size_t matched;
+  bool validating = false;
+
+  class RegexResult final : public AbstractParserResult<char, std::string> {
+  private:
+    std::string output;
+    std::string remaining;
+    bool outputLeft;
+    std::size_t next = 0;
+
+  public:
+    RegexResult(std::string output, std::string remaining)
+        : output(std::move(output)), remaining(std::move(remaining)),
+          outputLeft(!this->output.empty()) {}
+
+    std::optional<char> getRemaining() override {
+      if (next < remaining.size())
+        return remaining[next++];
+      return {};
+    }
+
+    std::optional<std::string> get() override {
+      if (outputLeft) {
+        outputLeft = false;
+        return std::move(output);
+      }
+      return {};
+    }
+  };
+
+  ParserResult<char, std::string> step(const char value);
+  ParserResult<char, std::string> finish(const bool end);
+  void resync();
+
+public:
+  RegexParser(std::shared_ptr<Cache> cache, Name name);
+
+  void reset() override;
+
+  AbstractParserPtr<char, std::string> clone() const override;
+
+  bool restore(AbstractParser<char, std::string> &other) override;
+
+  ParserResult<char, std::string> operator()(const char &value) override;
+
+  FeedResult<char, std::string> feed(const char *begin,
+                                     const char *end) override;
+
+  ParserResult<char, std::string> operator()() override;
+
+  const std::string &getName() const override { return name.str(); }
+
+  FirstSet<char> first() const override;
+
+  void setValidating(const bool validating) override {
+    this->validating = validating;
+  }
+
+  /**
+   * The number of DFA states in the cache, and the number of times it was
+   * cleared.
+   */
+  std::size_t getCachedStates() const;
+  std::size_t getFlushes() const;
+
+  /**
+   * Compile the pattern, returns nullptr if it is invalid. The cache holds at
+   * most cacheStates DFA states.
+   */
+  static std::unique_ptr<RegexParser> get(const std::string &pattern,
+                                          const std::string &name,
+                                          const std::size_t cacheStates = 1024);
+};
+
+} // namespace Parser
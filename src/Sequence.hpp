@@ -11,76 +11,154 @@ namespace Parser {
 template <typename S, typename T> class Sequence : public AbstractParser<S, T> {
 private:
   std::unique_ptr<std::vector<AbstractParserPtr<S, T>>> sequence;
-  std::unique_ptr<std::stack<AbstractParserResultPtr<S, T>>> prevResults;
-  std::queue<T> content;
-  QueueParserResult<S, T> *input;
-  std::string name;
+  PendingTokens<S, T> pending;
+  Vector<T> content;
+  Name name;
+  // the sink mode: the parsers put their outputs in the sink, which had mark
+  // outputs when the sequence started
+  OutputSink<T> *sink = nullptr;
+  std::size_t mark = 0;
   unsigned int i = 0;
+  bool started = false;
+  bool validating = false;
+
+  void start() {
+    if (!started && sink != nullptr)
+      mark = sink->size();
+    started = true;
+  }
+
+  /**
+   * Handle the output of the current parser. Returns something if the sequence
+   * is failed or completed, otherwise move on to the next parser.
+   */
+  ParserResult<S, T> advance(ParserResult<S, T> &opt) {
+    if (isError(opt)) {
+      auto e = asError(opt);
+      e.record(name);
+      e.delay(pending.skip());
+      reset();
+      return ParsingError::get<S, T>(e);
+    }
+    auto &result = asResult(opt);
+    if (++i == sequence->size()) {
+      // the outputs in the sink are kept
+      started = false;
+      auto parsed = castResult<AggregatedParserResult<S, T>, S, T>(
+          std::move(content), std::move(result), pending.take());
+      reset();
+      return parsed;
+    }
+    // the outputs left in the result go before the ones of the next parsers
+    if (sink != nullptr) {
+      sink->drain(*result);
+    } else if (!validating) {
+      for (auto t = result->get(); t.has_value(); t = result->get())
+        content.push_back(std::move(t.value()));
+    }
+    pending.push(std::move(result));
+    return {};
+  }
+
+  /**
+   * Apply the pending tokens to the parsers until we run out of tokens.
+   */
+  ParserResult<S, T> drain() {
+    // Actually the principle is very simple, we deal with a stack of a token
+    // list, rather than the input directly. Previous tokens may expand the
+    // token list. Check HelperResult for the reason of this.
+    for (auto v = pending.next(); v.has_value(); v = pending.next()) {
+      auto opt = (*sequence->at(i))(v.value());
+      if (!opt.has_value())
+        continue;
+      if (auto r = advance(opt); r.has_value())
+        return r;
+    }
+    return {};
+  }
+
+  // The sub-parsers are cloned, or instantiated for an instance.
+  AbstractParserPtr<S, T> copy(const bool instance) const {
+    auto v = std::make_unique<std::vector<AbstractParserPtr<S, T>>>();
+    v->reserve(sequence->size());
+    for (auto &parser : *sequence)
+      v->push_back(instance ? parser->instantiate() : parser->clone());
+    auto p = std::make_unique<Sequence<S, T>>(std::move(v), name);
+    p->validating = validating;
+    return p;
+  }
 
 public:
-  Sequence(decltype(sequence) sequence, const std::string &name)
+  Sequence(decltype(sequence) sequence, Name name)
       : sequence(std::move(sequence)), name(name) {
     reset();
   }
 
+  /**
+   * Reset the parsers, and take back the outputs put in the sink since the
+   * sequence started.
+   */
   void reset() override {
     for (auto &parser : *sequence)
       parser->reset();
-    prevResults = std::make_unique<std::stack<AbstractParserResultPtr<S, T>>>();
-    auto storage = std::make_unique<QueueParserResult<S, T>>();
-    input = storage.get();
-    prevResults->push(std::move(storage));
-    while (!content.empty())
-      content.pop();
+    if (started && sink != nullptr)
+      sink->truncate(mark);
+    pending.clear();
+    content.clear();
     i = 0;
+    started = false;
   }
 
-  AbstractParserPtr<S, T> clone() override {
-    auto v = std::make_unique<std::vector<AbstractParserPtr<S, T>>>();
-    for (auto &parser : *sequence)
-      v->push_back(std::move(parser->clone()));
-    return std::make_unique<Sequence<S, T>>(std::move(v), name);
+  AbstractParserPtr<S, T> clone() const override { return copy(false); }
+
+  AbstractParserPtr<S, T> instantiate() const override { return copy(true); }
+
+  bool restore(AbstractParser<S, T> &other) override {
+    auto p = dynamic_cast<Sequence<S, T> *>(&other);
+    if (p == nullptr || p->sequence->size() != sequence->size() ||
+        sink != nullptr || p->sink != nullptr)
+      return false;
+    // the outputs are copied
+    if constexpr (!std::is_copy_constructible_v<T>) {
+      if (!p->content.empty())
+        return false;
+    }
+    // the results of the previous parsers are always drained before we
+    // return, so only the outputs are kept
+    reset();
+    for (unsigned int k = 0; k < sequence->size(); ++k) {
+      if (!(*sequence)[k]->restore(*(*p->sequence)[k]))
+        return false;
+    }
+    if constexpr (std::is_copy_constructible_v<T>)
+      content = p->content;
+    i = p->i;
+    started = p->started;
+    return true;
   }
 
   ParserResult<S, T> operator()(const S &value) override {
-    // Actually the principle is very simple, we deal with a stack of a token
-    // list, rather than the input directly. Previous tokens may expand the
-    // token list. Check HelperResult for the reason of this.
-    input->push(value);
-    while (true) {
-      S v;
-      while (true) {
-        if (auto t = prevResults->top()->getRemaining(); t.has_value()) {
-          v = t.value();
-          break;
-        }
-        if (prevResults->size() == 1) {
-          // we don't delete the last one, that is the input queue
-          return {};
-        }
-        prevResults->pop();
-      }
-      auto opt = (*sequence->at(i))(v);
+    start();
+    pending.push(value);
+    return drain();
+  }
+
+  FeedResult<S, T> feed(const S *begin, const S *end) override {
+    // Tokens left by the previous parsers are always applied before we
+    // return, so the current parser can take the input span directly.
+    start();
+    const S *it = begin;
+    while (it != end) {
+      auto [consumed, opt] = sequence->at(i)->feed(it, end);
+      it += consumed;
       if (!opt.has_value())
-        continue;
-      if (isError(opt)) {
-        auto e = asError(opt);
-        e.record(name);
-        reset();
-        return ParsingError::get<S, T>(e);
-      }
-      auto &result = asResult(opt);
-      if (++i == sequence->size()) {
-        auto parsed = castResult<AggregatedParserResult<S, T>, S, T>(
-            std::move(prevResults), std::move(result), content);
-        reset();
-        return parsed;
-      }
-      for (auto t = result->get(); t.has_value(); t = result->get()) {
-        content.push(t.value());
-      }
-      prevResults->push(std::move(result));
+        break;
+      if (auto r = advance(opt); r.has_value())
+        return {static_cast<std::size_t>(it - begin), std::move(r)};
+      if (auto r = drain(); r.has_value())
+        return {static_cast<std::size_t>(it - begin), std::move(r)};
     }
+    return {static_cast<std::size_t>(it - begin), {}};
   }
 
   ParserResult<S, T> operator()() override {
@@ -88,49 +166,64 @@ public:
     // error if the current parser has no output. Even if we are provided with
     // no input token, we may still have some because of the tokens from
     // previous parsers.
+    start();
     while (true) {
-      S v;
-      bool hasValue;
-      while (true) {
-        if (auto t = prevResults->top()->getRemaining(); t.has_value()) {
-          v = t.value();
-          hasValue = true;
-          break;
-        }
-        if (prevResults->size() == 1) {
-          hasValue = false;
-          break;
-        }
-        prevResults->pop();
-      }
-      auto opt = hasValue ? (*sequence->at(i))(v) : (*sequence->at(i))();
+      auto v = pending.next();
+      auto opt = v.has_value() ? (*sequence->at(i))(v.value())
+                               : (*sequence->at(i))();
       if (!opt.has_value()) {
         reset();
-        return ParsingError::get<S, T>("Insufficient Tokens", name);
-      }
-      if (isError(opt)) {
-        auto e = asError(opt);
-        e.record(name);
-        reset();
-        return ParsingError::get<S, T>(e);
-      }
-      auto &result = asResult(opt);
-      if (++i == sequence->size()) {
-        auto parsed = castResult<AggregatedParserResult<S, T>, S, T>(
-            std::move(prevResults), std::move(result), content);
-        reset();
-        return parsed;
-      }
-      for (auto t = result->get(); t.has_value(); t = result->get()) {
-        content.push(t.value());
+        return ParsingError::get<S, T>(ErrorCode::Incomplete, name);
       }
-      prevResults->push(std::move(result));
+      if (auto r = advance(opt); r.has_value())
+        return r;
     }
   }
 
-  const std::string &getName() override { return name; }
+  void setValidating(const bool validating) override {
+    this->validating = validating;
+    for (auto &parser : *sequence)
+      parser->setValidating(validating);
+  }
+
+  void setSink(OutputSink<T> *sink) override {
+    this->sink = sink;
+    for (auto &parser : *sequence)
+      parser->setSink(sink);
+  }
+
+  const std::string &getName() const override { return name.str(); }
+
+  FirstSet<S> first() const override {
+    auto set = FirstSet<S>::epsilon();
+    for (auto &parser : *sequence) {
+      if (!set.append(parser->first()))
+        break;
+    }
+    return set;
+  }
+
+  std::optional<std::vector<S>> literal() const override {
+    std::vector<S> tokens;
+    for (auto &parser : *sequence) {
+      auto l = parser->literal();
+      if (!l.has_value())
+        return {};
+      tokens.insert(tokens.end(), l->begin(), l->end());
+    }
+    return tokens;
+  }
+
+  /**
+   * The parsers may be modified, so the FIRST sets of the alternations are
+   * computed again.
+   */
+  auto &getSequence() {
+    grammarChanged();
+    return sequence;
+  }
 
-  auto &getSequence() { return sequence; }
+  const auto &getSequence() const { return sequence; }
 
   template <typename array>
   static auto get(const std::string &name, array &&args) {
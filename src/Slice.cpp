@@ -0,0 +1,190 @@
+#include "Slice.hpp"
+
+namespace Parser {
+
+namespace {
+thread_local const SliceScope *current = nullptr;
+
+std::string describe(std::uint64_t payload) {
+  return std::string(1, static_cast<char>(payload));
+}
+} // namespace
+
+Slice Slice::copy(std::string_view chars) {
+  auto s = std::make_shared<const std::string>(chars);
+  return Slice(std::string_view(*s), s);
+}
+
+Slice Slice::extend(const Slice &a, const Slice &b) {
+  if (a.view.empty())
+    return b;
+  // the views of the same input, so the owner keeps both alive
+  if (a.view.data() + a.view.size() == b.view.data() && a.owner == b.owner &&
+      a.concatenated == nullptr && b.concatenated == nullptr)
+    return Slice(std::string_view(a.view.data(), a.view.size() + b.view.size()),
+                 a.owner);
+  Slice result;
+  if (a.concatenated != nullptr && a.concatenated.use_count() == 1 &&
+      a.view.data() + a.view.size() ==
+          a.concatenated->data() + a.concatenated->size() &&
+      a.concatenated->capacity() - a.concatenated->size() >= b.view.size()) {
+    // nobody else extended the concatenation, and appending does not move it,
+    // so the slices made before stay valid
+    result.concatenated = a.concatenated;
+    result.concatenated->append(b.view);
+  } else {
+    // not adjacent, copy them with room for the next folds
+    result.concatenated = std::make_shared<std::string>();
+    result.concatenated->reserve(2 * (a.view.size() + b.view.size()));
+    result.concatenated->append(a.view).append(b.view);
+  }
+  result.view = *result.concatenated;
+  return result;
+}
+
+SliceScope::SliceScope(std::shared_ptr<const std::string> input)
+    : SliceScope(input, input->data(), input->data() + input->size()) {}
+
+SliceScope::SliceScope(std::shared_ptr<const void> owner, const char *begin,
+                       const char *end)
+    : owner(std::move(owner)), begin(begin), end(end), previous(current) {
+  current = this;
+}
+
+SliceScope::~SliceScope() { current = previous; }
+
+Slice SliceScope::slice(const char *p, const std::size_t n) {
+  if (current != nullptr && p >= current->begin && p + n <= current->end)
+    return Slice(std::string_view(p, n), current->owner);
+  return Slice::copy(std::string_view(p, n));
+}
+
+const char *SliceParser::scan(const char *begin, const char *limit) const {
+  if (text == nullptr)
+    return charClass.scan(begin, limit);
+  // the limit keeps count + n within the literal
+  const char *it = begin;
+  while (it != limit && (*text)[count + (it - begin)] == *it)
+    ++it;
+  return it;
+}
+
+void SliceParser::append(const char *p, const std::size_t n) {
+  if (!validating)
+    aggregated = Slice::extend(aggregated, SliceScope::slice(p, n));
+  count += n;
+}
+
+ParserResult<char, Slice> SliceParser::accepted(const char last) {
+  if (quantifier == NONE) {
+    auto error = ParsingError::unexpected(last, describe, name);
+    reset();
+    return ParsingError::get<char, Slice>(error);
+  }
+  if (full()) {
+    auto parsed = output();
+    reset();
+    return parsed;
+  }
+  return {};
+}
+
+ParserResult<char, Slice> SliceParser::output() {
+  if (count == 0 || validating)
+    return castResult<SliceResult, char, Slice>();
+  return castResult<SliceResult, char, Slice>(std::move(aggregated));
+}
+
+ParserResult<char, Slice> SliceParser::rejected(const char value) {
+  if (insufficient()) {
+    auto error = ParsingError(ErrorCode::InsufficientTokens, name, 1);
+    reset();
+    return ParsingError::get<char, Slice>(error);
+  }
+  auto result = count == 0 || validating
+                    ? castResult<SliceResult, char, Slice>(value)
+                    : castResult<SliceResult, char, Slice>(
+                          value, std::move(aggregated));
+  reset();
+  return result;
+}
+
+bool SliceParser::restore(AbstractParser<char, Slice> &other) {
+  auto p = dynamic_cast<SliceParser *>(&other);
+  if (p == nullptr)
+    return false;
+  count = p->count;
+  aggregated = p->aggregated;
+  return true;
+}
+
+FirstSet<char> SliceParser::first() const {
+  if (text != nullptr)
+    return text->empty() ? FirstSet<char>::any()
+                         : FirstSet<char>::of(text->front());
+  auto set = charClass.first();
+  set.setNullable(quantifier == NONE || quantifier == OPTIONAL ||
+                  quantifier == ANY || quantifier == 0);
+  return set;
+}
+
+ParserResult<char, Slice> SliceParser::operator()(const char &value) {
+  if (!test(value))
+    return rejected(value);
+  // a view if the token is the one in the input
+  append(&value, 1);
+  return accepted(value);
+}
+
+FeedResult<char, Slice> SliceParser::feed(const char *begin, const char *end) {
+  if (quantifier == NONE)
+    return AbstractParser::feed(begin, end);
+  // the number of characters that we may still accept
+  const char *limit = end;
+  if (quantifier == ONCE || quantifier == OPTIONAL) {
+    if (end - begin > 1)
+      limit = begin + 1;
+  } else if (quantifier >= 0 && end - begin > quantifier - count) {
+    limit = begin + (quantifier - count);
+  }
+  const char *it = scan(begin, limit);
+  auto n = static_cast<std::size_t>(it - begin);
+  if (n > 0) {
+    append(begin, n);
+    if (auto result = accepted(it[-1]); result.has_value())
+      return {n, std::move(result)};
+  }
+  if (it == end)
+    return {n, {}};
+  return {n + 1, rejected(*it)};
+}
+
+ParserResult<char, Slice> SliceParser::operator()() {
+  if (insufficient()) {
+    auto error = ParsingError(ErrorCode::InsufficientTokens, name);
+    reset();
+    return ParsingError::get<char, Slice>(error);
+  }
+  auto result = output();
+  reset();
+  return result;
+}
+
+std::unique_ptr<SliceParser> SliceString(const std::string &str,
+                                         const std::string &name) {
+  return std::make_unique<SliceParser>(str, name);
+}
+
+std::unique_ptr<SliceParser> SliceChar(const char c, const int quantifier,
+                                       const std::string &name) {
+  return std::make_unique<SliceParser>(CharClass(std::string(1, c)),
+                                       quantifier, name);
+}
+
+std::unique_ptr<SliceParser> SliceClass(const CharClass &charClass,
+                                        const int quantifier,
+                                        const std::string &name) {
+  return std::make_unique<SliceParser>(charClass, quantifier, name);
+}
+
+} // namespace Parser
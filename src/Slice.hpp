@@ -0,0 +1,201 @@
+#pragma once
+#include "CharClass.hpp"
+#include "Predicate.hpp"
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Parser {
+
+/**
+ * Output type for parsing a contiguous buffer without copying. The outputs are
+ * views of the input (see SliceScope): folding two adjacent slices just
+ * extends the view, so a run of N characters costs nothing instead of O(N^2)
+ * copying. The string is only copied when it is materialized with str().
+ *
+ * A view keeps the input that it points to alive, so a slice stays valid
+ * after the input is dropped. Slices that are not adjacent (for example across
+ * two chunks of a streaming input) are concatenated into a string owned by the
+ * slice. The next folds extend it in place if it is not shared and has room,
+ * so that the slices made before keep viewing valid characters.
+ */
+class Slice {
+private:
+  std::string_view view;
+  std::shared_ptr<const void> owner;
+  // the concatenation, if the slice is not a view of the input
+  std::shared_ptr<std::string> concatenated;
+
+public:
+  Slice() = default;
+  Slice(std::string_view view, std::shared_ptr<const void> owner = nullptr)
+      : view(view), owner(std::move(owner)) {}
+
+  std::string_view get() const { return view; }
+  std::string str() const { return std::string(view); }
+  std::size_t size() const { return view.size(); }
+  bool isOwned() const { return owner != nullptr || concatenated != nullptr; }
+
+  bool operator==(const Slice &other) const { return view == other.view; }
+
+  /**
+   * A slice that owns a copy of the characters.
+   */
+  static Slice copy(std::string_view chars);
+  static Slice extend(const Slice &a, const Slice &b);
+};
+
+/**
+ * The input that the slice parsers of the current thread are fed with, until
+ * the scope ends. The slices of the characters of the input are views that
+ * share its owner, so the input lives as long as the slices that point to it,
+ * and nobody has to release it. The characters that are not in the input
+ * (such as the remaining tokens of a result that are applied again) are
+ * copied into the slices.
+ */
+class SliceScope {
+private:
+  std::shared_ptr<const void> owner;
+  const char *begin;
+  const char *end;
+  const SliceScope *previous;
+
+public:
+  SliceScope(std::shared_ptr<const std::string> input);
+  SliceScope(std::shared_ptr<const void> owner, const char *begin,
+             const char *end);
+  SliceScope(const SliceScope &) = delete;
+  ~SliceScope();
+
+  /**
+   * The n characters at p: a view if they are in the input of the current
+   * scope, a copy otherwise.
+   */
+  static Slice slice(const char *p, const std::size_t n);
+};
+
+/**
+ * A predicate over the characters, with slices as the outputs: a character
+ * class with the quantifiers of PredicateParser, or a literal. The tokens are
+ * the characters, and feed takes the run of matching characters of the span
+ * as one view of it (see SliceScope), so the tokens are fed as spans of the
+ * input and the run costs one slice instead of one per character.
+ */
+class SliceParser final : public AbstractParser<char, Slice> {
+private:
+  CharClass charClass;
+  // the literal, which is matched instead of the class if it is not null
+  std::shared_ptr<const std::string> text;
+  int quantifier;
+  int count = 0;
+  Slice aggregated;
+  Name name;
+  // the characters are not sliced, the results have no value
+  bool validating = false;
+
+  class SliceResult final : public AbstractParserResult<char, Slice> {
+  private:
+    char token;
+    Slice value;
+    bool tokenLeft;
+    bool valueLeft;
+
+  public:
+    SliceResult() : tokenLeft(false), valueLeft(false) {}
+    SliceResult(char token) : token(token), tokenLeft(true), valueLeft(false) {}
+    SliceResult(Slice value)
+        : value(std::move(value)), tokenLeft(false), valueLeft(true) {}
+    SliceResult(char token, Slice value)
+        : token(token), value(std::move(value)), tokenLeft(true),
+          valueLeft(true) {}
+
+    std::optional<char> getRemaining() override {
+      if (tokenLeft) {
+        tokenLeft = false;
+        return std::make_optional(token);
+      }
+      return {};
+    }
+
+    std::optional<Slice> get() override {
+      if (valueLeft) {
+        valueLeft = false;
+        return std::make_optional(std::move(value));
+      }
+      return {};
+    }
+  };
+
+  bool insufficient() const {
+    return count < quantifier ||
+           (count == 0 && (quantifier == ONCE || quantifier == MORE));
+  }
+  bool full() const {
+    return quantifier == ONCE || quantifier == OPTIONAL || quantifier == count;
+  }
+  bool test(const char value) const {
+    if (text != nullptr)
+      return count < quantifier && (*text)[count] == value;
+    return charClass.contains(value);
+  }
+  // The end of the run of matching characters in [begin, limit).
+  const char *scan(const char *begin, const char *limit) const;
+  void append(const char *p, const std::size_t n);
+  ParserResult<char, Slice> accepted(const char last);
+  ParserResult<char, Slice> output();
+  ParserResult<char, Slice> rejected(const char value);
+
+public:
+  SliceParser(CharClass charClass, const int quantifier, Name name)
+      : charClass(charClass), quantifier(quantifier), name(name) {}
+  SliceParser(const std::string &literal, Name name)
+      : text(std::make_shared<const std::string>(literal)),
+        quantifier(literal.size()), name(name) {}
+
+  void reset() override {
+    count = 0;
+    aggregated = Slice();
+  }
+
+  AbstractParserPtr<char, Slice> clone() const override {
+    auto p = std::make_unique<SliceParser>(*this);
+    p->reset();
+    return p;
+  }
+
+  bool restore(AbstractParser<char, Slice> &other) override;
+
+  FirstSet<char> first() const override;
+
+  std::optional<std::vector<char>> literal() const override {
+    if (text == nullptr)
+      return {};
+    return std::vector<char>(text->begin(), text->end());
+  }
+
+  void setValidating(const bool validating) override {
+    this->validating = validating;
+  }
+
+  ParserResult<char, Slice> operator()(const char &value) override;
+
+  FeedResult<char, Slice> feed(const char *begin, const char *end) override;
+
+  ParserResult<char, Slice> operator()() override;
+
+  const std::string &getName() const override { return name.str(); }
+};
+
+/**
+ * Same as StringPredicate, CharPredicate and CharClassParser, with slices.
+ */
+std::unique_ptr<SliceParser> SliceString(const std::string &str,
+                                         const std::string &name);
+std::unique_ptr<SliceParser> SliceChar(const char c, const int quantifier,
+                                       const std::string &name);
+std::unique_ptr<SliceParser> SliceClass(const CharClass &charClass,
+                                        const int quantifier,
+                                        const std::string &name);
+
+} // namespace Parser
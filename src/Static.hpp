@@ -0,0 +1,636 @@
+#pragma once
+#include "HelperResults.hpp"
+#include "Parser.hpp"
+#include <array>
+#include <deque>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace Parser {
+
+/**
+ * Statically typed versions of the combinators. The sub-parsers are stored by
+ * value in a tuple and are called through their concrete type, so the compiler
+ * can inline across the combinator boundaries instead of going through a
+ * virtual call for every token. The static combinators are still parsers, so
+ * they can be put into an AbstractParserPtr (for example as the source of a
+ * LazyParser for recursion), and dynamic parsers can be used as sub-parsers by
+ * wrapping them with Dynamic.
+ *
+ * The semantics are exactly the same as Sequence, Alternate and TakeTill.
+ * Copying a static combinator copies the sub-parsers but not the internal
+ * states, same as clone.
+ */
+namespace Static {
+
+template <typename S, typename T> S tokenOf(const AbstractParser<S, T> *);
+template <typename S, typename T> T outputOf(const AbstractParser<S, T> *);
+
+template <typename P>
+using TokenOf = decltype(tokenOf(std::declval<std::decay_t<P> *>()));
+template <typename P>
+using OutputOf = decltype(outputOf(std::declval<std::decay_t<P> *>()));
+
+// Qualified calls, so the virtual dispatch is bypassed even if the concrete
+// type is not final.
+template <typename P, typename S> auto apply(P &p, const S &value) {
+  return p.P::operator()(value);
+}
+template <typename P> auto apply(P &p) { return p.P::operator()(); }
+template <typename P, typename S>
+auto apply(P &p, const S *begin, const S *end) {
+  return p.P::feed(begin, end);
+}
+
+/**
+ * Call f with the i-th element of the tuple. The index is only known at
+ * runtime, but every branch is a call with a concrete type.
+ */
+template <std::size_t I = 0, typename Tuple, typename F>
+decltype(auto) visitAt(Tuple &t, const std::size_t i, F &&f) {
+  if constexpr (I + 1 == std::tuple_size_v<Tuple>) {
+    return f(std::get<I>(t));
+  } else {
+    if (i == I)
+      return f(std::get<I>(t));
+    return visitAt<I + 1>(t, i, std::forward<F>(f));
+  }
+}
+
+/**
+ * Call f with every element of the tuple and its index.
+ */
+template <typename Tuple, typename F, std::size_t... I>
+void forEach(Tuple &t, F &&f, std::index_sequence<I...>) {
+  (f(std::get<I>(t), I), ...);
+}
+template <typename Tuple, typename F> void forEach(Tuple &t, F &&f) {
+  forEach(t, std::forward<F>(f),
+          std::make_index_sequence<std::tuple_size_v<Tuple>>());
+}
+
+} // namespace Static
+
+/**
+ * Adapter for using a dynamic parser inside the static combinators.
+ * The parser can also be set later, so a recursive static grammar can point a
+ * LazyParser to an empty Dynamic and set the grammar when it is constructed.
+ */
+template <typename S, typename T>
+class Dynamic final : public AbstractParser<S, T> {
+private:
+  AbstractParserPtr<S, T> parser;
+
+public:
+  Dynamic(decltype(parser) parser) : parser(std::move(parser)) {}
+  Dynamic(const Dynamic &other)
+      : parser(other.parser == nullptr ? nullptr : other.parser->clone()) {}
+  Dynamic(Dynamic &&) = default;
+
+  void set(decltype(parser) p) {
+    parser = std::move(p);
+    grammarChanged();
+  }
+
+  void reset() override { parser->reset(); }
+  AbstractParserPtr<S, T> clone() const override {
+    return std::make_unique<Dynamic>(*this);
+  }
+  AbstractParserPtr<S, T> instantiate() const override {
+    return std::make_unique<Dynamic>(
+        parser == nullptr ? nullptr : parser->instantiate());
+  }
+  ParserResult<S, T> operator()(const S &value) override {
+    return (*parser)(value);
+  }
+  ParserResult<S, T> operator()() override { return (*parser)(); }
+  FeedResult<S, T> feed(const S *begin, const S *end) override {
+    return parser->feed(begin, end);
+  }
+  bool restore(AbstractParser<S, T> &other) override {
+    auto p = dynamic_cast<Dynamic *>(&other);
+    return p != nullptr && parser->restore(*p->parser);
+  }
+  void setValidating(const bool validating) override {
+    parser->setValidating(validating);
+  }
+
+  void setSink(OutputSink<T> *sink) override { parser->setSink(sink); }
+  const std::string &getName() const override { return parser->getName(); }
+  FirstSet<S> first() const override {
+    return parser == nullptr ? FirstSet<S>::any() : parser->first();
+  }
+};
+
+/**
+ * Static version of Sequence.
+ */
+template <typename S, typename T, typename... Ps>
+class StaticSequence final : public AbstractParser<S, T> {
+private:
+  std::tuple<Ps...> sequence;
+  PendingTokens<S, T> pending;
+  Vector<T> content;
+  Name name;
+  unsigned int i = 0;
+  bool validating = false;
+
+  ParserResult<S, T> advance(ParserResult<S, T> &opt) {
+    if (isError(opt)) {
+      auto e = asError(opt);
+      e.record(name);
+      e.delay(pending.skip());
+      reset();
+      return ParsingError::get<S, T>(e);
+    }
+    auto &result = asResult(opt);
+    if (++i == sizeof...(Ps)) {
+      auto parsed = castResult<AggregatedParserResult<S, T>, S, T>(
+          std::move(content), std::move(result), pending.take());
+      reset();
+      return parsed;
+    }
+    if (!validating) {
+      for (auto t = result->get(); t.has_value(); t = result->get())
+        content.push_back(std::move(t.value()));
+    }
+    pending.push(std::move(result));
+    return {};
+  }
+
+  ParserResult<S, T> drain() {
+    for (auto v = pending.next(); v.has_value(); v = pending.next()) {
+      auto opt = Static::visitAt(
+          sequence, i, [&](auto &p) { return Static::apply(p, v.value()); });
+      if (!opt.has_value())
+        continue;
+      if (auto r = advance(opt); r.has_value())
+        return r;
+    }
+    return {};
+  }
+
+public:
+  StaticSequence(std::tuple<Ps...> sequence, Name name)
+      : sequence(std::move(sequence)), name(name) {
+    reset();
+  }
+  StaticSequence(const StaticSequence &other)
+      : sequence(other.sequence), name(other.name),
+        validating(other.validating) {
+    reset();
+  }
+  StaticSequence(StaticSequence &&) = default;
+
+  void reset() override {
+    Static::forEach(sequence, [](auto &p, std::size_t) { p.reset(); });
+    pending.clear();
+    content.clear();
+    i = 0;
+  }
+
+  AbstractParserPtr<S, T> clone() const override {
+    return std::make_unique<StaticSequence>(*this);
+  }
+
+  ParserResult<S, T> operator()(const S &value) override {
+    pending.push(value);
+    return drain();
+  }
+
+  FeedResult<S, T> feed(const S *begin, const S *end) override {
+    const S *it = begin;
+    while (it != end) {
+      auto [consumed, opt] = Static::visitAt(
+          sequence, i, [&](auto &p) { return Static::apply(p, it, end); });
+      it += consumed;
+      if (!opt.has_value())
+        break;
+      if (auto r = advance(opt); r.has_value())
+        return {static_cast<std::size_t>(it - begin), std::move(r)};
+      if (auto r = drain(); r.has_value())
+        return {static_cast<std::size_t>(it - begin), std::move(r)};
+    }
+    return {static_cast<std::size_t>(it - begin), {}};
+  }
+
+  ParserResult<S, T> operator()() override {
+    while (true) {
+      auto v = pending.next();
+      auto opt = Static::visitAt(sequence, i, [&](auto &p) {
+        return v.has_value() ? Static::apply(p, v.value()) : Static::apply(p);
+      });
+      if (!opt.has_value()) {
+        reset();
+        return ParsingError::get<S, T>(ErrorCode::Incomplete, name);
+      }
+      if (auto r = advance(opt); r.has_value())
+        return r;
+    }
+  }
+
+  void setValidating(const bool validating) override {
+    this->validating = validating;
+    Static::forEach(sequence, [&](auto &p, std::size_t) {
+      p.setValidating(validating);
+    });
+  }
+
+  const std::string &getName() const override { return name.str(); }
+
+  FirstSet<S> first() const override {
+    auto set = FirstSet<S>::epsilon();
+    bool more = true;
+    Static::forEach(sequence, [&](auto &p, std::size_t) {
+      if (more)
+        more = set.append(p.first());
+    });
+    return set;
+  }
+};
+
+/**
+ * Static version of Alternate.
+ */
+template <typename S, typename T, typename... Ps>
+class StaticAlternate final : public AbstractParser<S, T> {
+private:
+  std::tuple<Ps...> options;
+  std::array<bool, sizeof...(Ps)> completed;
+  std::unique_ptr<StateResult<S, T>> result;
+  std::optional<ParsingError> error;
+  Name name;
+  // the tokens applied, and the ones applied when the error was made
+  std::size_t tokens = 0;
+  std::size_t errorAt = 0;
+
+  // Record the result of a branch, returns false if it is not completed.
+  bool update(ParserResult<S, T> &r) {
+    if (!r.has_value())
+      return false;
+    if (isError(r)) {
+      error = std::optional(asError(r));
+      errorAt = tokens;
+    } else
+      result = std::make_unique<StateResult<S, T>>(std::move(asResult(r)));
+    return true;
+  }
+
+  ParserResult<S, T> finish() {
+    if (result != nullptr) {
+      AbstractParserResultPtr<S, T> p = std::move(result);
+      auto parsed = std::make_optional(
+          std::variant<ParsingError, decltype(p)>(std::move(p)));
+      reset();
+      return parsed;
+    }
+    auto v = error.value();
+    v.recordAlternate(name);
+    v.delay(tokens - errorAt);
+    reset();
+    return ParsingError::get<S, T>(v);
+  }
+
+public:
+  StaticAlternate(std::tuple<Ps...> options, Name name)
+      : options(std::move(options)), name(name) {
+    reset();
+  }
+  StaticAlternate(const StaticAlternate &other)
+      : options(other.options), name(other.name) {
+    reset();
+  }
+  StaticAlternate(StaticAlternate &&) = default;
+
+  void reset() override {
+    result = nullptr;
+    error.reset();
+    tokens = 0;
+    completed.fill(false);
+    Static::forEach(options, [](auto &p, std::size_t) { p.reset(); });
+  }
+
+  AbstractParserPtr<S, T> clone() const override {
+    return std::make_unique<StaticAlternate>(*this);
+  }
+
+  ParserResult<S, T> operator()(const S &value) override {
+    bool allCompleted = true;
+    ++tokens;
+    if (result != nullptr)
+      result->push(value);
+    Static::forEach(options, [&](auto &p, std::size_t i) {
+      if (completed[i])
+        return;
+      auto r = Static::apply(p, value);
+      completed[i] = update(r);
+      allCompleted = allCompleted && completed[i];
+    });
+    if (allCompleted)
+      return finish();
+    return {};
+  }
+
+  FeedResult<S, T> feed(const S *begin, const S *end) override {
+    if (begin == end)
+      return {0, {}};
+    // Same as Alternate::feed, the branches run over the span independently.
+    std::size_t consumed = 0;
+    std::size_t resultAt = 0;
+    std::size_t localErrorAt = 0;
+    bool allCompleted = true;
+    Static::forEach(options, [&](auto &p, std::size_t i) {
+      if (completed[i])
+        return;
+      auto [n, r] = Static::apply(p, begin, end);
+      if (!r.has_value()) {
+        allCompleted = false;
+        return;
+      }
+      completed[i] = true;
+      if (n > consumed)
+        consumed = n;
+      if (isError(r)) {
+        if (n >= localErrorAt) {
+          error = std::optional(asError(r));
+          errorAt = tokens + n;
+          localErrorAt = n;
+        }
+      } else if (n >= resultAt) {
+        result = std::make_unique<StateResult<S, T>>(std::move(asResult(r)));
+        resultAt = n;
+      }
+    });
+    if (!allCompleted)
+      consumed = end - begin;
+    tokens += consumed;
+    if (result != nullptr) {
+      for (const S *it = begin + resultAt; it != begin + consumed; ++it)
+        result->push(*it);
+    }
+    if (allCompleted)
+      return {consumed, finish()};
+    return {consumed, {}};
+  }
+
+  ParserResult<S, T> operator()() override {
+    Static::forEach(options, [&](auto &p, std::size_t i) {
+      if (completed[i])
+        return;
+      auto r = Static::apply(p);
+      completed[i] = update(r);
+    });
+    if (result != nullptr) {
+      AbstractParserResultPtr<S, T> p = std::move(result);
+      auto parsed = std::make_optional(
+          std::variant<ParsingError, decltype(p)>(std::move(p)));
+      reset();
+      return parsed;
+    }
+    auto e = std::move(error);
+    auto lag = tokens - errorAt;
+    reset();
+    if (e.has_value()) {
+      e->recordAlternate(name);
+      e->delay(lag);
+      return ParsingError::get<S, T>(e.value());
+    }
+    return ParsingError::get<S, T>(ErrorCode::Incomplete, name);
+  }
+
+  void setValidating(const bool validating) override {
+    Static::forEach(options, [&](auto &p, std::size_t) {
+      p.setValidating(validating);
+    });
+  }
+
+  const std::string &getName() const override { return name.str(); }
+
+  FirstSet<S> first() const override {
+    FirstSet<S> set;
+    Static::forEach(options,
+                    [&](auto &p, std::size_t) { set.merge(p.first()); });
+    return set;
+  }
+};
+
+/**
+ * Static version of TakeTill. The suffix states are copies of the suffix
+ * parser, which is never applied itself. As in TakeTill, the states that are
+ * done are kept in a pool for the next tokens instead of copying the suffix
+ * for every token. They stay in place in the storage, and are referred to by
+ * their index.
+ */
+template <typename S, typename T, typename P, typename Q>
+class StaticTakeTill final : public AbstractParser<S, T> {
+private:
+  P parser;
+  Q suffix;
+  Deque<Q> states;
+  // the indices of the states that are not running, which are reset
+  Vector<std::size_t> pool;
+  // the length and the index of the running states
+  Deque<std::pair<int, std::size_t>> suffixStates;
+  PendingTokens<S, T> pending;
+  Queue<S> tokens;
+  Vector<T> content;
+  Name name;
+  bool lastFinished = true;
+  bool validating = false;
+
+  void consumeResult(AbstractParserResultPtr<S, T> result) {
+    if (!validating) {
+      for (auto t = result->get(); t.has_value(); t = result->get())
+        content.push_back(std::move(t.value()));
+    }
+    pending.push(std::move(result));
+  }
+
+  std::size_t acquire() {
+    if (pool.empty()) {
+      states.push_back(suffix);
+      return states.size() - 1;
+    }
+    auto i = pool.back();
+    pool.pop_back();
+    return i;
+  }
+
+  void release(const std::size_t i) {
+    states[i].reset();
+    pool.push_back(i);
+  }
+
+  ParserResult<S, T> consumeTokens(const int keep) {
+    int count = tokens.size() - keep;
+    for (int i = 0; i < count; ++i) {
+      pending.push(std::move(tokens.front()));
+      tokens.pop();
+    }
+    for (auto v = pending.next(); v.has_value(); v = pending.next()) {
+      auto opt = Static::apply(parser, v.value());
+      if ((lastFinished = opt.has_value())) {
+        if (isError(opt)) {
+          auto error = asError(opt);
+          error.record(name);
+          error.delay(pending.skip() + tokens.size());
+          reset();
+          return ParsingError::get<S, T>(error);
+        }
+        consumeResult(std::move(asResult(opt)));
+      }
+    }
+    return {};
+  }
+
+  template <typename R> ParserResult<S, T> terminate(R matched) {
+    if (!lastFinished) {
+      auto opt = Static::apply(parser);
+      if (!opt.has_value()) {
+        auto lag = tokens.size();
+        reset();
+        return ParsingError::get<S, T>(ErrorCode::Incomplete, name, lag);
+      }
+      if (isError(opt)) {
+        auto error = asError(opt);
+        error.record(name);
+        error.delay(tokens.size());
+        reset();
+        return ParsingError::get<S, T>(error);
+      }
+      consumeResult(std::move(asResult(opt)));
+    }
+    while (matched->get().has_value())
+      ;
+    auto parsed = castResult<AggregatedParserResult<S, T>, S, T>(
+        std::move(content), std::move(matched));
+    reset();
+    return parsed;
+  }
+
+public:
+  StaticTakeTill(P parser, Q suffix, Name name)
+      : parser(std::move(parser)), suffix(std::move(suffix)), name(name) {
+    reset();
+  }
+  StaticTakeTill(const StaticTakeTill &other)
+      : parser(other.parser), suffix(other.suffix), name(other.name),
+        validating(other.validating) {
+    reset();
+  }
+  StaticTakeTill(StaticTakeTill &&) = default;
+
+  void reset() override {
+    parser.reset();
+    for (auto &[length, state] : suffixStates)
+      release(state);
+    suffixStates.clear();
+    pending.clear();
+    while (!tokens.empty())
+      tokens.pop();
+    content.clear();
+    lastFinished = true;
+  }
+
+  AbstractParserPtr<S, T> clone() const override {
+    return std::make_unique<StaticTakeTill>(*this);
+  }
+
+  ParserResult<S, T> operator()(const S &value) override {
+    tokens.push(value);
+    suffixStates.emplace_back(0, acquire());
+    int max = 0;
+    auto matched = AbstractParserResultPtr<S, Static::OutputOf<Q>>(nullptr);
+    for (auto it = suffixStates.begin(); it != suffixStates.end();) {
+      if (auto v = Static::apply(states[it->second], value); v.has_value()) {
+        if (!isError(v)) {
+          matched = std::move(asResult(v));
+          max = it->first + 1;
+          break;
+        }
+        release(it->second);
+        it = suffixStates.erase(it);
+      } else {
+        if (max < ++(it->first))
+          max = it->first;
+        ++it;
+      }
+    }
+    if (auto v = consumeTokens(max); v.has_value())
+      return v;
+    if (matched != nullptr)
+      return terminate(std::move(matched));
+    return {};
+  }
+
+  ParserResult<S, T> operator()() override {
+    int max = 0;
+    auto matched = AbstractParserResultPtr<S, Static::OutputOf<Q>>(nullptr);
+    for (auto it = suffixStates.begin(); it != suffixStates.end();) {
+      if (auto v = Static::apply(states[it->second]); v.has_value()) {
+        if (!isError(v)) {
+          matched = std::move(asResult(v));
+          max = it->first + 1;
+          break;
+        }
+        release(it->second);
+        it = suffixStates.erase(it);
+      } else {
+        if (max < ++(it->first))
+          max = it->first;
+        ++it;
+      }
+    }
+    if (matched == nullptr) {
+      reset();
+      return ParsingError::get<S, T>(ErrorCode::NotTerminated, name);
+    }
+    if (auto v = consumeTokens(max); v.has_value())
+      return v;
+    return terminate(std::move(matched));
+  }
+
+  void setValidating(const bool validating) override {
+    this->validating = validating;
+    parser.setValidating(validating);
+    // the suffix states are copies of the suffix
+    suffix.setValidating(validating);
+    for (auto &state : states)
+      state.setValidating(validating);
+  }
+
+  const std::string &getName() const override { return name.str(); }
+
+  FirstSet<S> first() const override {
+    auto set = parser.first();
+    set.merge(suffix.first());
+    return set;
+  }
+};
+
+template <typename P, typename... Ps>
+auto seq(const std::string &name, P &&p, Ps &&... ps) {
+  using S = Static::TokenOf<P>;
+  using T = Static::OutputOf<P>;
+  return StaticSequence<S, T, std::decay_t<P>, std::decay_t<Ps>...>(
+      std::make_tuple(std::forward<P>(p), std::forward<Ps>(ps)...), name);
+}
+
+template <typename P, typename... Ps>
+auto alt(const std::string &name, P &&p, Ps &&... ps) {
+  using S = Static::TokenOf<P>;
+  using T = Static::OutputOf<P>;
+  return StaticAlternate<S, T, std::decay_t<P>, std::decay_t<Ps>...>(
+      std::make_tuple(std::forward<P>(p), std::forward<Ps>(ps)...), name);
+}
+
+template <typename P, typename Q>
+auto takeTill(const std::string &name, P &&p, Q &&q) {
+  using S = Static::TokenOf<P>;
+  using T = Static::OutputOf<P>;
+  return StaticTakeTill<S, T, std::decay_t<P>, std::decay_t<Q>>(
+      std::forward<P>(p), std::forward<Q>(q), name);
+}
+
+} // namespace Parser
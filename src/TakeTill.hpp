@@ -4,6 +4,42 @@
 
 namespace Parser {
 
+/**
+ * Knuth-Morris-Pratt matcher for a literal. The state is the length of the
+ * longest prefix of the literal that matches the end of the input.
+ */
+template <typename S> class KMPMatcher {
+private:
+  std::vector<S> pattern;
+  // the length of the longest proper prefix that is also a suffix of
+  // pattern[0..i]
+  std::vector<int> failure;
+
+public:
+  KMPMatcher(std::vector<S> pattern)
+      : pattern(std::move(pattern)), failure(this->pattern.size(), 0) {
+    for (int i = 1, k = 0; i < size(); ++i) {
+      while (k > 0 && !(this->pattern[i] == this->pattern[k]))
+        k = failure[k - 1];
+      if (this->pattern[i] == this->pattern[k])
+        ++k;
+      failure[i] = k;
+    }
+  }
+
+  int size() const { return pattern.size(); }
+
+  int next(int state, const S &value) const {
+    if (state == size())
+      state = failure[state - 1];
+    while (state > 0 && !(pattern[state] == value))
+      state = failure[state - 1];
+    if (pattern[state] == value)
+      ++state;
+    return state;
+  }
+};
+
 /**
  * Apply the first parser many times until the terminating parser is matched.
  * Simple concept but there are some requirements on the parsers.
@@ -21,25 +57,55 @@ namespace Parser {
  * using a queue, maintain a maximum number of tokens that is currently hold
  * by the different states of the suffix parser, and apply the remaining tokens
  * that are not held by the suffix parser.
+ *
+ * If the suffix is a literal, the states are exactly the prefixes of the
+ * literal that match the end of the input, so we use the KMP matcher instead:
+ * its state is the longest of them, which is the number of tokens held by
+ * the suffix. Otherwise, the suffix states are taken from a pool of instances
+ * of the suffix parser, instead of instantiating it for every token.
  */
 template <typename S, typename T, typename U>
 class TakeTill : public AbstractParser<S, T> {
 private:
   AbstractParserPtr<S, T> parser;
   AbstractParserPtr<S, U> suffix;
-  std::deque<std::pair<int, AbstractParserPtr<S, T>>> suffixStates;
-  std::unique_ptr<std::stack<AbstractParserResultPtr<S, T>>> prevResults;
-  std::queue<S> tokens;
-  std::queue<T> content;
-  QueueParserResult<S, T> *input;
-  std::string name;
+  // the suffix of the definition, for an instance
+  const AbstractParser<S, U> *borrowed = nullptr;
+  Deque<std::pair<int, AbstractParserPtr<S, U>>> suffixStates;
+  std::vector<AbstractParserPtr<S, U>> pool;
+  // the KMP matcher if the suffix is a literal
+  std::shared_ptr<const KMPMatcher<S>> matcher;
+  int prefix = 0;
+  PendingTokens<S, T> pending;
+  Queue<S> tokens;
+  Vector<T> content;
+  Name name;
+  // the sink mode, the sink had mark outputs when the parser started
+  OutputSink<T> *sink = nullptr;
+  std::size_t mark = 0;
+  bool started = false;
   bool lastFinished = true;
+  bool validating = false;
+
+  void start() {
+    if (!started && sink != nullptr)
+      mark = sink->size();
+    started = true;
+  }
+
+  ParserResult<S, T> fail(ParserResult<S, T> error) {
+    reset();
+    return error;
+  }
 
   void consumeResult(AbstractParserResultPtr<S, T> result) {
-    for (auto t = result->get(); t.has_value(); t = result->get()) {
-      content.push(t.value());
+    if (sink != nullptr) {
+      sink->drain(*result);
+    } else if (!validating) {
+      for (auto t = result->get(); t.has_value(); t = result->get())
+        content.push_back(std::move(t.value()));
     }
-    prevResults->push(std::move(result));
+    pending.push(std::move(result));
   }
 
   ParserResult<S, T> consumeTokens(const int keep) {
@@ -47,35 +113,20 @@ private:
     int count = tokens.size() - keep;
     for (int i = 0; i < count; ++i) {
       auto &t = tokens.front();
-      input->push(t);
+      pending.push(std::move(t));
       tokens.pop();
     }
-    while (true) {
-      // this part is similar to what happened in the sequence parser,
-      // as the parser is applied repeatedly in a sequential manner.
-      S v;
-      bool hasValue = true;
-      while (true) {
-        if (auto t = prevResults->top()->getRemaining(); t.has_value()) {
-          v = t.value();
-          break;
-        }
-        if (prevResults->size() == 1) {
-          // we don't delete the last one, that is the input queue
-          hasValue = false;
-          break;
-        }
-        prevResults->pop();
-      }
-      if (!hasValue)
-        break;
-      auto opt = (*parser)(v);
+    // this part is similar to what happened in the sequence parser, as the
+    // parser is applied repeatedly in a sequential manner.
+    for (auto v = pending.next(); v.has_value(); v = pending.next()) {
+      auto opt = (*parser)(v.value());
       if ((lastFinished = opt.has_value())) {
         if (isError(opt)) {
           auto error = asError(opt);
           error.record(name);
-          reset();
-          return ParsingError::get<S, T>(error);
+          // the tokens after it, the ones held by the suffix included
+          error.delay(pending.skip() + tokens.size());
+          return fail(ParsingError::get<S, T>(error));
         }
         consumeResult(std::move(asResult(opt)));
       }
@@ -83,33 +134,154 @@ private:
     return {};
   }
 
+  void release(AbstractParserPtr<S, U> state) {
+    state->reset();
+    pool.push_back(std::move(state));
+  }
+
+  // The suffix that the states are instances of.
+  const AbstractParser<S, U> &prototype() const {
+    return borrowed != nullptr ? *borrowed : *suffix;
+  }
+
+  AbstractParserPtr<S, U> acquire() {
+    if (pool.empty()) {
+      auto state = prototype().instantiate();
+      state->setValidating(validating);
+      return state;
+    }
+    auto state = std::move(pool.back());
+    pool.pop_back();
+    return state;
+  }
+
+  ParserResult<S, T> terminate(AbstractParserResultPtr<S, U> matched) {
+    if (!lastFinished) {
+      // the parser ends where the suffix starts
+      auto opt = (*parser)();
+      if (!opt.has_value())
+        return fail(ParsingError::get<S, T>(ErrorCode::Incomplete, name,
+                                            tokens.size()));
+      if (isError(opt)) {
+        auto error = asError(opt);
+        error.record(name);
+        error.delay(tokens.size());
+        return fail(ParsingError::get<S, T>(error));
+      }
+      consumeResult(std::move(asResult(opt)));
+    }
+    // discard the output of the suffix parser, as we don't want its output.
+    while (matched->get().has_value())
+      ;
+    // the outputs in the sink are kept
+    started = false;
+    auto parsed = castResult<AggregatedParserResult<S, T>, S, T>(
+        std::move(content), std::move(matched));
+    reset();
+    return parsed;
+  }
+
+  ParserResult<S, T> literalStep(const S &value) {
+    start();
+    tokens.push(value);
+    prefix = matcher->next(prefix, value);
+    if (auto v = consumeTokens(prefix); v.has_value())
+      return v;
+    if (prefix == matcher->size()) {
+      // the literal has no output and no remaining tokens
+      return terminate(std::make_unique<QueueParserResult<S, U>>());
+    }
+    return {};
+  }
+
+  // An instance of the definition, with an instance of its parser.
+  TakeTill(decltype(parser) parser, const TakeTill &definition)
+      : parser(std::move(parser)), borrowed(&definition.prototype()),
+        matcher(definition.matcher), name(definition.name),
+        validating(definition.validating) {
+    reset();
+  }
+
 public:
-  TakeTill(decltype(parser) parser, decltype(suffix) suffix,
-           const std::string &name)
+  TakeTill(decltype(parser) parser, decltype(suffix) suffix, Name name)
       : parser(std::move(parser)), suffix(std::move(suffix)), name(name) {
+    if (auto literal = this->suffix->literal();
+        literal.has_value() && !literal->empty())
+      matcher = std::make_shared<KMPMatcher<S>>(std::move(literal.value()));
     reset();
   }
 
+  /**
+   * Reset the parsers, and take back the outputs put in the sink since the
+   * parser started.
+   */
   void reset() override {
     parser->reset();
-    suffixStates.clear();
-    prevResults = std::make_unique<std::stack<AbstractParserResultPtr<S, T>>>();
-    auto storage = std::make_unique<QueueParserResult<S, T>>();
-    input = storage.get();
-    prevResults->push(std::move(storage));
-    while (!content.empty())
-      content.pop();
+    if (started && sink != nullptr)
+      sink->truncate(mark);
+    while (!suffixStates.empty()) {
+      release(std::move(suffixStates.front().second));
+      suffixStates.pop_front();
+    }
+    while (!tokens.empty())
+      tokens.pop();
+    prefix = 0;
+    pending.clear();
+    content.clear();
+    lastFinished = true;
+    started = false;
+  }
+
+  bool restore(AbstractParser<S, T> &other) override {
+    auto p = dynamic_cast<TakeTill<S, T, U> *>(&other);
+    if (p == nullptr || sink != nullptr || p->sink != nullptr)
+      return false;
+    // the outputs are copied
+    if constexpr (!std::is_copy_constructible_v<T>) {
+      if (!p->content.empty())
+        return false;
+    }
+    // the results of the parser are always drained before we return
+    reset();
+    if (!parser->restore(*p->parser))
+      return false;
+    for (auto &[length, state] : p->suffixStates) {
+      auto copy = acquire();
+      if (!copy->restore(*state))
+        return false;
+      suffixStates.push_back(std::make_pair(length, std::move(copy)));
+    }
+    tokens = p->tokens;
+    prefix = p->prefix;
+    if constexpr (std::is_copy_constructible_v<T>)
+      content = p->content;
+    lastFinished = p->lastFinished;
+    started = p->started;
+    return true;
+  }
+
+  AbstractParserPtr<S, T> clone() const override {
+    auto p = std::make_unique<TakeTill<S, T, U>>(
+        std::move(parser->clone()), std::move(prototype().clone()), name);
+    p->validating = validating;
+    return p;
   }
 
-  AbstractParserPtr<S, T> clone() override {
-    return std::make_unique<TakeTill<S, T, U>>(
-        std::move(parser->clone()), std::move(suffix->clone()), name);
+  /**
+   * The instance borrows the suffix, its suffix states are instances of it.
+   */
+  AbstractParserPtr<S, T> instantiate() const override {
+    return std::unique_ptr<TakeTill<S, T, U>>(
+        new TakeTill<S, T, U>(parser->instantiate(), *this));
   }
 
   ParserResult<S, T> operator()(const S &value) override {
+    if (matcher != nullptr)
+      return literalStep(value);
+    start();
     tokens.push(value);
     // add new state
-    suffixStates.push_back(std::make_pair(0, std::move(suffix->clone())));
+    suffixStates.push_back(std::make_pair(0, acquire()));
     int max = 0;
     auto matched = std::unique_ptr<AbstractParserResult<S, U>>(nullptr);
     // delete states that does not match with the input, and track the length of
@@ -123,6 +295,7 @@ public:
           break;
         }
         // suffix not match, remove this state
+        release(std::move(it->second));
         it = suffixStates.erase(it);
       } else {
         // suffix not yet determined
@@ -135,36 +308,34 @@ public:
     // input
     if (auto v = consumeTokens(max); v.has_value())
       return v;
-    if (matched != nullptr) {
-      // the suffix matched against the input
-      // we must terminate the parser
-      if (!lastFinished) {
-        auto opt = (*parser)();
-        if (!opt.has_value()) {
-          reset();
-          return ParsingError::get<S, T>("Insufficient Tokens", name);
-        }
-        if (isError(opt)) {
-          auto error = asError(opt);
-          error.record(name);
-          reset();
-          return ParsingError::get<S, T>(error);
-        }
-        consumeResult(std::move(asResult(opt)));
+    // the suffix matched against the input, we must terminate the parser
+    if (matched != nullptr)
+      return terminate(std::move(matched));
+    return {};
+  }
+
+  FeedResult<S, T> feed(const S *begin, const S *end) override {
+    // The suffix states have to see every token, so this is just the token
+    // loop without the virtual call.
+    if (matcher != nullptr) {
+      for (const S *it = begin; it != end; ++it) {
+        if (auto result = literalStep(*it); result.has_value())
+          return {static_cast<std::size_t>(it - begin + 1), std::move(result)};
       }
-      // discard the output of the suffix parser, as we don't want its output.
-      while (matched->get().has_value())
-        ;
-      auto parsed = castResult<AggregatedParserResult<S, T>, S, T>(
-          std::make_unique<std::stack<AbstractParserResultPtr<S, T>>>(),
-          std::move(matched), content);
-      reset();
-      return parsed;
+      return {static_cast<std::size_t>(end - begin), {}};
     }
-    return {};
+    for (const S *it = begin; it != end; ++it) {
+      if (auto result = TakeTill::operator()(*it); result.has_value())
+        return {static_cast<std::size_t>(it - begin + 1), std::move(result)};
+    }
+    return {static_cast<std::size_t>(end - begin), {}};
   }
 
   ParserResult<S, T> operator()() override {
+    start();
+    // a literal cannot match at the end of input
+    if (matcher != nullptr)
+      return fail(ParsingError::get<S, T>(ErrorCode::NotTerminated, name));
     int max = 0;
     auto matched = std::unique_ptr<AbstractParserResult<S, U>>(nullptr);
     for (auto it = suffixStates.begin(); it != suffixStates.end();) {
@@ -176,6 +347,7 @@ public:
           break;
         }
         // suffix not match, remove this state
+        release(std::move(it->second));
         it = suffixStates.erase(it);
       } else {
         // suffix not yet determined
@@ -185,35 +357,62 @@ public:
       }
     }
     if (matched == nullptr)
-      return ParsingError::get<S, T>("Insufficient Tokens: Not Terminated",
-                                     name);
+      return fail(ParsingError::get<S, T>(ErrorCode::NotTerminated, name));
 
     if (auto v = consumeTokens(max); v.has_value())
       return v;
-    if (!lastFinished) {
-      auto opt = (*parser)();
-      if (!opt.has_value()) {
-        reset();
-        return ParsingError::get<S, T>("Insufficient Tokens", name);
-      }
-      if (isError(opt)) {
-        auto error = asError(opt);
-        error.record(name);
-        reset();
-        return ParsingError::get<S, T>(error);
-      }
-      consumeResult(std::move(asResult(opt)));
-    }
-    while (matched->get().has_value())
-      ;
-    auto parsed = castResult<AggregatedParserResult<S, T>, S, T>(
-        std::make_unique<std::stack<AbstractParserResultPtr<S, T>>>(),
-        std::move(matched), content);
+    return terminate(std::move(matched));
+  }
+
+  void setValidating(const bool validating) override {
+    this->validating = validating;
+    parser->setValidating(validating);
+    // the output of the suffix is discarded anyway
+    if (suffix != nullptr)
+      suffix->setValidating(validating);
+    for (auto &state : pool)
+      state->setValidating(validating);
+    for (auto &[length, state] : suffixStates)
+      state->setValidating(validating);
+  }
+
+  /**
+   * The suffix states run at the same time as the parser, and their outputs
+   * are discarded, so they are not in the sink mode.
+   */
+  void setSink(OutputSink<T> *sink) override {
+    this->sink = sink;
+    parser->setSink(sink);
+  }
+
+  const std::string &getName() const override { return name.str(); }
+
+  auto &getParser() {
+    grammarChanged();
+    return parser;
+  }
+
+  const auto &getParser() const { return parser; }
+
+  /**
+   * The suffix may be replaced, so the pooled suffix states, which are
+   * instances of it, are dropped. nullptr for an instance.
+   */
+  auto &getSuffix() {
     reset();
-    return parsed;
+    pool.clear();
+    grammarChanged();
+    return suffix;
   }
 
-  const std::string &getName() override { return name; }
+  const auto &getSuffix() const { return suffix; }
+
+  FirstSet<S> first() const override {
+    // the first token goes to the suffix, or the parser if the suffix fails
+    auto set = parser->first();
+    set.merge(prototype().first());
+    return set;
+  }
 
   static AbstractParserPtr<S, T> get(decltype(parser) parser,
                                      decltype(suffix) suffix,
@@ -0,0 +1,659 @@
+#include "Vm.hpp"
+#include "Alternate.hpp"
+#include "Lazy.hpp"
+#include "LiteralSet.hpp"
+#include "Predicate.hpp"
+#include "Sequence.hpp"
+#include <algorithm>
+#include <iterator>
+#include <unordered_map>
+
+namespace Parser {
+
+namespace {
+using CharPredicate =
+    PredicateParser<char, std::string, Utils::fromChar, Utils::fold>;
+
+class Compiler {
+private:
+  VmParser::Program &program;
+  // the instructions of the parsers, so that the recursion of the lazy
+  // parsers is a jump back
+  std::unordered_map<const void *, std::uint32_t> compiled;
+
+  // The operands are contiguous, so the children are compiled first.
+  std::uint32_t
+  children(const std::vector<AbstractParserPtr<char, std::string>> &ps,
+           const bool firsts) {
+    std::vector<std::uint32_t> pcs;
+    for (auto &p : ps)
+      pcs.push_back(emit(*p));
+    std::uint32_t first = program.operands.size();
+    for (std::size_t i = 0; i < ps.size(); ++i) {
+      program.operands.push_back(pcs[i]);
+      program.firsts.push_back(firsts ? ps[i]->first() : FirstSet<char>());
+    }
+    return first;
+  }
+
+  void object(const std::uint32_t pc, AbstractParserPtr<char, std::string> p) {
+    auto &ins = program.code[pc];
+    ins.op = VmParser::Op::Object;
+    ins.first = program.objects.size();
+    program.objects.push_back(std::move(p));
+  }
+
+public:
+  Compiler(VmParser::Program &program) : program(program) {}
+
+  std::uint32_t emit(AbstractParser<char, std::string> &parser) {
+    if (auto it = compiled.find(&parser); it != compiled.end())
+      return it->second;
+    if (auto p = dynamic_cast<LazyParser<char, std::string> *>(&parser);
+        p != nullptr && p->isTransparent()) {
+      auto pc = emit(*p->getSource());
+      compiled.emplace(&parser, pc);
+      return pc;
+    }
+    // the instruction is added before its children, which may jump back to it
+    std::uint32_t pc = program.code.size();
+    program.code.push_back(
+        VmParser::Instruction{VmParser::Op::Object, 0, ONCE, 0, 0,
+                              parser.getName()});
+    compiled.emplace(&parser, pc);
+    if (auto p = dynamic_cast<CharPredicate *>(&parser)) {
+      auto l = p->literal();
+      int q = p->getQuantifier();
+      auto &ins = program.code[pc];
+      if (l.has_value() && !l->empty() && q == static_cast<int>(l->size())) {
+        ins.op = VmParser::Op::Literal;
+        ins.first = program.text.size();
+        ins.count = l->size();
+        program.text.append(l->begin(), l->end());
+      } else if (p->getToken().has_value() &&
+                 (q == OPTIONAL || q == ANY || q == MORE || q == 0)) {
+        ins.op = VmParser::Op::Token;
+        ins.token = *p->getToken();
+        ins.quantifier = q;
+      } else {
+        object(pc, parser.clone());
+      }
+    } else if (auto p =
+                   dynamic_cast<const Sequence<char, std::string> *>(&parser);
+               p != nullptr && !p->getSequence()->empty()) {
+      auto first = children(*p->getSequence(), false);
+      auto &ins = program.code[pc];
+      ins.op = VmParser::Op::Sequence;
+      ins.first = first;
+      ins.count = p->getSequence()->size();
+    } else if (auto p =
+                   dynamic_cast<const Alternate<char, std::string> *>(&parser);
+               p != nullptr && !p->getOptions()->empty()) {
+      if (auto set = LiteralSet::fromOptions(*p->getOptions(),
+                                             parser.getName())) {
+        object(pc, std::move(set));
+        return pc;
+      }
+      auto first = children(*p->getOptions(), true);
+      auto &ins = program.code[pc];
+      ins.op = VmParser::Op::Alternate;
+      ins.first = first;
+      ins.count = p->getOptions()->size();
+    } else if (auto p = dynamic_cast<
+                   const TakeTill<char, std::string, std::string> *>(&parser)) {
+      auto l = p->getSuffix()->literal();
+      if (!l.has_value() || l->empty()) {
+        object(pc, parser.clone());
+        return pc;
+      }
+      auto body = emit(*p->getParser());
+      auto &ins = program.code[pc];
+      ins.op = VmParser::Op::TakeTill;
+      ins.first = body;
+      ins.count = program.matchers.size();
+      program.matchers.push_back(
+          std::make_shared<KMPMatcher<char>>(std::move(l.value())));
+    } else {
+      object(pc, parser.clone());
+    }
+    return pc;
+  }
+};
+} // namespace
+
+VmParser::VmParser(
+    std::shared_ptr<const Program> program,
+    std::shared_ptr<const AbstractParser<char, std::string>> source)
+    : program(std::move(program)), source(std::move(source)) {
+  // the program is shared and outlives the instances
+  for (auto &p : this->program->objects)
+    objects.push_back(p->instantiate());
+}
+
+void VmParser::reset() {
+  // the other parsers reset themselves when they return
+  for (auto &f : frames) {
+    auto &ins = program->code[f.pc];
+    if (ins.op == Op::Object)
+      objects[ins.first]->reset();
+  }
+  buffer.clear();
+  frames.clear();
+  outputs.clear();
+  unwindTo = -1;
+  returning = false;
+  ended = false;
+}
+
+AbstractParserPtr<char, std::string> VmParser::clone() const {
+  auto p = std::make_unique<VmParser>(program, source);
+  p->setValidating(validating);
+  return p;
+}
+
+bool VmParser::restore(AbstractParser<char, std::string> &other) {
+  auto p = dynamic_cast<VmParser *>(&other);
+  if (p == nullptr || p->program != program)
+    return false;
+  for (std::size_t i = 0; i < objects.size(); ++i) {
+    if (!objects[i]->restore(*p->objects[i]))
+      return false;
+  }
+  buffer = p->buffer;
+  frames = p->frames;
+  outputs = p->outputs;
+  ret = p->ret;
+  unwindTo = p->unwindTo;
+  returning = p->returning;
+  ended = p->ended;
+  return true;
+}
+
+void VmParser::setValidating(const bool validating) {
+  this->validating = validating;
+  for (auto &p : objects)
+    p->setValidating(validating);
+}
+
+VmParser::Read VmParser::need(const std::size_t p, const std::int32_t window,
+                              std::size_t &limit) {
+  while (true) {
+    // Find the frame that holds the token: the take tills that hold it have
+    // to run their matcher on their next token first (inner), which they read
+    // through their own window.
+    std::int32_t w = window, inner = -1;
+    std::size_t q = p;
+    Read r = Read::Available;
+    for (; w >= 0; inner = w, w = frames[w].window) {
+      auto &f = frames[w];
+      if (program->code[f.pc].op == Op::Alternate) {
+        // only the first token is applied to a skipped option
+        if (q > f.start) {
+          unwindTo = w;
+          return Read::Unwind;
+        }
+        limit = f.start + 1;
+        break;
+      }
+      limit = f.start + f.fed - f.prefix;
+      if (q < limit)
+        break;
+      if (f.matched) {
+        r = Read::End;
+        break;
+      }
+      q = f.start + f.fed;
+    }
+    if (w < 0) {
+      if (q >= buffer.size() && input != inputEnd) {
+        // doubled, so that the span is copied once for a long match, but a
+        // short one does not copy the rest of the span
+        std::size_t n = std::max<std::size_t>(buffer.size(), 1024);
+        n = std::min<std::size_t>(n, inputEnd - input);
+        buffer.append(input, n);
+        input += n;
+      }
+      limit = buffer.size();
+      r = q < limit ? Read::Available : ended ? Read::End : Read::Wait;
+    }
+    if (inner < 0 || r == Read::Wait)
+      return r;
+    if (r == Read::End) {
+      // the suffix is not terminated, at the end of the window
+      unwindTo = inner;
+      ret.at = limit;
+      return Read::Unwind;
+    }
+    auto &f = frames[inner];
+    auto &matcher = *program->matchers[program->code[f.pc].count];
+    f.prefix = matcher.next(f.prefix, buffer[q]);
+    ++f.fed;
+    f.matched = f.prefix == matcher.size();
+  }
+}
+
+void VmParser::push(const std::uint32_t pc, const std::size_t start,
+                    const std::int32_t window) {
+  auto &f = frames.emplace_back();
+  f.pc = pc;
+  f.window = window;
+  f.start = start;
+  f.pos = start;
+  f.outputs = outputs.size();
+}
+
+VmParser::Step VmParser::succeed(const std::size_t end,
+                                 const std::size_t time) {
+  frames.pop_back();
+  ret.status = Status::Ok;
+  ret.end = end;
+  ret.time = time;
+  returning = true;
+  return Step::Continue;
+}
+
+VmParser::Step VmParser::fail(ParsingError error, const std::size_t time,
+                              const std::size_t at) {
+  outputs.resize(frames.back().outputs);
+  frames.pop_back();
+  ret.status = Status::Error;
+  ret.time = time;
+  ret.error = error;
+  ret.at = at;
+  returning = true;
+  return Step::Continue;
+}
+
+VmParser::Step VmParser::none() {
+  outputs.resize(frames.back().outputs);
+  frames.pop_back();
+  ret.status = Status::None;
+  ret.time = eof;
+  returning = true;
+  return Step::Continue;
+}
+
+VmParser::Step VmParser::unwind() {
+  for (std::size_t i = unwindTo + 1; i < frames.size(); ++i) {
+    auto &ins = program->code[frames[i].pc];
+    if (ins.op == Op::Object)
+      objects[ins.first]->reset();
+  }
+  if (static_cast<std::size_t>(unwindTo + 1) < frames.size()) {
+    outputs.resize(frames[unwindTo + 1].outputs);
+    frames.resize(unwindTo + 1);
+  }
+  ret.status = Status::Unwound;
+  returning = true;
+  return Step::Continue;
+}
+
+VmParser::Step VmParser::literal(Frame &f, const Instruction &ins) {
+  const char *text = program->text.data() + ins.first;
+  const std::size_t stop = f.start + ins.count;
+  while (f.pos < stop) {
+    std::size_t limit;
+    switch (need(f.pos, f.window, limit)) {
+    case Read::Wait:
+      return Step::Wait;
+    case Read::Unwind:
+      return Step::Unwind;
+    case Read::End:
+      return fail(ParsingError(ErrorCode::InsufficientTokens, ins.name), eof,
+                  limit);
+    case Read::Available:
+      break;
+    }
+    for (limit = std::min(limit, stop); f.pos < limit; ++f.pos) {
+      if (buffer[f.pos] != text[f.pos - f.start])
+        return fail(ParsingError(ErrorCode::InsufficientTokens, ins.name),
+                    f.pos + 1, f.pos);
+    }
+  }
+  if (!validating)
+    outputs.emplace_back(buffer, f.start, ins.count);
+  return succeed(stop, stop);
+}
+
+VmParser::Step VmParser::token(Frame &f, const Instruction &ins) {
+  while (true) {
+    std::size_t limit;
+    switch (need(f.pos, f.window, limit)) {
+    case Read::Wait:
+      return Step::Wait;
+    case Read::Unwind:
+      return Step::Unwind;
+    case Read::End:
+      if (f.pos == f.start && ins.quantifier == MORE)
+        return fail(ParsingError(ErrorCode::InsufficientTokens, ins.name),
+                    eof, limit);
+      if (!validating && f.pos > f.start)
+        outputs.emplace_back(buffer, f.start, f.pos - f.start);
+      return succeed(f.pos, eof);
+    case Read::Available:
+      break;
+    }
+    for (; f.pos < limit; ++f.pos) {
+      if (buffer[f.pos] != ins.token) {
+        // the token remains
+        if (f.pos == f.start && ins.quantifier == MORE)
+          return fail(ParsingError(ErrorCode::InsufficientTokens, ins.name),
+                      f.pos + 1, f.pos);
+        if (!validating && f.pos > f.start)
+          outputs.emplace_back(buffer, f.start, f.pos - f.start);
+        return succeed(f.pos, f.pos + 1);
+      }
+      if (ins.quantifier == OPTIONAL) {
+        if (!validating)
+          outputs.emplace_back(1, ins.token);
+        return succeed(f.pos + 1, f.pos + 1);
+      }
+    }
+  }
+}
+
+VmParser::Step VmParser::object(Frame &f, const Instruction &ins) {
+  auto &parser = *objects[ins.first];
+  while (true) {
+    std::size_t limit;
+    ParserResult<char, std::string> r;
+    std::size_t time = eof;
+    switch (need(f.pos, f.window, limit)) {
+    case Read::Wait:
+      return Step::Wait;
+    case Read::Unwind:
+      return Step::Unwind;
+    case Read::End:
+      r = parser();
+      if (!r.has_value()) {
+        parser.reset();
+        return none();
+      }
+      break;
+    case Read::Available: {
+      auto fed = parser.feed(buffer.data() + f.pos, buffer.data() + limit);
+      f.pos += fed.consumed;
+      if (!fed.result.has_value())
+        continue;
+      r = std::move(fed.result);
+      time = f.pos;
+    }
+    }
+    if (isError(r)) {
+      auto lag = std::min<std::size_t>(asError(r).getLag(), f.pos);
+      return fail(asError(r), time, f.pos - lag);
+    }
+    auto &result = asResult(r);
+    for (auto t = result->get(); t.has_value(); t = result->get()) {
+      if (!validating)
+        outputs.push_back(std::move(t.value()));
+    }
+    std::size_t remaining = 0;
+    while (result->getRemaining().has_value())
+      ++remaining;
+    return succeed(f.pos - remaining, time);
+  }
+}
+
+VmParser::Step VmParser::sequence(Frame &f, const Instruction &ins) {
+  if (!returning) {
+    push(program->operands[ins.first], f.start, f.window);
+    return Step::Continue;
+  }
+  returning = false;
+  // After the end of input, the tokens left by a child are given to the next
+  // one by one, and the sequence fails if the child does not return on the
+  // first one, as Sequence::operator()() does.
+  if (f.head && ret.time != f.pos + 1)
+    return fail(ParsingError(ErrorCode::Incomplete, ins.name), eof, eof);
+  if (ret.status == Status::Error) {
+    auto e = ret.error;
+    e.record(ins.name);
+    return fail(e, std::max(f.time, ret.time), ret.at);
+  }
+  if (ret.status != Status::Ok)
+    return fail(ParsingError(ErrorCode::Incomplete, ins.name), eof, eof);
+  f.time = std::max(f.time, ret.time);
+  if (++f.index == ins.count)
+    return succeed(ret.end, f.time);
+  // the remaining tokens of the child are applied to the next one
+  f.pos = ret.end;
+  f.head = false;
+  if (f.time == eof) {
+    std::size_t limit;
+    switch (need(f.pos, f.window, limit)) {
+    case Read::Unwind:
+      return Step::Unwind;
+    case Read::Available:
+      f.head = true;
+      break;
+    case Read::Wait:
+    case Read::End:
+      break;
+    }
+  }
+  auto window = f.window;
+  push(program->operands[ins.first + f.index], f.pos, window);
+  return Step::Continue;
+}
+
+VmParser::Step VmParser::alternate(Frame &f, const Instruction &ins) {
+  if (!f.started) {
+    std::size_t limit;
+    switch (need(f.start, f.window, limit)) {
+    case Read::Wait:
+      return Step::Wait;
+    case Read::Unwind:
+      return Step::Unwind;
+    case Read::End:
+      f.time = eof;
+      break;
+    case Read::Available:
+      f.head = true;
+      f.first = buffer[f.start];
+      f.time = f.start + 1;
+      break;
+    }
+    f.started = true;
+    f.bestOutputs = f.outputs;
+  } else if (returning) {
+    returning = false;
+    if (f.fallback) {
+      // the error of the skipped option, if it fails on the first token
+      if (ret.status == Status::Error) {
+        f.error = ret.error;
+        f.errorAt = ret.at;
+      }
+      f.index = ins.count;
+    } else {
+      if (ret.status == Status::Ok) {
+        if (!f.best || ret.time >= f.bestTime) {
+          outputs.erase(outputs.begin() + f.outputs,
+                        outputs.begin() + f.bestOutputs);
+          f.best = true;
+          f.bestEnd = ret.end;
+          f.bestTime = ret.time;
+          f.bestOutputs = outputs.size();
+        } else {
+          outputs.resize(f.bestOutputs);
+        }
+      } else if (ret.status == Status::Error &&
+                 (!f.error.has_value() || ret.time >= f.errorTime)) {
+        f.error = ret.error;
+        f.errorTime = ret.time;
+        f.errorAt = ret.at;
+        f.errorIndex = f.index;
+      }
+      f.time = std::max(f.time, ret.time);
+      ++f.index;
+    }
+  }
+  for (; f.index < ins.count; ++f.index) {
+    if (!f.head || program->firsts[ins.first + f.index].mayStart(f.first)) {
+      push(program->operands[ins.first + f.index], f.start, f.window);
+      return Step::Continue;
+    }
+    f.skipped = f.index;
+  }
+  if (f.best)
+    return succeed(f.bestEnd, f.time);
+  // The skipped options fail on the first token. If one of them would be the
+  // last one failing, apply the token to get its error.
+  if (!f.fallback && f.skipped >= 0 &&
+      (!f.error.has_value() ||
+       (f.errorTime == f.start + 1 &&
+        f.errorIndex < static_cast<std::uint32_t>(f.skipped)))) {
+    f.fallback = true;
+    std::int32_t self = frames.size() - 1;
+    push(program->operands[ins.first + f.skipped], f.start, self);
+    return Step::Continue;
+  }
+  if (!f.error.has_value())
+    return fail(ParsingError(ErrorCode::Incomplete, ins.name), f.time, eof);
+  auto e = f.error.value();
+  e.recordAlternate(ins.name);
+  return fail(e, f.time, f.errorAt);
+}
+
+VmParser::Step VmParser::takeTill(Frame &f, const Instruction &ins) {
+  if (returning) {
+    returning = false;
+    switch (ret.status) {
+    case Status::Unwound:
+      return fail(ParsingError(ErrorCode::NotTerminated, ins.name), eof,
+                  ret.at);
+    case Status::Error: {
+      auto e = ret.error;
+      e.record(ins.name);
+      return fail(e, f.start + f.fed, ret.at);
+    }
+    case Status::None:
+      // the body ends where the suffix starts
+      return fail(ParsingError(ErrorCode::Incomplete, ins.name),
+                  f.start + f.fed, f.start + f.fed - f.prefix);
+    case Status::Ok:
+      break;
+    }
+    f.pos = ret.end;
+    // the body was given the end of input, when the suffix matched
+    if (ret.time == eof)
+      return succeed(f.start + f.fed, f.start + f.fed);
+  }
+  // the body is applied again from the end of its last match, if there is a
+  // token that the suffix does not hold
+  std::size_t limit;
+  std::int32_t self = frames.size() - 1;
+  switch (need(f.pos, self, limit)) {
+  case Read::Wait:
+    return Step::Wait;
+  case Read::Unwind:
+    return Step::Unwind;
+  case Read::End:
+    return succeed(f.start + f.fed, f.start + f.fed);
+  case Read::Available:
+    break;
+  }
+  push(ins.first, f.pos, self);
+  return Step::Continue;
+}
+
+bool VmParser::run() {
+  while (!frames.empty()) {
+    auto &f = frames.back();
+    auto &ins = program->code[f.pc];
+    Step step = Step::Continue;
+    switch (ins.op) {
+    case Op::Literal:
+      step = literal(f, ins);
+      break;
+    case Op::Token:
+      step = token(f, ins);
+      break;
+    case Op::Sequence:
+      step = sequence(f, ins);
+      break;
+    case Op::Alternate:
+      step = alternate(f, ins);
+      break;
+    case Op::TakeTill:
+      step = takeTill(f, ins);
+      break;
+    case Op::Object:
+      step = object(f, ins);
+      break;
+    }
+    if (step == Step::Wait)
+      return false;
+    if (step == Step::Unwind)
+      unwind();
+  }
+  return true;
+}
+
+ParserResult<char, std::string> VmParser::result() {
+  ParserResult<char, std::string> r;
+  if (ret.status == Status::Ok) {
+    std::size_t stop = std::min(ret.time, buffer.size());
+    r = castResult<VmResult, char, std::string>(
+        std::vector<std::string>(std::make_move_iterator(outputs.begin()),
+                                 std::make_move_iterator(outputs.end())),
+        buffer.substr(ret.end, stop - ret.end));
+  } else if (ret.status == Status::Error) {
+    r = ParsingError::get<char, std::string>(ret.error);
+    auto applied = buffer.size();
+    asError(r).setLag(ret.at < applied ? applied - ret.at : 0);
+  }
+  reset();
+  return r;
+}
+
+ParserResult<char, std::string> VmParser::operator()(const char &value) {
+  if (frames.empty())
+    push(program->entry, 0, -1);
+  buffer.push_back(value);
+  if (!run())
+    return {};
+  return result();
+}
+
+FeedResult<char, std::string> VmParser::feed(const char *begin,
+                                             const char *end) {
+  if (begin == end)
+    return {0, {}};
+  if (frames.empty())
+    push(program->entry, 0, -1);
+  std::size_t base = buffer.size();
+  input = begin;
+  inputEnd = end;
+  bool done = run();
+  input = inputEnd = nullptr;
+  if (!done) {
+    // the frames are waiting for a token after the span
+    return {static_cast<std::size_t>(end - begin), {}};
+  }
+  // the root returns on the last token it reads, the tokens after it are not
+  // consumed
+  std::size_t consumed = ret.time - base;
+  buffer.resize(ret.time);
+  return {consumed, result()};
+}
+
+ParserResult<char, std::string> VmParser::operator()() {
+  if (frames.empty())
+    push(program->entry, 0, -1);
+  ended = true;
+  run();
+  return result();
+}
+
+std::unique_ptr<VmParser>
+VmParser::compile(AbstractParserPtr<char, std::string> parser) {
+  auto program = std::make_shared<Program>();
+  Compiler compiler(*program);
+  program->entry = compiler.emit(*parser);
+  return std::make_unique<VmParser>(
+      std::move(program),
+      std::shared_ptr<AbstractParser<char, std::string>>(std::move(parser)));
+}
+
+} // namespace Parser
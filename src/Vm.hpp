@@ -0,0 +1,238 @@
+#pragma once
+#include "Parser.hpp"
+#include "Predicate.hpp"
+#include "TakeTill.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Parser {
+
+/**
+ * A grammar compiled into a flat array of instructions, run by a loop with an
+ * explicit stack of frames instead of a tree of parser objects. Sequences,
+ * alternations, lazy parsers (without a mapping function or a memo table),
+ * take tills with a literal suffix and the predicates matching a literal or a
+ * repeated token are compiled. The sources of the lazy parsers are compiled
+ * once, and a lazy parser is a jump to its source, so the recursion only
+ * grows the stack of frames. The other parsers (regular expressions,
+ * character classes, custom predicates...) are run as they are, from a clone
+ * per VmParser.
+ *
+ * The tokens of the current match are kept in a buffer, and the frames refer
+ * to them by position: the options of an alternation are run one after the
+ * other from the same position instead of in lockstep, and the remaining
+ * tokens of a result are the tokens between the end of its match and the last
+ * token it was given. The results are the ones the options would have in
+ * lockstep (the option that completes on the latest token wins, the last one
+ * on ties), so the outputs, the remaining tokens and the errors are the same
+ * as the ones of the parsers, and the results are returned on the same token.
+ * When the frame on the top needs a token that was not given yet, the loop
+ * returns and resumes there on the next token.
+ *
+ * The body of a take till only sees the tokens that the suffix does not hold:
+ * the frames of the body read through the frame of the take till, which runs
+ * the suffix matcher on the next token when they need one, and gives them the
+ * end of input when the suffix matches.
+ *
+ * The parsers that are run as they are must leave the last tokens they were
+ * given as their remaining tokens, as the parsers of this library do.
+ */
+class VmParser final : public AbstractParser<char, std::string> {
+public:
+  enum class Op : std::uint8_t {
+    // a literal of count characters from first in the text
+    Literal,
+    // the token repeated, with an OPTIONAL, ANY or MORE quantifier
+    Token,
+    // the count children from first in the operands
+    Sequence,
+    Alternate,
+    // the body is first, with the matcher of index count
+    TakeTill,
+    // the parser of index first, run as it is
+    Object,
+  };
+
+  struct Instruction {
+    Op op;
+    char token = 0;
+    int quantifier = ONCE;
+    std::uint32_t first = 0;
+    std::uint32_t count = 0;
+    Name name;
+  };
+
+  struct Program {
+    std::vector<Instruction> code;
+    std::vector<std::uint32_t> operands;
+    // the FIRST sets of the options of the alternations, by operand
+    std::vector<FirstSet<char>> firsts;
+    std::string text;
+    std::vector<std::shared_ptr<const KMPMatcher<char>>> matchers;
+    // cloned for every VmParser
+    std::vector<AbstractParserPtr<char, std::string>> objects;
+    std::uint32_t entry = 0;
+  };
+
+  // the completion time of a frame that completed at the end of input, which
+  // is after every token
+  static constexpr std::size_t eof = SIZE_MAX;
+
+private:
+  enum class Status : std::uint8_t { Ok, Error, None, Unwound };
+
+  enum class Step : std::uint8_t { Continue, Wait, Unwind };
+
+  enum class Read : std::uint8_t { Available, End, Wait, Unwind };
+
+  struct Frame {
+    std::uint32_t pc;
+    // the frame the tokens are read through (a take till, or an alternation
+    // applying the first token to an option it skipped), or -1
+    std::int32_t window = -1;
+    std::size_t start;
+    // leaves: the next token; sequences: the start of the child; take tills:
+    // the start of the body
+    std::size_t pos;
+    // the latest completion of the children
+    std::size_t time = 0;
+    // the size of the output stack when the frame started
+    std::size_t outputs;
+    // sequences: the child; alternations: the option
+    std::uint32_t index = 0;
+    // alternations: the best result, whose outputs end at bestOutputs
+    bool best = false;
+    // alternations: the first token is known; sequences: the child is given
+    // a token left after the end of input
+    bool head = false;
+    bool started = false;
+    // alternations: running the skipped option for its error
+    bool fallback = false;
+    char first = 0;
+    std::int32_t skipped = -1;
+    std::size_t bestEnd = 0;
+    std::size_t bestTime = 0;
+    std::size_t bestOutputs = 0;
+    std::optional<ParsingError> error;
+    std::size_t errorTime = 0;
+    std::size_t errorAt = 0;
+    std::uint32_t errorIndex = 0;
+    // take tills: the tokens given to the matcher and its state
+    std::size_t fed = 0;
+    int prefix = 0;
+    bool matched = false;
+  };
+
+  // the outcome of the last frame that completed
+  struct Return {
+    Status status = Status::Ok;
+    std::size_t end = 0;
+    std::size_t time = 0;
+    ParsingError error;
+    // the token the error is at, or eof at the end of input, as the lag of
+    // the error is only known when the root returns
+    std::size_t at = 0;
+  };
+
+  class VmResult final : public AbstractParserResult<char, std::string> {
+  private:
+    std::vector<std::string> outputs;
+    std::string remaining;
+    std::size_t output = 0;
+    std::size_t next = 0;
+
+  public:
+    VmResult(std::vector<std::string> outputs, std::string remaining)
+        : outputs(std::move(outputs)), remaining(std::move(remaining)) {}
+
+    std::optional<char> getRemaining() override {
+      if (next < remaining.size())
+        return remaining[next++];
+      return {};
+    }
+
+    std::optional<std::string> get() override {
+      if (output < outputs.size())
+        return std::move(outputs[output++]);
+      return {};
+    }
+  };
+
+  std::shared_ptr<const Program> program;
+  std::shared_ptr<const AbstractParser<char, std::string>> source;
+  std::vector<AbstractParserPtr<char, std::string>> objects;
+  std::string buffer;
+  // the tokens of the span given to feed that are not in the buffer yet, they
+  // are appended when the frames need them
+  const char *input = nullptr;
+  const char *inputEnd = nullptr;
+  std::vector<Frame> frames;
+  std::vector<std::string> outputs;
+  Return ret;
+  // the frame the stack is unwound to
+  std::int32_t unwindTo = -1;
+  bool returning = false;
+  bool ended = false;
+  bool validating = false;
+
+  Read need(const std::size_t p, const std::int32_t window,
+            std::size_t &limit);
+  void push(const std::uint32_t pc, const std::size_t start,
+            const std::int32_t window);
+  Step succeed(const std::size_t end, const std::size_t time);
+  Step fail(ParsingError error, const std::size_t time, const std::size_t at);
+  Step none();
+  Step unwind();
+  Step literal(Frame &f, const Instruction &ins);
+  Step token(Frame &f, const Instruction &ins);
+  Step object(Frame &f, const Instruction &ins);
+  Step sequence(Frame &f, const Instruction &ins);
+  Step alternate(Frame &f, const Instruction &ins);
+  Step takeTill(Frame &f, const Instruction &ins);
+  bool run();
+  ParserResult<char, std::string> result();
+
+public:
+  VmParser(std::shared_ptr<const Program> program,
+           std::shared_ptr<const AbstractParser<char, std::string>> source);
+
+  void reset() override;
+
+  AbstractParserPtr<char, std::string> clone() const override;
+
+  bool restore(AbstractParser<char, std::string> &other) override;
+
+  ParserResult<char, std::string> operator()(const char &value) override;
+
+  FeedResult<char, std::string> feed(const char *begin,
+                                     const char *end) override;
+
+  ParserResult<char, std::string> operator()() override;
+
+  const std::string &getName() const override { return source->getName(); }
+  FirstSet<char> first() const override { return source->first(); }
+  std::optional<std::vector<char>> literal() const override {
+    return source->literal();
+  }
+  void setValidating(const bool validating) override;
+
+  const Program &getProgram() const { return *program; }
+
+  /**
+   * The number of frames on the stack, which is the depth of the nesting at
+   * the current token.
+   */
+  std::size_t depth() const { return frames.size(); }
+
+  /**
+   * Compile the parser, which is moved into the VmParser. The sources of the
+   * lazy parsers are compiled as well, and must live as long as the parser
+   * if they are run as they are (with a mapping function or a memo table).
+   */
+  static std::unique_ptr<VmParser>
+  compile(AbstractParserPtr<char, std::string> parser);
+};
+
+} // namespace Parser
@@ -1,10 +1,30 @@
 #include "Alternate.hpp"
+#include "ArenaParser.hpp"
+#include "CharClass.hpp"
+#include "Dfa.hpp"
+#include "Driver.hpp"
+#include "Grammar.hpp"
 #include "Lazy.hpp"
+#include "Memo.hpp"
+#include "LiteralSet.hpp"
+#include "Optimize.hpp"
 #include "Predicate.hpp"
+#include "Profile.hpp"
+#include "Regex.hpp"
 #include "Sequence.hpp"
+#include "Slice.hpp"
+#include "Static.hpp"
 #include "TakeTill.hpp"
+#include "Vm.hpp"
+#include <atomic>
 #include <cassert>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <new>
+#include <regex>
+#include <sstream>
+#include <unistd.h>
 
 // some tests for the parsers.
 // some functions for convenience
@@ -20,12 +40,70 @@ auto conv(std::optional<std::variant<
       std::move(v.value()));
 }
 
+// The calls to the global allocator, for the allocations that do not go
+// through Parser::allocate. The deletes are not inlined, as GCC would take
+// the free of an inlined delete for a mismatch with new.
+static std::atomic<std::size_t> globalAllocations = 0;
+
+void *operator new(std::size_t size) {
+  ++globalAllocations;
+  if (void *p = std::malloc(size == 0 ? 1 : size))
+    return p;
+  throw std::bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void *p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void *p, std::size_t) noexcept {
+  std::free(p);
+}
+
 static Parser::AbstractParserPtr<char, std::string>
 operator"" _c(const char *str, const std::size_t size) {
   std::string st(str, size);
   return Parser::StringPredicate(st, st);
 }
 
+// Describe the result or the error.
+static std::string describe(Parser::ParserResult<char, std::string> v) {
+  if (Parser::isError(v))
+    return "error: " + Parser::asError(v).toString();
+  auto &result = Parser::asResult(v);
+  std::string s = "result: ";
+  for (auto t = result->get(); t.has_value(); t = result->get())
+    s += t.value();
+  s += ", remaining: ";
+  for (auto t = result->getRemaining(); t.has_value();
+       t = result->getRemaining())
+    s.push_back(t.value());
+  return s;
+}
+
+// Apply the input and describe the result or the error.
+static std::string
+describe(Parser::AbstractParser<char, std::string> &parser,
+         const std::string &input) {
+  Parser::ParserResult<char, std::string> v;
+  for (char c : input) {
+    if ((v = parser(c)).has_value())
+      break;
+  }
+  if (!v.has_value())
+    v = parser();
+  return describe(std::move(v));
+}
+
+// Feed the input in two spans and describe the result or the error.
+static std::string
+describeFed(Parser::AbstractParser<char, std::string> &parser,
+            const std::string &input, const std::size_t split) {
+  auto begin = input.data(), end = input.data() + input.size();
+  auto v = parser.feed(begin, begin + split).result;
+  if (!v.has_value())
+    v = parser.feed(begin + split, end).result;
+  if (!v.has_value())
+    v = parser();
+  return describe(std::move(v));
+}
+
 void trivialPredicateTest() {
   auto a = CharPredicate('a', Parser::MORE, "Test");
   auto b = CharPredicate('a', Parser::ANY, "Test 2");
@@ -230,6 +308,49 @@ void takeTillTest() {
     assert(result->getRemaining().has_value() == false);
     assert(result->get().has_value() == false);
   }
+  {
+    std::cout << "TakeTill 3" << std::endl;
+    // the parsers can be used again after terminating
+    for (int i = 0; i < 2; ++i) {
+      for (char c : std::string("aaaa"))
+        assert(!parser(c).has_value());
+      auto result = conv(parser('/'));
+      assert(result->get().value() == "aa");
+      assert(result->get().has_value() == false);
+    }
+    for (char c : std::string("aaaa"))
+      assert(!parser2(c).has_value());
+    assert(conv(parser2())->get().has_value() == false);
+  }
+  {
+    std::cout << "TakeTill 4" << std::endl;
+    // a block comment, with the literal suffix and with a suffix that is not
+    // a literal
+    auto any = [] {
+      return std::make_unique<CharPredicate>(
+          []() { return [](const char &) { return true; }; }, 1, "any");
+    };
+    Parser::AbstractParserPtr<char, std::string> end = "*/"_c;
+    auto literal = Parser::TakeTill<char, std::string, std::string>(
+        any(), end->clone(), "comment");
+    auto general = Parser::TakeTill<char, std::string, std::string>(
+        any(),
+        std::make_unique<Parser::LazyParser<char, std::string>>(end.get()),
+        "comment");
+    for (auto input : {"/* a ** b * / c **/ d", "**/", "*/", "x*", "***"}) {
+      auto s = std::string(input);
+      assert(describe(literal, s) == describe(general, s));
+    }
+    std::string comment(100000, '*');
+    comment += "*/";
+    auto [consumed, v] =
+        literal.feed(comment.data(), comment.data() + comment.size());
+    assert(consumed == comment.size());
+    std::size_t count = 0;
+    for (auto &result = Parser::asResult(v); result->get().has_value();)
+      ++count;
+    assert(count == 100000);
+  }
 }
 
 void lazyTest() {
@@ -266,6 +387,2152 @@ void lazyTest() {
   }
 }
 
+static int toDigit(const char &c) { return c - '0'; }
+static int foldDigits(const int &a, const int &b) { return a * 10 + b; }
+static std::string digitsString(const int &n) { return std::to_string(n); }
+
+void feedTest() {
+  {
+    std::cout << "Feed 1" << std::endl;
+    auto a = CharPredicate('a', Parser::MORE, "a");
+    std::string input = "aaaaab";
+    auto [consumed, v] = a.feed(input.data(), input.data() + input.size());
+    assert(consumed == input.size());
+    auto result = conv(std::move(v));
+    assert(result->get().value() == "aaaaa");
+    assert(result->getRemaining().value() == 'b');
+    assert(result->getRemaining().has_value() == false);
+  }
+  {
+    std::cout << "Feed 2" << std::endl;
+    auto parser = Parser::Sequence<char, std::string>::get(
+        "SEQ",
+        std::array{"("_c, CharPredicate::get('a', Parser::MORE, "a"), ")"_c});
+    std::string input = "(aaa)(a";
+    auto [consumed, v] =
+        parser->feed(input.data(), input.data() + input.size());
+    assert(consumed == 5);
+    auto result = conv(std::move(v));
+    for (auto s : std::array{"(", "aaa", ")"})
+      assert(result->get().value() == s);
+    assert(result->get().has_value() == false);
+    // the remaining part is not completed yet
+    auto [consumed2, v2] =
+        parser->feed(input.data() + 5, input.data() + input.size());
+    assert(consumed2 == 2);
+    assert(v2.has_value() == false);
+    result = conv((*parser)(')'));
+    for (auto s : std::array{"(", "a", ")"})
+      assert(result->get().value() == s);
+  }
+  {
+    std::cout << "Feed 3" << std::endl;
+    auto list = std::make_unique<
+        std::vector<Parser::AbstractParserPtr<char, std::string>>>();
+    list->push_back(Parser::StringPredicate("foo", "foo"));
+    list->push_back(Parser::StringPredicate("foobar", "foobar"));
+    auto parser = Parser::Alternate<char, std::string>(std::move(list), "alt");
+    std::string input = "foobag";
+    auto [consumed, v] = parser.feed(input.data(), input.data() + 3);
+    assert(consumed == 3);
+    assert(v.has_value() == false);
+    auto [consumed2, v2] =
+        parser.feed(input.data() + 3, input.data() + input.size());
+    assert(consumed2 == 3);
+    auto result = conv(std::move(v2));
+    assert(result->get().value() == "foo");
+    assert(result->get().has_value() == false);
+    for (char c : std::array{'b', 'a', 'g'})
+      assert(result->getRemaining().value() == c);
+    assert(result->getRemaining().has_value() == false);
+  }
+  {
+    std::cout << "Feed 4" << std::endl;
+    // the runs that are aggregated at once give the results of the tokens
+    // applied one by one, wherever the spans end
+    std::vector<Parser::AbstractParserPtr<char, std::string>> parsers;
+    for (int q : {Parser::NONE, Parser::OPTIONAL, Parser::MORE, Parser::ANY,
+                  Parser::ONCE, 3})
+      parsers.push_back(CharPredicate::get('a', q, "a"));
+    parsers.push_back(Parser::StringPredicate("aab", "aab"));
+    parsers.push_back(std::make_unique<CharPredicate>(
+        []() {
+          return [n = 0](const char &c) mutable {
+            return c == "ab"[n++ % 2];
+          };
+        },
+        Parser::MORE, "ab"));
+    for (auto &parser : parsers) {
+      for (std::string input : {"", "b", "aab", "aaaab", "abab", "aaaaaaa"}) {
+        auto expected = describe(*parser->clone(), input);
+        for (std::size_t split = 0; split <= input.size(); ++split)
+          assert(describeFed(*parser->clone(), input, split) == expected);
+      }
+    }
+    // the pieces pushed to the sink are the same
+    std::string input = "aaaaaaab";
+    for (std::size_t split = 0; split <= input.size(); ++split) {
+      std::string pieces;
+      Parser::OutputSink<std::string> sink(
+          [&](std::string s) { pieces += s + "|"; }, 3);
+      auto parser = CharPredicate('a', Parser::MORE, "a");
+      parser.setSink(&sink);
+      auto v = split == 0 ? describe(parser, input)
+                          : describeFed(parser, input, split);
+      assert(v == "result: , remaining: b");
+      sink.flush([&](std::string s) { pieces += s + "|"; });
+      assert(pieces == "aaa|aaa|a|");
+    }
+    // the values that are not strings are folded one by one
+    auto digits = Parser::PredicateParser<char, int, toDigit, foldDigits,
+                                          digitsString>(
+        []() { return [](const char &c) { return c >= '0' && c <= '9'; }; },
+        Parser::MORE, "digits");
+    std::string number = "1234;";
+    auto [consumed, v] = digits.feed(number.data(), number.data() + 2);
+    assert(consumed == 2 && !v.has_value());
+    auto [consumed2, v2] =
+        digits.feed(number.data() + 2, number.data() + number.size());
+    assert(consumed2 == 3);
+    assert(Parser::asResult(v2)->get().value() == 1234);
+  }
+}
+
+void staticTest() {
+  // The grammar in lazyTest, with the static combinators.
+  Parser::Dynamic<char, std::string> options(nullptr);
+  auto grammar = Parser::alt(
+      "options",
+      Parser::seq("SEQ", *Parser::StringPredicate("(", "("),
+                  Parser::LazyParser<char, std::string>(&options),
+                  *Parser::StringPredicate(")", ")")),
+      CharPredicate('a', Parser::MORE, "a"));
+  options.set(grammar.clone());
+  {
+    std::cout << "Static 1" << std::endl;
+    for (char c : std::string("((aaa)")) {
+      auto v = grammar(c);
+      assert(v.has_value() == false);
+    }
+    auto v = conv(grammar(')'));
+    for (auto s : std::array{"(", "(", "aaa", ")", ")"})
+      assert(v->get().value() == s);
+    assert(v->get().has_value() == false);
+    assert(v->getRemaining().has_value() == false);
+  }
+  {
+    std::cout << "Static 2" << std::endl;
+    std::string input = "((a)a";
+    auto [consumed, v] = grammar.feed(input.data(), input.data() + 5);
+    assert(consumed == 5);
+    assert(std::holds_alternative<Parser::ParsingError>(v.value()));
+  }
+  {
+    std::cout << "Static 3" << std::endl;
+    auto parser = Parser::takeTill("parser", CharPredicate('a', 2, "aa"),
+                                   *Parser::StringPredicate("aa/", "end"));
+    for (char c : std::array{'a', 'a', 'a', 'a', 'a', 'a'})
+      assert(parser(c).has_value() == false);
+    auto result = conv(parser('/'));
+    assert(result->get().value() == "aa");
+    assert(result->get().value() == "aa");
+    assert(result->get().has_value() == false);
+  }
+  {
+    std::cout << "Static 4" << std::endl;
+    // the error of an option that failed does not outlive the parse
+    auto parser = Parser::alt("ab|ac", *Parser::StringPredicate("ab", "ab"),
+                              *Parser::StringPredicate("ac", "ac"));
+    auto fresh = parser;
+    assert(describe(parser, "ab") == "result: ab, remaining: ");
+    assert(describe(parser, "ac") == "result: ac, remaining: ");
+    auto error = describe(fresh, "a");
+    assert(error.rfind("error: ", 0) == 0);
+    assert(describe(parser, "a") == error);
+    std::string input = "ab";
+    auto r = parser.feed(input.data(), input.data() + 2);
+    assert(r.consumed == 2 && conv(std::move(r.result))->get() == "ab");
+    assert(describe(parser, "a") == error);
+  }
+  {
+    std::cout << "Static 5" << std::endl;
+    // the suffix states are reused, and the suffix can be a combinator
+    auto parser = Parser::takeTill(
+        "comment", CharPredicate('a', 1, "a"),
+        Parser::seq("end", CharPredicate('*', Parser::MORE, "*"),
+                    CharPredicate('/', 1, "/")));
+    for (int i = 0; i < 2; ++i) {
+      assert(describe(parser, "aa**/") == "result: aa, remaining: ");
+      assert(describe(parser, "a*/") == "result: a, remaining: ");
+      assert(describe(parser, "a*a") ==
+             "error: Insufficient tokens\n  at a\n  at comment");
+    }
+  }
+}
+
+void arenaTest() {
+  auto alternatives = std::make_unique<
+      std::vector<Parser::AbstractParserPtr<char, std::string>>>();
+  auto options =
+      Parser::Alternate<char, std::string>(std::move(alternatives), "options");
+  Parser::AbstractParserPtr<char, std::string> recursive =
+      std::make_unique<Parser::LazyParser<char, std::string>>(&options);
+  options.getOptions()->push_back(Parser::Sequence<char, std::string>::get(
+      "SEQ", std::array{"("_c, std::move(recursive), ")"_c}));
+  options.getOptions()->push_back(CharPredicate::get('a', Parser::MORE, "a"));
+  options.reset();
+  auto parser = Parser::ArenaParser<char, std::string>(options.clone());
+
+  auto parse = [&]() {
+    for (char c : std::string("((aaa)")) {
+      auto v = parser(c);
+      assert(v.has_value() == false);
+    }
+    auto v = conv(parser(')'));
+    for (auto s : std::array{"(", "(", "aaa", ")", ")"})
+      assert(v->get().value() == s);
+    assert(v->get().has_value() == false);
+  };
+  {
+    std::cout << "Arena 1" << std::endl;
+    for (int i = 0; i < 10; ++i)
+      parse();
+    auto warm = parser.getArena().getStats();
+    auto heap = Parser::heapStats();
+    std::size_t global = globalAllocations;
+    for (int i = 0; i < 100; ++i)
+      parse();
+    auto stats = parser.getArena().getStats();
+    // everything goes to the arena, and nothing goes to the global allocator
+    // after warming up, not even the allocations that bypass Parser::allocate
+    assert(stats.allocations > warm.allocations);
+    assert(stats.heapAllocations == warm.heapAllocations);
+    assert(Parser::heapStats().allocations == heap.allocations);
+    assert(globalAllocations == global);
+  }
+  {
+    std::cout << "Arena 2" << std::endl;
+    // the parser keeps its storage when it is reset, and it is reused: the
+    // same objects are alive after every reset, so the arena is not freed
+    parser('(');
+    parser.reset();
+    auto live = parser.getArena().getLive();
+    assert(live > 0);
+    parse();
+    parser('(');
+    parser.reset();
+    assert(parser.getArena().getLive() == live);
+    parse();
+  }
+}
+
+static std::string fromWord(const char *const &word) { return word; }
+
+void errorTest() {
+  {
+    std::cout << "Error 1" << std::endl;
+    auto e = Parser::ParsingError("Custom error", "inner");
+    e.record("outer");
+    e.recordAlternate("alt");
+    assert(e.toString() ==
+           "Custom error\n  at inner\n  at outer\n  at alt (alt)");
+  }
+  {
+    std::cout << "Error 2" << std::endl;
+    auto a = CharPredicate('a', 3, "aaa");
+    a('a');
+    a('a');
+    auto v = a('b');
+    auto &e = std::get<Parser::ParsingError>(v.value());
+    assert(e.getCode() == Parser::ErrorCode::InsufficientTokens);
+    // the error is at the last token applied
+    assert(e.getLag() == 1);
+    e.locate(3);
+    assert(e.getPosition() == 2);
+    assert(e.toString() == "Insufficient tokens\n  at aaa");
+  }
+  {
+    std::cout << "Error 3" << std::endl;
+    // tokens that cannot be stored in the error, such as pointers, are
+    // formatted when it is made, and the copies share the message
+    using WordPredicate =
+        Parser::PredicateParser<const char *, std::string, fromWord,
+                                Utils::fold>;
+    const char *let = "let";
+    auto w = WordPredicate(let, Parser::NONE, "word");
+    auto v = w(let);
+    auto e = std::get<Parser::ParsingError>(v.value());
+    assert(e.getCode() == Parser::ErrorCode::Unexpected);
+    e.locate(1);
+    assert(e.getPosition() == 0);
+    auto copy = e;
+    copy.record("outer");
+    assert(e.toString() == "Unexpected let\n  at word");
+    assert(copy.toString() == "Unexpected let\n  at word\n  at outer");
+  }
+  {
+    std::cout << "Error 4" << std::endl;
+    // the alternation returns "a" with "bx" remaining, and z fails on the b:
+    // the error is located at the b, not at the last token applied
+    Parser::AbstractParserPtr<char, std::string> alt =
+        Parser::Alternate<char, std::string>::get("alt",
+                                                  std::array{"abc"_c, "a"_c});
+    auto seq = Parser::Sequence<char, std::string>::get(
+        "seq", std::array{std::move(alt), "z"_c});
+    std::string input = "azabx";
+    std::vector<std::uint64_t> positions;
+    auto stats = Parser::parseBuffer(
+        input.data(), input.data() + input.size(), *seq,
+        [&](Parser::ParserResult<char, std::string> &r) {
+          if (Parser::isError(r))
+            positions.push_back(Parser::asError(r).getPosition());
+          return true;
+        });
+    assert(stats.results == 2 && positions == std::vector<std::uint64_t>{3});
+    auto validation = Parser::validate(*seq, input.data() + 2,
+                                       input.data() + input.size());
+    assert(!validation.matched && validation.error->getPosition() == 1);
+  }
+  {
+    std::cout << "Error 5" << std::endl;
+    // an error without a stack allocates nothing, the stack is one array
+    // copied when a copy of the error records, and the stacks are freed with
+    // the errors: nothing is left in the arena
+    Parser::Arena arena;
+    {
+      Parser::ArenaScope scope(&arena);
+      auto e = Parser::ParsingError(Parser::ErrorCode::Incomplete, "inner");
+      auto plain = e;
+      assert(arena.getLive() == 0);
+      for (int i = 0; i < 1000; ++i)
+        e.record("outer");
+      assert(arena.getLive() == 2);
+      auto copy = e;
+      copy.recordAlternate("alt");
+      assert(arena.getLive() == 4);
+      assert(copy.toString() == e.toString() + "\n  at alt (alt)");
+      assert(plain.toString() == "Insufficient Tokens\n  at inner");
+    }
+    assert(arena.getLive() == 0);
+  }
+}
+
+void firstTest() {
+  {
+    std::cout << "First 1" << std::endl;
+    auto seq = Parser::Sequence<char, std::string>::get(
+        "seq", std::array{CharPredicate::get('a', Parser::OPTIONAL, "a"),
+                          "bc"_c, "d"_c});
+    auto set = seq->first();
+    assert(set.mayStart('a') && set.mayStart('b') && !set.mayStart('d'));
+    assert(!set.isNullable() && !set.isUnknown());
+  }
+  {
+    std::cout << "First 2" << std::endl;
+    // options that cannot start with the first token are not applied, unless
+    // we need their errors
+    int calls = 0;
+    auto q = std::make_unique<CharPredicate>(
+        [&calls]() {
+          return [&calls](const char &c) {
+            ++calls;
+            return c == 'q';
+          };
+        },
+        1, "q", Parser::FirstSet<char>::of('q'));
+    auto parser = Parser::Alternate<char, std::string>::get(
+        "keywords", std::array{"foo"_c, "bar"_c, "baz"_c,
+                               Parser::AbstractParserPtr<char, std::string>(
+                                   std::move(q))});
+    parser->operator()('b');
+    parser->operator()('a');
+    auto v = conv(parser->operator()('r'));
+    assert(v->get().value() == "bar");
+    assert(calls == 0);
+    auto e = std::get<Parser::ParsingError>(parser->operator()('x').value());
+    assert(e.toString() == "Insufficient tokens\n  at q\n  at keywords (alt)");
+    assert(calls == 1);
+    auto r = conv(parser->operator()('q'));
+    assert(r->get().value() == "q");
+  }
+  {
+    std::cout << "First 3" << std::endl;
+    // a sequence in an option, directly or through a lazy parser, is modified
+    // after the alternation computed the FIRST sets
+    using Seq = Parser::Sequence<char, std::string>;
+    auto rule = Seq::get("rule", std::array{"a"_c});
+    auto lazy = std::make_unique<Parser::LazyParser<char, std::string>>(
+        rule.get(), nullptr, nullptr);
+    auto nested = Seq::get(
+        "nested", std::array{CharPredicate::get('b', Parser::MORE, "b")});
+    auto seq = nested.get();
+    auto literals = Parser::Alternate<char, std::string>::get(
+        "literals", std::array{Parser::AbstractParserPtr<char, std::string>(
+                                   std::move(lazy)),
+                               "x"_c});
+    auto parser = Parser::Alternate<char, std::string>::get(
+        "parser", std::array{Parser::AbstractParserPtr<char, std::string>(
+                                 std::move(nested)),
+                             "y"_c});
+    assert(describe(*literals, "a") == "result: a, remaining: ");
+    assert(describe(*parser, "bb") == "result: bb, remaining: ");
+    rule->getSequence()->front() = "c"_c;
+    seq->getSequence()->front() = CharPredicate::get('d', Parser::MORE, "d");
+    assert(describe(*literals, "c") == "result: c, remaining: ");
+    assert(describe(*parser, "dd") == "result: dd, remaining: ");
+    assert(describe(*parser, "b").rfind("error: ", 0) == 0);
+  }
+}
+
+void charClassTest() {
+  {
+    std::cout << "CharClass 1" << std::endl;
+    // the SIMD scanning finds the same position as the scalar one
+    std::string input;
+    for (int i = 0; i < 1000; ++i)
+      input.push_back(static_cast<char>((i * 7919 + i / 3) % 256));
+    for (auto c : std::array{Parser::CharClass::whitespace(),
+                             Parser::CharClass::identifier(),
+                             ~Parser::CharClass::digit(),
+                             Parser::CharClass("aeiou!@#$%^&*()")}) {
+      for (std::size_t i = 0; i < input.size(); ++i) {
+        auto begin = input.data() + i;
+        auto end = input.data() + input.size();
+        assert(c.scan(begin, end) == c.scanScalar(begin, end));
+      }
+    }
+    auto digits = Parser::CharClass::digit();
+    std::string run(100, '7');
+    assert(digits.scan(run.data(), run.data() + run.size()) ==
+           run.data() + run.size());
+  }
+  {
+    std::cout << "CharClass 2" << std::endl;
+    auto parser = Parser::CharClassParser(Parser::CharClass::identifier(),
+                                          Parser::MORE, "identifier");
+    std::string input = "hello_world_from_a_long_identifier42 = 1";
+    auto [consumed, v] =
+        parser.feed(input.data(), input.data() + input.size());
+    assert(consumed == 37);
+    auto &result = Parser::asResult(v);
+    assert(result->get().value() == "hello_world_from_a_long_identifier42");
+    assert(result->getRemaining().value() == ' ');
+    for (char c : std::string("abc"))
+      assert(!parser(c).has_value());
+    assert(conv(parser('+'))->get().value() == "abc");
+    auto e = std::get<Parser::ParsingError>(parser('+').value());
+    assert(e.toString() == "Insufficient tokens\n  at identifier");
+  }
+  {
+    std::cout << "CharClass 3" << std::endl;
+    auto parser =
+        Parser::CharClassParser(Parser::CharClass::digit(), 4, "year");
+    std::string input = "2024123";
+    auto [consumed, v] =
+        parser.feed(input.data(), input.data() + input.size());
+    assert(consumed == 4);
+    assert(Parser::asResult(v)->get().value() == "2024");
+  }
+}
+
+void literalSetTest() {
+  std::vector<std::string> keywords = {"if",  "in",     "int",    "integer",
+                                       "for", "format", "in",     "a",
+                                       "aa",  "aaa",    "foreach"};
+  auto literals = std::make_unique<
+      std::vector<Parser::AbstractParserPtr<char, std::string>>>();
+  auto lazy = std::make_unique<
+      std::vector<Parser::AbstractParserPtr<char, std::string>>>();
+  std::vector<Parser::AbstractParserPtr<char, std::string>> sources;
+  for (auto &k : keywords) {
+    literals->push_back(Parser::StringPredicate(k, k));
+    sources.push_back(Parser::StringPredicate(k, k));
+    // the lazy parsers are not literals, so they are applied one by one
+    lazy->push_back(std::make_unique<Parser::LazyParser<char, std::string>>(
+        sources.back().get()));
+  }
+  auto parser =
+      Parser::Alternate<char, std::string>(std::move(literals), "keyword");
+  auto reference =
+      Parser::Alternate<char, std::string>(std::move(lazy), "keyword");
+  {
+    std::cout << "LiteralSet 1" << std::endl;
+    // compare with the options applied one by one, on every input up to a
+    // length over a small alphabet
+    std::string alphabet = "inteforma";
+    std::vector<std::string> inputs = {""};
+    for (std::size_t i = 0; i < inputs.size() && inputs.size() < 10000; ++i) {
+      assert(describe(parser, inputs[i]) == describe(reference, inputs[i]));
+      if (inputs[i].size() < 4) {
+        for (char c : alphabet)
+          inputs.push_back(inputs[i] + c);
+      }
+    }
+    assert(describe(parser, "integers") == "result: integer, remaining: ");
+    assert(describe(parser, "inx") == "result: in, remaining: x");
+    assert(describe(parser, "fx") ==
+           "error: Insufficient tokens\n  at foreach\n  at keyword (alt)");
+  }
+  {
+    std::cout << "LiteralSet 2" << std::endl;
+    auto clone = parser.clone();
+    std::string input = "forex";
+    auto [consumed, v] =
+        clone->feed(input.data(), input.data() + input.size());
+    assert(consumed == 5);
+    auto &result = Parser::asResult(v);
+    assert(result->get().value() == "for");
+    assert(result->getRemaining().value() == 'e');
+    assert(result->getRemaining().value() == 'x');
+    assert(!result->getRemaining().has_value());
+  }
+}
+
+// expr = term '+' expr | term '-' expr | term, term = '(' expr ')' | a+
+// The alternation of expr derives term three times at the same position.
+struct ExprGrammar {
+  using Ptr = Parser::AbstractParserPtr<char, std::string>;
+  Parser::Alternate<char, std::string> expr;
+  Parser::Alternate<char, std::string> term;
+
+  ExprGrammar(Parser::MemoTable<char, std::string> *memo)
+      : expr(std::make_unique<std::vector<Ptr>>(), "expr"),
+        term(std::make_unique<std::vector<Ptr>>(), "term") {
+    auto lazy = [memo](Parser::AbstractParser<char, std::string> *src) {
+      return Ptr(std::make_unique<Parser::LazyParser<char, std::string>>(
+          src, nullptr, memo));
+    };
+    for (auto op : {"+", "-"}) {
+      expr.getOptions()->push_back(Parser::Sequence<char, std::string>::get(
+          "binary",
+          std::array{lazy(&term), Ptr(Parser::StringPredicate(op, op)),
+                     lazy(&expr)}));
+    }
+    expr.getOptions()->push_back(lazy(&term));
+    term.getOptions()->push_back(Parser::Sequence<char, std::string>::get(
+        "group", std::array{"("_c, lazy(&expr), ")"_c}));
+    term.getOptions()->push_back(CharPredicate::get('a', Parser::MORE, "a"));
+  }
+};
+
+void memoTest() {
+  auto inputs = {"a",         "a+a",       "(a+a)-aa", "((a)+(a-a))",
+                 "(a+",       "a++a",      "((((a))))+a",
+                 "(a-(a+(a-(a+a))))+((a))"};
+  ExprGrammar reference(nullptr);
+  {
+    std::cout << "Memo 1" << std::endl;
+    Parser::MemoTable<char, std::string> memo;
+    for (auto input : inputs) {
+      ExprGrammar grammar(&memo);
+      assert(describe(grammar.expr, input) == describe(reference.expr, input));
+    }
+    // the entries are dropped with the parsers
+    assert(memo.getStats().bytes == 0);
+    // a single pass over an input where the alternations backtrack
+    auto grammar = std::make_unique<ExprGrammar>(&memo);
+    auto before = memo.getStats();
+    std::string input = "(a-(a+(a-(a+a))))+((a))";
+    assert(describe(grammar->expr, input) == describe(reference.expr, input));
+    auto &stats = memo.getStats();
+    auto hits = stats.hits - before.hits, misses = stats.misses - before.misses;
+    assert(hits * 2 > hits + misses);
+    assert(stats.evictions == 0);
+    grammar = nullptr;
+    assert(memo.getStats().bytes == 0);
+  }
+  {
+    std::cout << "Memo 2" << std::endl;
+    // the tries are evicted, but the results are the same
+    Parser::MemoTable<char, std::string> memo(4096);
+    ExprGrammar grammar(&memo);
+    for (auto input : inputs)
+      assert(describe(grammar.expr, input) == describe(reference.expr, input));
+    assert(memo.getStats().evictions > 0);
+    assert(memo.getStats().bytes <= 4096);
+  }
+}
+
+void sliceTest() {
+  using SlicePtr = Parser::AbstractParserPtr<char, Parser::Slice>;
+  {
+    std::cout << "Slice 1" << std::endl;
+    // the outputs are views of the input, the token applied again is copied
+    auto input = std::make_shared<const std::string>("hello_world= 1");
+    std::weak_ptr<const std::string> alive = input;
+    auto parser = Parser::Sequence<char, Parser::Slice>::get(
+        "assignment",
+        std::array{SlicePtr(Parser::SliceClass(Parser::CharClass::identifier(),
+                                               Parser::MORE, "identifier")),
+                   SlicePtr(Parser::SliceChar('=', Parser::ONCE, "="))});
+    Parser::ParserResult<char, Parser::Slice> v;
+    {
+      Parser::SliceScope scope(input);
+      auto [consumed, r] =
+          parser->feed(input->data(), input->data() + input->size());
+      assert(consumed == 12);
+      v = std::move(r);
+    }
+    auto &result = Parser::asResult(v);
+    auto identifier = result->get().value();
+    auto equal = result->get().value();
+    assert(identifier.get() == "hello_world" && equal.get() == "=");
+    assert(identifier.get().data() == input->data() && identifier.isOwned());
+    assert(equal.get().data() != input->data() + 11 && equal.isOwned());
+    // the input lives as long as the slices
+    input = nullptr;
+    assert(!alive.expired() && identifier.str() == "hello_world");
+    identifier = Parser::Slice();
+    assert(alive.expired());
+  }
+  {
+    std::cout << "Slice 2" << std::endl;
+    // streaming input, the slices across the chunks are concatenated, and the
+    // chunks are freed with the slices that view them
+    auto parser = Parser::Sequence<char, Parser::Slice>::get(
+        "number",
+        std::array{SlicePtr(Parser::SliceString("(", "(")),
+                   SlicePtr(Parser::SliceClass(Parser::CharClass::digit(),
+                                               Parser::MORE, "digits")),
+                   SlicePtr(Parser::SliceString(")", ")"))});
+    std::vector<std::weak_ptr<const std::string>> chunks;
+    Parser::ParserResult<char, Parser::Slice> v;
+    for (auto text : {"(12", "34", "5)"}) {
+      auto chunk = std::make_shared<const std::string>(text);
+      chunks.push_back(chunk);
+      Parser::SliceScope scope(chunk);
+      auto r = parser->feed(chunk->data(), chunk->data() + chunk->size());
+      if (r.result.has_value())
+        v = std::move(r.result);
+    }
+    auto &result = Parser::asResult(v);
+    std::vector<Parser::Slice> slices;
+    for (auto t = result->get(); t.has_value(); t = result->get())
+      slices.push_back(t.value());
+    assert(slices.size() == 3);
+    assert(slices[0].get() == "(" && slices[1].get() == "12345" &&
+           slices[2].get() == ")");
+    assert(slices[1].str() == "12345");
+    // the ')' is the remaining token of the digits, which is applied again
+    // from a copy
+    assert(!chunks[0].expired() && chunks[1].expired() &&
+           chunks[2].expired());
+    slices.clear();
+    assert(chunks[0].expired());
+    // the literal is known, as the tokens are the characters
+    assert(Parser::SliceString("()", "()")->literal() ==
+           std::vector<char>({'(', ')'}));
+  }
+  {
+    std::cout << "Slice 3" << std::endl;
+    // folding into a concatenation leaves the slices it was made of valid
+    std::string input = "abcdefghijklmnopqrstuvwxyz";
+    auto at = [&](std::size_t i, std::size_t n) {
+      return Parser::Slice(std::string_view(input.data() + i, n));
+    };
+    auto a = Parser::Slice::extend(at(0, 10), at(11, 10));
+    auto b = Parser::Slice::extend(a, at(10, 16));
+    auto c = Parser::Slice::extend(a, at(22, 1));
+    auto d = Parser::Slice::extend(a, at(23, 3));
+    assert(a.get() == "abcdefghijlmnopqrstu");
+    assert(b.get() == a.str() + input.substr(10));
+    assert(c.get() == a.str() + "w");
+    assert(d.get() == a.str() + "xyz");
+    // the run of a single slice is extended in place
+    auto run = a;
+    a = Parser::Slice();
+    for (std::size_t i = 21; i < 26; ++i)
+      run = Parser::Slice::extend(run, at(i, 1));
+    assert(run.get() == "abcdefghijlmnopqrstuvwxyz");
+  }
+}
+
+// Takes every token, and never returns, not even at the end of input.
+class Endless final : public Parser::AbstractParser<char, std::string> {
+  Parser::Name name = "endless";
+
+public:
+  void reset() override {}
+  Parser::ParserResult<char, std::string> operator()(const char &) override {
+    return {};
+  }
+  Parser::ParserResult<char, std::string> operator()() override { return {}; }
+  const std::string &getName() const override { return name.str(); }
+  Parser::AbstractParserPtr<char, std::string> clone() const override {
+    return std::make_unique<Endless>();
+  }
+};
+
+void driverTest() {
+  std::string input;
+  for (int i = 0; i < 1000; ++i)
+    input += std::string(i % 7 + 1, 'a') + ";";
+  auto parser = Parser::Sequence<char, std::string>::get(
+      "statement",
+      std::array{CharPredicate::get('a', Parser::MORE, "a"), ";"_c});
+  // count the results and the characters in them
+  std::size_t results = 0, length = 0;
+  auto onResult = [&](Parser::ParserResult<char, std::string> &r) {
+    if (Parser::isError(r))
+      return false;
+    ++results;
+    auto &result = Parser::asResult(r);
+    for (auto t = result->get(); t.has_value(); t = result->get())
+      length += t.value().size();
+    return true;
+  };
+  Parser::DriverOptions small;
+  small.window = 4096;
+  small.chunkSize = 7;
+  {
+    std::cout << "Driver 1" << std::endl;
+    char path[] = "/tmp/parserXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0 && write(fd, input.data(), input.size()) ==
+                          static_cast<ssize_t>(input.size()));
+    close(fd);
+    for (auto options : {Parser::DriverOptions(), small}) {
+      results = length = 0;
+      auto stats = Parser::parseFile(path, *parser, onResult, options);
+      assert(stats.error == 0 && stats.mapped);
+      assert(stats.bytes == input.size() && stats.results == 1000);
+      assert(results == 1000 && length == input.size());
+      assert(stats.peakRss > 0);
+    }
+    unlink(path);
+    auto stats = Parser::parseFile(path, *parser, onResult);
+    assert(stats.error != 0);
+  }
+  {
+    std::cout << "Driver 2" << std::endl;
+    // pipes are read in chunks, the input fits in the pipe buffer
+    int fds[2];
+    assert(pipe(fds) == 0);
+    assert(write(fds[1], input.data(), input.size()) ==
+           static_cast<ssize_t>(input.size()));
+    close(fds[1]);
+    results = length = 0;
+    auto stats = Parser::parseFd(fds[0], *parser, onResult, small);
+    close(fds[0]);
+    assert(stats.error == 0 && !stats.mapped);
+    assert(results == 1000 && length == input.size());
+  }
+  {
+    std::cout << "Driver 3" << std::endl;
+    // the last result is completed by the end of input, and errors stop
+    int fds[2];
+    assert(pipe(fds) == 0);
+    std::string s = "aa;a;b;aa";
+    assert(write(fds[1], s.data(), s.size()) ==
+           static_cast<ssize_t>(s.size()));
+    close(fds[1]);
+    results = length = 0;
+    auto stats = Parser::parseFd(fds[0], *parser, onResult);
+    close(fds[0]);
+    assert(stats.results == 3 && results == 2);
+  }
+  {
+    std::cout << "Driver 4" << std::endl;
+    // a parser that returns nothing at the end of input is incomplete
+    auto vm = Parser::VmParser::compile(std::make_unique<Endless>());
+    std::vector<std::string> errors;
+    std::string s = "aa";
+    auto stats = Parser::parseBuffer(
+        s.data(), s.data() + s.size(), *vm,
+        [&](Parser::ParserResult<char, std::string> &r) {
+          errors.push_back(Parser::asError(r).toString());
+          return false;
+        });
+    assert(stats.results == 1);
+    assert((errors == std::vector<std::string>{
+                          "Insufficient Tokens\n  at endless"}));
+  }
+  {
+    std::cout << "Driver 5" << std::endl;
+    // the slices are views of the mapping, of the chunks read and of a buffer
+    // with an owner, which live as long as the slices
+    using SlicePtr = Parser::AbstractParserPtr<char, Parser::Slice>;
+    auto statement = Parser::Sequence<char, Parser::Slice>::get(
+        "statement",
+        std::array{SlicePtr(Parser::SliceChar('a', Parser::MORE, "a")),
+                   SlicePtr(Parser::SliceChar(';', Parser::ONCE, ";"))});
+    std::vector<Parser::Slice> slices;
+    auto collect = [&](Parser::ParserResult<char, Parser::Slice> &r) {
+      auto &result = Parser::asResult(r);
+      for (auto t = result->get(); t.has_value(); t = result->get())
+        slices.push_back(t.value());
+      return true;
+    };
+    // the runs that are views of the same input are one character apart,
+    // the ';' is the remaining token of the run and is copied
+    auto check = [&] {
+      assert(slices.size() == 2000);
+      std::string text;
+      std::size_t views = 0;
+      for (std::size_t i = 0; i < slices.size(); ++i) {
+        text += slices[i].str();
+        if (i % 2 == 0 && i > 0 &&
+            slices[i - 2].get().data() + slices[i - 2].size() + 1 ==
+                slices[i].get().data())
+          ++views;
+      }
+      assert(text == input);
+      slices.clear();
+      return views;
+    };
+    char path[] = "/tmp/parserXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0 && write(fd, input.data(), input.size()) ==
+                          static_cast<ssize_t>(input.size()));
+    close(fd);
+    auto stats = Parser::parseFile(path, *statement, collect, small);
+    unlink(path);
+    assert(stats.mapped && check() == 999);
+    // a chunk ends in the middle of most statements, which are concatenated
+    int fds[2];
+    assert(pipe(fds) == 0);
+    assert(write(fds[1], input.data(), input.size()) ==
+           static_cast<ssize_t>(input.size()));
+    close(fds[1]);
+    Parser::DriverOptions chunks;
+    chunks.chunkSize = 512;
+    Parser::parseFd(fds[0], *statement, collect, chunks);
+    close(fds[0]);
+    assert(check() > 900);
+    auto owned = std::make_shared<const std::string>(input);
+    std::weak_ptr<const std::string> alive = owned;
+    Parser::parseBuffer(owned->data(), owned->data() + owned->size(),
+                        *statement, collect, owned);
+    owned = nullptr;
+    assert(!alive.expired() && check() == 999 && alive.expired());
+    // without an owner, the slices are copies
+    Parser::parseBuffer(input.data(), input.data() + input.size(), *statement,
+                        collect);
+    assert(check() == 0);
+  }
+}
+
+// Apply the prefix of the input, take a snapshot, and check that the rest of
+// the input gives the same outcome every time the snapshot is restored.
+static void
+checkSnapshot(Parser::AbstractParser<char, std::string> &parser,
+              Parser::AbstractParser<char, std::string> &reference,
+              const std::string &input) {
+  auto expected = describe(reference, input);
+  for (std::size_t k = 0; k < input.size(); ++k) {
+    parser.reset();
+    bool returned = false;
+    for (std::size_t j = 0; j < k && !returned; ++j)
+      returned = parser(input[j]).has_value();
+    if (returned)
+      break;
+    auto snapshot = parser.snapshot();
+    assert(snapshot != nullptr);
+    for (int i = 0; i < 3; ++i) {
+      assert(describe(parser, input.substr(k)) == expected);
+      assert(parser.restore(*snapshot));
+    }
+  }
+}
+
+void snapshotTest() {
+  {
+    std::cout << "Snapshot 1" << std::endl;
+    // lazy parsers, and alternations with pending results
+    ExprGrammar grammar(nullptr), reference(nullptr);
+    for (auto input : {"a+a", "(a+a)-aa", "((a)+(a-a))", "(a+", "a++a",
+                       "(a-(a+(a-(a+a))))+((a))"})
+      checkSnapshot(grammar.expr, reference.expr, input);
+    Parser::MemoTable<char, std::string> memo;
+    ExprGrammar memoized(&memo);
+    checkSnapshot(memoized.expr, reference.expr, "(a-(a+a))+(a)");
+  }
+  {
+    std::cout << "Snapshot 2" << std::endl;
+    // suffix states of TakeTill, with and without the literal matcher
+    auto make = [](Parser::AbstractParserPtr<char, std::string> suffix) {
+      return Parser::TakeTill<char, std::string, std::string>(
+          CharPredicate::get('a', Parser::ONCE, "a"), std::move(suffix),
+          "comment");
+    };
+    auto literal = make(Parser::StringPredicate("aab", "end"));
+    auto literalReference = make(Parser::StringPredicate("aab", "end"));
+    checkSnapshot(literal, literalReference, "aaaaaabaa");
+    auto general = make(Parser::Sequence<char, std::string>::get(
+        "end", std::array{CharPredicate::get('a', Parser::MORE, "a"), "b"_c}));
+    auto generalReference = make(Parser::Sequence<char, std::string>::get(
+        "end", std::array{CharPredicate::get('a', Parser::MORE, "a"), "b"_c}));
+    checkSnapshot(general, generalReference, "aaaaaabaa");
+  }
+  {
+    std::cout << "Snapshot 3" << std::endl;
+    // the snapshot is independent of the parser
+    auto parser = Parser::Sequence<char, std::string>::get(
+        "word", std::array{"hello"_c, " "_c,
+                           Parser::CharClassParser::get(
+                               Parser::CharClass::identifier(), Parser::MORE,
+                               "name")});
+    for (char c : std::string("hello wo"))
+      assert(!(*parser)(c).has_value());
+    auto snapshot = parser->snapshot();
+    assert(describe(*parser, "rld!") == "result: hello world, remaining: !");
+    assert(parser->restore(*snapshot));
+    assert(describe(*parser, "k!") == "result: hello wok, remaining: !");
+    assert(describe(*snapshot, "ld!") == "result: hello wold, remaining: !");
+    // static combinators do not support it
+    auto fixed = Parser::seq("fixed", *Parser::StringPredicate("a", "a"),
+                             *Parser::StringPredicate("b", "b"));
+    assert(fixed.snapshot() == nullptr);
+  }
+  {
+    std::cout << "Snapshot 4" << std::endl;
+    // restored into a copy that has parsed, so that its literal set has a
+    // trie of its own
+    using Alt = Parser::Alternate<char, std::string>;
+    auto a = Alt::get("keyword", std::array{"foo"_c, "foobar"_c});
+    auto b = a->clone();
+    (*b)('f');
+    b->reset();
+    (*a)('f');
+    (*a)('o');
+    assert(b->restore(*a));
+    assert(describe(*b, "obar") == describe(*a, "obar"));
+    // the suffix states of a TakeTill are such copies
+    using Till = Parser::TakeTill<char, std::string, std::string>;
+    auto till = Till::get(
+        Parser::CharClassParser::get(Parser::CharClass::range(';', 'z'),
+                                     Parser::ONCE, "char"),
+        Alt::get("end", std::array{";;"_c, ";."_c}), "till");
+    // the copy has a pooled suffix state, which was prepared apart
+    auto copy = till->clone();
+    assert(describe(*copy, "a;b;.") == "result: a;b, remaining: ");
+    for (char c : std::string("cd;"))
+      assert(!(*till)(c).has_value());
+    assert(copy->restore(*till));
+    assert(describe(*copy, ".") == "result: cd, remaining: ");
+  }
+}
+
+void profileTest() {
+  std::cout << "Profile 1" << std::endl;
+  ExprGrammar grammar(nullptr), reference(nullptr);
+  auto statement = [](ExprGrammar &g) {
+    return Parser::Sequence<char, std::string>::get(
+        "statement",
+        std::array{Parser::AbstractParserPtr<char, std::string>(
+                       std::make_unique<Parser::LazyParser<char, std::string>>(
+                           &g.expr)),
+                   ";"_c});
+  };
+  Parser::Profiler profiler;
+  Parser::AbstractParserPtr<char, std::string> plain = statement(grammar);
+  auto raw = plain.get();
+  auto parser = Parser::instrument(std::move(plain), profiler);
+  auto expected = statement(reference);
+  for (auto input : {"(a+a)-a;", "a+(a;", "a;"})
+    assert(describe(*parser, input) == describe(*expected, input));
+#ifdef PARSER_PROFILE
+  assert(parser.get() != raw);
+  auto &nodes = profiler.getNodes();
+  auto &root = nodes[nodes[Parser::Profiler::root].children[0]];
+  assert(root.name == "statement" && root.results == 2 && root.errors == 1);
+  assert(root.tokens == 15 && root.clones == 0);
+  // the grammar is walked through the lazy parsers, once per source
+  bool term = false;
+  for (auto &n : nodes)
+    term |= n.name == "term" && n.clones > 0 && n.results > 0;
+  assert(term && nodes.size() < 20);
+  std::ostringstream report, trace;
+  profiler.report(report);
+  profiler.writeTrace(trace);
+  assert(report.str().find("statement: tokens 15") == 0);
+  assert(trace.str().find("\"name\": \"expr\", \"ph\": \"X\"") !=
+         std::string::npos);
+#else
+  // compiled out
+  assert(parser.get() == raw && profiler.getNodes().size() == 1);
+#endif
+}
+
+// Same as describe, through feed.
+static std::string
+describeFeed(Parser::AbstractParser<char, std::string> &parser,
+             const std::string &input) {
+  auto [consumed, v] = parser.feed(input.data(), input.data() + input.size());
+  if (!v.has_value())
+    v = parser();
+  std::string s = std::to_string(consumed) + " ";
+  // the lag locates the error in the input
+  if (Parser::isError(v))
+    return s + "error: " + Parser::asError(v).toString() +
+           ", lag: " + std::to_string(Parser::asError(v).getLag());
+  auto &result = Parser::asResult(v);
+  for (auto t = result->get(); t.has_value(); t = result->get())
+    s += t.value() + "|";
+  s += ", remaining: ";
+  for (auto t = result->getRemaining(); t.has_value();
+       t = result->getRemaining())
+    s.push_back(t.value());
+  return s;
+}
+
+void dfaTest() {
+  using Ptr = Parser::AbstractParserPtr<char, std::string>;
+  using Seq = Parser::Sequence<char, std::string>;
+  using Alt = Parser::Alternate<char, std::string>;
+  auto seq = [](const std::string &name, auto... ps) {
+    return Ptr(Seq::get(name, std::array<Ptr, sizeof...(ps)>{
+                                  Ptr(std::move(ps))...}));
+  };
+  auto alt = [](const std::string &name, auto... ps) {
+    return Ptr(Alt::get(name, std::array<Ptr, sizeof...(ps)>{
+                                  Ptr(std::move(ps))...}));
+  };
+  auto c = [](char v, int q) { return CharPredicate::get(v, q, {v}); };
+  auto cls = [](Parser::CharClass v, int q) {
+    return Parser::CharClassParser::get(v, q, "class");
+  };
+  std::vector<std::pair<std::string, std::function<Ptr()>>> grammars;
+  // keywords and identifiers
+  grammars.emplace_back("if (", [&] {
+    return alt("token", seq("keyword", "if"_c, c(' ', Parser::ANY)),
+               cls(Parser::CharClass::range(';', 'z'), Parser::MORE), "("_c);
+  });
+  grammars.emplace_back("abc", [&] {
+    return seq("seq", c('a', Parser::MORE), c('b', Parser::OPTIONAL), "ab"_c);
+  });
+  // the pending results of the alternations
+  grammars.emplace_back("abcd", [&] {
+    return alt("alt", seq("seq", alt("inner", "a"_c, "ab"_c), "c"_c),
+               "abd"_c, c('a', Parser::ANY));
+  });
+  grammars.emplace_back("x12y", [&] {
+    return seq("number", c('x', Parser::NONE),
+               cls(Parser::CharClass::digit(), 2),
+               cls(Parser::CharClass::digit(), Parser::ANY));
+  });
+  {
+    std::cout << "Dfa 1" << std::endl;
+    // the same outputs, remaining tokens and errors on every input
+    for (auto &[alphabet, make] : grammars) {
+      auto reference = make();
+      auto parser = Parser::compileRegular(make());
+      assert(dynamic_cast<Parser::DfaParser *>(parser.get()) != nullptr);
+      std::vector<std::string> inputs = {""};
+      for (std::size_t i = 0; i < inputs.size(); ++i) {
+        assert(describe(*parser, inputs[i]) ==
+               describe(*reference, inputs[i]));
+        assert(describeFeed(*parser, inputs[i]) ==
+               describeFeed(*reference, inputs[i]));
+        if (inputs[i].size() < 5) {
+          for (char v : alphabet)
+            inputs.push_back(inputs[i] + v);
+        }
+      }
+    }
+  }
+  {
+    std::cout << "Dfa 2" << std::endl;
+    // the alternation leaves two tokens for the next parser, so only the
+    // alternation is compiled
+    auto parser = Parser::compileRegular(
+        seq("seq", alt("alt", "a"_c, "aab"_c), "a"_c));
+    auto top = dynamic_cast<Seq *>(parser.get());
+    assert(top != nullptr);
+    assert(dynamic_cast<Parser::DfaParser *>(
+               top->getSequence()->at(0).get()) != nullptr);
+    assert(describe(*parser, "aac") == "result: aa, remaining: c");
+    assert(describe(*parser, "aaba") == "result: aaba, remaining: ");
+    assert(describe(*parser, "aab") ==
+           "error: Insufficient tokens\n  at a\n  at seq");
+    // the table is minimized: a+ followed by b
+    auto ab = Parser::compileRegular(seq("ab", c('a', Parser::MORE), "b"_c));
+    auto &table = dynamic_cast<Parser::DfaParser &>(*ab).getTable();
+    assert(table.states() == 2 && table.classCount == 3);
+  }
+}
+
+void regexTest() {
+  {
+    std::cout << "Regex 1" << std::endl;
+    // the longest match of every input, the same as std::regex, and the tokens
+    // up to the one that cannot extend it remain
+    std::vector<std::pair<std::string, std::string>> patterns = {
+        {"ab", "a(b|bc)*c?"},   {"ab", "(a|ab)(c|bcd)?"}, {"abc", "[ab]+c|a"},
+        {"ab", "a{2,3}b?|b"},   {"ab", "(a|b)*abb"},      {"ab", "a?b{2}"},
+        {"a.-", "[^a]*\\.?a"}, {"a1 ", "\\d+|\\w\\s"}, {"ab", ""}};
+    for (auto &[alphabet, pattern] : patterns) {
+      auto parser = Parser::RegexParser::get(pattern, "regex");
+      assert(parser != nullptr);
+      std::regex reference(pattern);
+      std::vector<std::string> inputs = {""};
+      for (std::size_t i = 0; i < inputs.size(); ++i) {
+        auto input = inputs[i];
+        std::size_t longest = std::string::npos;
+        for (std::size_t k = 0; k <= input.size(); ++k) {
+          if (std::regex_match(input.substr(0, k), reference))
+            longest = k;
+        }
+        auto feed = describeFeed(*parser, input);
+        auto all = describe(*parser, input);
+        if (longest == std::string::npos) {
+          assert(feed.find("error: Insufficient tokens") != std::string::npos);
+          assert(all.find("error: Insufficient tokens") == 0);
+        } else {
+          auto consumed = std::stoul(feed);
+          auto match = input.substr(0, longest);
+          auto remaining = input.substr(longest, consumed - longest);
+          assert(consumed >= longest);
+          assert(feed == std::to_string(consumed) + " " +
+                             (match.empty() ? "" : match + "|") +
+                             ", remaining: " + remaining);
+          assert(all == "result: " + match + ", remaining: " + remaining);
+        }
+        if (input.size() < 6) {
+          for (char v : alphabet)
+            inputs.push_back(input + v);
+        }
+      }
+    }
+  }
+  {
+    std::cout << "Regex 2" << std::endl;
+    auto number = Parser::RegexParser::get("-?\\d+(\\.\\d+)?", "number");
+    assert(describe(*number, "-12.5,") == "result: -12.5, remaining: ,");
+    // the dot is not followed by a digit, so the match is -12
+    assert(describe(*number, "-12.x") == "result: -12, remaining: .x");
+    assert(describe(*number, "x") ==
+           "error: Insufficient tokens\n  at number");
+    // returns without lookahead when the match cannot be extended
+    auto keyword = Parser::RegexParser::get("if|else", "keyword");
+    assert(keyword->first().mayStart('e') && !keyword->first().mayStart('x'));
+    assert(!(*keyword)('i').has_value());
+    keyword->reset();
+    assert(describe(*keyword, "if") == "result: if, remaining: ");
+    for (auto pattern :
+         {"(a", "a)", "[a", "*", "a{2", "a{3,2}", "\\q", "[b-a]"})
+      assert(Parser::RegexParser::get(pattern, "invalid") == nullptr);
+    // (a|b)*a(a|b){8} has 2^9 DFA states, the cache is cleared on the way and
+    // the states of the clones are computed again
+    auto tail = Parser::RegexParser::get("(a|b)*a(a|b){8}", "tail", 16);
+    auto other = tail->clone();
+    std::string input;
+    for (unsigned int i = 0, x = 1; i < 256; ++i, x = x * 1103515245 + 12345)
+      input.push_back((x >> 16) & 1 ? 'a' : 'b');
+    (*other)(input[0]);
+    (*other)(input[1]);
+    std::string rest = input.substr(2);
+    auto r = describe(*tail, input);
+    assert(tail->getFlushes() > 0 && tail->getCachedStates() <= 16);
+    assert(describe(*other, rest) == r);
+  }
+}
+
+// The outputs of a result or the error, on a line.
+static std::string describeLine(Parser::ParserResult<char, std::string> &r) {
+  if (Parser::isError(r))
+    return "error: " + Parser::asError(r).toString() + "\n";
+  std::string s;
+  auto &result = Parser::asResult(r);
+  for (auto t = result->get(); t.has_value(); t = result->get())
+    s += t.value();
+  return s + "\n";
+}
+
+void grammarTest() {
+  using Ptr = Parser::AbstractParserPtr<char, std::string>;
+  using Seq = Parser::Sequence<char, std::string>;
+  using Alt = Parser::Alternate<char, std::string>;
+  using Lazy = Parser::LazyParser<char, std::string>;
+  {
+    std::cout << "Grammar 1" << std::endl;
+    // every index once, with uneven tasks so that the ranges are stolen
+    Parser::ThreadPool pool(4);
+    std::vector<std::atomic<int>> counts(1000);
+    for (int round = 0; round < 3; ++round) {
+      pool.run(counts.size(), [&](std::size_t i, unsigned int worker) {
+        assert(worker < pool.size());
+        if (i < 250)
+          std::this_thread::sleep_for(std::chrono::microseconds(200));
+        ++counts[i];
+      });
+    }
+    for (auto &c : counts)
+      assert(c == 3);
+  }
+  {
+    std::cout << "Grammar 2" << std::endl;
+    // options = '(' options ')' | [a-z]+, statement = options ';'
+    auto options =
+        std::make_unique<Alt>(std::make_unique<std::vector<Ptr>>(), "options");
+    options->getOptions()->push_back(Seq::get(
+        "SEQ", std::array{"("_c, Ptr(std::make_unique<Lazy>(options.get())),
+                          ")"_c}));
+    options->getOptions()->push_back(
+        Parser::RegexParser::get("[a-z]+", "word"));
+    auto root = Seq::get(
+        "statement",
+        std::array{Ptr(std::make_unique<Lazy>(options.get())), ";"_c});
+    std::vector<Ptr> rules;
+    rules.push_back(std::move(options));
+    auto grammar = Parser::Grammar<char, std::string>::make(std::move(root),
+                                                            std::move(rules));
+    std::vector<std::string> documents;
+    for (int i = 0; i < 64; ++i) {
+      std::string document;
+      for (int j = 0; j < 50; ++j) {
+        int depth = (i + j) % 5;
+        document += std::string(depth, '(') +
+                    std::string(1 + j % 3, 'a' + i % 26) +
+                    std::string(depth, ')') + ";";
+      }
+      // an unbalanced statement
+      if (i % 8 == 0)
+        document += "((a);";
+      documents.push_back(document);
+    }
+    // one session, one document after the other
+    std::vector<std::string> expected(documents.size());
+    Parser::ParseSession<char, std::string> session(grammar);
+    for (std::size_t i = 0; i < documents.size(); ++i) {
+      session.reset();
+      auto &d = documents[i];
+      Parser::parseBuffer(d.data(), d.data() + d.size(), session.getParser(),
+                          [&](Parser::ParserResult<char, std::string> &r) {
+                            expected[i] += describeLine(r);
+                            return true;
+                          });
+    }
+    assert(expected[1].find("error") == std::string::npos);
+    assert(expected[8].find("error") != std::string::npos);
+    // a document is parsed by one thread, so the outputs do not race
+    Parser::ThreadPool pool(4);
+    std::vector<std::string> outputs(documents.size());
+    auto stats = Parser::parseBatch(
+        grammar, documents, pool,
+        [&](std::size_t i, Parser::ParserResult<char, std::string> &r) {
+          outputs[i] += describeLine(r);
+          return true;
+        });
+    assert(outputs == expected);
+    assert(stats[1].results == 50 && stats[1].bytes == documents[1].size());
+  }
+  {
+    std::cout << "Grammar 3" << std::endl;
+    // the instances borrow the definition, which is only used as const
+    using Till = Parser::TakeTill<char, std::string, std::string>;
+    auto end = Alt::get("end", std::array{";;"_c, "."_c});
+    const Alt &definition = *end;
+    definition.first();
+    assert(!definition.prepared());
+    end->prepare();
+    assert(definition.prepared());
+    auto till = Till::get(Parser::RegexParser::get("[a-z]", "letter"),
+                          std::move(end), "till");
+    Lazy lazy(till.get());
+    auto instance = lazy.instantiate();
+    assert(lazy.getSource() == till.get());
+    assert(dynamic_cast<Lazy &>(*instance).getSource() == nullptr);
+    auto clone = lazy.clone();
+    for (std::string input : {"ab.", "abc;;", "a;b;;", "ab1.", "ab"}) {
+      assert(describeFeed(*instance, input) == describeFeed(*clone, input));
+      instance->reset();
+      clone->reset();
+    }
+    assert(describeFeed(*instance, "ab;;") == "4 a|b|, remaining: ");
+  }
+}
+
+void chunkedTest() {
+  std::cout << "Chunked 1" << std::endl;
+  // directives end at a newline that is not escaped
+  auto grammar = Parser::Grammar<char, std::string>::make(
+      Parser::RegexParser::get("#[a-z]+( |[a-z0-9]|\\\\\n)*\n", "directive"));
+  std::string input;
+  for (int i = 0; i < 500; ++i) {
+    input += "#define x" + std::to_string(i);
+    if (i % 3 == 0)
+      input += " \\\n  " + std::to_string(i * i);
+    input += "\n";
+    if (i % 100 == 50)
+      input += "#error (\n";
+  }
+  std::string expected;
+  Parser::ParseSession<char, std::string> session(grammar);
+  Parser::parseBuffer(input.data(), input.data() + input.size(),
+                      session.getParser(),
+                      [&](Parser::ParserResult<char, std::string> &r) {
+                        expected += describeLine(r);
+                        return true;
+                      });
+  assert(expected.find("error") != std::string::npos);
+  Parser::ThreadPool pool(4);
+  Parser::ChunkOptions options;
+  options.chunkSize = 64;
+  options.chunksPerThread = 2;
+  // after every newline, the sync points after the escaped ones are wrong and
+  // the chunks are parsed again
+  for (bool naive : {false, true}) {
+    std::string outputs;
+    auto stats = Parser::parseChunked(
+        grammar, input.data(), input.data() + input.size(), pool,
+        [&](const char *begin, const char *p) {
+          return naive ? p[-1] == '\n' : Parser::lineStart(begin, p);
+        },
+        [&](Parser::ParserResult<char, std::string> &r) {
+          outputs += describeLine(r);
+          return true;
+        },
+        options);
+    assert(outputs == expected);
+    assert(stats.chunks > 100 && (stats.fallbacks > 0) == naive);
+    assert(stats.bytes == input.size());
+  }
+  // the same from a mapped file
+  char path[] = "/tmp/parserXXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0 && write(fd, input.data(), input.size()) ==
+                        static_cast<ssize_t>(input.size()));
+  close(fd);
+  std::string outputs;
+  auto stats = Parser::parseFileChunked(
+      path, grammar, pool, Parser::lineStart,
+      [&](Parser::ParserResult<char, std::string> &r) {
+        outputs += describeLine(r);
+        return true;
+      },
+      options);
+  unlink(path);
+  assert(stats.mapped && stats.fallbacks == 0 && outputs == expected);
+}
+
+void resetTest() {
+  std::cout << "Reset 1" << std::endl;
+  // statement = comment options suffix, where the comment ends with ';',
+  // options = '(' options ')' | "ab" | 'c'+ and the suffix ends with "."
+  auto alternatives = std::make_unique<
+      std::vector<Parser::AbstractParserPtr<char, std::string>>>();
+  auto options =
+      Parser::Alternate<char, std::string>(std::move(alternatives), "options");
+  options.getOptions()->push_back(Parser::Sequence<char, std::string>::get(
+      "SEQ",
+      std::array{"("_c,
+                 Parser::AbstractParserPtr<char, std::string>(
+                     std::make_unique<Parser::LazyParser<char, std::string>>(
+                         &options)),
+                 ")"_c}));
+  options.getOptions()->push_back("ab"_c);
+  options.getOptions()->push_back(CharPredicate::get('c', Parser::MORE, "c"));
+  auto any = [] {
+    return std::make_unique<CharPredicate>(
+        [](const char &, int) { return true; }, 1, "any");
+  };
+  auto end = std::make_unique<CharPredicate>(
+      [](const char &c, int) { return c == ';'; }, 1, "end");
+  auto statement = Parser::Sequence<char, std::string>::get(
+      "statement",
+      std::array{Parser::TakeTill<char, std::string, std::string>::get(
+                     any(), std::move(end), "comment"),
+                 options.clone(),
+                 Parser::TakeTill<char, std::string, std::string>::get(
+                     any(), "."_c, "suffix")});
+  auto fixed = Parser::seq(
+      "fixed", *Parser::StringPredicate("x", "x"),
+      Parser::takeTill("till", CharPredicate('a', 1, "a"),
+                       *Parser::StringPredicate(";", ";")));
+
+  auto parse = [](Parser::AbstractParser<char, std::string> &parser,
+                  const std::string &input) {
+    Parser::ParserResult<char, std::string> v;
+    for (char c : input) {
+      if ((v = parser(c)).has_value())
+        break;
+    }
+    std::vector<std::string> outputs;
+    auto result = conv(std::move(v));
+    for (auto t = result->get(); t.has_value(); t = result->get())
+      outputs.push_back(t.value());
+    return outputs;
+  };
+  std::vector<std::pair<Parser::AbstractParser<char, std::string> *,
+                        std::string>>
+      cases = {{statement.get(), "xy;((ab))z."}, {&fixed, "xaa;"}};
+  std::vector<std::vector<std::string>> expected = {
+      {"x", "y", "(", "(", "ab", ")", ")", "z"}, {"x", "a", "a"}};
+  for (std::size_t k = 0; k < cases.size(); ++k) {
+    auto &[parser, input] = cases[k];
+    for (int i = 0; i < 100; ++i) {
+      // stop before the end, so that every combinator has a state
+      for (std::size_t j = 0; j + 1 < input.size(); ++j)
+        assert(!(*parser)(input[j]).has_value());
+      auto calls = Parser::heapStats().allocations;
+      std::size_t global = globalAllocations;
+      parser->reset();
+      // nothing is allocated after warming up
+      if (i >= 10) {
+        assert(Parser::heapStats().allocations == calls);
+        assert(globalAllocations == global);
+      }
+      assert(parse(*parser, input) == expected[k]);
+    }
+  }
+}
+
+void validateTest() {
+  // statement = options word comment, options = '(' options ')' | digits |
+  // ("if" | "else"), word = \s*[a-z]+, and the comment ends with ";"
+  using Ptr = Parser::AbstractParserPtr<char, std::string>;
+  auto options = std::make_unique<Parser::Alternate<char, std::string>>(
+      std::make_unique<std::vector<Ptr>>(), "options");
+  options->getOptions()->push_back(Parser::Sequence<char, std::string>::get(
+      "SEQ",
+      std::array{"("_c,
+                 Ptr(std::make_unique<Parser::LazyParser<char, std::string>>(
+                     options.get())),
+                 ")"_c}));
+  options->getOptions()->push_back(Parser::CharClassParser::get(
+      Parser::CharClass::digit(), Parser::MORE, "digits"));
+  options->getOptions()->push_back(Parser::Alternate<char, std::string>::get(
+      "keyword", std::array{"if"_c, "else"_c}));
+  auto statement = Parser::Sequence<char, std::string>::get(
+      "statement",
+      std::array{Ptr(std::make_unique<Parser::LazyParser<char, std::string>>(
+                     options.get())),
+                 Ptr(Parser::RegexParser::get("\\s*[a-z]+", "word")),
+                 Parser::TakeTill<char, std::string, std::string>::get(
+                     std::make_unique<CharPredicate>(
+                         [](const char &, int) { return true; }, 1, "any"),
+                     ";"_c, "comment")});
+  std::vector<Ptr> rules;
+  rules.push_back(std::move(options));
+  auto grammar = Parser::Grammar<char, std::string>::make(std::move(statement),
+                                                          std::move(rules));
+  Parser::ParseSession<char, std::string> parsing(grammar);
+  Parser::ParseSession<char, std::string> validating(grammar, true);
+  {
+    std::cout << "Validate 1" << std::endl;
+    // the same matches in both modes, and no outputs when validating
+    for (std::string input :
+         {"((12)) foo bar;", "(else) x;", "if y z;;rest", "((12) foo;",
+          "(if x;", "", "12 ;", "else", "(((if)))abc ; ;"}) {
+      auto begin = input.data(), end = input.data() + input.size();
+      auto expected = Parser::validate(parsing.getParser(), begin, end);
+      auto v = Parser::validate(validating.getParser(), begin, end);
+      assert(v.matched == expected.matched && v.length == expected.length);
+      assert(v.error.has_value() == expected.error.has_value());
+      if (v.error.has_value())
+        assert(v.error->toString() == expected.error->toString());
+      parsing.reset();
+      validating.reset();
+    }
+    std::string input = "if y z;;rest";
+    auto v = Parser::validate(validating.getParser(), input.data(),
+                              input.data() + input.size());
+    assert(v.matched && v.length == 7);
+    auto r = conv(validating.getParser().feed(input.data(), input.data() + 7)
+                      .result);
+    assert(!r->get().has_value() && !r->getRemaining().has_value());
+    // the mapping function is not applied to the results without outputs
+    auto digits = Parser::CharClassParser::get(Parser::CharClass::digit(),
+                                               Parser::MORE, "digits");
+    Parser::LazyParser<char, std::string> number(
+        digits.get(), [](Parser::ParserResult<char, std::string> r) {
+          if (r.has_value() && !Parser::isError(r))
+            assert(Parser::asResult(r)->get().has_value());
+          return r;
+        });
+    number.setValidating(true);
+    v = Parser::validate(number, input.data(), input.data() + 2);
+    assert(!v.matched);
+    input = "12a";
+    v = Parser::validate(number, input.data(), input.data() + input.size());
+    assert(v.matched && v.length == 2);
+  }
+  {
+    std::cout << "Validate 2" << std::endl;
+    // fewer allocations, the outputs are not built (the numbers are longer
+    // than a short string)
+    std::string input;
+    for (int i = 0; i < 50; ++i)
+      input += "((12345678901234567890)) foo bar baz;";
+    auto count = [&](Parser::ParseSession<char, std::string> &session) {
+      std::size_t calls = Parser::heapStats().allocations;
+      std::size_t global = globalAllocations;
+      std::size_t results = 0;
+      parseBuffer(input.data(), input.data() + input.size(),
+                  session.getParser(),
+                  [&](Parser::ParserResult<char, std::string> &r) {
+                    assert(!Parser::isError(r));
+                    ++results;
+                    return true;
+                  });
+      assert(results == 50);
+      return Parser::heapStats().allocations - calls + globalAllocations -
+             global;
+    };
+    count(parsing);
+    count(validating);
+    assert(count(validating) * 4 < count(parsing) * 3);
+    // the static combinators
+    auto fixed = Parser::seq(
+        "fixed", *Parser::StringPredicate("x", "x"),
+        Parser::takeTill("till", CharPredicate('a', 1, "a"),
+                         *Parser::StringPredicate(";", ";")));
+    fixed.setValidating(true);
+    for (char c : std::string("xaa"))
+      assert(!fixed(c).has_value());
+    auto r = conv(fixed(';'));
+    assert(!r->get().has_value() && !r->getRemaining().has_value());
+  }
+}
+
+void vmTest() {
+  using Ptr = Parser::AbstractParserPtr<char, std::string>;
+  using Seq = Parser::Sequence<char, std::string>;
+  using Alt = Parser::Alternate<char, std::string>;
+  using Till = Parser::TakeTill<char, std::string, std::string>;
+  using Lazy = Parser::LazyParser<char, std::string>;
+  auto seq = [](const std::string &name, auto... ps) {
+    return Ptr(Seq::get(name, std::array<Ptr, sizeof...(ps)>{
+                                  Ptr(std::move(ps))...}));
+  };
+  auto alt = [](const std::string &name, auto... ps) {
+    return Ptr(Alt::get(name, std::array<Ptr, sizeof...(ps)>{
+                                  Ptr(std::move(ps))...}));
+  };
+  auto till = [](Ptr parser, Ptr suffix) {
+    return Till::get(std::move(parser), std::move(suffix), "till");
+  };
+  auto c = [](char v, int q) { return CharPredicate::get(v, q, {v}); };
+  auto any = [] {
+    return Ptr(std::make_unique<CharPredicate>(
+        [] { return [](const char &) { return true; }; }, 1, "any"));
+  };
+  // options = '(' options ')' | a+ | '(' b, the rules of the recursive
+  // grammars
+  Alt options(std::make_unique<std::vector<Ptr>>(), "options");
+  options.getOptions()->push_back(
+      seq("SEQ", "("_c, std::make_unique<Lazy>(&options), ")"_c));
+  options.getOptions()->push_back(c('a', Parser::MORE));
+  options.getOptions()->push_back(seq("open", "("_c, "b"_c));
+  std::vector<std::pair<std::string, std::function<Ptr()>>> grammars;
+  grammars.emplace_back("ab", [&] {
+    return seq("seq", c('a', Parser::OPTIONAL), c('b', Parser::ANY),
+               c('a', Parser::MORE), "ab"_c);
+  });
+  // the options are run one after the other, with the skipped ones
+  grammars.emplace_back("abc", [&] {
+    return alt("alt", seq("seq", alt("inner", "a"_c, "ab"_c), "c"_c),
+               "abd"_c, c('a', Parser::ANY), seq("b", "b"_c, c('c', 2)),
+               c('c', Parser::NONE));
+  });
+  grammars.emplace_back("()ab ", [&] {
+    return seq("statement", std::make_unique<Lazy>(&options),
+               c(' ', Parser::OPTIONAL));
+  });
+  // the body of the take tills only sees the tokens the suffix does not hold,
+  // and the parser is used again after the body did not finish
+  grammars.emplace_back("a;*/", [&] {
+    return alt("till", till(c('a', Parser::MORE), ";"_c),
+               seq("comment", "/*"_c, till(any(), "*/"_c)));
+  });
+  grammars.emplace_back("ab;", [&] {
+    return seq("nested", till(till(alt("x", "ab"_c, c('b', 1)), "ba"_c),
+                              ";"_c),
+               c('a', Parser::ANY));
+  });
+  // run as they are
+  grammars.emplace_back("a1;", [&] {
+    return seq("objects",
+               Parser::CharClassParser::get(Parser::CharClass::digit(),
+                                            Parser::ANY, "digits"),
+               till(any(), std::make_unique<Lazy>(&options)),
+               std::make_unique<Lazy>(&options, [](auto r) { return r; }));
+  });
+  // the alternation returns at the end of input with a token left, which the
+  // sequence gives to the next parser alone
+  grammars.emplace_back("ab", [&] {
+    return seq("seq",
+               alt("alt", c('c', Parser::NONE), c('a', Parser::NONE),
+                   "aba"_c),
+               "aba"_c, c('b', Parser::MORE));
+  });
+  {
+    std::cout << "Vm 1" << std::endl;
+    // the same outputs, remaining tokens and errors on every input
+    for (auto &[alphabet, make] : grammars) {
+      auto reference = make();
+      auto parser = Parser::VmParser::compile(make());
+      std::vector<std::string> inputs = {""};
+      for (std::size_t i = 0; i < inputs.size(); ++i) {
+        assert(describe(*parser, inputs[i]) ==
+               describe(*reference, inputs[i]));
+        assert(describeFeed(*parser, inputs[i]) ==
+               describeFeed(*reference, inputs[i]));
+        if (inputs[i].size() < 5) {
+          for (char v : alphabet)
+            inputs.push_back(inputs[i] + v);
+        }
+      }
+    }
+  }
+  {
+    std::cout << "Vm 2" << std::endl;
+    // the recursion is on the stack of frames
+    auto parser = Parser::VmParser::compile(grammars[2].second());
+    std::size_t n = 200000;
+    std::string input = std::string(n, '(') + "aa" + std::string(n, ')');
+    auto half = input.size() / 2;
+    assert(!parser->feed(input.data(), input.data() + half).result);
+    assert(parser->depth() > n);
+    input += " ";
+    auto [consumed, v] =
+        parser->feed(input.data() + half, input.data() + input.size());
+    assert(consumed == input.size() - half);
+    auto &result = Parser::asResult(v);
+    std::size_t count = 0;
+    while (result->get().has_value())
+      ++count;
+    assert(count == 2 * n + 2 && parser->depth() == 0);
+    // the tokens after the result are not consumed
+    std::string twice = "(a) (a) ";
+    auto first = parser->feed(twice.data(), twice.data() + twice.size());
+    assert(first.consumed == 4);
+    // the clones, the snapshots and the validating mode
+    auto copy = parser->clone();
+    copy->setValidating(true);
+    for (char v : std::string("((a))"))
+      assert(!(*copy)(v).has_value());
+    auto snapshot = copy->snapshot();
+    auto done = conv((*copy)(' '));
+    assert(!done->get().has_value() && !done->getRemaining().has_value());
+    assert(describe(*snapshot, "x") == "result: , remaining: x");
+  }
+  {
+    std::cout << "Vm 3" << std::endl;
+    auto parser = Parser::VmParser::compile(grammars.back().second());
+    assert(describe(*parser, "a") ==
+           "error: Insufficient Tokens\n  at seq");
+  }
+}
+
+// Outputs that cannot be copied, such as the nodes of a syntax tree.
+using Node = std::unique_ptr<std::string>;
+static Node toNode(const char &c) {
+  return std::make_unique<std::string>(1, c);
+}
+static Node foldNodes(const Node &a, const Node &b) {
+  return std::make_unique<std::string>(*a + *b);
+}
+static std::string nodeString(const Node &n) { return *n; }
+using NodePredicate =
+    Parser::PredicateParser<char, Node, toNode, foldNodes, nodeString>;
+
+// Outputs that count their copies.
+struct Counted {
+  static inline std::size_t copies = 0;
+  std::string value;
+
+  Counted() = default;
+  Counted(std::string value) : value(std::move(value)) {}
+  Counted(const Counted &other) : value(other.value) { ++copies; }
+  Counted(Counted &&) = default;
+  Counted &operator=(const Counted &other) {
+    value = other.value;
+    ++copies;
+    return *this;
+  }
+  Counted &operator=(Counted &&) = default;
+};
+static Counted toCounted(const char &c) { return Counted(std::string(1, c)); }
+static Counted foldCounted(const Counted &a, const Counted &b) {
+  return Counted(a.value + b.value);
+}
+static std::string countedString(const Counted &c) { return c.value; }
+using CountedPredicate = Parser::PredicateParser<char, Counted, toCounted,
+                                                 foldCounted, countedString>;
+
+// statement = rule ' ' till, rule = '(' rule ')' | a+ | ab, till = any* '*'
+template <typename P, typename T>
+static Parser::AbstractParserPtr<char, T>
+statementOf(Parser::Alternate<char, T> &rule,
+            Parser::MemoTable<char, T> *memo = nullptr) {
+  using Ptr = Parser::AbstractParserPtr<char, T>;
+  using Seq = Parser::Sequence<char, T>;
+  using Lazy = Parser::LazyParser<char, T>;
+  // a memo table can only be given if the outputs can be copied
+  Ptr lazy;
+  if constexpr (std::is_copy_constructible_v<T>)
+    lazy = std::make_unique<Lazy>(&rule, nullptr, memo);
+  else
+    lazy = std::make_unique<Lazy>(&rule);
+  rule.getOptions()->push_back(
+      Seq::get("SEQ", std::array{P::get('(', Parser::ONCE, "("),
+                                 std::move(lazy),
+                                 P::get(')', Parser::ONCE, ")")}));
+  rule.getOptions()->push_back(P::get('a', Parser::MORE, "a"));
+  rule.getOptions()->push_back(Seq::get(
+      "ab", std::array{P::get('a', Parser::ONCE, "a"),
+                       P::get('b', Parser::ONCE, "b")}));
+  auto any = std::make_unique<P>(
+      [] { return [](const char &) { return true; }; }, Parser::ONCE, "any");
+  return Seq::get(
+      "statement",
+      std::array{Ptr(std::make_unique<Lazy>(&rule)),
+                 P::get(' ', Parser::ONCE, " "),
+                 Parser::TakeTill<char, T, T>::get(
+                     std::move(any), P::get('*', Parser::ONCE, "*"), "till")});
+}
+
+// The outputs and the remaining tokens of the result, through feed or token by
+// token. With a sink, the outputs are the ones in the sink followed by the ones
+// left in the result.
+template <typename T, typename F>
+static std::string collect(Parser::AbstractParser<char, T> &parser,
+                           const std::string &input, const bool feed,
+                           F &&toString,
+                           Parser::OutputSink<T> *sink = nullptr) {
+  Parser::ParserResult<char, T> v;
+  if (feed) {
+    v = parser.feed(input.data(), input.data() + input.size()).result;
+  } else {
+    for (char c : input) {
+      if ((v = parser(c)).has_value())
+        break;
+    }
+  }
+  if (!v.has_value())
+    v = parser();
+  if (Parser::isError(v)) {
+    // the outputs of the failed parsers are removed
+    assert(sink == nullptr || sink->size() == 0);
+    return "error";
+  }
+  auto &result = Parser::asResult(v);
+  std::string s;
+  if (sink != nullptr) {
+    sink->drain(*result);
+    sink->flush([&](T t) { s += toString(t) + "|"; });
+  }
+  for (auto t = result->get(); t.has_value(); t = result->get())
+    s += toString(t.value()) + "|";
+  s += ", remaining: ";
+  for (auto t = result->getRemaining(); t.has_value();
+       t = result->getRemaining())
+    s.push_back(t.value());
+  return s;
+}
+
+void moveTest() {
+  std::vector<std::string> inputs = {"((aa)) xy*z", "ab x*", "a *",
+                                     "(ab) (*", "((a) x", "aab *"};
+  Parser::Alternate<char, std::string> stringRule(
+      std::make_unique<
+          std::vector<Parser::AbstractParserPtr<char, std::string>>>(),
+      "rule");
+  auto reference = statementOf<CharPredicate>(stringRule);
+  {
+    std::cout << "Move 1" << std::endl;
+    // the outputs are moved from the predicates to the caller
+    Parser::Alternate<char, Node> rule(
+        std::make_unique<std::vector<Parser::AbstractParserPtr<char, Node>>>(),
+        "rule");
+    auto parser = statementOf<NodePredicate>(rule);
+    for (auto &input : inputs) {
+      for (bool feed : {false, true}) {
+        assert(collect(*parser, input, feed, nodeString) ==
+               collect(*reference, input, feed,
+                       [](const std::string &s) { return s; }));
+      }
+    }
+    // the outputs of a snapshot cannot be copied
+    for (char c : std::string("(("))
+      assert(!(*parser)(c).has_value());
+    assert(parser->snapshot() == nullptr);
+  }
+  {
+    std::cout << "Move 2" << std::endl;
+    Parser::Alternate<char, Counted> rule(
+        std::make_unique<
+            std::vector<Parser::AbstractParserPtr<char, Counted>>>(),
+        "rule");
+    auto parser = statementOf<CountedPredicate>(rule);
+    for (auto &input : inputs) {
+      for (bool feed : {false, true}) {
+        assert(collect(*parser, input, feed, countedString) ==
+               collect(*reference, input, feed,
+                       [](const std::string &s) { return s; }));
+      }
+    }
+    assert(Counted::copies == 0);
+    // the snapshots copy them
+    for (char c : std::string("(("))
+      assert(!(*parser)(c).has_value());
+    auto snapshot = parser->snapshot();
+    assert(snapshot != nullptr && Counted::copies > 0);
+  }
+}
+
+void sinkTest() {
+  std::vector<std::string> inputs = {"((aa)) xy*z", "ab x*", "a *",
+                                     "(ab) (*", "((a) x", "aab *",
+                                     "(((ab))) ***", "(a)b *"};
+  auto same = [](const std::string &s) { return s; };
+  using Ptr = Parser::AbstractParserPtr<char, std::string>;
+  using Rule = Parser::Alternate<char, std::string>;
+  auto makeRule = [] {
+    return Rule(std::make_unique<std::vector<Ptr>>(), "rule");
+  };
+  auto referenceRule = makeRule();
+  auto reference = statementOf<CharPredicate>(referenceRule);
+  {
+    std::cout << "Sink 1" << std::endl;
+    // the same outputs, whether the lazy parsers pass the sink (without a memo
+    // table) or leave the outputs in their results (with one)
+    Parser::MemoTable<char, std::string> memo;
+    for (auto table : {(decltype(&memo)) nullptr, &memo}) {
+      auto rule = makeRule();
+      auto parser = statementOf<CharPredicate>(rule, table);
+      Parser::OutputSink<std::string> sink;
+      parser->setSink(&sink);
+      for (auto &input : inputs) {
+        for (bool feed : {false, true}) {
+          assert(collect(*parser, input, feed, same, &sink) ==
+                 collect(*reference, input, feed, same));
+        }
+      }
+    }
+    // move-only outputs
+    Parser::Alternate<char, Node> rule(
+        std::make_unique<std::vector<Parser::AbstractParserPtr<char, Node>>>(),
+        "rule");
+    auto parser = statementOf<NodePredicate>(rule);
+    Parser::OutputSink<Node> sink;
+    parser->setSink(&sink);
+    for (auto &input : inputs) {
+      for (bool feed : {false, true}) {
+        assert(collect(*parser, input, feed, nodeString, &sink) ==
+               collect(*reference, input, feed, same));
+      }
+    }
+  }
+  {
+    std::cout << "Sink 2" << std::endl;
+    auto rule = makeRule();
+    auto parser = statementOf<CharPredicate>(rule);
+    Parser::OutputSink<std::string> sink;
+    parser->setSink(&sink);
+    // the outputs are all in the sink, the result only has the remaining
+    // tokens
+    std::string input = "((aa)) xy*z";
+    auto r = parser->feed(input.data(), input.data() + input.size());
+    assert(r.consumed == 10 && r.result.has_value() &&
+           !Parser::isError(r.result));
+    assert(!Parser::asResult(r.result)->get().has_value());
+    std::string outputs;
+    sink.flush([&](std::string s) { outputs += s + "|"; });
+    assert(outputs == "(|(|aa|)|)| |x|y|");
+    // the outputs are flushed when the results come, and the outputs of the
+    // statement that fails are removed
+    input = "ab x*(a) *(ab x";
+    std::vector<std::string> results;
+    Parser::parseBuffer(input.data(), input.data() + input.size(), *parser,
+                        [&](Parser::ParserResult<char, std::string> &r) {
+                          std::string s;
+                          if (Parser::isError(r))
+                            s = "error";
+                          else
+                            sink.drain(*Parser::asResult(r));
+                          sink.flush([&](std::string t) { s += t + "|"; });
+                          results.push_back(s);
+                          return !Parser::isError(r);
+                        });
+    assert((results ==
+            std::vector<std::string>{"a|b| |x|", "(|a|)| |", "error"}));
+    // the parsers in the sink mode cannot be restored
+    for (char c : std::string("(("))
+      assert(!(*parser)(c).has_value());
+    assert(parser->snapshot() == nullptr);
+    // a buffered sink only gets the outputs of an alternation once it is done
+    assert(sink.size() == 0);
+    parser->reset();
+    assert(sink.size() == 0);
+    // and they leave it
+    parser->setSink(nullptr);
+    for (auto &input : inputs)
+      assert(collect(*parser, input, true, same) ==
+             collect(*reference, input, true, same));
+  }
+  {
+    std::cout << "Sink 3" << std::endl;
+    // resetting takes back the outputs of the children that completed
+    using Seq = Parser::Sequence<char, std::string>;
+    using Alt = Parser::Alternate<char, std::string>;
+    using Till = Parser::TakeTill<char, std::string, std::string>;
+    std::vector<std::pair<Ptr, std::string>> parsers;
+    parsers.emplace_back(Seq::get("ab", std::array{"a"_c, "b"_c}), "ab");
+    parsers.emplace_back(
+        Till::get(std::make_unique<CharPredicate>('a', 1, "a"), ";"_c, "till"),
+        "aa;");
+    parsers.emplace_back(
+        Seq::get("alt",
+                 std::array{Ptr(Alt::get("x", std::array{"a"_c, "bc"_c})),
+                            "b"_c}),
+        "ab");
+    for (auto &[parser, input] : parsers) {
+      Parser::OutputSink<std::string> sink;
+      parser->setSink(&sink);
+      assert(!(*parser)('a').has_value());
+      assert(sink.size() == 1);
+      parser->reset();
+      assert(sink.size() == 0);
+      assert(describe(*parser, input) == "result: , remaining: ");
+      std::string outputs;
+      sink.flush([&](std::string t) { outputs += t + "|"; });
+      assert(outputs == (input == "ab" ? "a|b|" : "a|a|"));
+    }
+  }
+}
+
+using GrammarList = std::vector<
+    std::pair<std::string,
+              std::function<Parser::AbstractParserPtr<char, std::string>()>>>;
+
+// Small grammars, with the alphabets of their inputs, to compare parsers on
+// every short input. The rules of the recursive grammars are added to rules,
+// one per grammar made as the rules may be optimized in place.
+static GrammarList sampleGrammars(
+    std::vector<std::unique_ptr<Parser::Alternate<char, std::string>>>
+        &rules) {
+  using Ptr = Parser::AbstractParserPtr<char, std::string>;
+  using Seq = Parser::Sequence<char, std::string>;
+  using Alt = Parser::Alternate<char, std::string>;
+  using Till = Parser::TakeTill<char, std::string, std::string>;
+  using Lazy = Parser::LazyParser<char, std::string>;
+  auto seq = [](const std::string &name, auto... ps) {
+    return Ptr(Seq::get(name, std::array<Ptr, sizeof...(ps)>{
+                                  Ptr(std::move(ps))...}));
+  };
+  auto alt = [](const std::string &name, auto... ps) {
+    return Ptr(Alt::get(name, std::array<Ptr, sizeof...(ps)>{
+                                  Ptr(std::move(ps))...}));
+  };
+  auto c = [](char v, int q) { return CharPredicate::get(v, q, {v}); };
+  // rule = '(' ('(' rule) ')' | a+
+  auto rule = [=, &rules] {
+    rules.push_back(
+        std::make_unique<Alt>(std::make_unique<std::vector<Ptr>>(), "rule"));
+    auto r = rules.back().get();
+    r->getOptions()->push_back(
+        seq("SEQ", seq("open", "("_c), std::make_unique<Lazy>(r), ")"_c));
+    r->getOptions()->push_back(c('a', Parser::MORE));
+    return r;
+  };
+  GrammarList grammars;
+  grammars.emplace_back("abc", [=] {
+    return seq("s", seq("i", "a"_c, "b"_c), "c"_c,
+               seq("j", seq("k", "a"_c), c('b', Parser::ANY)));
+  });
+  // only the alternations that are separate from the other options are
+  // flattened
+  grammars.emplace_back("abcd", [=] {
+    return alt("o", alt("i", "ab"_c, seq("x", "b"_c, "a"_c)),
+               seq("y", "c"_c, "a"_c), alt("j", "a"_c, "c"_c),
+               alt("k", "d"_c, seq("z", "dd"_c, c('a', Parser::MORE))));
+  });
+  grammars.emplace_back("abcde", [=] {
+    return alt("f", seq("p", "a"_c, "b"_c, c('c', Parser::MORE)),
+               seq("q", "a"_c, "b"_c, "d"_c),
+               seq("r", "a"_c, c('b', Parser::ANY)), "e"_c);
+  });
+  // The options are not factored, z runs in lockstep with them: on abce, p
+  // completes before z and q after it, so z wins.
+  auto z = [=] {
+    auto any = std::make_unique<CharPredicate>(
+        [] { return [](const char &) { return true; }; }, 1, "any");
+    return seq("z", std::move(any), c('b', Parser::MORE), "c"_c);
+  };
+  grammars.emplace_back("abce", [=] {
+    return alt("g", seq("p", "a"_c, "b"_c), seq("q", "a"_c, "bcd"_c), z());
+  });
+  grammars.emplace_back("abce", [=] {
+    return alt("h", alt("i", seq("p", "a"_c, "b"_c), "abcd"_c), z());
+  });
+  grammars.emplace_back("ab", [=] {
+    return alt("d", seq("n", c('a', Parser::NONE), "a"_c), "ab"_c,
+               seq("m", c('b', Parser::NONE), c('b', Parser::MORE)),
+               seq("l", c('a', Parser::NONE), "b"_c));
+  });
+  grammars.emplace_back("()a ", [=] {
+    return seq("statement", std::make_unique<Lazy>(rule()), seq("end", " "_c));
+  });
+  grammars.emplace_back("ab*/", [=] {
+    return seq("comment", seq("start", "/"_c, "*"_c),
+               Till::get(seq("b", "a"_c, "b"_c), seq("end", "*"_c, "/"_c),
+                         "till"));
+  });
+  // the options of the rule are factored, and reach the rule again:
+  // rule = '(' rule ')' | '(' 'b'
+  grammars.emplace_back("()b ", [=, &rules] {
+    rules.push_back(
+        std::make_unique<Alt>(std::make_unique<std::vector<Ptr>>(), "rule"));
+    auto r = rules.back().get();
+    r->getOptions()->push_back(
+        seq("nested", "("_c, std::make_unique<Lazy>(r), ")"_c));
+    r->getOptions()->push_back(seq("leaf", "("_c, "b"_c));
+    return seq("statement", std::make_unique<Lazy>(r), " "_c);
+  });
+  return grammars;
+}
+
+void optimizeTest() {
+  using Seq = Parser::Sequence<char, std::string>;
+  using Alt = Parser::Alternate<char, std::string>;
+  std::vector<std::unique_ptr<Alt>> rules;
+  auto grammars = sampleGrammars(rules);
+  // Outputs and remaining tokens, and where the errors are.
+  auto outcome = [](std::string s) {
+    auto p = s.find("error");
+    return p == std::string::npos ? s : s.substr(0, p + 5);
+  };
+  {
+    std::cout << "Optimize 1" << std::endl;
+    for (auto &[alphabet, make] : grammars) {
+      auto reference = make();
+      auto parser = Parser::optimize(make());
+      auto vm = Parser::VmParser::compile(Parser::optimize(make()));
+      std::vector<std::string> inputs = {""};
+      for (std::size_t i = 0; i < inputs.size(); ++i) {
+        auto input = inputs[i];
+        auto expected = describe(*parser, input);
+        assert(outcome(expected) == outcome(describe(*reference, input)));
+        assert(describe(*vm, input) == expected);
+        expected = describeFeed(*parser, input);
+        assert(outcome(expected) == outcome(describeFeed(*reference, input)));
+        assert(describeFeed(*vm, input) == expected);
+        if (input.size() < 5) {
+          for (char v : alphabet)
+            inputs.push_back(input + v);
+        }
+      }
+    }
+  }
+  {
+    std::cout << "Optimize 2" << std::endl;
+    // the literals are fused, with one output per literal
+    auto fused = Parser::optimize(grammars[0].second());
+    auto s = dynamic_cast<Seq *>(fused.get());
+    assert(s != nullptr && s->getSequence()->size() == 2);
+    auto run =
+        dynamic_cast<Parser::LiteralRun *>(s->getSequence()->at(0).get());
+    assert(run != nullptr && run->getLiterals().text == "abca");
+    assert(describeFeed(*fused, "abcabbc") == "7 a|b|c|a|bb|, remaining: c");
+    // the error of the literal that fails, in the sequence
+    assert(describe(*fused, "abd") ==
+           "error: Insufficient tokens\n  at c\n  at s");
+    fused->setValidating(true);
+    assert(describeFeed(*fused, "abcab ") == "6 , remaining:  ");
+    // the separate alternations are flattened, and the dead branches removed
+    auto flat = Parser::optimize(grammars[1].second());
+    assert(dynamic_cast<Alt *>(flat.get())->getOptions()->size() == 5);
+    auto live = Parser::optimize(grammars[5].second());
+    assert(dynamic_cast<Alt *>(live.get())->getOptions()->size() == 2);
+    // a (b (c+ | d) | b*) | e
+    auto factored = Parser::optimize(grammars[2].second());
+    auto &options = *dynamic_cast<Alt *>(factored.get())->getOptions();
+    assert(options.size() == 2);
+    auto head = dynamic_cast<Seq *>(options[0].get());
+    assert(head != nullptr && head->getSequence()->size() == 2);
+    assert(dynamic_cast<Alt *>(head->getSequence()->at(1).get()) != nullptr);
+    // the rules stay where the lazy parsers point to
+    auto recursive = Parser::optimize(grammars[6].second());
+    auto r = rules.back().get();
+    assert(dynamic_cast<Seq *>(r->getOptions()->at(0).get())
+               ->getSequence()
+               ->size() == 3);
+    assert(describe(*recursive, "((a)) ") == "result: ((a)) , remaining: ");
+    auto factoredRule = Parser::optimize(grammars[8].second());
+    r = rules.back().get();
+    assert(r->getOptions()->size() == 1);
+    assert(describe(*factoredRule, "(((b)) ") ==
+           "result: (((b)) , remaining: ");
+  }
+}
+
+void streamTest() {
+  auto same = [](const std::string &s) { return s; };
+  std::string streamed;
+  Parser::OutputSink<std::string> stream(
+      [&](std::string s) { streamed += s + "|"; });
+  {
+    std::cout << "Stream 1" << std::endl;
+    // the alternations forward the sink of the last option, and still take
+    // back its outputs if it fails
+    std::vector<std::unique_ptr<Parser::Alternate<char, std::string>>> rules;
+    for (auto &[alphabet, make] : sampleGrammars(rules)) {
+      auto reference = make();
+      auto buffered = make();
+      Parser::OutputSink<std::string> sink;
+      buffered->setSink(&sink);
+      auto streaming = make();
+      streaming->setSink(&stream);
+      std::vector<std::string> inputs = {""};
+      for (std::size_t i = 0; i < inputs.size(); ++i) {
+        auto input = inputs[i];
+        for (bool feed : {false, true}) {
+          auto expected = collect(*reference, input, feed, same);
+          assert(collect(*buffered, input, feed, same, &sink) == expected);
+          // the outputs are passed to the callback before the result
+          streamed.clear();
+          auto result = collect(*streaming, input, feed, same, &stream);
+          if (expected == "error")
+            assert(result == "error");
+          else
+            assert(streamed + result == expected);
+        }
+        if (input.size() < 5) {
+          for (char v : alphabet)
+            inputs.push_back(input + v);
+        }
+      }
+    }
+  }
+  using Ptr = Parser::AbstractParserPtr<char, std::string>;
+  auto rule = Parser::Alternate<char, std::string>(
+      std::make_unique<std::vector<Ptr>>(), "rule");
+  auto parser = statementOf<CharPredicate>(rule);
+  // the outputs streamed after every token
+  auto log = [&](const std::string &input) {
+    std::string s;
+    parser->setSink(&stream);
+    for (char c : input) {
+      streamed.clear();
+      auto r = (*parser)(c);
+      s += streamed + (r.has_value() ? Parser::isError(r) ? "error" : "done"
+                                     : "") +
+           "#";
+    }
+    return s;
+  };
+  {
+    std::cout << "Stream 2" << std::endl;
+    // the options starting with '(' are alone, a+ is once b cannot follow,
+    // and the sequences and the take till pass on their outputs as their
+    // parsers complete
+    assert(log("((aa)) xy*") == "(|#(|###aa|)|#)|# |#x|#y|#done#");
+    assert(log("(ab) *") == "(|##a|b|#)|# |#done#");
+    // the outputs are not taken back when the statement fails
+    assert(log("((a) ") == "(|#(|##a|)|#error#");
+  }
+  {
+    std::cout << "Stream 3" << std::endl;
+    // the long runs are passed on in pieces
+    stream.setPieces(4);
+    assert(log("aaaaaaaaaa *") == "###aaaa|####aaaa|###aa| |#done#");
+    stream.setPieces(0);
+  }
+}
+
 int main() {
   trivialPredicateTest();
   stringPredicateTest();
@@ -273,5 +2540,28 @@ int main() {
   alternateTest();
   takeTillTest();
   lazyTest();
+  feedTest();
+  staticTest();
+  arenaTest();
+  errorTest();
+  firstTest();
+  charClassTest();
+  literalSetTest();
+  memoTest();
+  sliceTest();
+  driverTest();
+  snapshotTest();
+  profileTest();
+  dfaTest();
+  regexTest();
+  grammarTest();
+  chunkedTest();
+  resetTest();
+  validateTest();
+  vmTest();
+  optimizeTest();
+  moveTest();
+  sinkTest();
+  streamTest();
   return 0;
 }
\ No newline at end of file